@@ -0,0 +1,721 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BenchmarkToolbox.h"
+#include "BulkImportBenchmark.h"
+#include "ChangeFeedBenchmark.h"
+#include "FakeOrthancCore.h"
+#include "FrameCacheBenchmark.h"
+#include "LanesBenchmark.h"
+#include "MirrorBenchmark.h"
+#include "LazyRefreshSimulation.h"
+#include "MockGoogleServer.h"
+#include "RoutingBenchmark.h"
+#include "StoreSyncBenchmark.h"
+#include "TokenRecoveryBenchmark.h"
+#include "TokenRotationBenchmarks.h"
+
+#include "../Plugin/GoogleConfiguration.h"
+#include "../Plugin/GoogleUpdater.h"
+
+#include <HttpClient.h>
+#include <Logging.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#include <algorithm>
+#include <stdio.h>
+
+
+namespace
+{
+  struct Parameters
+  {
+    std::string   scenario_;
+    unsigned int  iterations_;
+    unsigned int  threads_;
+    unsigned int  latency_;
+    float         errorRate_;
+    size_t        instanceSize_;
+    unsigned int  maxAccounts_;
+    bool          csv_;
+    unsigned int  accounts_;
+    unsigned int  outage_;
+    unsigned int  retryAfter_;
+    std::string   trace_;
+    unsigned int  idleTimeout_;
+    unsigned int  stowDelay_;
+    unsigned int  importRate_;
+    unsigned int  lanes_;
+    size_t        mirrorInstances_;
+    size_t        feedInstances_;
+    size_t        syncInstances_;
+    size_t        rules_;
+
+    Parameters() :
+      scenario_("all"),
+      iterations_(100),
+      threads_(4),
+      latency_(0),
+      errorRate_(0),
+      instanceSize_(256 * 1024),
+      maxAccounts_(10000),
+      csv_(false),
+      accounts_(300),
+      outage_(10),
+      retryAfter_(0),
+      idleTimeout_(3600),
+      stowDelay_(0),
+      importRate_(1000),
+      lanes_(8),
+      mirrorInstances_(10000000),
+      feedInstances_(10000),
+      syncInstances_(1000000),
+      rules_(200)
+    {
+    }
+  };
+}
+
+
+static std::string GenerateServiceAccount(const std::string& tokenUri)
+{
+  // Generate a throw-away RSA key to sign the JWT assertions sent to the mock
+  EVP_PKEY_CTX* context = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+  EVP_PKEY* key = NULL;
+
+  if (context == NULL ||
+      EVP_PKEY_keygen_init(context) <= 0 ||
+      EVP_PKEY_CTX_set_rsa_keygen_bits(context, 2048) <= 0 ||
+      EVP_PKEY_keygen(context, &key) <= 0)
+  {
+    EVP_PKEY_CTX_free(context);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Cannot generate a RSA key");
+  }
+
+  BIO* bio = BIO_new(BIO_s_mem());
+  PEM_write_bio_PrivateKey(bio, key, NULL, NULL, 0, NULL, NULL);
+
+  char* data = NULL;
+  long size = BIO_get_mem_data(bio, &data);
+  std::string pem(data, size);
+
+  BIO_free(bio);
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(context);
+
+  Json::Value account = Json::objectValue;
+  account["type"] = "service_account";
+  account["project_id"] = "benchmark";
+  account["private_key_id"] = "benchmark-key";
+  account["private_key"] = pem;
+  account["client_email"] = "benchmark@benchmark.iam.gserviceaccount.com";
+  account["client_id"] = "1";
+  account["token_uri"] = tokenUri;
+
+  return account.toStyledString();
+}
+
+
+static void BenchmarkTokenRotation(MockGoogleServer& server,
+                                   const Parameters& parameters)
+{
+  const GoogleAccount& account = GoogleConfiguration::GetInstance().GetAccount(0);
+
+  BenchmarkToolbox::LatencyRecorder rotation;
+  const unsigned int before = server.GetTokenRequestsCount();
+
+  for (unsigned int i = 0; i < parameters.iterations_; i++)
+  {
+    // New credentials have an empty cache, which forces a new token
+    std::shared_ptr<google::cloud::storage::oauth2::Credentials> credentials = account.CreateCredentials();
+
+    BenchmarkToolbox::Chronometer chronometer;
+    google::cloud::StatusOr<std::string> token = credentials->AuthorizationHeader();
+
+    if (token)
+    {
+      rotation.Add(chronometer.GetElapsed());
+    }
+    else
+    {
+      rotation.AddError();
+    }
+  }
+
+  rotation.Print("Token rotation");
+  printf("  %u token requests received by the mock\n", server.GetTokenRequestsCount() - before);
+
+  std::shared_ptr<google::cloud::storage::oauth2::Credentials> credentials = account.CreateCredentials();
+  credentials->AuthorizationHeader();
+
+  BenchmarkToolbox::LatencyRecorder cached;
+  for (unsigned int i = 0; i < parameters.iterations_; i++)
+  {
+    BenchmarkToolbox::Chronometer chronometer;
+    credentials->AuthorizationHeader();
+    cached.Add(chronometer.GetElapsed());
+  }
+
+  cached.Print("Cached token");
+}
+
+
+static void BenchmarkServerDefinition(FakeOrthancCore& core,
+                                      const Parameters& parameters)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  const GoogleAccount& account = configuration.GetAccount(0);
+
+  BenchmarkToolbox::LatencyRecorder recorder;
+
+  for (unsigned int i = 0; i < parameters.iterations_; i++)
+  {
+    const std::string token = "Authorization: Bearer mock-" + boost::lexical_cast<std::string>(i);
+
+    BenchmarkToolbox::Chronometer chronometer;
+    if (account.UpdateServerDefinition(configuration.GetDicomWebPluginRoot(),
+                                       configuration.GetBaseGoogleUrl(), token))
+    {
+      recorder.Add(chronometer.GetElapsed());
+    }
+    else
+    {
+      recorder.AddError();
+    }
+  }
+
+  recorder.Print("Server definition update");
+  printf("  %u updates received by the emulated DICOMweb plugin\n", core.GetServerUpdatesCount());
+}
+
+
+namespace
+{
+  // Issues the requests of the plugin-owned data paths, with the
+  // "Authorization" header read from the token updater of the plugin
+  // before each request
+  class DataPathWorker : public boost::noncopyable
+  {
+  private:
+    const std::string&                  accountName_;
+    const std::string&                  dicomWeb_;
+    const std::string&                  scenario_;
+    const std::vector<std::string>&     studies_;
+    const std::vector<std::string>&     series_;
+    const std::vector<std::string>&     instances_;
+    const std::string&                  stowBody_;
+    BenchmarkToolbox::LatencyRecorder&  recorder_;
+    boost::mutex&                       mutex_;
+    size_t&                             bytes_;
+
+  public:
+    DataPathWorker(const std::string& accountName,
+                   const std::string& dicomWeb,
+                   const std::string& scenario,
+                   const std::vector<std::string>& studies,
+                   const std::vector<std::string>& series,
+                   const std::vector<std::string>& instances,
+                   const std::string& stowBody,
+                   BenchmarkToolbox::LatencyRecorder& recorder,
+                   boost::mutex& mutex,
+                   size_t& bytes) :
+      accountName_(accountName),
+      dicomWeb_(dicomWeb),
+      scenario_(scenario),
+      studies_(studies),
+      series_(series),
+      instances_(instances),
+      stowBody_(stowBody),
+      recorder_(recorder),
+      mutex_(mutex),
+      bytes_(bytes)
+    {
+    }
+
+    void Run(unsigned int first,
+             unsigned int count)
+    {
+      for (unsigned int i = first; i < first + count; i++)
+      {
+        const size_t index = i % instances_.size();
+
+        BenchmarkToolbox::Chronometer chronometer;
+
+        std::string header;
+        if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName_))
+        {
+          recorder_.AddError();
+          continue;
+        }
+
+        std::string headerKey, headerValue;
+        GoogleAccount::ParseAuthorizationHeader(headerKey, headerValue, header);
+
+        Orthanc::HttpClient client;
+        client.SetTimeout(60);
+        client.AddHeader(headerKey, headerValue);
+
+        if (scenario_ == "qido")
+        {
+          client.SetUrl(dicomWeb_ + "studies/" + studies_[index] + "/series/" +
+                        series_[index] + "/instances");
+          client.SetMethod(Orthanc::HttpMethod_Get);
+          client.AddHeader("Accept", "application/dicom+json");
+        }
+        else if (scenario_ == "wado")
+        {
+          client.SetUrl(dicomWeb_ + "studies/" + studies_[index] + "/series/" +
+                        series_[index] + "/instances/" + instances_[index]);
+          client.SetMethod(Orthanc::HttpMethod_Get);
+          client.AddHeader("Accept", "application/dicom; transfer-syntax=*");
+        }
+        else if (scenario_ == "stow")
+        {
+          client.SetUrl(dicomWeb_ + "studies");
+          client.SetMethod(Orthanc::HttpMethod_Post);
+          client.AddHeader("Content-Type", "multipart/related; type=\"application/dicom\"; boundary=benchmark");
+          client.AssignBody(stowBody_);
+        }
+        else
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        }
+
+        std::string answer;
+
+        if (client.Apply(answer))
+        {
+          recorder_.Add(chronometer.GetElapsed());
+
+          boost::mutex::scoped_lock lock(mutex_);
+          bytes_ += answer.size() + (scenario_ == "stow" ? stowBody_.size() : 0);
+        }
+        else
+        {
+          recorder_.AddError();
+        }
+      }
+    }
+  };
+}
+
+
+static void WaitForToken(const std::string& accountName)
+{
+  BenchmarkToolbox::Chronometer chronometer;
+
+  std::string header;
+  while (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    if (chronometer.GetElapsed() > 60 * 1000000.0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout, "No token from the mock");
+    }
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+}
+
+
+// The token updater of the plugin must be running
+static void BenchmarkDataPath(MockGoogleServer& server,
+                              const std::string& scenario,
+                              const Parameters& parameters)
+{
+  const GoogleAccount& account = GoogleConfiguration::GetInstance().GetAccount(0);
+  const std::string dicomWeb = server.GetDicomWebUrl(account.GetProject(), account.GetLocation(),
+                                                     account.GetDataset(), account.GetDicomStore());
+
+  std::vector<std::string> studies, series, instances;
+  server.GetInstances(studies, series, instances);
+
+  const std::string stowBody = ("--benchmark\r\nContent-Type: application/dicom\r\n\r\n" +
+                                std::string(parameters.instanceSize_, 'x') +
+                                "\r\n--benchmark--\r\n");
+
+  BenchmarkToolbox::LatencyRecorder recorder;
+  boost::mutex mutex;
+  size_t bytes = 0;
+
+  WaitForToken(account.GetName());
+
+  DataPathWorker worker(account.GetName(), dicomWeb, scenario, studies, series, instances,
+                        stowBody, recorder, mutex, bytes);
+
+  const unsigned int threads = std::max(1u, parameters.threads_);
+  const unsigned int perThread = parameters.iterations_ / threads;
+  const unsigned int remainder = parameters.iterations_ % threads;
+
+  BenchmarkToolbox::Chronometer chronometer;
+
+  boost::thread_group group;
+  unsigned int first = 0;
+  for (unsigned int i = 0; i < threads; i++)
+  {
+    // The first "remainder" threads run one more iteration
+    const unsigned int count = perThread + (i < remainder ? 1 : 0);
+    group.create_thread(boost::bind(&DataPathWorker::Run, &worker, first, count));
+    first += count;
+  }
+
+  group.join_all();
+
+  const double elapsed = chronometer.GetElapsed();
+
+  recorder.Print("Data path: " + scenario);
+  BenchmarkToolbox::PrintThroughput("Data path: " + scenario, recorder.GetCount(), bytes, elapsed);
+}
+
+
+static void PrintUsage(const char* path)
+{
+  printf("Usage: %s [options]\n\n", path);
+  printf("  --scenario=NAME     all, token, server-definition, qido, wado, stow, micro, recovery,\n");
+  printf("                      lazy, bulk-import, lanes, mirror, feed, sync, frames or routing\n");
+  printf("                      (default: all, that does not include recovery, lazy, bulk-import,\n");
+  printf("                      lanes, mirror, feed, sync, frames and routing)\n");
+  printf("  --iterations=N      number of iterations per scenario (default: 100)\n");
+  printf("  --threads=N         number of concurrent clients for the data path (default: 4)\n");
+  printf("  --latency=MS        latency injected by the mock server (default: 0, 100 in frames)\n");
+  printf("  --error-rate=R      fraction of the requests failing with HTTP 503 (default: 0)\n");
+  printf("  --instance-size=N   size of the synthetic DICOM instances (default: 262144)\n");
+  printf("  --max-accounts=N    largest number of accounts in the micro-benchmarks (default: 10000)\n");
+  printf("  --csv               CSV output for the micro-benchmarks, to track regressions\n");
+  printf("  --accounts=N        number of accounts sharing the token endpoint in recovery (default: 300)\n");
+  printf("  --outage=S          duration of the outage of the token endpoint in recovery (default: 10)\n");
+  printf("  --retry-after=S     \"Retry-After\" sent by the token endpoint during the outage (default: 0)\n");
+  printf("  --trace=PATH        CSV trace of the activity of the tenants for lazy (default: synthetic)\n");
+  printf("  --idle-timeout=S    idle timeout of the lazy refresh (default: 3600)\n");
+  printf("  --stow-delay=MS     processing time of each instance received by STOW-RS (default: 0)\n");
+  printf("  --import-rate=N     instances per second loaded by the import operations (default: 1000)\n");
+  printf("  --lanes=N           number of lanes of the account in lanes (default: 8)\n");
+  printf("  --mirror-instances=N  number of synthetic instances in mirror (default: 10000000)\n");
+  printf("  --feed-instances=N  number of notified instances in the backlog of feed (default: 10000)\n");
+  printf("  --sync-instances=N  number of synthetic instances in the DICOM store of sync (default: 1000000)\n");
+  printf("  --rules=N           number of routing rules in routing, also run with N/10 and N*10 (default: 200)\n\n");
+}
+
+
+static bool ParseParameters(Parameters& parameters,
+                            int argc,
+                            char* argv[])
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg(argv[i]);
+    const size_t equal = arg.find('=');
+    const std::string key = arg.substr(0, equal);
+    const std::string value = (equal == std::string::npos ? "" : arg.substr(equal + 1));
+
+    try
+    {
+      if (key == "--scenario")
+      {
+        parameters.scenario_ = value;
+      }
+      else if (key == "--iterations")
+      {
+        parameters.iterations_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--threads")
+      {
+        parameters.threads_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--latency")
+      {
+        parameters.latency_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--error-rate")
+      {
+        parameters.errorRate_ = boost::lexical_cast<float>(value);
+      }
+      else if (key == "--instance-size")
+      {
+        parameters.instanceSize_ = boost::lexical_cast<size_t>(value);
+      }
+      else if (key == "--max-accounts")
+      {
+        parameters.maxAccounts_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--csv")
+      {
+        parameters.csv_ = true;
+      }
+      else if (key == "--accounts")
+      {
+        parameters.accounts_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--outage")
+      {
+        parameters.outage_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--retry-after")
+      {
+        parameters.retryAfter_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--trace")
+      {
+        parameters.trace_ = value;
+      }
+      else if (key == "--idle-timeout")
+      {
+        parameters.idleTimeout_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--stow-delay")
+      {
+        parameters.stowDelay_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--import-rate")
+      {
+        parameters.importRate_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--lanes")
+      {
+        parameters.lanes_ = boost::lexical_cast<unsigned int>(value);
+      }
+      else if (key == "--mirror-instances")
+      {
+        parameters.mirrorInstances_ = boost::lexical_cast<size_t>(value);
+      }
+      else if (key == "--feed-instances")
+      {
+        parameters.feedInstances_ = boost::lexical_cast<size_t>(value);
+      }
+      else if (key == "--sync-instances")
+      {
+        parameters.syncInstances_ = boost::lexical_cast<size_t>(value);
+      }
+      else if (key == "--rules")
+      {
+        parameters.rules_ = boost::lexical_cast<size_t>(value);
+      }
+      else
+      {
+        return false;
+      }
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+  Parameters parameters;
+  if (!ParseParameters(parameters, argc, argv))
+  {
+    PrintUsage(argv[0]);
+    return -1;
+  }
+
+  FakeOrthancCore core;
+  OrthancPlugins::SetGlobalContext(core.GetContext());
+
+#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 7, 2)
+  Orthanc::Logging::InitializePluginContext(core.GetContext());
+#else
+  Orthanc::Logging::Initialize(core.GetContext());
+#endif
+
+  Orthanc::Toolbox::InitializeOpenSsl();
+  Orthanc::HttpClient::GlobalInitialize();
+
+  int status = 0;
+  const boost::filesystem::path serviceAccount =
+    boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("gcp-benchmark-%%%%-%%%%.json");
+
+  try
+  {
+    MockGoogleServer server;
+    server.Start(0);
+    server.AddSyntheticInstances(5, 4, 10, parameters.instanceSize_);
+
+    Orthanc::SystemToolbox::WriteFile(GenerateServiceAccount(server.GetTokenUrl()), serviceAccount.string());
+
+    Json::Value account = Json::objectValue;
+    account["Project"] = "benchmark";
+    account["Location"] = "local";
+    account["Dataset"] = "dataset";
+    account["DicomStore"] = "store";
+    account["ServiceAccountFile"] = serviceAccount.string();
+
+    if (parameters.scenario_ == "lanes")
+    {
+      account["Lanes"] = parameters.lanes_;
+    }
+
+    if (parameters.scenario_ == "feed")
+    {
+      account["Mirror"] = true;
+      account["Subscription"] = "benchmark";
+    }
+
+    Json::Value configuration = Json::objectValue;
+    configuration["HttpsVerifyPeers"] = false;
+    configuration["DicomWeb"]["Root"] = "/dicom-web/";
+    configuration["GoogleCloudPlatform"]["BaseUrl"] = server.GetBaseUrl();
+    configuration["GoogleCloudPlatform"]["StorageUrl"] = server.GetStorageUrl();
+    configuration["GoogleCloudPlatform"]["Timeout"] = 10;
+    configuration["GoogleCloudPlatform"]["Accounts"]["benchmark"] = account;
+    configuration["GoogleCloudPlatform"]["PubSubUrl"] = server.GetPubSubUrl();
+    configuration["GoogleCloudPlatform"]["ChangeFeedPollInterval"] = 1;
+    configuration["GoogleCloudPlatform"]["MirrorDirectory"] = boost::filesystem::temp_directory_path().string();
+    core.SetConfiguration(configuration);
+
+    GoogleConfiguration::GetInstance();  // Force the initialization of the singleton
+
+    server.SetLatency(parameters.latency_);
+    server.SetErrors(parameters.errorRate_, 503, 0);
+    server.SetStowDelay(parameters.stowDelay_);
+    server.SetImportRate(parameters.importRate_);
+
+    const bool all = (parameters.scenario_ == "all");
+
+    if (all || parameters.scenario_ == "token")
+    {
+      BenchmarkTokenRotation(server, parameters);
+    }
+
+    if (all || parameters.scenario_ == "server-definition")
+    {
+      BenchmarkServerDefinition(core, parameters);
+    }
+
+    const char* const DATA_PATH[] = { "qido", "wado", "stow" };
+    const size_t dataPathCount = sizeof(DATA_PATH) / sizeof(DATA_PATH[0]);
+
+    if (all ||
+        std::find(DATA_PATH, DATA_PATH + dataPathCount, parameters.scenario_) != DATA_PATH + dataPathCount)
+    {
+      // The token updater can only be started once
+      GoogleUpdater::GetInstance().Start();
+
+      try
+      {
+        for (size_t i = 0; i < dataPathCount; i++)
+        {
+          if (all || parameters.scenario_ == DATA_PATH[i])
+          {
+            BenchmarkDataPath(server, DATA_PATH[i], parameters);
+          }
+        }
+      }
+      catch (Orthanc::OrthancException&)
+      {
+        GoogleUpdater::GetInstance().Stop();
+        throw;
+      }
+
+      GoogleUpdater::GetInstance().Stop();
+    }
+
+    if (all || parameters.scenario_ == "micro")
+    {
+      RunTokenRotationMicroBenchmarks(server, core, parameters.maxAccounts_, parameters.csv_);
+    }
+
+    if (parameters.scenario_ == "recovery")
+    {
+      RunTokenRecoveryBenchmark(server, serviceAccount.string(), parameters.accounts_,
+                                parameters.outage_, parameters.retryAfter_);
+    }
+
+    if (parameters.scenario_ == "lazy")
+    {
+      RunLazyRefreshSimulation(parameters.trace_, GoogleConfiguration::GetInstance().GetRefreshIntervalSeconds(),
+                               parameters.idleTimeout_);
+    }
+
+    if (parameters.scenario_ == "bulk-import")
+    {
+      RunBulkImportBenchmark(server, parameters.iterations_, parameters.instanceSize_, parameters.threads_);
+    }
+
+    if (parameters.scenario_ == "lanes")
+    {
+      RunLanesBenchmark(core, parameters.iterations_);
+    }
+
+    if (parameters.scenario_ == "mirror")
+    {
+      RunMirrorBenchmark(parameters.mirrorInstances_, parameters.iterations_);
+    }
+
+    if (parameters.scenario_ == "feed")
+    {
+      RunChangeFeedBenchmark(server, parameters.feedInstances_, parameters.iterations_);
+    }
+
+    if (parameters.scenario_ == "sync")
+    {
+      RunStoreSyncBenchmark(server, parameters.syncInstances_);
+    }
+
+    if (parameters.scenario_ == "frames")
+    {
+      RunFrameCacheBenchmark(server, parameters.iterations_, parameters.latency_ == 0 ? 100 : parameters.latency_);
+    }
+
+    if (parameters.scenario_ == "routing")
+    {
+      RunRoutingBenchmark(parameters.rules_, parameters.csv_);
+    }
+
+    server.Stop();
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    fprintf(stderr, "Error during the benchmark: %s\n", e.What());
+    status = -1;
+  }
+
+  boost::filesystem::remove(serviceAccount);
+
+  Orthanc::HttpClient::GlobalFinalize();
+  Orthanc::Toolbox::FinalizeOpenSsl();
+
+  return status;
+}
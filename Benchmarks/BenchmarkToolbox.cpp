@@ -0,0 +1,162 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BenchmarkToolbox.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+
+namespace BenchmarkToolbox
+{
+  void LatencyRecorder::Add(double microseconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    samples_.push_back(microseconds);
+  }
+
+
+  void LatencyRecorder::AddError()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    errors_++;
+  }
+
+
+  size_t LatencyRecorder::GetCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return samples_.size();
+  }
+
+
+  unsigned int LatencyRecorder::GetErrorsCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return errors_;
+  }
+
+
+  double LatencyRecorder::GetPercentile(double percentile)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (samples_.empty())
+    {
+      return 0;
+    }
+
+    std::sort(samples_.begin(), samples_.end());
+
+    size_t index = static_cast<size_t>(std::ceil(percentile / 100.0 * static_cast<double>(samples_.size())));
+    if (index > 0)
+    {
+      index--;
+    }
+
+    return samples_[std::min(index, samples_.size() - 1)];
+  }
+
+
+  double LatencyRecorder::GetMean()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (samples_.empty())
+    {
+      return 0;
+    }
+
+    double sum = 0;
+    for (size_t i = 0; i < samples_.size(); i++)
+    {
+      sum += samples_[i];
+    }
+
+    return sum / static_cast<double>(samples_.size());
+  }
+
+
+  void LatencyRecorder::Print(const std::string& name)
+  {
+    const double p50 = GetPercentile(50);
+    const double p99 = GetPercentile(99);
+    const double max = GetPercentile(100);
+    const double min = GetPercentile(0);
+    const double mean = GetMean();
+
+    printf("%-40s n=%-7u err=%-5u min=%10.1f  mean=%10.1f  p50=%10.1f  p99=%10.1f  max=%10.1f (us)\n",
+           name.c_str(), static_cast<unsigned int>(GetCount()), GetErrorsCount(),
+           min, mean, p50, p99, max);
+  }
+
+
+  void PrintMicroBenchmark(const std::string& name,
+                           size_t iterations,
+                           double elapsed,
+                           bool csv)
+  {
+    const double nanoseconds = elapsed * 1000.0 / static_cast<double>(iterations);
+
+    if (csv)
+    {
+      printf("\"%s\",%u,%.1f\n", name.c_str(), static_cast<unsigned int>(iterations), nanoseconds);
+    }
+    else
+    {
+      printf("%-50s %12u iterations %14.1f ns/iteration\n", name.c_str(),
+             static_cast<unsigned int>(iterations), nanoseconds);
+    }
+  }
+
+
+  void PrintThroughput(const std::string& name,
+                       size_t countRequests,
+                       size_t bytes,
+                       double elapsed)
+  {
+    const double seconds = elapsed / 1000000.0;
+
+    if (seconds <= 0)
+    {
+      printf("%-40s (too fast to be measured)\n", name.c_str());
+    }
+    else
+    {
+      printf("%-40s %10.1f requests/s  %10.2f MB/s\n", name.c_str(),
+             static_cast<double>(countRequests) / seconds,
+             static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds);
+    }
+  }
+}
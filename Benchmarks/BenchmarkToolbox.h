@@ -0,0 +1,151 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+
+namespace BenchmarkToolbox
+{
+  class Chronometer : public boost::noncopyable
+  {
+  private:
+    boost::posix_time::ptime  start_;
+
+  public:
+    Chronometer()
+    {
+      Restart();
+    }
+
+    void Restart()
+    {
+      start_ = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    // Elapsed time in microseconds
+    double GetElapsed() const
+    {
+      return static_cast<double>
+        ((boost::posix_time::microsec_clock::universal_time() - start_).total_microseconds());
+    }
+  };
+
+
+  // Thread-safe collection of latencies, in microseconds
+  class LatencyRecorder : public boost::noncopyable
+  {
+  private:
+    boost::mutex         mutex_;
+    std::vector<double>  samples_;
+    unsigned int         errors_;
+
+  public:
+    LatencyRecorder() :
+      errors_(0)
+    {
+    }
+
+    void Add(double microseconds);
+
+    void AddError();
+
+    size_t GetCount();
+
+    unsigned int GetErrorsCount();
+
+    // "percentile" is between 0 and 100
+    double GetPercentile(double percentile);
+
+    double GetMean();
+
+    void Print(const std::string& name);
+  };
+
+
+  void PrintMicroBenchmark(const std::string& name,
+                           size_t iterations,
+                           double elapsed,
+                           bool csv);
+
+
+  // Runs "f" in a loop, doubling the number of iterations until the
+  // loop lasts at least "minimalDuration" microseconds (as in
+  // google-benchmark), then prints the mean time per iteration. The
+  // CSV output is meant to be archived for each release.
+  template <typename Function>
+  void RunMicroBenchmark(const std::string& name,
+                         Function f,
+                         bool csv,
+                         double minimalDuration = 200000)
+  {
+    size_t iterations = 1;
+
+    for (;;)
+    {
+      Chronometer chronometer;
+
+      for (size_t i = 0; i < iterations; i++)
+      {
+        f();
+      }
+
+      const double elapsed = chronometer.GetElapsed();
+
+      if (elapsed >= minimalDuration ||
+          iterations >= (1u << 30))
+      {
+        PrintMicroBenchmark(name, iterations, elapsed, csv);
+        return;
+      }
+      else
+      {
+        iterations *= 2;
+      }
+    }
+  }
+
+
+  // Prints the throughput of a test that has run for "elapsed"
+  // microseconds, and that has transferred "bytes" bytes
+  void PrintThroughput(const std::string& name,
+                       size_t countRequests,
+                       size_t bytes,
+                       double elapsed);
+}
@@ -0,0 +1,252 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BulkImportBenchmark.h"
+
+#include "BenchmarkToolbox.h"
+
+#include "../Plugin/GoogleConfiguration.h"
+#include "../Plugin/HealthcareClient.h"
+#include "../Plugin/StorageStaging.h"
+
+#include <HttpClient.h>
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <stdio.h>
+
+
+// The mock does not check the access tokens
+static const char* const AUTHORIZATION_HEADER = "Authorization: Bearer benchmark";
+static const char* const BUCKET = "benchmark-bucket";
+
+
+namespace
+{
+  class SyntheticSource : public StorageStaging::IInstanceSource
+  {
+  private:
+    size_t  instanceSize_;
+
+  public:
+    explicit SyntheticSource(size_t instanceSize) :
+      instanceSize_(instanceSize)
+    {
+    }
+
+    virtual void ReadInstance(std::string& dicom,
+                              const std::string& instanceId)
+    {
+      dicom.assign(instanceSize_, 'x');
+    }
+  };
+
+
+  class StowWorker : public boost::noncopyable
+  {
+  private:
+    const std::string&                  dicomWeb_;
+    const std::string&                  body_;
+    BenchmarkToolbox::LatencyRecorder&  recorder_;
+
+  public:
+    StowWorker(const std::string& dicomWeb,
+               const std::string& body,
+               BenchmarkToolbox::LatencyRecorder& recorder) :
+      dicomWeb_(dicomWeb),
+      body_(body),
+      recorder_(recorder)
+    {
+    }
+
+    void Run(unsigned int count)
+    {
+      for (unsigned int i = 0; i < count; i++)
+      {
+        Orthanc::HttpClient client;
+        client.SetTimeout(60);
+        client.SetUrl(dicomWeb_ + "studies");
+        client.SetMethod(Orthanc::HttpMethod_Post);
+        client.AddHeader("Content-Type", "multipart/related; type=\"application/dicom\"; boundary=benchmark");
+        client.AssignBody(body_);
+
+        std::string answer;
+
+        BenchmarkToolbox::Chronometer chronometer;
+        if (client.Apply(answer))
+        {
+          recorder_.Add(chronometer.GetElapsed());
+        }
+        else
+        {
+          recorder_.AddError();
+        }
+      }
+    }
+  };
+}
+
+
+static void BenchmarkStow(MockGoogleServer& server,
+                          const GoogleAccount& account,
+                          unsigned int instancesCount,
+                          size_t instanceSize,
+                          unsigned int threads)
+{
+  const std::string dicomWeb = server.GetDicomWebUrl(account.GetProject(), account.GetLocation(),
+                                                     account.GetDataset(), account.GetDicomStore());
+
+  const std::string body = ("--benchmark\r\nContent-Type: application/dicom\r\n\r\n" +
+                            std::string(instanceSize, 'x') +
+                            "\r\n--benchmark--\r\n");
+
+  BenchmarkToolbox::LatencyRecorder recorder;
+  StowWorker worker(dicomWeb, body, recorder);
+
+  const unsigned int perThread = instancesCount / threads;
+
+  BenchmarkToolbox::Chronometer chronometer;
+
+  boost::thread_group group;
+  for (unsigned int i = 0; i < threads; i++)
+  {
+    group.create_thread(boost::bind(&StowWorker::Run, &worker, perThread));
+  }
+
+  group.join_all();
+
+  const double elapsed = chronometer.GetElapsed();
+
+  recorder.Print("Migration: STOW-RS");
+  BenchmarkToolbox::PrintThroughput("Migration: STOW-RS", recorder.GetCount(),
+                                    recorder.GetCount() * instanceSize, elapsed);
+}
+
+
+static void BenchmarkBulkImport(MockGoogleServer& server,
+                                const GoogleAccount& account,
+                                unsigned int instancesCount,
+                                size_t instanceSize,
+                                unsigned int threads)
+{
+  const std::string prefix = StorageStaging::NormalizePrefix(
+    "benchmark/" + boost::lexical_cast<std::string>(server.GetObjectsCount()));
+
+  std::vector<std::string> instances;
+  instances.reserve(instancesCount);
+
+  for (unsigned int i = 0; i < instancesCount; i++)
+  {
+    instances.push_back("instance-" + boost::lexical_cast<std::string>(i));
+  }
+
+  const size_t importedBefore = server.GetImportedInstancesCount();
+  const unsigned int storageRequestsBefore = server.GetStorageRequestsCount();
+
+  StorageStaging staging(account, BUCKET, threads);
+  SyntheticSource source(instanceSize);
+
+  BenchmarkToolbox::Chronometer chronometer;
+
+  const uint64_t bytes = staging.UploadInstances(source, instances, prefix, threads);
+  const double upload = chronometer.GetElapsed();
+
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  Json::Value body = Json::objectValue;
+  body["gcsSource"] = Json::objectValue;
+  body["gcsSource"]["uri"] = staging.GetSourceUri(prefix);
+
+  Json::Value operation;
+  HealthcareClient::Post(operation, account.GetDicomStoreUrl(configuration.GetBaseGoogleUrl(), account.GetDataset(),
+                                                             account.GetDicomStore()) + ":import",
+                         body, AUTHORIZATION_HEADER, HttpTimings::EndpointClass_Operations);
+
+  if (!operation.isMember("name"))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "No long-running operation");
+  }
+
+  const std::string url = configuration.GetBaseGoogleUrl() + operation["name"].asString();
+  unsigned int pollsCount = 0;
+
+  for (;;)
+  {
+    HealthcareClient::Get(operation, url, AUTHORIZATION_HEADER, HttpTimings::EndpointClass_Operations);
+    pollsCount++;
+
+    if (operation.get("done", false).asBool())
+    {
+      break;
+    }
+    else
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+    }
+  }
+
+  const double elapsed = chronometer.GetElapsed();
+
+  printf("Migration: GCS staging + import\n");
+  printf("  upload: %.1f ms with %u streams (%u requests to the storage)\n", upload / 1000.0, threads,
+         server.GetStorageRequestsCount() - storageRequestsBefore);
+  printf("  import: %.1f ms (%u polls of the long-running operation)\n", (elapsed - upload) / 1000.0, pollsCount);
+  printf("  %u instances imported by the DICOM store\n",
+         static_cast<unsigned int>(server.GetImportedInstancesCount() - importedBefore));
+
+  BenchmarkToolbox::PrintThroughput("Migration: GCS staging (upload only)", instancesCount,
+                                    static_cast<size_t>(bytes), upload);
+  BenchmarkToolbox::PrintThroughput("Migration: GCS staging + import", instancesCount,
+                                    static_cast<size_t>(bytes), elapsed);
+}
+
+
+void RunBulkImportBenchmark(MockGoogleServer& server,
+                            unsigned int instancesCount,
+                            size_t instanceSize,
+                            unsigned int threads)
+{
+  const GoogleAccount& account = GoogleConfiguration::GetInstance().GetAccount(0);
+
+  threads = std::max(1u, threads);
+  instancesCount = std::max(threads, instancesCount);
+
+  printf("Migration of %u instances of %u bytes, with %u threads\n\n", instancesCount,
+         static_cast<unsigned int>(instanceSize), threads);
+
+  BenchmarkStow(server, account, instancesCount, instanceSize, threads);
+  printf("\n");
+  BenchmarkBulkImport(server, account, instancesCount, instanceSize, threads);
+}
@@ -0,0 +1,233 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ChangeFeedBenchmark.h"
+
+#include "BenchmarkToolbox.h"
+
+#include "../Plugin/ChangeFeed.h"
+#include "../Plugin/GoogleConfiguration.h"
+#include "../Plugin/GoogleUpdater.h"
+#include "../Plugin/MirrorUpdater.h"
+
+#include <HttpClient.h>
+#include <OrthancException.h>
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <stdio.h>
+
+
+static const size_t INSTANCES_PER_STUDY = 100;
+static const size_t INSTANCES_PER_LIVE_STUDY = 10;
+static const unsigned int TIMEOUT_SECONDS = 600;
+
+
+static std::string FormatStowBody(size_t instancesCount)
+{
+  std::string body;
+
+  for (size_t i = 0; i < instancesCount; i++)
+  {
+    body += "--benchmark\r\nContent-Type: application/dicom\r\n\r\n" + std::string(64, 'x') + "\r\n";
+  }
+
+  return body + "--benchmark--\r\n";
+}
+
+
+static void Stow(const std::string& dicomWeb,
+                 const std::string& body)
+{
+  Orthanc::HttpClient client;
+  client.SetTimeout(60);
+  client.SetUrl(dicomWeb + "studies");
+  client.SetMethod(Orthanc::HttpMethod_Post);
+  client.AddHeader("Content-Type", "multipart/related; type=\"application/dicom\"; boundary=benchmark");
+  client.AssignBody(body);
+
+  std::string answer;
+  if (!client.Apply(answer))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "STOW-RS has failed");
+  }
+}
+
+
+static uint64_t GetMirroredInstancesCount(const std::string& accountName)
+{
+  Json::Value mirrors;
+  MirrorUpdater::GetInstance().Format(mirrors);
+  return mirrors[accountName]["InstancesCount"].asUInt64();
+}
+
+
+static void GetFeedStatus(Json::Value& target,
+                          const std::string& accountName)
+{
+  Json::Value feeds;
+  ChangeFeed::GetInstance().Format(feeds);
+  target = feeds[accountName];
+}
+
+
+void RunChangeFeedBenchmark(MockGoogleServer& server,
+                            size_t instancesCount,
+                            unsigned int iterations)
+{
+  const GoogleAccount& account = GoogleConfiguration::GetInstance().GetAccount(0);
+  const std::string dicomWeb = server.GetDicomWebUrl(account.GetProject(), account.GetLocation(),
+                                                     account.GetDataset(), account.GetDicomStore());
+
+  if (!account.IsMirrored() ||
+      account.GetSubscription().empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                    "The account must have the \"Mirror\" and \"Subscription\" options");
+  }
+
+  printf("Change feed: backlog of %u instances, batches of %u notifications\n\n",
+         static_cast<unsigned int>(instancesCount), GoogleConfiguration::GetInstance().GetChangeFeedBatchSize());
+
+  // Backlog of notifications, accumulated while the feed is stopped
+  {
+    const std::string body = FormatStowBody(INSTANCES_PER_STUDY);
+
+    for (size_t i = 0; i < instancesCount; i += INSTANCES_PER_STUDY)
+    {
+      Stow(dicomWeb, i + INSTANCES_PER_STUDY <= instancesCount ? body :
+           FormatStowBody(instancesCount - i));
+    }
+  }
+
+  ChangeFeed::GetInstance().Register(MirrorUpdater::GetInstance());
+  GoogleUpdater::GetInstance().Start();
+
+  {
+    // Wait for the first token of the account, which is not part of the measure
+    std::string header;
+    BenchmarkToolbox::Chronometer chronometer;
+
+    while (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, account.GetName()))
+    {
+      if (chronometer.GetElapsed() > TIMEOUT_SECONDS * 1000000.0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout, "No token from the mock");
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+    }
+  }
+
+  const unsigned int pullsBefore = server.GetPullsCount();
+  const unsigned int ackRequestsBefore = server.GetAckRequestsCount();
+
+  double maxLag = 0;
+  BenchmarkToolbox::Chronometer chronometer;
+
+  ChangeFeed::GetInstance().Start();
+
+  while (server.GetPendingNotificationsCount() > 0 ||
+         GetMirroredInstancesCount(account.GetName()) < instancesCount)
+  {
+    if (chronometer.GetElapsed() > TIMEOUT_SECONDS * 1000000.0)
+    {
+      ChangeFeed::GetInstance().Stop();
+      GoogleUpdater::GetInstance().Stop();
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout, "The change feed has not drained the backlog");
+    }
+
+    Json::Value status;
+    GetFeedStatus(status, account.GetName());
+    maxLag = std::max(maxLag, status["Lag"].asDouble());
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  const double elapsed = chronometer.GetElapsed();
+
+  Json::Value status;
+  GetFeedStatus(status, account.GetName());
+
+  printf("Change feed: backlog\n");
+  printf("  drained in %.1f ms: %u pulls, %u acknowledgment requests\n", elapsed / 1000.0,
+         server.GetPullsCount() - pullsBefore, server.GetAckRequestsCount() - ackRequestsBefore);
+  printf("  batch size: %.1f on average, maximum lag: %.0f s, %u failures\n",
+         status["MeanBatchSize"].asDouble(), maxLag, status["FailuresCount"].asUInt());
+  printf("  %u instances in the mirror\n",
+         static_cast<unsigned int>(GetMirroredInstancesCount(account.GetName())));
+  BenchmarkToolbox::PrintThroughput("Change feed: backlog", instancesCount, 0, elapsed);
+
+  // Live notifications: Time between STOW-RS and the visibility in the mirror
+  BenchmarkToolbox::LatencyRecorder visibility;
+  const std::string body = FormatStowBody(INSTANCES_PER_LIVE_STUDY);
+
+  for (unsigned int i = 0; i < iterations; i++)
+  {
+    const uint64_t expected = GetMirroredInstancesCount(account.GetName()) + INSTANCES_PER_LIVE_STUDY;
+
+    BenchmarkToolbox::Chronometer latency;
+    Stow(dicomWeb, body);
+
+    bool visible = false;
+
+    while (latency.GetElapsed() < TIMEOUT_SECONDS * 1000000.0)
+    {
+      if (GetMirroredInstancesCount(account.GetName()) >= expected)
+      {
+        visible = true;
+        break;
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+
+    if (visible)
+    {
+      visibility.Add(latency.GetElapsed());
+    }
+    else
+    {
+      visibility.AddError();
+    }
+  }
+
+  ChangeFeed::GetInstance().Stop();
+  GoogleUpdater::GetInstance().Stop();
+
+  printf("\n");
+  visibility.Print("Change feed: STOW-RS to mirror");
+  printf("  (each pull that drains the subscription is followed by a pause of %u s)\n",
+         GoogleConfiguration::GetInstance().GetChangeFeedPollIntervalSeconds());
+}
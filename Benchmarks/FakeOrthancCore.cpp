@@ -0,0 +1,222 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "FakeOrthancCore.h"
+
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <json/reader.h>
+#include <json/writer.h>
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+
+
+static void AllocateBuffer(OrthancPluginMemoryBuffer* target,
+                           const std::string& content)
+{
+  if (content.empty())
+  {
+    target->data = NULL;
+    target->size = 0;
+  }
+  else
+  {
+    target->data = malloc(content.size());
+    target->size = static_cast<uint32_t>(content.size());
+    memcpy(target->data, content.c_str(), content.size());
+  }
+}
+
+
+FakeOrthancCore::FakeOrthancCore() :
+  configuration_("{}"),
+  dicomWebRoot_("/dicom-web/"),
+  serverUpdatesCount_(0)
+{
+  memset(&context_, 0, sizeof(context_));
+  context_.pluginsManager = this;
+  context_.orthancVersion = "mainline";
+  context_.Free = free;
+  context_.InvokeService = InvokeService;
+}
+
+
+void FakeOrthancCore::SetConfiguration(const Json::Value& configuration)
+{
+  Json::FastWriter writer;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  configuration_ = writer.write(configuration);
+}
+
+
+unsigned int FakeOrthancCore::GetServerUpdatesCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return serverUpdatesCount_;
+}
+
+
+bool FakeOrthancCore::LookupServer(std::string& definition,
+                                   const std::string& name)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::map<std::string, std::string>::const_iterator found = servers_.find(name);
+  if (found == servers_.end())
+  {
+    return false;
+  }
+  else
+  {
+    definition = found->second;
+    return true;
+  }
+}
+
+
+OrthancPluginErrorCode FakeOrthancCore::RestApi(OrthancPluginMemoryBuffer* target,
+                                                const std::string& method,
+                                                const std::string& uri,
+                                                const std::string& body)
+{
+  if (method == "GET" &&
+      uri == "/plugins/dicom-web")
+  {
+    AllocateBuffer(target, "{\"ID\":\"dicom-web\",\"Version\":\"mainline\"}");
+    return OrthancPluginErrorCode_Success;
+  }
+  else if (method == "PUT" &&
+           boost::starts_with(uri, dicomWebRoot_ + "servers/"))
+  {
+    // Like the DICOMweb plugin, parse the definition of the server
+    Json::Value server;
+    Json::Reader reader;
+    if (!reader.parse(body, server) ||
+        server.type() != Json::objectValue ||
+        !server.isMember("Url"))
+    {
+      return OrthancPluginErrorCode_BadFileFormat;
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      servers_[uri.substr(dicomWebRoot_.size() + 8)] = body;
+      serverUpdatesCount_++;
+    }
+
+    AllocateBuffer(target, "");
+    return OrthancPluginErrorCode_Success;
+  }
+  else
+  {
+    return OrthancPluginErrorCode_UnknownResource;
+  }
+}
+
+
+OrthancPluginErrorCode FakeOrthancCore::InvokeService(OrthancPluginContext* context,
+                                                      _OrthancPluginService service,
+                                                      const void* params)
+{
+  FakeOrthancCore& that = *reinterpret_cast<FakeOrthancCore*>(context->pluginsManager);
+
+  try
+  {
+    switch (service)
+    {
+      case _OrthancPluginService_LogError:
+        std::cerr << "E " << reinterpret_cast<const char*>(params) << std::endl;
+        return OrthancPluginErrorCode_Success;
+
+      case _OrthancPluginService_LogWarning:
+        std::cerr << "W " << reinterpret_cast<const char*>(params) << std::endl;
+        return OrthancPluginErrorCode_Success;
+
+      case _OrthancPluginService_LogInfo:
+        return OrthancPluginErrorCode_Success;
+
+      case _OrthancPluginService_GetConfiguration:
+      {
+        const _OrthancPluginRetrieveDynamicString& p =
+          *reinterpret_cast<const _OrthancPluginRetrieveDynamicString*>(params);
+
+        boost::mutex::scoped_lock lock(that.mutex_);
+        *p.result = strdup(that.configuration_.c_str());
+        return OrthancPluginErrorCode_Success;
+      }
+
+      case _OrthancPluginService_ReadFile:
+      {
+        const _OrthancPluginReadFile& p = *reinterpret_cast<const _OrthancPluginReadFile*>(params);
+
+        std::string content;
+        Orthanc::SystemToolbox::ReadFile(content, p.path);
+        AllocateBuffer(p.target, content);
+        return OrthancPluginErrorCode_Success;
+      }
+
+      case _OrthancPluginService_RestApiGet:
+      case _OrthancPluginService_RestApiGetAfterPlugins:
+      {
+        const _OrthancPluginRestApiGet& p = *reinterpret_cast<const _OrthancPluginRestApiGet*>(params);
+        return that.RestApi(p.target, "GET", p.uri, "");
+      }
+
+      case _OrthancPluginService_RestApiPost:
+      case _OrthancPluginService_RestApiPostAfterPlugins:
+      case _OrthancPluginService_RestApiPut:
+      case _OrthancPluginService_RestApiPutAfterPlugins:
+      {
+        const _OrthancPluginRestApiPostPut& p = *reinterpret_cast<const _OrthancPluginRestApiPostPut*>(params);
+
+        const bool isPut = (service == _OrthancPluginService_RestApiPut ||
+                            service == _OrthancPluginService_RestApiPutAfterPlugins);
+
+        return that.RestApi(p.target, isPut ? "PUT" : "POST", p.uri,
+                            std::string(p.body, p.bodySize));
+      }
+
+      default:
+        return OrthancPluginErrorCode_NotImplemented;
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+  }
+}
@@ -0,0 +1,295 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "FrameCacheBenchmark.h"
+
+#include "BenchmarkToolbox.h"
+
+#include "../Plugin/FrameCache.h"
+#include "../Plugin/GoogleConfiguration.h"
+#include "../Plugin/GoogleUpdater.h"
+#include "../Plugin/HealthcareClient.h"
+
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <stdio.h>
+
+
+static const unsigned int GRID_SIZE = 32;        // Tiles per row and per column
+static const size_t TILE_SIZE = 16 * 1024;
+static const unsigned int VIEW_COLUMNS = 4;      // Tiles of the viewport
+static const unsigned int VIEW_ROWS = 3;
+static const unsigned int THINK_MS = 200;        // Delay between two pans
+static const unsigned int TIMEOUT_SECONDS = 60;
+static const char* const ACCEPT = "multipart/related; type=\"application/octet-stream\"; transfer-syntax=*";
+
+
+namespace
+{
+  struct Viewport
+  {
+    unsigned int  column_;
+    unsigned int  row_;
+  };
+
+
+  // Writes the frames (numbered from 1, row by row) that become
+  // visible after each pan of a deterministic random walk, that
+  // mostly keeps its direction and bounces on the borders of the
+  // matrix of tiles
+  void GenerateWalk(std::vector<std::vector<unsigned int> >& walk,
+                    unsigned int pansCount)
+  {
+    static const int DIRECTIONS[4][2] = { { 1, 0 }, { 0, 1 }, { -1, 0 }, { 0, -1 } };
+
+    uint32_t random = 2463534242u;
+    size_t direction = 0;
+
+    Viewport viewport;
+    viewport.column_ = 0;
+    viewport.row_ = 0;
+
+    walk.clear();
+    walk.resize(pansCount + 1);
+
+    // The initial viewport
+    for (unsigned int r = 0; r < VIEW_ROWS; r++)
+    {
+      for (unsigned int c = 0; c < VIEW_COLUMNS; c++)
+      {
+        walk[0].push_back(1 + r * GRID_SIZE + c);
+      }
+    }
+
+    for (unsigned int pan = 1; pan <= pansCount; pan++)
+    {
+      random ^= random << 13;
+      random ^= random >> 17;
+      random ^= random << 5;
+
+      if (random % 4 == 0)
+      {
+        direction = (random / 4) % 4;
+      }
+
+      for (;;)
+      {
+        const int column = static_cast<int>(viewport.column_) + DIRECTIONS[direction][0];
+        const int row = static_cast<int>(viewport.row_) + DIRECTIONS[direction][1];
+
+        if (column >= 0 && column + VIEW_COLUMNS <= GRID_SIZE &&
+            row >= 0 && row + VIEW_ROWS <= GRID_SIZE)
+        {
+          viewport.column_ = static_cast<unsigned int>(column);
+          viewport.row_ = static_cast<unsigned int>(row);
+          break;
+        }
+        else
+        {
+          direction = (direction + 1) % 4;  // Bounce
+        }
+      }
+
+      // The strip of tiles exposed by the pan, row by row
+      for (unsigned int r = 0; r < VIEW_ROWS; r++)
+      {
+        for (unsigned int c = 0; c < VIEW_COLUMNS; c++)
+        {
+          const bool exposed = ((DIRECTIONS[direction][0] == 1 && c == VIEW_COLUMNS - 1) ||
+                                (DIRECTIONS[direction][0] == -1 && c == 0) ||
+                                (DIRECTIONS[direction][1] == 1 && r == VIEW_ROWS - 1) ||
+                                (DIRECTIONS[direction][1] == -1 && r == 0));
+
+          if (exposed)
+          {
+            walk[pan].push_back(1 + (viewport.row_ + r) * GRID_SIZE + viewport.column_ + c);
+          }
+        }
+      }
+    }
+  }
+}
+
+
+static void WaitForToken(std::string& header,
+                         const std::string& accountName)
+{
+  BenchmarkToolbox::Chronometer chronometer;
+
+  while (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    if (chronometer.GetElapsed() > TIMEOUT_SECONDS * 1000000.0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout, "No token from the mock");
+    }
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+}
+
+
+template <typename Retrieve>
+static void RunWalk(BenchmarkToolbox::LatencyRecorder& recorder,
+                    const std::vector<std::vector<unsigned int> >& walk,
+                    Retrieve retrieve)
+{
+  for (size_t pan = 0; pan < walk.size(); pan++)
+  {
+    for (size_t i = 0; i < walk[pan].size(); i++)
+    {
+      BenchmarkToolbox::Chronometer chronometer;
+
+      try
+      {
+        std::string body, contentType;
+        retrieve(body, contentType, walk[pan][i]);
+
+        if (body.size() < TILE_SIZE)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Truncated frame");
+        }
+
+        recorder.Add(chronometer.GetElapsed());
+      }
+      catch (Orthanc::OrthancException&)
+      {
+        recorder.AddError();
+      }
+    }
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(THINK_MS));
+  }
+}
+
+
+static void PrintImprovement(BenchmarkToolbox::LatencyRecorder& direct,
+                             BenchmarkToolbox::LatencyRecorder& cached,
+                             const std::string& name)
+{
+  const double p50 = cached.GetPercentile(50);
+  const double p99 = cached.GetPercentile(99);
+
+  printf("  %s: p50 %.1f ms -> %.1f ms (x%.1f), p99 %.1f ms -> %.1f ms (x%.1f)\n", name.c_str(),
+         direct.GetPercentile(50) / 1000.0, p50 / 1000.0, p50 > 0 ? direct.GetPercentile(50) / p50 : 0.0,
+         direct.GetPercentile(99) / 1000.0, p99 / 1000.0, p99 > 0 ? direct.GetPercentile(99) / p99 : 0.0);
+}
+
+
+void RunFrameCacheBenchmark(MockGoogleServer& server,
+                            unsigned int pansCount,
+                            unsigned int latencyMs)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  const GoogleAccount& account = configuration.GetAccount(0);
+  const std::string dicomWeb = account.GetDicomWebUrl(configuration.GetBaseGoogleUrl());
+
+  FrameCache& cache = FrameCache::GetInstance();
+  if (!cache.IsEnabled())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "The frame cache is disabled");
+  }
+
+  // One whole-slide image, whose tiles are the frames
+  server.SetFramesPerInstance(GRID_SIZE * GRID_SIZE);
+  server.AddSyntheticInstances(1, 1, 1, GRID_SIZE * GRID_SIZE * TILE_SIZE);
+  server.SetLatency(latencyMs);
+
+  std::vector<std::string> studies, series, instances;
+  server.GetInstances(studies, series, instances);
+
+  const std::string study = studies.back();
+  const std::string serie = series.back();
+  const std::string instance = instances.back();
+  const std::string instanceUrl = dicomWeb + "studies/" + study + "/series/" + serie + "/instances/" + instance + "/";
+
+  std::vector<std::vector<unsigned int> > walk;
+  GenerateWalk(walk, pansCount);
+
+  printf("Frame cache: %ux%u tiles of %u KB, viewport of %ux%u tiles, %u pans, %u ms latency, %u ms think time\n\n",
+         GRID_SIZE, GRID_SIZE, static_cast<unsigned int>(TILE_SIZE / 1024), VIEW_COLUMNS, VIEW_ROWS,
+         pansCount, latencyMs, THINK_MS);
+
+  GoogleUpdater::GetInstance().Start();
+  cache.Start();
+
+  try
+  {
+    std::string header;
+    WaitForToken(header, account.GetName());
+
+    BenchmarkToolbox::LatencyRecorder direct;
+    RunWalk(direct, walk, [&] (std::string& body, std::string& contentType, unsigned int frame) {
+        HealthcareClient::RetrieveFrames(body, contentType, instanceUrl + "frames/" + boost::lexical_cast<std::string>(frame),
+                                         header, ACCEPT);
+      });
+    direct.Print("Frame cache: direct");
+
+    BenchmarkToolbox::LatencyRecorder first;
+    RunWalk(first, walk, [&] (std::string& body, std::string& contentType, unsigned int frame) {
+        cache.GetFrames(body, contentType, account.GetName(), study, serie, instance,
+                        boost::lexical_cast<std::string>(frame), ACCEPT);
+      });
+    first.Print("Frame cache: first visit (prefetch)");
+
+    BenchmarkToolbox::LatencyRecorder revisit;
+    RunWalk(revisit, walk, [&] (std::string& body, std::string& contentType, unsigned int frame) {
+        cache.GetFrames(body, contentType, account.GetName(), study, serie, instance,
+                        boost::lexical_cast<std::string>(frame), ACCEPT);
+      });
+    revisit.Print("Frame cache: revisit");
+
+    printf("\nFrame cache: improvement over the direct retrieval\n");
+    PrintImprovement(direct, first, "first visit");
+    PrintImprovement(direct, revisit, "revisit");
+
+    Json::Value status;
+    cache.Format(status);
+    printf("  %u requests, hit rate %.1f%%, %u prefetches (%u used), %u shared fetches, %.1f MB in memory\n",
+           status["RequestsCount"].asUInt(), status["HitRate"].asDouble() * 100.0,
+           status["PrefetchesCount"].asUInt(), status["PrefetchHitsCount"].asUInt(),
+           status["SharedFetchesCount"].asUInt(),
+           static_cast<double>(status["MemoryUsage"].asUInt64()) / (1024.0 * 1024.0));
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    cache.Stop();
+    GoogleUpdater::GetInstance().Stop();
+    throw;
+  }
+
+  cache.Stop();
+  GoogleUpdater::GetInstance().Stop();
+}
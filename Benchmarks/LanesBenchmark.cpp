@@ -0,0 +1,116 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "LanesBenchmark.h"
+
+#include "BenchmarkToolbox.h"
+
+#include "../Plugin/GoogleConfiguration.h"
+
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+#include <json/reader.h>
+
+#include <stdio.h>
+
+
+// Tells whether the DICOMweb server "serverName" carries the given
+// value of the "Authorization" header
+static bool HasToken(FakeOrthancCore& core,
+                     const std::string& serverName,
+                     const std::string& authorization)
+{
+  std::string s;
+  Json::Value definition;
+  Json::Reader reader;
+
+  return (core.LookupServer(s, serverName) &&
+          reader.parse(s, definition) &&
+          definition.isMember("HttpHeaders") &&
+          definition["HttpHeaders"].isObject() &&
+          definition["HttpHeaders"].isMember("Authorization") &&
+          definition["HttpHeaders"]["Authorization"] == authorization);
+}
+
+
+void RunLanesBenchmark(FakeOrthancCore& core,
+                       unsigned int iterations)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  const GoogleAccount& account = configuration.GetAccount(0);
+
+  std::vector<std::string> lanes;
+  account.ListServerNames(lanes, account.GetDataset(), account.GetDicomStore());
+
+  BenchmarkToolbox::LatencyRecorder recorder;
+  unsigned int stale = 0;
+
+  for (unsigned int i = 0; i < iterations; i++)
+  {
+    // One new token per iteration, as pushed by each token refresh
+    const std::string value = "Bearer benchmark-lanes-" + boost::lexical_cast<std::string>(i);
+
+    BenchmarkToolbox::Chronometer chronometer;
+
+    if (account.UpdateServerDefinition(configuration.GetDicomWebPluginRoot(), configuration.GetBaseGoogleUrl(),
+                                       "Authorization: " + value))
+    {
+      recorder.Add(chronometer.GetElapsed());
+    }
+    else
+    {
+      recorder.AddError();
+    }
+
+    for (size_t j = 0; j < lanes.size(); j++)
+    {
+      if (!HasToken(core, lanes[j], value))
+      {
+        stale++;
+      }
+    }
+  }
+
+  recorder.Print("Lanes: token push x" + boost::lexical_cast<std::string>(lanes.size()));
+
+  if (!lanes.empty())
+  {
+    printf("  %.1f us per lane\n", recorder.GetMean() / static_cast<double>(lanes.size()));
+  }
+
+  if (stale != 0)
+  {
+    printf("  %u lanes were left with a stale token\n", stale);
+  }
+}
@@ -0,0 +1,283 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "LazyRefreshSimulation.h"
+
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+
+static const unsigned int TOKEN_LIFETIME = 3600;    // Lifetime of the Google access tokens
+static const unsigned int EXPIRATION_SLACK = 300;   // google-cloud-cpp renews the tokens 5 minutes ahead
+
+
+namespace
+{
+  typedef std::map<std::string, std::vector<uint64_t> >  Trace;   // Account => sorted timestamps
+
+  struct Counters
+  {
+    uint64_t  tokenRequests_;
+    uint64_t  wakeUps_;
+    uint64_t  coldWakeUps_;   // Wake-ups that had to wait for a new token
+
+    Counters() :
+      tokenRequests_(0),
+      wakeUps_(0),
+      coldWakeUps_(0)
+    {
+    }
+  };
+
+  // Emulates "Credentials::AuthorizationHeader()": Returns "true" iff a token request is issued
+  class TokenCache
+  {
+  private:
+    bool      hasToken_;
+    uint64_t  expiration_;
+
+  public:
+    TokenCache() :
+      hasToken_(false),
+      expiration_(0)
+    {
+    }
+
+    bool Get(uint64_t now)
+    {
+      if (!hasToken_ ||
+          now + EXPIRATION_SLACK >= expiration_)
+      {
+        hasToken_ = true;
+        expiration_ = now + TOKEN_LIFETIME;
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    }
+  };
+}
+
+
+static void SimulateAccount(Counters& eager,
+                            Counters& lazy,
+                            const std::vector<uint64_t>& events,
+                            uint64_t duration,
+                            unsigned int refreshInterval,
+                            unsigned int idleTimeout)
+{
+  {
+    // Eager mode: Periodic refresh from the start
+    TokenCache cache;
+    for (uint64_t t = 0; t < duration; t += refreshInterval)
+    {
+      eager.tokenRequests_ += cache.Get(t) ? 1 : 0;
+    }
+  }
+
+  {
+    // Lazy mode, as in "AccountRefresher::Run()" and "NotifyActivity()"
+    TokenCache cache;
+    uint64_t lastActivity = 0;
+    uint64_t nextRefresh = 0;
+    bool dormant = false;
+    size_t nextEvent = 0;
+
+    for (;;)
+    {
+      const uint64_t eventTime = (nextEvent < events.size() ? events[nextEvent] : duration);
+
+      if (!dormant &&
+          nextRefresh <= eventTime &&
+          nextRefresh < duration)
+      {
+        // Periodic refresh
+        lazy.tokenRequests_ += cache.Get(nextRefresh) ? 1 : 0;
+        dormant = (nextRefresh - std::min(nextRefresh, lastActivity) >= idleTimeout);
+        nextRefresh += refreshInterval;
+      }
+      else if (nextEvent < events.size() &&
+               eventTime < duration)
+      {
+        lastActivity = eventTime;
+
+        if (dormant)
+        {
+          // Synchronous refresh on first use
+          lazy.wakeUps_++;
+
+          if (cache.Get(eventTime))
+          {
+            lazy.tokenRequests_++;
+            lazy.coldWakeUps_++;
+          }
+
+          dormant = false;
+          nextRefresh = eventTime + refreshInterval;
+        }
+
+        nextEvent++;
+      }
+      else
+      {
+        break;
+      }
+    }
+  }
+}
+
+
+static void GenerateSyntheticTrace(Trace& trace,
+                                   uint64_t& duration)
+{
+  static const unsigned int TENANTS = 300;
+  static const unsigned int DAYS = 7;
+
+  duration = DAYS * 86400;
+
+  // Heavy-tailed activity: Tenant "i" issues about "2000 / (i + 1)" queries per day
+  unsigned int state = 42;
+
+  for (unsigned int i = 0; i < TENANTS; i++)
+  {
+    const std::string account = "tenant-" + boost::lexical_cast<std::string>(i);
+    const double perDay = 2000.0 / static_cast<double>(i + 1);
+    const uint64_t count = static_cast<uint64_t>(perDay * DAYS);
+
+    std::vector<uint64_t>& events = trace[account];
+    for (uint64_t j = 0; j < count; j++)
+    {
+      state = state * 1103515245u + 12345u;
+      events.push_back(static_cast<uint64_t>(state >> 8) % duration);
+    }
+
+    std::sort(events.begin(), events.end());
+  }
+}
+
+
+static void LoadTrace(Trace& trace,
+                      uint64_t& duration,
+                      const std::string& path)
+{
+  std::string content;
+  Orthanc::SystemToolbox::ReadFile(content, path);
+
+  std::vector<std::string> lines;
+  Orthanc::Toolbox::TokenizeString(lines, content, '\n');
+
+  duration = 0;
+
+  for (size_t i = 0; i < lines.size(); i++)
+  {
+    const std::string line = Orthanc::Toolbox::StripSpaces(lines[i]);
+    const size_t comma = line.find(',');
+
+    if (!line.empty() &&
+        comma != std::string::npos)
+    {
+      try
+      {
+        const uint64_t timestamp = boost::lexical_cast<uint64_t>(Orthanc::Toolbox::StripSpaces(line.substr(0, comma)));
+        trace[Orthanc::Toolbox::StripSpaces(line.substr(comma + 1))].push_back(timestamp);
+        duration = std::max(duration, timestamp + 1);
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        // Header line
+      }
+    }
+  }
+
+  for (Trace::iterator it = trace.begin(); it != trace.end(); ++it)
+  {
+    std::sort(it->second.begin(), it->second.end());
+  }
+}
+
+
+void RunLazyRefreshSimulation(const std::string& tracePath,
+                              unsigned int refreshIntervalSeconds,
+                              unsigned int idleTimeoutSeconds)
+{
+  Trace trace;
+  uint64_t duration;
+
+  if (tracePath.empty())
+  {
+    GenerateSyntheticTrace(trace, duration);
+  }
+  else
+  {
+    LoadTrace(trace, duration, tracePath);
+  }
+
+  if (trace.empty() ||
+      duration == 0)
+  {
+    printf("Lazy refresh: Empty trace\n");
+    return;
+  }
+
+  Counters eager, lazy;
+  uint64_t events = 0;
+
+  for (Trace::const_iterator it = trace.begin(); it != trace.end(); ++it)
+  {
+    SimulateAccount(eager, lazy, it->second, duration, refreshIntervalSeconds, idleTimeoutSeconds);
+    events += it->second.size();
+  }
+
+  const double days = static_cast<double>(duration) / 86400.0;
+
+  printf("Lazy refresh (%u accounts, %llu events over %.2f days, idle timeout of %u seconds):\n",
+         static_cast<unsigned int>(trace.size()), static_cast<unsigned long long>(events), days,
+         idleTimeoutSeconds);
+  printf("  Eager refresh: %.1f token requests/day\n", static_cast<double>(eager.tokenRequests_) / days);
+  printf("  Lazy refresh:  %.1f token requests/day (%.1f%% less)\n",
+         static_cast<double>(lazy.tokenRequests_) / days,
+         100.0 * (1.0 - static_cast<double>(lazy.tokenRequests_) /
+                  static_cast<double>(std::max<uint64_t>(1, eager.tokenRequests_))));
+  printf("  Lazy refresh:  %.1f wake-ups/day, including %.1f waiting for a new token\n",
+         static_cast<double>(lazy.wakeUps_) / days, static_cast<double>(lazy.coldWakeUps_) / days);
+}
@@ -0,0 +1,53 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <string>
+
+
+/**
+ * Replays a trace of the activity of the tenants, and compares the
+ * number of token requests issued per day by the eager refresh (all
+ * the accounts are refreshed forever) and by the lazy refresh
+ * ("GoogleCloudPlatform.LazyRefresh"). The trace is a CSV file whose
+ * lines are "{seconds since start},{account}". If no trace is
+ * provided, a synthetic trace with a heavy-tailed activity is used.
+ *
+ * This is a discrete-time simulation of the policy implemented by
+ * "AccountRefresher" and of the token cache of google-cloud-cpp, as
+ * replaying days of activity in real time is not an option.
+ **/
+void RunLazyRefreshSimulation(const std::string& tracePath,
+                              unsigned int refreshIntervalSeconds,
+                              unsigned int idleTimeoutSeconds);
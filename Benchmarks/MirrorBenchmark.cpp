@@ -0,0 +1,323 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "MirrorBenchmark.h"
+
+#include "BenchmarkToolbox.h"
+
+#include "../Plugin/StoreMirror.h"
+
+#include <OrthancException.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <stdio.h>
+
+
+static const char* const UID_ROOT = "1.2.826.0.1.3680043.10.543.";
+static const size_t PATIENTS_PER_STUDY = 3;   // Each patient has 3 studies on average
+static const char* const NAMES[] = { "SMITH", "JOHNSON", "WILLIAMS", "BROWN", "JONES", "GARCIA", "MILLER", "DAVIS" };
+static const char* const MODALITIES[] = { "CT", "MR", "CR", "US", "PT", "DX" };
+
+
+namespace
+{
+  // Deterministic generator, so that the runs are comparable
+  class Random : public boost::noncopyable
+  {
+  private:
+    uint32_t  state_;
+
+  public:
+    Random() :
+      state_(2463534242u)
+    {
+    }
+
+    uint32_t Next()
+    {
+      state_ ^= state_ << 13;
+      state_ ^= state_ >> 17;
+      state_ ^= state_ << 5;
+      return state_;
+    }
+
+    uint32_t Next(uint32_t max)   // In [0, max)
+    {
+      return Next() % max;
+    }
+  };
+}
+
+
+static std::string GetStudyUid(size_t study)
+{
+  return UID_ROOT + boost::lexical_cast<std::string>(study);
+}
+
+
+static std::string GetSeriesUid(size_t study,
+                                size_t series)
+{
+  return GetStudyUid(study) + "." + boost::lexical_cast<std::string>(series + 1);
+}
+
+
+static std::string GetSopUid(size_t study,
+                             size_t series,
+                             size_t instance)
+{
+  return GetSeriesUid(study, series) + "." + boost::lexical_cast<std::string>(instance + 1);
+}
+
+
+static std::string GetPatientId(size_t study)
+{
+  char buffer[32];
+  sprintf(buffer, "P%08u", static_cast<unsigned int>(study / PATIENTS_PER_STUDY));
+  return buffer;
+}
+
+
+static std::string GetDate(uint32_t day)  // Days since 2015-01-01, with 28 days per month
+{
+  char buffer[16];
+  sprintf(buffer, "%04u%02u%02u", 2015 + day / 336, 1 + (day / 28) % 12, 1 + day % 28);
+  return buffer;
+}
+
+
+static void GenerateStudy(StoreMirror::StudyRecord& study,
+                          std::vector<size_t>& seriesSizes,
+                          Random& random,
+                          size_t index,
+                          size_t remaining)
+{
+  const size_t patient = index / PATIENTS_PER_STUDY;
+  const char* name = NAMES[patient % (sizeof(NAMES) / sizeof(NAMES[0]))];
+
+  study.study_[StoreMirror::StudyColumn_StudyInstanceUid] = GetStudyUid(index);
+  study.study_[StoreMirror::StudyColumn_PatientName] = (std::string(name) + "^PATIENT" +
+                                                        boost::lexical_cast<std::string>(patient));
+  study.study_[StoreMirror::StudyColumn_PatientId] = GetPatientId(index);
+  study.study_[StoreMirror::StudyColumn_PatientBirthDate] = GetDate(random.Next(336 * 10)).replace(0, 4, "1960");
+  study.study_[StoreMirror::StudyColumn_PatientSex] = (patient % 2 == 0 ? "F" : "M");
+  study.study_[StoreMirror::StudyColumn_StudyDate] = GetDate(random.Next(336 * 10));
+  study.study_[StoreMirror::StudyColumn_StudyTime] = "101500";
+  study.study_[StoreMirror::StudyColumn_AccessionNumber] = "A" + boost::lexical_cast<std::string>(index);
+  study.study_[StoreMirror::StudyColumn_ReferringPhysicianName] = "REFERRING^DOCTOR";
+  study.study_[StoreMirror::StudyColumn_StudyId] = boost::lexical_cast<std::string>(index % 10000);
+  study.study_[StoreMirror::StudyColumn_StudyDescription] = "Synthetic study";
+
+  study.instances_.clear();
+  seriesSizes.clear();
+
+  const size_t seriesCount = 1 + random.Next(6);
+  const char* modality = MODALITIES[random.Next(sizeof(MODALITIES) / sizeof(MODALITIES[0]))];
+
+  for (size_t s = 0; s < seriesCount && study.instances_.size() < remaining; s++)
+  {
+    const size_t count = std::min(static_cast<size_t>(1 + random.Next(200)), remaining - study.instances_.size());
+    seriesSizes.push_back(count);
+
+    StoreMirror::InstanceRecord instance;
+    instance.series_[StoreMirror::SeriesColumn_SeriesInstanceUid] = GetSeriesUid(index, s);
+    instance.series_[StoreMirror::SeriesColumn_Modality] = modality;
+    instance.series_[StoreMirror::SeriesColumn_SeriesNumber] = boost::lexical_cast<std::string>(s + 1);
+    instance.series_[StoreMirror::SeriesColumn_SeriesDescription] = "Series " + boost::lexical_cast<std::string>(s + 1);
+    instance.instance_[StoreMirror::InstanceColumn_SopClassUid] = "1.2.840.10008.5.1.4.1.1.2";
+
+    for (size_t i = 0; i < count; i++)
+    {
+      instance.instance_[StoreMirror::InstanceColumn_SopInstanceUid] = GetSopUid(index, s, i);
+      instance.instance_[StoreMirror::InstanceColumn_InstanceNumber] = boost::lexical_cast<std::string>(i + 1);
+      study.instances_.push_back(instance);
+    }
+  }
+}
+
+
+template <typename QueryGenerator>
+static void BenchmarkQueries(const StoreMirror& mirror,
+                             const std::string& name,
+                             unsigned int iterations,
+                             QueryGenerator generator)
+{
+  BenchmarkToolbox::LatencyRecorder recorder;
+  size_t matches = 0;
+
+  for (unsigned int i = 0; i < iterations; i++)
+  {
+    StoreMirror::Query query;
+    generator(query);
+
+    BenchmarkToolbox::Chronometer chronometer;
+
+    Json::Value answer;
+    if (mirror.Execute(answer, query))
+    {
+      recorder.Add(chronometer.GetElapsed());
+      matches += answer.size();
+    }
+    else
+    {
+      recorder.AddError();
+    }
+  }
+
+  recorder.Print("Mirror: " + name);
+  printf("  %.1f matches per query\n", iterations == 0 ? 0.0 :
+         static_cast<double>(matches) / static_cast<double>(iterations));
+}
+
+
+void RunMirrorBenchmark(size_t instancesCount,
+                        unsigned int iterations)
+{
+  StoreMirror mirror;
+  Random random;
+
+  // Layout of the generated studies, to build the queries
+  std::vector<std::vector<size_t> > layout;
+
+  BenchmarkToolbox::Chronometer chronometer;
+
+  {
+    StoreMirror::StudyRecord study;
+    std::vector<size_t> seriesSizes;
+
+    for (size_t generated = 0; generated < instancesCount; )
+    {
+      GenerateStudy(study, seriesSizes, random, layout.size(), instancesCount - generated);
+      mirror.ReplaceStudy(study);
+      layout.push_back(seriesSizes);
+      generated += study.instances_.size();
+    }
+  }
+
+  const double build = chronometer.GetElapsed();
+
+  chronometer.Restart();
+  mirror.Commit();
+  const double commit = chronometer.GetElapsed();
+
+  const uint64_t memory = mirror.GetMemoryUsage();
+
+  printf("Mirror: %u studies, %u instances\n", static_cast<unsigned int>(mirror.GetStudiesCount()),
+         static_cast<unsigned int>(mirror.GetInstancesCount()));
+  printf("  build: %.1f s (%.0f instances/s), commit: %.1f ms\n", build / 1000000.0,
+         build > 0 ? static_cast<double>(instancesCount) / build * 1000000.0 : 0.0, commit / 1000.0);
+  printf("  memory: %.1f MB (%.1f bytes per instance)\n", static_cast<double>(memory) / (1024.0 * 1024.0),
+         instancesCount == 0 ? 0.0 : static_cast<double>(memory) / static_cast<double>(instancesCount));
+
+  const boost::filesystem::path snapshot =
+    boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("gcp-mirror-%%%%-%%%%.bin");
+
+  try
+  {
+    chronometer.Restart();
+    mirror.SaveSnapshot(snapshot.string());
+    const double save = chronometer.GetElapsed();
+
+    StoreMirror reloaded;
+    chronometer.Restart();
+    if (!reloaded.LoadSnapshot(snapshot.string()))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Cannot reload the snapshot");
+    }
+
+    const double load = chronometer.GetElapsed();
+
+    printf("  snapshot: %.1f MB, save: %.1f ms, load: %.1f ms\n",
+           static_cast<double>(boost::filesystem::file_size(snapshot)) / (1024.0 * 1024.0),
+           save / 1000.0, load / 1000.0);
+  }
+  catch (...)
+  {
+    boost::filesystem::remove(snapshot);
+    throw;
+  }
+
+  boost::filesystem::remove(snapshot);
+
+  if (layout.empty())
+  {
+    return;
+  }
+
+  const uint32_t studiesCount = static_cast<uint32_t>(layout.size());
+
+  BenchmarkQueries(mirror, "studies?PatientID", iterations, [&] (StoreMirror::Query& query) {
+      query.filters_["PatientID"] = GetPatientId(random.Next(studiesCount));
+    });
+
+  BenchmarkQueries(mirror, "studies?AccessionNumber", iterations, [&] (StoreMirror::Query& query) {
+      query.filters_["AccessionNumber"] = "A" + boost::lexical_cast<std::string>(random.Next(studiesCount));
+    });
+
+  BenchmarkQueries(mirror, "studies?StudyDate=(1 week)&limit=100", iterations, [&] (StoreMirror::Query& query) {
+      const uint32_t day = random.Next(336 * 10 - 7);
+      query.filters_["StudyDate"] = GetDate(day) + "-" + GetDate(day + 6);
+      query.limit_ = 100;
+    });
+
+  BenchmarkQueries(mirror, "studies?PatientName=(wildcard)&limit=25", iterations, [&] (StoreMirror::Query& query) {
+      query.filters_["PatientName"] = std::string(NAMES[random.Next(sizeof(NAMES) / sizeof(NAMES[0]))]) + "^PATIENT1*";
+      query.limit_ = 25;
+    });
+
+  BenchmarkQueries(mirror, "studies?ModalitiesInStudy&limit=25", iterations, [&] (StoreMirror::Query& query) {
+      query.filters_["ModalitiesInStudy"] = MODALITIES[random.Next(sizeof(MODALITIES) / sizeof(MODALITIES[0]))];
+      query.limit_ = 25;
+    });
+
+  BenchmarkQueries(mirror, "studies/{study}/series", iterations, [&] (StoreMirror::Query& query) {
+      query.level_ = StoreMirror::Level_Series;
+      query.study_ = GetStudyUid(random.Next(studiesCount));
+    });
+
+  BenchmarkQueries(mirror, "studies/{study}/series/{series}/instances", iterations, [&] (StoreMirror::Query& query) {
+      const size_t study = random.Next(studiesCount);
+      query.level_ = StoreMirror::Level_Instance;
+      query.study_ = GetStudyUid(study);
+      query.series_ = GetSeriesUid(study, random.Next(static_cast<uint32_t>(layout[study].size())));
+    });
+
+  BenchmarkQueries(mirror, "instances?SOPInstanceUID", iterations, [&] (StoreMirror::Query& query) {
+      const size_t study = random.Next(studiesCount);
+      const size_t series = random.Next(static_cast<uint32_t>(layout[study].size()));
+      query.level_ = StoreMirror::Level_Instance;
+      query.filters_["SOPInstanceUID"] = GetSopUid(study, series, random.Next(static_cast<uint32_t>(layout[study][series])));
+    });
+}
@@ -0,0 +1,1645 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "MockGoogleServer.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <json/reader.h>
+#include <json/value.h>
+#include <json/writer.h>
+
+#include <algorithm>
+#include <set>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#if !defined(MSG_NOSIGNAL)
+#  define MSG_NOSIGNAL 0
+#endif
+
+
+static const char* const DICOMWEB_PREFIX = "/v1/projects/";
+static const char* const STORAGE_JSON_PREFIX = "/storage/v1/b/";
+static const char* const STORAGE_UPLOAD_PREFIX = "/upload/storage/v1/b/";
+static const char* const STORAGE_XML_PREFIX = "/xmlapi/";
+static const char* const PUBSUB_PREFIX = "/pubsub/v1/projects/";
+
+static const unsigned int ACK_DEADLINE_SECONDS = 10;
+
+
+static const char* GetStatusText(uint16_t status)
+{
+  switch (status)
+  {
+    case 200:  return "OK";
+    case 204:  return "No Content";
+    case 304:  return "Not Modified";
+    case 400:  return "Bad Request";
+    case 401:  return "Unauthorized";
+    case 404:  return "Not Found";
+    case 405:  return "Method Not Allowed";
+    case 409:  return "Conflict";
+    case 429:  return "Too Many Requests";
+    case 500:  return "Internal Server Error";
+    case 503:  return "Service Unavailable";
+    default:   return "Unknown";
+  }
+}
+
+
+static void SendAll(int connection,
+                    const std::string& data)
+{
+  size_t pos = 0;
+  while (pos < data.size())
+  {
+    ssize_t sent = send(connection, data.c_str() + pos, data.size() - pos, MSG_NOSIGNAL);
+    if (sent <= 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+    }
+
+    pos += static_cast<size_t>(sent);
+  }
+}
+
+
+static void ParseArguments(std::map<std::string, std::string>& target,
+                           const std::string& query)
+{
+  std::vector<std::string> tokens;
+  Orthanc::Toolbox::TokenizeString(tokens, query, '&');
+
+  for (size_t i = 0; i < tokens.size(); i++)
+  {
+    size_t equal = tokens[i].find('=');
+    if (equal == std::string::npos)
+    {
+      target[tokens[i]] = "";
+    }
+    else
+    {
+      target[tokens[i].substr(0, equal)] = tokens[i].substr(equal + 1);
+    }
+  }
+}
+
+
+static void AddDicomJsonString(Json::Value& target,
+                               const std::string& tag,
+                               const std::string& vr,
+                               const std::string& value)
+{
+  Json::Value item = Json::objectValue;
+  item["vr"] = vr;
+  item["Value"] = Json::arrayValue;
+  item["Value"].append(value);
+  target[tag] = item;
+}
+
+
+static std::string GetBoundary(const std::string& contentType)
+{
+  size_t pos = contentType.find("boundary=");
+  if (pos == std::string::npos)
+  {
+    return "";
+  }
+
+  std::string boundary = contentType.substr(pos + 9);
+
+  size_t semicolon = boundary.find(';');
+  if (semicolon != std::string::npos)
+  {
+    boundary = boundary.substr(0, semicolon);
+  }
+
+  boundary = Orthanc::Toolbox::StripSpaces(boundary);
+  if (boundary.size() >= 2 &&
+      boundary[0] == '"' &&
+      boundary[boundary.size() - 1] == '"')
+  {
+    boundary = boundary.substr(1, boundary.size() - 2);
+  }
+
+  return boundary;
+}
+
+
+static void SplitMultipart(std::vector<std::string>& parts,
+                           const std::string& body,
+                           const std::string& boundary)
+{
+  const std::string delimiter = "--" + boundary;
+
+  size_t pos = body.find(delimiter);
+  while (pos != std::string::npos)
+  {
+    pos += delimiter.size();
+    if (body.compare(pos, 2, "--") == 0)
+    {
+      break;  // Closing delimiter
+    }
+
+    size_t headersEnd = body.find("\r\n\r\n", pos);
+    if (headersEnd == std::string::npos)
+    {
+      break;
+    }
+
+    size_t next = body.find("\r\n" + delimiter, headersEnd + 4);
+    if (next == std::string::npos)
+    {
+      break;
+    }
+
+    parts.push_back(body.substr(headersEnd + 4, next - headersEnd - 4));
+    pos = next + 2;
+  }
+}
+
+
+static void FormatMultipart(MockGoogleServer::Answer& answer,
+                            const std::vector<const std::string*>& parts,
+                            const std::string& contentType)
+{
+  const std::string boundary = "mock-google-server-boundary";
+
+  answer.body_.clear();
+  for (size_t i = 0; i < parts.size(); i++)
+  {
+    answer.body_ += ("--" + boundary + "\r\nContent-Type: " + contentType + "\r\n" +
+                     "Content-Length: " + boost::lexical_cast<std::string>(parts[i]->size()) +
+                     "\r\n\r\n");
+    answer.body_ += *parts[i];
+    answer.body_ += "\r\n";
+  }
+
+  answer.body_ += "--" + boundary + "--\r\n";
+  answer.headers_["Content-Type"] = ("multipart/related; type=\"" + contentType +
+                                     "\"; boundary=" + boundary);
+}
+
+
+MockGoogleServer::MockGoogleServer() :
+  socket_(-1),
+  port_(0),
+  running_(false),
+  latencyMs_(0),
+  errorRate_(0),
+  errorStatus_(503),
+  retryAfterSeconds_(0),
+  randomState_(42),
+  tokenRequestsCount_(0),
+  dicomWebRequestsCount_(0),
+  uidCounter_(0),
+  stowDelayMs_(0),
+  importRate_(1000),
+  framesPerInstance_(16),
+  storageRequestsCount_(0),
+  importedInstancesCount_(0),
+  notificationsCounter_(0),
+  pullsCount_(0),
+  ackRequestsCount_(0)
+{
+}
+
+
+MockGoogleServer::~MockGoogleServer()
+{
+  Stop();
+}
+
+
+void MockGoogleServer::Start(uint16_t port)
+{
+  if (running_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  socket_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (socket_ < 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Cannot create a socket");
+  }
+
+  int reuse = 1;
+  setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+
+  socklen_t length = sizeof(address);
+  if (bind(socket_, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 ||
+      listen(socket_, 128) != 0 ||
+      getsockname(socket_, reinterpret_cast<struct sockaddr*>(&address), &length) != 0)
+  {
+    close(socket_);
+    socket_ = -1;
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_HttpPortInUse);
+  }
+
+  port_ = ntohs(address.sin_port);
+  running_ = true;
+  acceptThread_ = boost::thread(&MockGoogleServer::AcceptLoop, this);
+
+  LOG(WARNING) << "Mock Google server listening on: " << GetBaseUrl();
+}
+
+
+void MockGoogleServer::Stop()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!running_)
+    {
+      return;
+    }
+
+    running_ = false;
+  }
+
+  shutdown(socket_, SHUT_RDWR);
+  close(socket_);
+  socket_ = -1;
+
+  if (acceptThread_.joinable())
+  {
+    acceptThread_.join();
+  }
+
+  std::vector<boost::thread*> connections;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    connections.swap(connections_);
+  }
+
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    if (connections[i]->joinable())
+    {
+      connections[i]->join();
+    }
+
+    delete connections[i];
+  }
+}
+
+
+void MockGoogleServer::AcceptLoop()
+{
+  for (;;)
+  {
+    int connection = accept(socket_, NULL, NULL);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!running_)
+    {
+      if (connection >= 0)
+      {
+        close(connection);
+      }
+
+      return;
+    }
+    else if (connection >= 0)
+    {
+      // Wake up regularly to check whether the server is stopping
+      struct timeval timeout;
+      timeout.tv_sec = 1;
+      timeout.tv_usec = 0;
+      setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+      int noDelay = 1;
+      setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+      connections_.push_back(new boost::thread(&MockGoogleServer::ConnectionLoop, this, connection));
+    }
+  }
+}
+
+
+void MockGoogleServer::ConnectionLoop(int connection)
+{
+  std::string buffer;
+  std::vector<char> chunk(65536);
+
+  try
+  {
+    for (;;)
+    {
+      size_t headersEnd = buffer.find("\r\n\r\n");
+
+      if (headersEnd == std::string::npos)
+      {
+        ssize_t received = recv(connection, &chunk[0], chunk.size(), 0);
+
+        if (received > 0)
+        {
+          buffer.append(&chunk[0], static_cast<size_t>(received));
+          continue;
+        }
+        else if (received < 0 &&
+                 (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          if (running_)
+          {
+            continue;
+          }
+        }
+
+        break;  // Connection closed by the client, or server stopping
+      }
+
+      Request request;
+      bool keepAlive = true;
+
+      {
+        std::vector<std::string> lines;
+        Orthanc::Toolbox::TokenizeString(lines, buffer.substr(0, headersEnd), '\n');
+
+        std::vector<std::string> requestLine;
+        Orthanc::Toolbox::TokenizeString(requestLine, Orthanc::Toolbox::StripSpaces(lines[0]), ' ');
+        if (requestLine.size() != 3)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+        }
+
+        request.method_ = requestLine[0];
+
+        size_t question = requestLine[1].find('?');
+        if (question == std::string::npos)
+        {
+          request.path_ = requestLine[1];
+        }
+        else
+        {
+          request.path_ = requestLine[1].substr(0, question);
+          ParseArguments(request.arguments_, requestLine[1].substr(question + 1));
+        }
+
+        for (size_t i = 1; i < lines.size(); i++)
+        {
+          size_t colon = lines[i].find(':');
+          if (colon != std::string::npos)
+          {
+            std::string key = Orthanc::Toolbox::StripSpaces(lines[i].substr(0, colon));
+            Orthanc::Toolbox::ToLowerCase(key);
+            request.headers_[key] = Orthanc::Toolbox::StripSpaces(lines[i].substr(colon + 1));
+          }
+        }
+
+        HttpHeaders::const_iterator found = request.headers_.find("connection");
+        if (found != request.headers_.end() &&
+            found->second == "close")
+        {
+          keepAlive = false;
+        }
+      }
+
+      buffer.erase(0, headersEnd + 4);
+
+      HttpHeaders::const_iterator contentLength = request.headers_.find("content-length");
+      HttpHeaders::const_iterator transferEncoding = request.headers_.find("transfer-encoding");
+
+      if (transferEncoding != request.headers_.end() &&
+          transferEncoding->second == "chunked")
+      {
+        for (;;)
+        {
+          size_t eol;
+          while ((eol = buffer.find("\r\n")) == std::string::npos)
+          {
+            ssize_t received = recv(connection, &chunk[0], chunk.size(), 0);
+            if (received <= 0)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+            }
+            buffer.append(&chunk[0], static_cast<size_t>(received));
+          }
+
+          size_t size = strtoul(buffer.substr(0, eol).c_str(), NULL, 16);
+          while (buffer.size() < eol + 2 + size + 2)
+          {
+            ssize_t received = recv(connection, &chunk[0], chunk.size(), 0);
+            if (received <= 0)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+            }
+            buffer.append(&chunk[0], static_cast<size_t>(received));
+          }
+
+          request.body_.append(buffer, eol + 2, size);
+          buffer.erase(0, eol + 2 + size + 2);
+
+          if (size == 0)
+          {
+            break;
+          }
+        }
+      }
+      else if (contentLength != request.headers_.end())
+      {
+        size_t size = boost::lexical_cast<size_t>(contentLength->second);
+
+        while (buffer.size() < size)
+        {
+          ssize_t received = recv(connection, &chunk[0], chunk.size(), 0);
+          if (received <= 0)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol);
+          }
+          buffer.append(&chunk[0], static_cast<size_t>(received));
+        }
+
+        request.body_ = buffer.substr(0, size);
+        buffer.erase(0, size);
+      }
+
+      Answer answer;
+      Handle(answer, request);
+
+      std::string header = ("HTTP/1.1 " + boost::lexical_cast<std::string>(answer.status_) + " " +
+                            GetStatusText(answer.status_) + "\r\n");
+
+      for (HttpHeaders::const_iterator it = answer.headers_.begin(); it != answer.headers_.end(); ++it)
+      {
+        header += it->first + ": " + it->second + "\r\n";
+      }
+
+      header += ("Content-Length: " + boost::lexical_cast<std::string>(answer.body_.size()) + "\r\n" +
+                 "Connection: " + (keepAlive ? "keep-alive" : "close") + "\r\n\r\n");
+
+      SendAll(connection, header);
+      SendAll(connection, answer.body_);
+
+      if (!keepAlive)
+      {
+        break;
+      }
+    }
+  }
+  catch (Orthanc::OrthancException&)
+  {
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+  }
+
+  close(connection);
+}
+
+
+bool MockGoogleServer::InjectFault(Answer& answer)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (errorRate_ <= 0)
+  {
+    return false;
+  }
+
+  // Linear congruential generator, to get reproducible benchmarks
+  randomState_ = randomState_ * 1103515245u + 12345u;
+  float r = static_cast<float>((randomState_ >> 8) & 0xffffu) / 65536.0f;
+
+  if (r < errorRate_)
+  {
+    answer.status_ = errorStatus_;
+    answer.headers_["Content-Type"] = "application/json";
+    answer.body_ = "{\"error\":{\"code\":" + boost::lexical_cast<std::string>(errorStatus_) +
+      ",\"message\":\"Error injected by the mock server\"}}";
+
+    if (retryAfterSeconds_ != 0)
+    {
+      answer.headers_["Retry-After"] = boost::lexical_cast<std::string>(retryAfterSeconds_);
+    }
+
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+void MockGoogleServer::Handle(Answer& answer,
+                              const Request& request)
+{
+  unsigned int latency;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    latency = latencyMs_;
+
+    if (request.path_ == "/token")
+    {
+      tokenArrivals_.push_back(boost::posix_time::microsec_clock::universal_time());
+    }
+  }
+
+  if (latency != 0)
+  {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(latency));
+  }
+
+  if (InjectFault(answer))
+  {
+    return;
+  }
+
+  if (request.path_ == "/token")
+  {
+    if (request.method_ == "POST")
+    {
+      HandleToken(answer);
+    }
+    else
+    {
+      answer.status_ = 405;
+    }
+  }
+  else if (boost::starts_with(request.path_, STORAGE_JSON_PREFIX) ||
+           boost::starts_with(request.path_, STORAGE_UPLOAD_PREFIX) ||
+           boost::starts_with(request.path_, STORAGE_XML_PREFIX))
+  {
+    HandleStorage(answer, request);
+  }
+  else if (boost::starts_with(request.path_, PUBSUB_PREFIX))
+  {
+    HandlePubSub(answer, request);
+  }
+  else if (boost::starts_with(request.path_, DICOMWEB_PREFIX))
+  {
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, request.path_.substr(1), '/');
+
+    // "v1/projects/{p}/locations/{l}/datasets/{d}/dicomStores/{s}/dicomWeb/..."
+    if (tokens.size() >= 10 &&
+        tokens[9] == "dicomWeb")
+    {
+      // All the DICOM stores of the mock share the same content
+      const size_t start = strlen("/v1/");
+      const std::string dicomStore = request.path_.substr(start, request.path_.find("/dicomWeb") - start);
+      HandleDicomWeb(answer, request, dicomStore, std::vector<std::string>(tokens.begin() + 10, tokens.end()));
+    }
+    else if (tokens.size() == 9 &&
+             tokens[7] == "dicomStores" &&
+             request.method_ == "POST")
+    {
+      // "v1/projects/{p}/locations/{l}/datasets/{d}/dicomStores/{s}:{method}"
+      HandleImport(answer, request, tokens);
+    }
+    else if (tokens.size() == 9 &&
+             tokens[7] == "operations" &&
+             request.method_ == "GET")
+    {
+      HandleOperation(answer, request.path_.substr(strlen("/v1/")));
+    }
+    else
+    {
+      answer.status_ = 404;
+    }
+  }
+  else if ((request.method_ == "PUT" || request.method_ == "GET") &&
+           request.path_.find('/', 1) != std::string::npos)
+  {
+    // Objects accessed through the XML API of Cloud Storage, without prefix
+    HandleStorage(answer, request);
+  }
+  else
+  {
+    answer.status_ = 404;
+  }
+}
+
+
+void MockGoogleServer::HandleToken(Answer& answer)
+{
+  unsigned int count;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    count = ++tokenRequestsCount_;
+  }
+
+  Json::Value token = Json::objectValue;
+  token["access_token"] = "mock-token-" + boost::lexical_cast<std::string>(count);
+  token["expires_in"] = 3600;
+  token["token_type"] = "Bearer";
+
+  Json::FastWriter writer;
+  answer.body_ = writer.write(token);
+  answer.headers_["Content-Type"] = "application/json";
+}
+
+
+void MockGoogleServer::HandleDicomWeb(Answer& answer,
+                                      const Request& request,
+                                      const std::string& dicomStore,
+                                      const std::vector<std::string>& uri)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    dicomWebRequestsCount_++;
+  }
+
+  if (request.method_ == "POST")
+  {
+    if (uri.size() == 1 &&
+        uri[0] == "studies")
+    {
+      HandleStow(answer, request, dicomStore);
+    }
+    else
+    {
+      answer.status_ = 405;
+    }
+  }
+  else if (request.method_ != "GET")
+  {
+    answer.status_ = 405;
+  }
+  else if (uri.size() == 1 &&
+           (uri[0] == "studies" || uri[0] == "instances"))
+  {
+    HandleQido(answer, request, "", "", uri[0]);
+  }
+  else if (uri.size() == 3 &&
+           uri[0] == "studies" &&
+           uri[2] == "series")
+  {
+    HandleQido(answer, request, uri[1], "", "series");
+  }
+  else if (uri.size() == 5 &&
+           uri[0] == "studies" &&
+           uri[2] == "series" &&
+           uri[4] == "instances")
+  {
+    HandleQido(answer, request, uri[1], uri[3], "instances");
+  }
+  else if (uri.size() >= 6 &&
+           uri[0] == "studies" &&
+           uri[2] == "series" &&
+           uri[4] == "instances")
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::map<std::string, size_t>::const_iterator found = instancesIndex_.find(uri[5]);
+    if (found == instancesIndex_.end())
+    {
+      answer.status_ = 404;
+      return;
+    }
+
+    const Instance& instance = instances_[found->second];
+
+    if (uri.size() == 6)
+    {
+      // WADO-RS retrieve instance
+      HttpHeaders::const_iterator accept = request.headers_.find("accept");
+      if (accept != request.headers_.end() &&
+          accept->second.find("multipart/related") != std::string::npos)
+      {
+        std::vector<const std::string*> parts;
+        parts.push_back(&instance.content_);
+        FormatMultipart(answer, parts, "application/dicom");
+      }
+      else
+      {
+        answer.body_ = instance.content_;
+        answer.headers_["Content-Type"] = "application/dicom";
+      }
+    }
+    else if (uri.size() == 7 &&
+             uri[6] == "metadata")
+    {
+      Json::Value item = Json::objectValue;
+      AddDicomJsonString(item, "0020000D", "UI", instance.study_);
+      AddDicomJsonString(item, "0020000E", "UI", instance.series_);
+      AddDicomJsonString(item, "00080018", "UI", instance.sop_);
+
+      Json::Value metadata = Json::arrayValue;
+      metadata.append(item);
+
+      Json::FastWriter writer;
+      answer.body_ = writer.write(metadata);
+      answer.headers_["Content-Type"] = "application/dicom+json";
+    }
+    else if (uri.size() == 8 &&
+             uri[6] == "frames")
+    {
+      // Synthetic frames: Slices of the instance
+      size_t frame = boost::lexical_cast<size_t>(uri[7]);
+      size_t frameSize = std::max(static_cast<size_t>(1), instance.content_.size() / framesPerInstance_);
+      if (frame == 0 ||
+          (frame - 1) * frameSize >= instance.content_.size())
+      {
+        answer.status_ = 404;
+      }
+      else
+      {
+        std::string content = instance.content_.substr((frame - 1) * frameSize, frameSize);
+        std::vector<const std::string*> parts;
+        parts.push_back(&content);
+        FormatMultipart(answer, parts, "application/octet-stream");
+      }
+    }
+    else
+    {
+      answer.status_ = 404;
+    }
+  }
+  else
+  {
+    answer.status_ = 404;
+  }
+}
+
+
+void MockGoogleServer::HandleQido(Answer& answer,
+                                  const Request& request,
+                                  const std::string& study,
+                                  const std::string& series,
+                                  const std::string& level)
+{
+  size_t limit = 0, offset = 0;
+
+  std::map<std::string, std::string>::const_iterator found = request.arguments_.find("limit");
+  if (found != request.arguments_.end())
+  {
+    limit = boost::lexical_cast<size_t>(found->second);
+  }
+
+  found = request.arguments_.find("offset");
+  if (found != request.arguments_.end())
+  {
+    offset = boost::lexical_cast<size_t>(found->second);
+  }
+
+  std::string filterStudy = study;
+  found = request.arguments_.find("StudyInstanceUID");
+  if (found != request.arguments_.end())
+  {
+    filterStudy = found->second;
+  }
+
+  std::string filterSop;
+  found = request.arguments_.find("SOPInstanceUID");
+  if (found != request.arguments_.end())
+  {
+    filterSop = found->second;
+  }
+
+  Json::Value result = Json::arrayValue;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // The pages of an unfiltered search of instances start directly
+    // at the offset, which keeps the listing of large stores linear
+    const bool unfiltered = (level == "instances" && filterStudy.empty() &&
+                             series.empty() && filterSop.empty());
+
+    std::set<std::string> seen;
+    size_t skipped = (unfiltered ? offset : 0);
+
+    for (size_t i = (unfiltered ? offset : 0); i < instances_.size(); i++)
+    {
+      const Instance& instance = instances_[i];
+
+      if ((!filterStudy.empty() && instance.study_ != filterStudy) ||
+          (!series.empty() && instance.series_ != series) ||
+          (!filterSop.empty() && instance.sop_ != filterSop))
+      {
+        continue;
+      }
+
+      const std::string& key = (level == "studies" ? instance.study_ :
+                                level == "series" ? instance.series_ : instance.sop_);
+      if (!unfiltered &&
+          !seen.insert(key).second)
+      {
+        continue;
+      }
+
+      if (skipped < offset)
+      {
+        skipped++;
+        continue;
+      }
+
+      Json::Value item = Json::objectValue;
+      AddDicomJsonString(item, "0020000D", "UI", instance.study_);
+
+      if (level != "studies")
+      {
+        AddDicomJsonString(item, "0020000E", "UI", instance.series_);
+      }
+
+      if (level == "instances")
+      {
+        AddDicomJsonString(item, "00080018", "UI", instance.sop_);
+      }
+
+      result.append(item);
+
+      if (limit != 0 &&
+          result.size() >= limit)
+      {
+        break;
+      }
+    }
+  }
+
+  Json::FastWriter writer;
+  answer.body_ = writer.write(result);
+  answer.headers_["Content-Type"] = "application/dicom+json";
+}
+
+
+void MockGoogleServer::HandleStow(Answer& answer,
+                                  const Request& request,
+                                  const std::string& dicomStore)
+{
+  HttpHeaders::const_iterator contentType = request.headers_.find("content-type");
+  if (contentType == request.headers_.end())
+  {
+    answer.status_ = 400;
+    return;
+  }
+
+  std::vector<std::string> parts;
+  SplitMultipart(parts, request.body_, GetBoundary(contentType->second));
+
+  unsigned int delay;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    delay = stowDelayMs_;
+  }
+
+  if (delay != 0)
+  {
+    // Simulates the parsing and indexing of the instances by the DICOM store
+    boost::this_thread::sleep(boost::posix_time::milliseconds(delay * parts.size()));
+  }
+
+  Json::Value referenced = Json::arrayValue;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const std::string study = GenerateUid();
+    const std::string series = GenerateUid();
+
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+      Instance instance;
+      instance.study_ = study;
+      instance.series_ = series;
+      instance.sop_ = GenerateUid();
+      instance.content_.swap(parts[i]);
+
+      instancesIndex_[instance.sop_] = instances_.size();
+      instances_.push_back(instance);
+
+      PublishNotification(dicomStore + "/dicomWeb/studies/" + study + "/series/" + series +
+                          "/instances/" + instance.sop_);
+
+      Json::Value item = Json::objectValue;
+      AddDicomJsonString(item, "00081155", "UI", instance.sop_);
+      referenced.append(item);
+    }
+  }
+
+  Json::Value result = Json::objectValue;
+  result["00081199"] = Json::objectValue;
+  result["00081199"]["vr"] = "SQ";
+  result["00081199"]["Value"] = referenced;
+
+  Json::FastWriter writer;
+  answer.body_ = writer.write(result);
+  answer.headers_["Content-Type"] = "application/dicom+json";
+}
+
+
+static std::string FormatObjectMetadata(const std::string& bucket,
+                                       const std::string& name,
+                                       size_t size)
+{
+  Json::Value metadata = Json::objectValue;
+  metadata["kind"] = "storage#object";
+  metadata["id"] = bucket + "/" + name + "/1";
+  metadata["bucket"] = bucket;
+  metadata["name"] = name;
+  metadata["size"] = boost::lexical_cast<std::string>(size);
+  metadata["generation"] = "1";
+  metadata["metageneration"] = "1";
+  metadata["contentType"] = "application/dicom";
+  return metadata.toStyledString();
+}
+
+
+static std::string DecodeObjectName(const std::string& source)
+{
+  std::string s = source;
+  Orthanc::Toolbox::UrlDecode(s);
+  return s;
+}
+
+
+void MockGoogleServer::HandleStorage(Answer& answer,
+                                     const Request& request)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    storageRequestsCount_++;
+  }
+
+  std::string bucket, object, content;
+  bool upload = false;
+
+  if (boost::starts_with(request.path_, STORAGE_UPLOAD_PREFIX))
+  {
+    // JSON API upload: "/upload/storage/v1/b/{bucket}/o?uploadType=media|multipart"
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, request.path_.substr(strlen(STORAGE_UPLOAD_PREFIX)), '/');
+
+    if (tokens.size() != 2 ||
+        tokens[1] != "o" ||
+        request.method_ != "POST")
+    {
+      answer.status_ = 400;
+      return;
+    }
+
+    bucket = tokens[0];
+    upload = true;
+
+    std::map<std::string, std::string>::const_iterator type = request.arguments_.find("uploadType");
+    std::map<std::string, std::string>::const_iterator name = request.arguments_.find("name");
+
+    if (type != request.arguments_.end() &&
+        type->second == "multipart")
+    {
+      // First part: JSON metadata, second part: content of the object
+      HttpHeaders::const_iterator contentType = request.headers_.find("content-type");
+
+      std::vector<std::string> parts;
+      if (contentType != request.headers_.end())
+      {
+        SplitMultipart(parts, request.body_, GetBoundary(contentType->second));
+      }
+
+      Json::Value metadata;
+      Json::Reader reader;
+      if (parts.size() != 2 ||
+          !reader.parse(parts[0], metadata) ||
+          !metadata.isMember("name"))
+      {
+        answer.status_ = 400;
+        return;
+      }
+
+      object = metadata["name"].asString();
+      content.swap(parts[1]);
+    }
+    else if (name != request.arguments_.end())
+    {
+      object = DecodeObjectName(name->second);
+      content = request.body_;
+    }
+    else
+    {
+      answer.status_ = 400;
+      return;
+    }
+  }
+  else
+  {
+    // JSON API: "/storage/v1/b/{bucket}/o[/{object}]"
+    // XML API: "[/xmlapi]/{bucket}/{object}", depending on the version of google-cloud-cpp
+    const bool xml = !boost::starts_with(request.path_, STORAGE_JSON_PREFIX);
+    const std::string path = request.path_.substr(
+      !xml ? strlen(STORAGE_JSON_PREFIX) :
+      boost::starts_with(request.path_, STORAGE_XML_PREFIX) ? strlen(STORAGE_XML_PREFIX) : 1);
+
+    const size_t slash = path.find('/');
+    bucket = path.substr(0, slash);
+
+    if (xml)
+    {
+      if (slash == std::string::npos)
+      {
+        answer.status_ = 400;
+        return;
+      }
+
+      object = DecodeObjectName(path.substr(slash + 1));
+    }
+    else if (slash == std::string::npos ||
+             path.compare(slash, 2, "/o") != 0)
+    {
+      answer.status_ = 404;
+      return;
+    }
+    else if (path.size() > slash + 3)
+    {
+      object = DecodeObjectName(path.substr(slash + 3));
+    }
+
+    if (request.method_ == "PUT" &&
+        xml)
+    {
+      upload = true;
+      content = request.body_;
+    }
+    else if (request.method_ != "GET")
+    {
+      answer.status_ = 405;
+      return;
+    }
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (upload)
+  {
+    const size_t size = content.size();
+    objects_[bucket + "/" + object].swap(content);
+
+    answer.body_ = FormatObjectMetadata(bucket, object, size);
+    answer.headers_["Content-Type"] = "application/json";
+    answer.headers_["ETag"] = "\"1\"";
+    answer.headers_["x-goog-generation"] = "1";
+    answer.headers_["x-goog-metageneration"] = "1";
+  }
+  else if (object.empty())
+  {
+    // Listing of the objects, sorted by name
+    std::string prefix;
+    size_t maxResults = 1000;
+
+    std::map<std::string, std::string>::const_iterator found = request.arguments_.find("prefix");
+    if (found != request.arguments_.end())
+    {
+      prefix = DecodeObjectName(found->second);
+    }
+
+    found = request.arguments_.find("maxResults");
+    if (found != request.arguments_.end())
+    {
+      maxResults = std::max(static_cast<size_t>(1), boost::lexical_cast<size_t>(found->second));
+    }
+
+    std::string start = bucket + "/" + prefix;
+
+    found = request.arguments_.find("pageToken");
+    if (found != request.arguments_.end())
+    {
+      start = bucket + "/" + DecodeObjectName(found->second);
+    }
+
+    Json::Value items = Json::arrayValue;
+    std::string nextPageToken;
+
+    for (std::map<std::string, std::string>::const_iterator it = objects_.lower_bound(start);
+         it != objects_.end() && boost::starts_with(it->first, bucket + "/" + prefix); ++it)
+    {
+      const std::string name = it->first.substr(bucket.size() + 1);
+
+      if (items.size() == maxResults)
+      {
+        nextPageToken = name;
+        break;
+      }
+
+      Json::Value item;
+      Json::Reader reader;
+      reader.parse(FormatObjectMetadata(bucket, name, it->second.size()), item);
+      items.append(item);
+    }
+
+    Json::Value result = Json::objectValue;
+    result["kind"] = "storage#objects";
+    result["items"] = items;
+
+    if (!nextPageToken.empty())
+    {
+      result["nextPageToken"] = nextPageToken;
+    }
+
+    Json::FastWriter writer;
+    answer.body_ = writer.write(result);
+    answer.headers_["Content-Type"] = "application/json";
+  }
+  else
+  {
+    std::map<std::string, std::string>::const_iterator found = objects_.find(bucket + "/" + object);
+    if (found == objects_.end())
+    {
+      answer.status_ = 404;
+      return;
+    }
+
+    std::map<std::string, std::string>::const_iterator alt = request.arguments_.find("alt");
+
+    if (!boost::starts_with(request.path_, STORAGE_JSON_PREFIX) ||
+        (alt != request.arguments_.end() && alt->second == "media"))
+    {
+      answer.body_ = found->second;
+      answer.headers_["Content-Type"] = "application/dicom";
+      answer.headers_["x-goog-generation"] = "1";
+    }
+    else
+    {
+      answer.body_ = FormatObjectMetadata(bucket, object, found->second.size());
+      answer.headers_["Content-Type"] = "application/json";
+    }
+  }
+}
+
+
+void MockGoogleServer::HandleImport(Answer& answer,
+                                    const Request& request,
+                                    const std::vector<std::string>& uri)
+{
+  const size_t colon = uri[8].find(':');
+  if (colon == std::string::npos ||
+      uri[8].substr(colon + 1) != "import")
+  {
+    answer.status_ = 404;
+    return;
+  }
+
+  // "gs://{bucket}/{prefix}**.dcm"
+  Json::Value body;
+  Json::Reader reader;
+  if (!reader.parse(request.body_, body) ||
+      !body.isMember("gcsSource") ||
+      !body["gcsSource"].isMember("uri"))
+  {
+    answer.status_ = 400;
+    return;
+  }
+
+  std::string source = body["gcsSource"]["uri"].asString();
+  if (!boost::starts_with(source, "gs://"))
+  {
+    answer.status_ = 400;
+    return;
+  }
+
+  source = source.substr(5);
+
+  const size_t wildcard = source.find('*');
+  const std::string prefix = (wildcard == std::string::npos ? source : source.substr(0, wildcard));
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  size_t count = 0;
+  for (std::map<std::string, std::string>::const_iterator it = objects_.lower_bound(prefix);
+       it != objects_.end() && boost::starts_with(it->first, prefix); ++it)
+  {
+    if (boost::ends_with(it->first, ".dcm"))
+    {
+      count++;
+    }
+  }
+
+  const std::string name = ("projects/" + uri[2] + "/locations/" + uri[4] + "/datasets/" + uri[6] +
+                            "/operations/" + boost::lexical_cast<std::string>(operations_.size() + 1));
+
+  Operation& operation = operations_[name];
+  operation.total_ = count;
+  operation.start_ = boost::posix_time::microsec_clock::universal_time();
+  operation.end_ = operation.start_ + boost::posix_time::milliseconds(
+    static_cast<int64_t>(count) * 1000 / std::max(1u, importRate_));
+
+  Json::Value result = Json::objectValue;
+  result["name"] = name;
+
+  Json::FastWriter writer;
+  answer.body_ = writer.write(result);
+  answer.headers_["Content-Type"] = "application/json";
+}
+
+
+void MockGoogleServer::HandleOperation(Answer& answer,
+                                       const std::string& name)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::map<std::string, Operation>::iterator found = operations_.find(name);
+  if (found == operations_.end())
+  {
+    answer.status_ = 404;
+    return;
+  }
+
+  const Operation& operation = found->second;
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  size_t success = operation.total_;
+  const bool done = (now >= operation.end_);
+
+  if (!done)
+  {
+    success = static_cast<size_t>(static_cast<double>(operation.total_) *
+                                  static_cast<double>((now - operation.start_).total_milliseconds()) /
+                                  static_cast<double>(std::max(static_cast<int64_t>(1), (operation.end_ - operation.start_).total_milliseconds())));
+  }
+
+  Json::Value result = Json::objectValue;
+  result["name"] = name;
+  result["metadata"] = Json::objectValue;
+  result["metadata"]["counter"] = Json::objectValue;
+  result["metadata"]["counter"]["success"] = boost::lexical_cast<std::string>(success);
+  result["metadata"]["counter"]["pending"] = boost::lexical_cast<std::string>(operation.total_ - success);
+  result["done"] = done;
+
+  if (done)
+  {
+    result["response"] = Json::objectValue;
+
+    // Each operation is only counted once, when its completion is first observed
+    if (operation.total_ != 0)
+    {
+      importedInstancesCount_ += operation.total_;
+      found->second.total_ = 0;
+    }
+  }
+
+  Json::FastWriter writer;
+  answer.body_ = writer.write(result);
+  answer.headers_["Content-Type"] = "application/json";
+}
+
+
+void MockGoogleServer::HandlePubSub(Answer& answer,
+                                    const Request& request)
+{
+  // "pubsub/v1/projects/{p}/subscriptions/{s}:{method}"
+  std::vector<std::string> tokens;
+  Orthanc::Toolbox::TokenizeString(tokens, request.path_.substr(1), '/');
+
+  if (request.method_ != "POST")
+  {
+    answer.status_ = 405;
+    return;
+  }
+
+  if (tokens.size() != 6 ||
+      tokens[4] != "subscriptions")
+  {
+    answer.status_ = 404;
+    return;
+  }
+
+  Json::Value body;
+  Json::Reader reader;
+  if (!reader.parse(request.body_, body) ||
+      body.type() != Json::objectValue)
+  {
+    answer.status_ = 400;
+    return;
+  }
+
+  Json::Value result = Json::objectValue;
+
+  if (boost::ends_with(tokens[5], ":pull"))
+  {
+    const unsigned int maxMessages = (body.isMember("maxMessages") ? body["maxMessages"].asUInt() : 1000);
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    boost::mutex::scoped_lock lock(mutex_);
+    pullsCount_++;
+
+    // The notifications whose deadline has expired are delivered again
+    Json::Value messages = Json::arrayValue;
+
+    for (std::map<uint64_t, Notification>::iterator it = notifications_.begin();
+         it != notifications_.end() && messages.size() < maxMessages; ++it)
+    {
+      if (it->second.deadline_.is_not_a_date_time() ||
+          it->second.deadline_ < now)
+      {
+        it->second.deadline_ = now + boost::posix_time::seconds(ACK_DEADLINE_SECONDS);
+
+        std::string data;
+        Orthanc::Toolbox::EncodeBase64(data, it->second.data_);
+
+        Json::Value message = Json::objectValue;
+        message["ackId"] = boost::lexical_cast<std::string>(it->first);
+        message["message"]["data"] = data;
+        message["message"]["messageId"] = boost::lexical_cast<std::string>(it->first);
+        message["message"]["publishTime"] = it->second.publishTime_;
+        message["message"]["attributes"]["action"] = "StoreInstances";
+        messages.append(message);
+      }
+    }
+
+    if (messages.size() > 0)
+    {
+      result["receivedMessages"] = messages;
+    }
+  }
+  else if (boost::ends_with(tokens[5], ":acknowledge"))
+  {
+    const Json::Value& ackIds = body["ackIds"];
+    if (ackIds.type() != Json::arrayValue)
+    {
+      answer.status_ = 400;
+      return;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    ackRequestsCount_++;
+
+    for (Json::Value::ArrayIndex i = 0; i < ackIds.size(); i++)
+    {
+      try
+      {
+        notifications_.erase(boost::lexical_cast<uint64_t>(ackIds[i].asString()));
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+      }
+    }
+  }
+  else
+  {
+    answer.status_ = 404;
+    return;
+  }
+
+  Json::FastWriter writer;
+  answer.body_ = writer.write(result);
+  answer.headers_["Content-Type"] = "application/json";
+}
+
+
+void MockGoogleServer::PublishNotification(const std::string& resourceName)
+{
+  // The mutex must be locked by the caller
+  Notification notification;
+  notification.data_ = resourceName;
+  notification.publishTime_ = boost::posix_time::to_iso_extended_string(
+    boost::posix_time::microsec_clock::universal_time()) + "Z";
+
+  notifications_[++notificationsCounter_] = notification;
+}
+
+
+std::string MockGoogleServer::GenerateUid()
+{
+  // The mutex must be locked by the caller
+  uidCounter_++;
+  return "1.2.826.0.1.3680043.10.1000." + boost::lexical_cast<std::string>(uidCounter_);
+}
+
+
+std::string MockGoogleServer::GetBaseUrl() const
+{
+  return "http://127.0.0.1:" + boost::lexical_cast<std::string>(port_) + "/v1/";
+}
+
+
+std::string MockGoogleServer::GetTokenUrl() const
+{
+  return "http://127.0.0.1:" + boost::lexical_cast<std::string>(port_) + "/token";
+}
+
+
+std::string MockGoogleServer::GetStorageUrl() const
+{
+  return "http://127.0.0.1:" + boost::lexical_cast<std::string>(port_);
+}
+
+
+std::string MockGoogleServer::GetPubSubUrl() const
+{
+  return "http://127.0.0.1:" + boost::lexical_cast<std::string>(port_) + "/pubsub/v1/";
+}
+
+
+std::string MockGoogleServer::GetDicomWebUrl(const std::string& project,
+                                             const std::string& location,
+                                             const std::string& dataset,
+                                             const std::string& dicomStore) const
+{
+  return (GetBaseUrl() + "projects/" + project + "/locations/" + location +
+          "/datasets/" + dataset + "/dicomStores/" + dicomStore + "/dicomWeb/");
+}
+
+
+void MockGoogleServer::SetLatency(unsigned int milliseconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  latencyMs_ = milliseconds;
+}
+
+
+void MockGoogleServer::SetErrors(float rate,
+                                 uint16_t httpStatus,
+                                 unsigned int retryAfterSeconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  errorRate_ = rate;
+  errorStatus_ = httpStatus;
+  retryAfterSeconds_ = retryAfterSeconds;
+}
+
+
+void MockGoogleServer::SetStowDelay(unsigned int milliseconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  stowDelayMs_ = milliseconds;
+}
+
+
+void MockGoogleServer::SetImportRate(unsigned int instancesPerSecond)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  importRate_ = std::max(1u, instancesPerSecond);
+}
+
+
+void MockGoogleServer::SetFramesPerInstance(unsigned int count)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  framesPerInstance_ = std::max(1u, count);
+}
+
+
+void MockGoogleServer::AddSyntheticInstances(unsigned int countStudies,
+                                             unsigned int countSeriesPerStudy,
+                                             unsigned int countInstancesPerSeries,
+                                             size_t instanceSize)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const std::string content(instanceSize, 'x');
+
+  for (unsigned int i = 0; i < countStudies; i++)
+  {
+    const std::string study = GenerateUid();
+
+    for (unsigned int j = 0; j < countSeriesPerStudy; j++)
+    {
+      const std::string series = GenerateUid();
+
+      for (unsigned int k = 0; k < countInstancesPerSeries; k++)
+      {
+        Instance instance;
+        instance.study_ = study;
+        instance.series_ = series;
+        instance.sop_ = GenerateUid();
+        instance.content_ = content;
+
+        instancesIndex_[instance.sop_] = instances_.size();
+        instances_.push_back(instance);
+      }
+    }
+  }
+}
+
+
+void MockGoogleServer::GetInstances(std::vector<std::string>& studies,
+                                    std::vector<std::string>& series,
+                                    std::vector<std::string>& instances)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  studies.resize(instances_.size());
+  series.resize(instances_.size());
+  instances.resize(instances_.size());
+
+  for (size_t i = 0; i < instances_.size(); i++)
+  {
+    studies[i] = instances_[i].study_;
+    series[i] = instances_[i].series_;
+    instances[i] = instances_[i].sop_;
+  }
+}
+
+
+unsigned int MockGoogleServer::GetTokenRequestsCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return tokenRequestsCount_;
+}
+
+
+unsigned int MockGoogleServer::GetDicomWebRequestsCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return dicomWebRequestsCount_;
+}
+
+
+unsigned int MockGoogleServer::GetStorageRequestsCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return storageRequestsCount_;
+}
+
+
+size_t MockGoogleServer::GetObjectsCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return objects_.size();
+}
+
+
+size_t MockGoogleServer::GetImportedInstancesCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return importedInstancesCount_;
+}
+
+
+size_t MockGoogleServer::GetInstancesCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return instances_.size();
+}
+
+
+size_t MockGoogleServer::GetPendingNotificationsCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return notifications_.size();
+}
+
+
+unsigned int MockGoogleServer::GetPullsCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return pullsCount_;
+}
+
+
+unsigned int MockGoogleServer::GetAckRequestsCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return ackRequestsCount_;
+}
+
+
+void MockGoogleServer::GetTokenArrivals(std::vector<boost::posix_time::ptime>& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  target = tokenArrivals_;
+}
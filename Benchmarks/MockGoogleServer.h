@@ -0,0 +1,267 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * In-process HTTP server that mimics the Google OAuth 2.0 token
+ * endpoint, a minimal DICOMweb store of the Google Healthcare API
+ * (QIDO-RS, WADO-RS and STOW-RS), the "import" long-running
+ * operation of the DICOM stores, the subset of the JSON and XML APIs
+ * of Google Cloud Storage that is used by google-cloud-cpp to upload,
+ * list and read objects, and the "pull" and "acknowledge" methods of
+ * the Pub/Sub subscriptions receiving the notifications of the DICOM
+ * stores. It listens on the loopback
+ * interface, and can inject latency and errors in its answers. This
+ * server is only meant for benchmarking: It is not a conformant
+ * implementation of DICOMweb.
+ **/
+class MockGoogleServer : public boost::noncopyable
+{
+public:
+  typedef std::map<std::string, std::string>  HttpHeaders;
+
+  struct Request
+  {
+    std::string  method_;
+    std::string  path_;       // Without the GET arguments
+    std::map<std::string, std::string>  arguments_;
+    HttpHeaders  headers_;    // Keys are lowercase
+    std::string  body_;
+  };
+
+  struct Answer
+  {
+    uint16_t     status_;
+    HttpHeaders  headers_;
+    std::string  body_;
+
+    Answer() :
+      status_(200)
+    {
+    }
+  };
+
+private:
+  struct Instance
+  {
+    std::string  study_;
+    std::string  series_;
+    std::string  sop_;
+    std::string  content_;
+  };
+
+  // Notification of a stored instance, published to all the
+  // subscriptions of the mock (they share the same queue)
+  struct Notification
+  {
+    std::string               data_;         // Resource name of the instance
+    std::string               publishTime_;
+    boost::posix_time::ptime  deadline_;     // Acknowledgment deadline, if delivered
+  };
+
+  struct Operation
+  {
+    size_t                    total_;
+    boost::posix_time::ptime  start_;
+    boost::posix_time::ptime  end_;
+  };
+
+  boost::mutex                 mutex_;
+  int                          socket_;
+  uint16_t                     port_;
+  bool                         running_;
+  boost::thread                acceptThread_;
+  std::vector<boost::thread*>  connections_;
+
+  unsigned int                 latencyMs_;
+  float                        errorRate_;
+  uint16_t                     errorStatus_;
+  unsigned int                 retryAfterSeconds_;
+  unsigned int                 randomState_;
+
+  unsigned int                 tokenRequestsCount_;
+  std::vector<boost::posix_time::ptime>  tokenArrivals_;   // Including the failed requests
+  unsigned int                 dicomWebRequestsCount_;
+  unsigned int                 uidCounter_;
+  std::vector<Instance>        instances_;
+  std::map<std::string, size_t>  instancesIndex_;   // SOPInstanceUID => index in "instances_"
+  unsigned int                 stowDelayMs_;
+  unsigned int                 importRate_;
+  unsigned int                 framesPerInstance_;
+  unsigned int                 storageRequestsCount_;
+  size_t                       importedInstancesCount_;
+  std::map<std::string, std::string>  objects_;     // "{bucket}/{object}" => content
+  std::map<std::string, Operation>    operations_;  // Name => operation
+  uint64_t                     notificationsCounter_;
+  std::map<uint64_t, Notification>    notifications_;  // Ack ID => unacknowledged notification
+  unsigned int                 pullsCount_;
+  unsigned int                 ackRequestsCount_;
+
+  void AcceptLoop();
+
+  void ConnectionLoop(int connection);
+
+  bool InjectFault(Answer& answer);
+
+  void HandleToken(Answer& answer);
+
+  void HandleDicomWeb(Answer& answer,
+                      const Request& request,
+                      const std::string& dicomStore,
+                      const std::vector<std::string>& uri);
+
+  void HandleQido(Answer& answer,
+                  const Request& request,
+                  const std::string& study,
+                  const std::string& series,
+                  const std::string& level);
+
+  void HandleStow(Answer& answer,
+                  const Request& request,
+                  const std::string& dicomStore);
+
+  void HandleStorage(Answer& answer,
+                     const Request& request);
+
+  void HandleImport(Answer& answer,
+                    const Request& request,
+                    const std::vector<std::string>& uri);
+
+  void HandleOperation(Answer& answer,
+                       const std::string& name);
+
+  void HandlePubSub(Answer& answer,
+                    const Request& request);
+
+  void PublishNotification(const std::string& resourceName);
+
+  std::string GenerateUid();
+
+public:
+  MockGoogleServer();
+
+  ~MockGoogleServer();
+
+  // Use port 0 to select an ephemeral port
+  void Start(uint16_t port);
+
+  void Stop();
+
+  uint16_t GetPort() const
+  {
+    return port_;
+  }
+
+  // Base URL to be used as the "BaseUrl" option of the plugin
+  std::string GetBaseUrl() const;
+
+  std::string GetTokenUrl() const;
+
+  // Endpoint to be used as the "StorageUrl" option of the plugin
+  std::string GetStorageUrl() const;
+
+  // Root to be used as the "PubSubUrl" option of the plugin
+  std::string GetPubSubUrl() const;
+
+  // URL of the DICOMweb root of one DICOM store of the mock
+  std::string GetDicomWebUrl(const std::string& project,
+                             const std::string& location,
+                             const std::string& dataset,
+                             const std::string& dicomStore) const;
+
+  void SetLatency(unsigned int milliseconds);
+
+  // Fraction of the requests (between 0 and 1) that fail with the
+  // given HTTP status. A "Retry-After" header is added if
+  // "retryAfterSeconds" is not zero.
+  void SetErrors(float rate,
+                 uint16_t httpStatus,
+                 unsigned int retryAfterSeconds);
+
+  // Server-side processing time of each instance received by
+  // STOW-RS, that is not paid by the bulk imports
+  void SetStowDelay(unsigned int milliseconds);
+
+  // Number of instances loaded per second by the import operations
+  void SetImportRate(unsigned int instancesPerSecond);
+
+  // Number of synthetic frames of each instance (16 by default), as
+  // retrieved by WADO-RS: Each frame is a slice of the instance
+  void SetFramesPerInstance(unsigned int count);
+
+  // Populates the DICOM store with synthetic instances
+  void AddSyntheticInstances(unsigned int countStudies,
+                             unsigned int countSeriesPerStudy,
+                             unsigned int countInstancesPerSeries,
+                             size_t instanceSize);
+
+  void GetInstances(std::vector<std::string>& studies,
+                    std::vector<std::string>& series,
+                    std::vector<std::string>& instances);
+
+  unsigned int GetTokenRequestsCount();
+
+  // Arrival times of all the requests to the token endpoint
+  void GetTokenArrivals(std::vector<boost::posix_time::ptime>& target);
+
+  unsigned int GetDicomWebRequestsCount();
+
+  unsigned int GetStorageRequestsCount();
+
+  size_t GetObjectsCount();
+
+  // Instances loaded by the completed import operations
+  size_t GetImportedInstancesCount();
+
+  size_t GetInstancesCount();
+
+  // Notifications that are not acknowledged yet
+  size_t GetPendingNotificationsCount();
+
+  unsigned int GetPullsCount();
+
+  unsigned int GetAckRequestsCount();
+
+  void Handle(Answer& answer,
+              const Request& request);
+};
@@ -0,0 +1,348 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "RoutingBenchmark.h"
+
+#include "BenchmarkToolbox.h"
+
+#include "../Plugin/RoutingTree.h"
+
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <stdio.h>
+
+
+static const size_t INSTANCES_COUNT = 1000;
+static const size_t PIXEL_DATA_SIZE = 16384;
+static const unsigned int ACCOUNTS_COUNT = 32;
+static const unsigned int INSTITUTIONS_COUNT = 50;
+static const unsigned int VENDORS_COUNT = 10;
+static const unsigned int STATIONS_COUNT = 20;
+static const char* const MODALITIES[] = { "CT", "MR", "CR", "US", "PT", "DX", "MG", "NM" };
+static const size_t MODALITIES_COUNT = sizeof(MODALITIES) / sizeof(MODALITIES[0]);
+
+static const Orthanc::DicomTag TAG_MODALITY(0x0008, 0x0060);
+static const Orthanc::DicomTag TAG_INSTITUTION_NAME(0x0008, 0x0080);
+static const Orthanc::DicomTag TAG_STATION_NAME(0x0008, 0x1010);
+static const Orthanc::DicomTag TAG_PRIVATE_VENDOR(0x0009, 0x1010);
+
+
+namespace
+{
+  // Deterministic generator, so that the runs are comparable
+  class Random : public boost::noncopyable
+  {
+  private:
+    uint32_t  state_;
+
+  public:
+    Random() :
+      state_(2463534242u)
+    {
+    }
+
+    uint32_t Next()
+    {
+      state_ ^= state_ << 13;
+      state_ ^= state_ >> 17;
+      state_ ^= state_ << 5;
+      return state_;
+    }
+
+    uint32_t Next(uint32_t max)   // In [0, max)
+    {
+      return Next() % max;
+    }
+  };
+}
+
+
+static std::string GetInstitution(uint32_t index)
+{
+  char buffer[32];
+  sprintf(buffer, "HOSPITAL %02u", index);
+  return buffer;
+}
+
+
+static std::string GetVendor(uint32_t index)
+{
+  return "VENDOR " + boost::lexical_cast<std::string>(index);
+}
+
+
+static std::string GetStation(const char* modality,
+                              uint32_t index)
+{
+  char buffer[32];
+  sprintf(buffer, "%s-%02u-%u", modality, index, index % 3);
+  return buffer;
+}
+
+
+static void AppendUint16(std::string& target,
+                         uint16_t value)
+{
+  target.push_back(static_cast<char>(value & 0xff));
+  target.push_back(static_cast<char>(value >> 8));
+}
+
+
+static void AppendUint32(std::string& target,
+                         uint32_t value)
+{
+  AppendUint16(target, static_cast<uint16_t>(value & 0xffff));
+  AppendUint16(target, static_cast<uint16_t>(value >> 16));
+}
+
+
+// Element in the explicit VR little endian transfer syntax
+static void AppendElement(std::string& target,
+                          uint16_t group,
+                          uint16_t element,
+                          const char* vr,
+                          const std::string& value)
+{
+  std::string padded = value;
+  if (padded.size() % 2 == 1)
+  {
+    padded.push_back(std::string(vr) == "UI" ? '\0' : ' ');
+  }
+
+  AppendUint16(target, group);
+  AppendUint16(target, element);
+  target.append(vr, 2);
+
+  if (std::string(vr) == "OB" ||
+      std::string(vr) == "OW")
+  {
+    AppendUint16(target, 0);
+    AppendUint32(target, static_cast<uint32_t>(padded.size()));
+  }
+  else
+  {
+    AppendUint16(target, static_cast<uint16_t>(padded.size()));
+  }
+
+  target.append(padded);
+}
+
+
+static void GenerateInstance(std::string& dicom,
+                             Random& random,
+                             size_t index)
+{
+  const std::string sopInstanceUid = "1.2.826.0.1.3680043.10.543.9." + boost::lexical_cast<std::string>(index);
+  const char* modality = MODALITIES[random.Next(MODALITIES_COUNT)];
+
+  std::string meta;
+  AppendElement(meta, 0x0002, 0x0002, "UI", "1.2.840.10008.5.1.4.1.1.7");
+  AppendElement(meta, 0x0002, 0x0003, "UI", sopInstanceUid);
+  AppendElement(meta, 0x0002, 0x0010, "UI", "1.2.840.10008.1.2.1");
+
+  std::string groupLength;
+  AppendUint32(groupLength, static_cast<uint32_t>(meta.size()));
+
+  dicom.assign(128, '\0');
+  dicom.append("DICM");
+  AppendElement(dicom, 0x0002, 0x0000, "UL", groupLength);
+  dicom.append(meta);
+
+  AppendElement(dicom, 0x0008, 0x0016, "UI", "1.2.840.10008.5.1.4.1.1.7");
+  AppendElement(dicom, 0x0008, 0x0018, "UI", sopInstanceUid);
+  AppendElement(dicom, 0x0008, 0x0060, "CS", modality);
+  AppendElement(dicom, 0x0008, 0x0080, "LO", GetInstitution(random.Next(INSTITUTIONS_COUNT)));
+  AppendElement(dicom, 0x0008, 0x1010, "SH", GetStation(modality, random.Next(STATIONS_COUNT)));
+  AppendElement(dicom, 0x0009, 0x0010, "LO", "BENCHMARK");
+  AppendElement(dicom, 0x0009, 0x1010, "LO", GetVendor(random.Next(VENDORS_COUNT)));
+  AppendElement(dicom, 0x0010, 0x0010, "PN", "BENCHMARK^PATIENT");
+  AppendElement(dicom, 0x0010, 0x0020, "LO", "P" + boost::lexical_cast<std::string>(index % 100));
+  AppendElement(dicom, 0x0020, 0x000d, "UI", "1.2.826.0.1.3680043.10.543.7." + boost::lexical_cast<std::string>(index / 50));
+  AppendElement(dicom, 0x0020, 0x000e, "UI", "1.2.826.0.1.3680043.10.543.8." + boost::lexical_cast<std::string>(index / 10));
+  AppendElement(dicom, 0x7fe0, 0x0010, "OW", std::string(PIXEL_DATA_SIZE, 'x'));
+}
+
+
+// Mix of the usual rules: modality and institution, vendor-specific
+// private tag, whole institution, wildcards on the station name, and
+// one catch-all archive
+static void GenerateRules(std::vector<RoutingTree::Rule>& rules,
+                          Random& random,
+                          size_t count)
+{
+  rules.resize(count);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    RoutingTree::Rule& rule = rules[i];
+    rule.account_ = "store-" + boost::lexical_cast<std::string>(i % ACCOUNTS_COUNT);
+    rule.conditions_.clear();
+
+    const char* modality = MODALITIES[random.Next(MODALITIES_COUNT)];
+
+    RoutingTree::Condition modalities(TAG_MODALITY);
+    modalities.values_.push_back(modality);
+
+    RoutingTree::Condition institution(TAG_INSTITUTION_NAME);
+    institution.values_.push_back(GetInstitution(random.Next(INSTITUTIONS_COUNT)));
+
+    if (i == 0)
+    {
+      rule.account_ = "archive";
+    }
+    else if (i % 10 < 6)
+    {
+      if (random.Next(2) == 0)
+      {
+        modalities.values_.push_back(MODALITIES[random.Next(MODALITIES_COUNT)]);
+      }
+
+      rule.conditions_.push_back(modalities);
+      rule.conditions_.push_back(institution);
+    }
+    else if (i % 10 < 8)
+    {
+      RoutingTree::Condition vendor(TAG_PRIVATE_VENDOR);
+      vendor.values_.push_back(GetVendor(random.Next(VENDORS_COUNT)));
+      rule.conditions_.push_back(vendor);
+      rule.conditions_.push_back(modalities);
+    }
+    else if (i % 10 < 9)
+    {
+      rule.conditions_.push_back(institution);
+    }
+    else
+    {
+      RoutingTree::Condition station(TAG_STATION_NAME);
+      station.values_.push_back(std::string(modality) + "-" + boost::lexical_cast<std::string>(random.Next(2)) + "*");
+      rule.conditions_.push_back(station);
+      rule.conditions_.push_back(institution);
+    }
+  }
+}
+
+
+static void BenchmarkRules(const std::vector<std::string>& instances,
+                           size_t rulesCount,
+                           bool csv)
+{
+  Random random;
+  std::vector<RoutingTree::Rule> rules;
+  GenerateRules(rules, random, rulesCount);
+
+  BenchmarkToolbox::Chronometer chronometer;
+  RoutingTree tree(rules);
+  const double compilation = chronometer.GetElapsed();
+
+  const std::string prefix = "Routing (" + boost::lexical_cast<std::string>(rulesCount) + " rules): ";
+
+  printf("%s%u tags, %u accounts, %u nodes, depth %u, compiled in %.1f ms\n", prefix.c_str(),
+         static_cast<unsigned int>(tree.GetTagsCount()), static_cast<unsigned int>(tree.GetAccountsCount()),
+         static_cast<unsigned int>(tree.GetNodesCount()), static_cast<unsigned int>(tree.GetDepth()),
+         compilation / 1000.0);
+
+  // Extract the values once, and check the tree against the reference
+  std::vector<RoutingTree::Values> values(instances.size());
+  size_t targets = 0;
+
+  for (size_t i = 0; i < instances.size(); i++)
+  {
+    std::string sopInstanceUid;
+    if (!tree.ExtractValues(values[i], sopInstanceUid, instances[i].c_str(), instances[i].size()) ||
+        sopInstanceUid.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Cannot parse a synthetic instance");
+    }
+
+    std::vector<size_t> a, b;
+    tree.Evaluate(a, values[i]);
+    tree.EvaluateLinear(b, values[i]);
+
+    if (a != b)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                      "The decision tree disagrees with the linear evaluation");
+    }
+
+    targets += a.size();
+  }
+
+  printf("  %.2f accounts per instance\n", static_cast<double>(targets) / static_cast<double>(instances.size()));
+
+  size_t next = 0;
+  std::vector<size_t> accounts;
+  RoutingTree::Values extracted;
+  std::string sopInstanceUid;
+
+  BenchmarkToolbox::RunMicroBenchmark(prefix + "ExtractValues() - single pass", [&] () {
+      const std::string& dicom = instances[next++ % instances.size()];
+      tree.ExtractValues(extracted, sopInstanceUid, dicom.c_str(), dicom.size());
+    }, csv);
+
+  BenchmarkToolbox::RunMicroBenchmark(prefix + "Evaluate() - decision tree", [&] () {
+      tree.Evaluate(accounts, values[next++ % values.size()]);
+    }, csv);
+
+  BenchmarkToolbox::RunMicroBenchmark(prefix + "EvaluateLinear() - rule by rule", [&] () {
+      tree.EvaluateLinear(accounts, values[next++ % values.size()]);
+    }, csv);
+
+  BenchmarkToolbox::RunMicroBenchmark(prefix + "ExtractValues() + Evaluate()", [&] () {
+      const std::string& dicom = instances[next++ % instances.size()];
+      tree.ExtractValues(extracted, sopInstanceUid, dicom.c_str(), dicom.size());
+      tree.Evaluate(accounts, extracted);
+    }, csv);
+}
+
+
+void RunRoutingBenchmark(size_t rulesCount,
+                         bool csv)
+{
+  Random random;
+
+  std::vector<std::string> instances(INSTANCES_COUNT);
+  for (size_t i = 0; i < instances.size(); i++)
+  {
+    GenerateInstance(instances[i], random, i);
+  }
+
+  const size_t sizes[] = { std::max(static_cast<size_t>(1), rulesCount / 10), rulesCount, rulesCount * 10 };
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    BenchmarkRules(instances, sizes[i], csv);
+  }
+}
@@ -0,0 +1,267 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StoreSyncBenchmark.h"
+
+#include "BenchmarkToolbox.h"
+
+#include "../Plugin/GoogleConfiguration.h"
+#include "../Plugin/GoogleUpdater.h"
+#include "../Plugin/HealthcareClient.h"
+#include "../Plugin/SortedUidRuns.h"
+
+#include <OrthancException.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <stdio.h>
+
+
+static const unsigned int INSTANCES_PER_SERIES = 100;
+static const unsigned int PAGE_SIZE = 5000;    // Same as the store synchronization job
+static const size_t RUN_SIZE = 100000;         // Same as the store synchronization job
+static const size_t DIFFERENCE_PERIOD = 100;   // 1% of differences on each side
+static const unsigned int TIMEOUT_SECONDS = 60;
+
+
+namespace
+{
+  class DifferenceCounter : public SortedUidRuns::IDifferenceVisitor
+  {
+  private:
+    uint64_t  leftOnly_;
+    uint64_t  rightOnly_;
+
+  public:
+    DifferenceCounter() :
+      leftOnly_(0),
+      rightOnly_(0)
+    {
+    }
+
+    void VisitLeftOnly(const std::string& uid,
+                       const std::string& payload) override
+    {
+      leftOnly_++;
+    }
+
+    void VisitRightOnly(const std::string& uid,
+                        const std::string& payload) override
+    {
+      rightOnly_++;
+    }
+
+    uint64_t GetLeftOnly() const
+    {
+      return leftOnly_;
+    }
+
+    uint64_t GetRightOnly() const
+    {
+      return rightOnly_;
+    }
+  };
+}
+
+
+static std::string GetFirstValue(const Json::Value& item,
+                                 const char* tag)
+{
+  return item[tag]["Value"][0].asString();
+}
+
+
+static void WaitForToken(std::string& header,
+                         const std::string& accountName)
+{
+  BenchmarkToolbox::Chronometer chronometer;
+
+  while (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    if (chronometer.GetElapsed() > TIMEOUT_SECONDS * 1000000.0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout, "No token from the mock");
+    }
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+}
+
+
+void RunStoreSyncBenchmark(MockGoogleServer& server,
+                           size_t instancesCount)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  const GoogleAccount& account = configuration.GetAccount(0);
+  const std::string dicomWeb = account.GetDicomWebUrl(configuration.GetBaseGoogleUrl());
+
+  server.AddSyntheticInstances(static_cast<unsigned int>(instancesCount / INSTANCES_PER_SERIES), 1,
+                               INSTANCES_PER_SERIES, 0);
+
+  std::vector<std::string> studies, series, instances;
+  server.GetInstances(studies, series, instances);
+
+  printf("Store synchronization: %u instances in the DICOM store, runs of %u UIDs\n\n",
+         static_cast<unsigned int>(instances.size()), static_cast<unsigned int>(RUN_SIZE));
+
+  const boost::filesystem::path directory =
+    boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("gcp-sync-%%%%-%%%%");
+  boost::filesystem::create_directories(directory);
+
+  GoogleUpdater::GetInstance().Start();
+
+  try
+  {
+    std::string header;
+    WaitForToken(header, account.GetName());
+
+    // Listing of Google, by pages of QIDO-RS
+    unsigned int googleRuns;
+    uint64_t googleCount = 0;
+
+    {
+      BenchmarkToolbox::Chronometer chronometer;
+      SortedUidRuns::Writer writer(directory.string(), "google", RUN_SIZE, 0);
+
+      for (size_t offset = 0; ; offset += PAGE_SIZE)
+      {
+        Json::Value page;
+        HealthcareClient::Search(page, dicomWeb + "instances?limit=" + boost::lexical_cast<std::string>(PAGE_SIZE) +
+                                 "&offset=" + boost::lexical_cast<std::string>(offset), header);
+
+        for (Json::Value::ArrayIndex i = 0; i < page.size(); i++)
+        {
+          writer.Add(GetFirstValue(page[i], "00080018"),
+                     GetFirstValue(page[i], "0020000D") + "/" + GetFirstValue(page[i], "0020000E"));
+          googleCount++;
+
+          if (writer.IsFull())
+          {
+            writer.Flush();
+          }
+        }
+
+        if (page.size() < PAGE_SIZE)
+        {
+          break;
+        }
+      }
+
+      writer.Flush();
+      googleRuns = writer.GetRunsCount();
+
+      const double elapsed = chronometer.GetElapsed();
+      printf("Store synchronization: listing and sorting of Google\n");
+      printf("  %u instances in %u runs, %.1f ms\n", static_cast<unsigned int>(googleCount), googleRuns, elapsed / 1000.0);
+      BenchmarkToolbox::PrintThroughput("Store synchronization: Google", static_cast<size_t>(googleCount), 0, elapsed);
+    }
+
+    // Emulated Orthanc, that lacks some instances of Google and has extra ones
+    unsigned int orthancRuns;
+    uint64_t expectedMissingInOrthanc = 0;
+    uint64_t expectedMissingInGoogle = 0;
+
+    {
+      BenchmarkToolbox::Chronometer chronometer;
+      SortedUidRuns::Writer writer(directory.string(), "orthanc", RUN_SIZE, 0);
+
+      for (size_t i = 0; i < instances.size(); i++)
+      {
+        if (i % DIFFERENCE_PERIOD == 0)
+        {
+          expectedMissingInOrthanc++;
+        }
+        else
+        {
+          writer.Add(instances[i], "orthanc-" + boost::lexical_cast<std::string>(i));
+        }
+
+        if (i % DIFFERENCE_PERIOD == 1)
+        {
+          writer.Add("1.2.826.0.1.3680043.10.2000." + boost::lexical_cast<std::string>(i),
+                     "extra-" + boost::lexical_cast<std::string>(i));
+          expectedMissingInGoogle++;
+        }
+
+        if (writer.IsFull())
+        {
+          writer.Flush();
+        }
+      }
+
+      writer.Flush();
+      orthancRuns = writer.GetRunsCount();
+
+      printf("Store synchronization: sorting of Orthanc\n");
+      printf("  %u runs, %.1f ms\n", orthancRuns, chronometer.GetElapsed() / 1000.0);
+    }
+
+    // Merge join
+    {
+      BenchmarkToolbox::Chronometer chronometer;
+
+      SortedUidRuns::Reader orthanc(directory.string(), "orthanc", orthancRuns);
+      SortedUidRuns::Reader google(directory.string(), "google", googleRuns);
+
+      DifferenceCounter counter;
+      const uint64_t common = SortedUidRuns::ComputeDifferences(counter, orthanc, google);
+
+      const double elapsed = chronometer.GetElapsed();
+      printf("Store synchronization: merge join\n");
+      printf("  %u common instances, %u missing in Google (expected %u), %u missing in Orthanc (expected %u)\n",
+             static_cast<unsigned int>(common),
+             static_cast<unsigned int>(counter.GetLeftOnly()), static_cast<unsigned int>(expectedMissingInGoogle),
+             static_cast<unsigned int>(counter.GetRightOnly()), static_cast<unsigned int>(expectedMissingInOrthanc));
+      printf("  %.1f ms\n", elapsed / 1000.0);
+
+      if (counter.GetLeftOnly() != expectedMissingInGoogle ||
+          counter.GetRightOnly() != expectedMissingInOrthanc ||
+          common + expectedMissingInOrthanc != googleCount)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                        "The differences between the stores are not the expected ones");
+      }
+    }
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    GoogleUpdater::GetInstance().Stop();
+    boost::filesystem::remove_all(directory);
+    throw;
+  }
+
+  GoogleUpdater::GetInstance().Stop();
+  boost::filesystem::remove_all(directory);
+}
@@ -0,0 +1,51 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "MockGoogleServer.h"
+
+
+/**
+ * Measures the comparison of a DICOM store of "instancesCount"
+ * synthetic instances with the content of Orthanc, as done by the
+ * store synchronization job (the jobs themselves need a more recent
+ * Orthanc SDK than the one of the benchmarks). The store of the mock
+ * is listed with QIDO-RS and sorted into runs on disk, the same is
+ * done for an emulated Orthanc that misses 1% of the instances and
+ * has 1% of extra instances, then both sides are compared by a merge
+ * join. The duration of each phase is reported, and the computed
+ * differences are checked.
+ **/
+void RunStoreSyncBenchmark(MockGoogleServer& server,
+                           size_t instancesCount);
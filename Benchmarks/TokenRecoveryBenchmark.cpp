@@ -0,0 +1,188 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "TokenRecoveryBenchmark.h"
+
+#include "BenchmarkToolbox.h"
+
+#include "../Plugin/AccountRefresher.h"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <stdio.h>
+
+
+// Highest number of requests within one second, in the given period
+static size_t GetPeakRate(const std::vector<boost::posix_time::ptime>& arrivals,
+                          const boost::posix_time::ptime& start,
+                          const boost::posix_time::ptime& end)
+{
+  std::vector<size_t> histogram;
+
+  for (size_t i = 0; i < arrivals.size(); i++)
+  {
+    if (arrivals[i] >= start &&
+        arrivals[i] < end)
+    {
+      const size_t bucket = static_cast<size_t>((arrivals[i] - start).total_seconds());
+      if (bucket >= histogram.size())
+      {
+        histogram.resize(bucket + 1, 0);
+      }
+
+      histogram[bucket]++;
+    }
+  }
+
+  size_t peak = 0;
+  for (size_t i = 0; i < histogram.size(); i++)
+  {
+    peak = std::max(peak, histogram[i]);
+  }
+
+  return peak;
+}
+
+
+static size_t CountArrivals(const std::vector<boost::posix_time::ptime>& arrivals,
+                            const boost::posix_time::ptime& start,
+                            const boost::posix_time::ptime& end)
+{
+  size_t count = 0;
+
+  for (size_t i = 0; i < arrivals.size(); i++)
+  {
+    if (arrivals[i] >= start &&
+        arrivals[i] < end)
+    {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+
+void RunTokenRecoveryBenchmark(MockGoogleServer& server,
+                               const std::string& serviceAccountFile,
+                               unsigned int accountsCount,
+                               unsigned int outageSeconds,
+                               unsigned int retryAfterSeconds)
+{
+  std::vector<GoogleAccount*> accounts;
+  std::vector<AccountRefresher*> refreshers;
+
+  for (unsigned int i = 0; i < accountsCount; i++)
+  {
+    Json::Value json = Json::objectValue;
+    json["Project"] = "benchmark";
+    json["Location"] = "local";
+    json["Dataset"] = "recovery-" + boost::lexical_cast<std::string>(i);
+    json["DicomStore"] = "store";
+    json["ServiceAccountFile"] = serviceAccountFile;
+
+    OrthancPlugins::OrthancConfiguration section(json, "");
+    accounts.push_back(new GoogleAccount(section, "recovery-" + boost::lexical_cast<std::string>(i)));
+    refreshers.push_back(new AccountRefresher(*accounts.back()));
+  }
+
+  server.SetErrors(1.0f, 503, retryAfterSeconds);
+
+  const boost::posix_time::ptime outageStart = boost::posix_time::microsec_clock::universal_time();
+
+  boost::thread_group group;
+  for (size_t i = 0; i < refreshers.size(); i++)
+  {
+    // Long refresh interval: Only the retries are measured
+    group.create_thread(boost::bind(&AccountRefresher::Run, refreshers[i], 3600));
+  }
+
+  boost::this_thread::sleep(boost::posix_time::seconds(outageSeconds));
+  server.SetErrors(0, 503, 0);
+
+  const boost::posix_time::ptime recoveryStart = boost::posix_time::microsec_clock::universal_time();
+
+  size_t recovered = 0;
+
+  for (;;)
+  {
+    recovered = 0;
+    for (size_t i = 0; i < refreshers.size(); i++)
+    {
+      std::string token;
+      if (refreshers[i]->GetToken(token))
+      {
+        recovered++;
+      }
+    }
+
+    if (recovered == refreshers.size() ||
+        boost::posix_time::microsec_clock::universal_time() - recoveryStart > boost::posix_time::minutes(10))
+    {
+      break;
+    }
+
+    boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+  }
+
+  const boost::posix_time::ptime recoveryEnd = boost::posix_time::microsec_clock::universal_time();
+
+  for (size_t i = 0; i < refreshers.size(); i++)
+  {
+    refreshers[i]->Stop();
+  }
+
+  group.join_all();
+
+  std::vector<boost::posix_time::ptime> arrivals;
+  server.GetTokenArrivals(arrivals);
+
+  printf("Token endpoint recovery (%u accounts, outage of %u seconds):\n", accountsCount, outageSeconds);
+  printf("  During the outage:  %u requests, peak of %u requests/s\n",
+         static_cast<unsigned int>(CountArrivals(arrivals, outageStart, recoveryStart)),
+         static_cast<unsigned int>(GetPeakRate(arrivals, outageStart, recoveryStart)));
+  printf("  After the recovery: %u requests, peak of %u requests/s\n",
+         static_cast<unsigned int>(CountArrivals(arrivals, recoveryStart, recoveryEnd)),
+         static_cast<unsigned int>(GetPeakRate(arrivals, recoveryStart, recoveryEnd)));
+  printf("  %u/%u accounts recovered in %.3f seconds\n",
+         static_cast<unsigned int>(recovered), accountsCount,
+         static_cast<double>((recoveryEnd - recoveryStart).total_milliseconds()) / 1000.0);
+
+  for (size_t i = 0; i < refreshers.size(); i++)
+  {
+    delete refreshers[i];
+    delete accounts[i];
+  }
+}
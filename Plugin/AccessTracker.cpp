@@ -0,0 +1,483 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "AccessTracker.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <string.h>
+
+
+static const char   FILE_MAGIC[] = "GCPACC01";
+static const size_t FILE_MAGIC_SIZE = 8;
+static const size_t FILE_RECORD_SIZE = 16 + 8 + 4 + 4 + 1;
+
+
+static int ParseHexDigit(char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+  else if (c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+  else if (c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+  else
+  {
+    return -1;
+  }
+}
+
+
+bool AccessTracker::ParseUuid(Key& key,
+                              const std::string& uuid)
+{
+  // "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx", as generated by Orthanc
+  if (uuid.size() != 36)
+  {
+    return false;
+  }
+
+  key.high_ = 0;
+  key.low_ = 0;
+
+  unsigned int digits = 0;
+  for (size_t i = 0; i < uuid.size(); i++)
+  {
+    if (i == 8 || i == 13 || i == 18 || i == 23)
+    {
+      if (uuid[i] != '-')
+      {
+        return false;
+      }
+    }
+    else
+    {
+      int digit = ParseHexDigit(uuid[i]);
+      if (digit < 0)
+      {
+        return false;
+      }
+
+      uint64_t& target = (digits < 16 ? key.high_ : key.low_);
+      target = (target << 4) | static_cast<uint64_t>(digit);
+      digits++;
+    }
+  }
+
+  return true;
+}
+
+
+std::string AccessTracker::FormatUuid(const Key& key)
+{
+  static const char HEX[] = "0123456789abcdef";
+
+  std::string uuid(36, '-');
+
+  unsigned int digits = 0;
+  for (size_t i = 0; i < uuid.size(); i++)
+  {
+    if (i != 8 && i != 13 && i != 18 && i != 23)
+    {
+      const uint64_t source = (digits < 16 ? key.high_ : key.low_);
+      const unsigned int shift = 4 * (15 - digits % 16);
+      uuid[i] = HEX[(source >> shift) & 0x0f];
+      digits++;
+    }
+  }
+
+  return uuid;
+}
+
+
+float AccessTracker::GetTemperature(const Record& record,
+                                    uint32_t now) const
+{
+  const double age = (now > record.lastAccess_ ? static_cast<double>(now - record.lastAccess_) : 0.0);
+  return static_cast<float>(record.frequency_ * std::pow(2.0, -age / halfLifeSeconds_));
+}
+
+
+void AccessTracker::SetLocal(Record& record,
+                             bool local,
+                             uint64_t size)
+{
+  // Must be called while holding "mutex_"
+  if (record.flags_ & Flag_Local)
+  {
+    localBytes_ -= std::min(localBytes_, record.size_);
+  }
+
+  if (size != 0)
+  {
+    record.size_ = size;
+  }
+
+  if (local)
+  {
+    record.flags_ |= Flag_Local;
+    localBytes_ += record.size_;
+  }
+  else
+  {
+    record.flags_ &= ~Flag_Local;
+  }
+}
+
+
+AccessTracker::AccessTracker(unsigned int halfLifeSeconds) :
+  localBytes_(0),
+  halfLifeSeconds_(std::max(1u, halfLifeSeconds)),
+  dirty_(false)
+{
+}
+
+
+uint32_t AccessTracker::GetNow()
+{
+  static const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+  return static_cast<uint32_t>((boost::posix_time::second_clock::universal_time() - epoch).total_seconds());
+}
+
+
+void AccessTracker::NotifyCreated(const std::string& uuid,
+                                  uint64_t size,
+                                  bool evictable)
+{
+  Key key;
+  if (ParseUuid(key, uuid))
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Records::iterator found = records_.find(key);
+    if (found != records_.end())
+    {
+      SetLocal(found->second, false, 0);  // Should not happen, UUIDs are unique
+      records_.erase(found);
+    }
+
+    Record record;
+    record.size_ = 0;
+    record.lastAccess_ = GetNow();
+    record.frequency_ = 1.0f;
+    record.flags_ = (evictable ? Flag_Evictable : 0);
+    SetLocal(record, true, size);
+
+    records_[key] = record;
+    dirty_ = true;
+  }
+}
+
+
+void AccessTracker::NotifyAccess(const std::string& uuid,
+                                 uint64_t size)
+{
+  Key key;
+  if (ParseUuid(key, uuid))
+  {
+    const uint32_t now = GetNow();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Records::iterator found = records_.find(key);
+    if (found == records_.end())
+    {
+      // The attachment was stored before the tracking started
+      Record record;
+      record.size_ = 0;
+      record.lastAccess_ = now;
+      record.frequency_ = 1.0f;
+      record.flags_ = Flag_Evictable;
+      SetLocal(record, true, size);
+      records_[key] = record;
+    }
+    else
+    {
+      Record& record = found->second;
+      record.frequency_ = GetTemperature(record, now) + 1.0f;
+      record.lastAccess_ = now;
+
+      if (!(record.flags_ & Flag_Local) ||
+          record.size_ != size)
+      {
+        SetLocal(record, true, size);
+      }
+    }
+
+    dirty_ = true;
+  }
+}
+
+
+void AccessTracker::NotifyEvicted(const std::string& uuid)
+{
+  Key key;
+  if (ParseUuid(key, uuid))
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Records::iterator found = records_.find(key);
+    if (found != records_.end())
+    {
+      SetLocal(found->second, false, 0);
+      dirty_ = true;
+    }
+  }
+}
+
+
+void AccessTracker::NotifyRemoved(const std::string& uuid)
+{
+  Key key;
+  if (ParseUuid(key, uuid))
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Records::iterator found = records_.find(key);
+    if (found != records_.end())
+    {
+      SetLocal(found->second, false, 0);
+      records_.erase(found);
+      dirty_ = true;
+    }
+  }
+}
+
+
+void AccessTracker::Discover(const std::string& uuid,
+                             uint64_t size,
+                             bool local,
+                             bool evictable,
+                             uint32_t lastAccess)
+{
+  Key key;
+  if (ParseUuid(key, uuid))
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (records_.find(key) == records_.end())
+    {
+      Record record;
+      record.size_ = 0;
+      record.lastAccess_ = lastAccess;
+      record.frequency_ = 1.0f;
+      record.flags_ = (evictable ? Flag_Evictable : 0);
+      SetLocal(record, local, size);
+
+      records_[key] = record;
+      dirty_ = true;
+    }
+  }
+}
+
+
+uint64_t AccessTracker::GetLocalBytes()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return localBytes_;
+}
+
+
+size_t AccessTracker::GetSize()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return records_.size();
+}
+
+
+namespace
+{
+  struct ColderThan
+  {
+    bool operator() (const AccessTracker::Candidate& a,
+                     const AccessTracker::Candidate& b) const
+    {
+      return a.temperature_ < b.temperature_;
+    }
+  };
+}
+
+
+void AccessTracker::SelectColdest(std::vector<Candidate>& target,
+                                  uint64_t bytes)
+{
+  target.clear();
+
+  if (bytes == 0)
+  {
+    return;
+  }
+
+  std::vector<Candidate> candidates;
+
+  {
+    const uint32_t now = GetNow();
+
+    boost::mutex::scoped_lock lock(mutex_);
+    candidates.reserve(records_.size());
+
+    for (Records::const_iterator it = records_.begin(); it != records_.end(); ++it)
+    {
+      if ((it->second.flags_ & Flag_Local) &&
+          (it->second.flags_ & Flag_Evictable))
+      {
+        Candidate candidate;
+        candidate.size_ = it->second.size_;
+        candidate.temperature_ = GetTemperature(it->second, now);
+        candidates.push_back(candidate);
+        candidates.back().uuid_ = FormatUuid(it->first);
+      }
+    }
+  }
+
+  // Sorting happens outside of the lock, so that the storage area is
+  // not slowed down while the eviction is prepared
+  std::sort(candidates.begin(), candidates.end(), ColderThan());
+
+  uint64_t selected = 0;
+  for (size_t i = 0; i < candidates.size() && selected < bytes; i++)
+  {
+    target.push_back(candidates[i]);
+    selected += candidates[i].size_;
+  }
+}
+
+
+bool AccessTracker::Load(const std::string& path)
+{
+  if (!Orthanc::SystemToolbox::IsRegularFile(path))
+  {
+    return false;
+  }
+
+  std::string content;
+  Orthanc::SystemToolbox::ReadFile(content, path);
+
+  if (content.size() < FILE_MAGIC_SIZE ||
+      memcmp(content.c_str(), FILE_MAGIC, FILE_MAGIC_SIZE) != 0 ||
+      (content.size() - FILE_MAGIC_SIZE) % FILE_RECORD_SIZE != 0)
+  {
+    LOG(WARNING) << "Ignoring invalid access statistics of the cold tier: " << path;
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const size_t count = (content.size() - FILE_MAGIC_SIZE) / FILE_RECORD_SIZE;
+  records_.reserve(records_.size() + count);
+
+  const char* p = content.c_str() + FILE_MAGIC_SIZE;
+  for (size_t i = 0; i < count; i++, p += FILE_RECORD_SIZE)
+  {
+    Key key;
+    memcpy(&key.high_, p, 8);
+    memcpy(&key.low_, p + 8, 8);
+
+    Record record;
+    memcpy(&record.size_, p + 16, 8);
+    memcpy(&record.lastAccess_, p + 24, 4);
+    memcpy(&record.frequency_, p + 28, 4);
+    record.flags_ = static_cast<uint8_t>(p[32]);
+
+    // The accesses since the startup are more recent than the file
+    if (records_.find(key) == records_.end())
+    {
+      if (record.flags_ & Flag_Local)
+      {
+        localBytes_ += record.size_;
+      }
+
+      records_[key] = record;
+    }
+  }
+
+  return true;
+}
+
+
+void AccessTracker::Save(const std::string& path)
+{
+  // Native byte order: The file is only meant to be read back on the same host
+  std::string content;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!dirty_)
+    {
+      return;
+    }
+
+    content.resize(FILE_MAGIC_SIZE + records_.size() * FILE_RECORD_SIZE);
+    memcpy(&content[0], FILE_MAGIC, FILE_MAGIC_SIZE);
+
+    char* p = &content[FILE_MAGIC_SIZE];
+    for (Records::const_iterator it = records_.begin(); it != records_.end(); ++it, p += FILE_RECORD_SIZE)
+    {
+      memcpy(p, &it->first.high_, 8);
+      memcpy(p + 8, &it->first.low_, 8);
+      memcpy(p + 16, &it->second.size_, 8);
+      memcpy(p + 24, &it->second.lastAccess_, 4);
+      memcpy(p + 28, &it->second.frequency_, 4);
+      p[32] = static_cast<char>(it->second.flags_);
+    }
+
+    dirty_ = false;
+  }
+
+  try
+  {
+    const std::string tmp = path + ".tmp";
+    Orthanc::SystemToolbox::WriteFile(content, tmp);
+    boost::filesystem::rename(tmp, path);
+  }
+  catch (...)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    dirty_ = true;  // Retry at the next save
+    throw;
+  }
+}
@@ -0,0 +1,160 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * Compact in-memory record of the accesses to the local attachments
+ * of the cold tier. Each attachment is keyed by its 128-bit UUID and
+ * takes about 40 bytes, so that millions of attachments fit in a few
+ * hundreds of MB. The "temperature" of an attachment combines recency
+ * and frequency: Its access count decays exponentially with a
+ * configurable half-life, and the coldest attachments are those with
+ * the lowest decayed count. The records are saved to a binary file.
+ **/
+class AccessTracker : public boost::noncopyable
+{
+public:
+  struct Candidate
+  {
+    std::string  uuid_;
+    uint64_t     size_;
+    float        temperature_;
+  };
+
+private:
+  struct Key
+  {
+    uint64_t  high_;
+    uint64_t  low_;
+
+    bool operator== (const Key& other) const
+    {
+      return high_ == other.high_ && low_ == other.low_;
+    }
+  };
+
+  struct KeyHash
+  {
+    size_t operator() (const Key& key) const
+    {
+      return static_cast<size_t>(key.high_ ^ (key.low_ * 0x9e3779b97f4a7c15ull));
+    }
+  };
+
+  enum Flag
+  {
+    Flag_Local = 1,       // The file is in the local storage
+    Flag_Evictable = 2    // The UIDs of the instance are known
+  };
+
+  struct Record
+  {
+    uint64_t  size_;
+    uint32_t  lastAccess_;   // Seconds since the epoch
+    float     frequency_;    // Decayed access count, as of "lastAccess_"
+    uint8_t   flags_;
+  };
+
+  typedef std::unordered_map<Key, Record, KeyHash>  Records;
+
+  boost::mutex  mutex_;
+  Records       records_;
+  uint64_t      localBytes_;
+  double        halfLifeSeconds_;
+  bool          dirty_;
+
+  static bool ParseUuid(Key& key,
+                        const std::string& uuid);
+
+  static std::string FormatUuid(const Key& key);
+
+  float GetTemperature(const Record& record,
+                       uint32_t now) const;
+
+  void SetLocal(Record& record,
+                bool local,
+                uint64_t size);
+
+public:
+  explicit AccessTracker(unsigned int halfLifeSeconds);
+
+  static uint32_t GetNow();
+
+  // A new local file. "evictable" is false if its UIDs are unknown.
+  void NotifyCreated(const std::string& uuid,
+                     uint64_t size,
+                     bool evictable);
+
+  // A read of the file, from the local storage or from Google (in
+  // which case the file has just been written back locally)
+  void NotifyAccess(const std::string& uuid,
+                    uint64_t size);
+
+  void NotifyEvicted(const std::string& uuid);
+
+  void NotifyRemoved(const std::string& uuid);
+
+  // Records an existing file found while scanning the local storage,
+  // if not already known. "lastAccess" is typically the modification time.
+  void Discover(const std::string& uuid,
+                uint64_t size,
+                bool local,
+                bool evictable,
+                uint32_t lastAccess);
+
+  // Total size of the local DICOM files
+  uint64_t GetLocalBytes();
+
+  size_t GetSize();
+
+  // Coldest local files that can be evicted, totalling at least "bytes"
+  void SelectColdest(std::vector<Candidate>& target,
+                     uint64_t bytes);
+
+  // Merges the records of the file with those already known. Returns
+  // "false" if the file does not exist or is not valid.
+  bool Load(const std::string& path);
+
+  // Only writes the file if the records have changed since last time
+  void Save(const std::string& path);
+};
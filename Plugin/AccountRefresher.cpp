@@ -0,0 +1,793 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "AccountRefresher.h"
+
+#include "CurlBuilder.h"
+#include "GoogleConfiguration.h"
+
+#include <Logging.h>
+
+#include <algorithm>
+#include <iterator>
+
+
+static const unsigned int TOKEN_EXPIRATION_MARGIN = 60;  // A token that expires sooner is not handed out, in seconds
+
+
+AccountRefresher::Status::Status() :
+  workerState_(WorkerState_Starting),
+  hasToken_(false),
+  lastLatencyMs_(0),
+  lastSuccess_(false),
+  successes_(0),
+  failures_(0),
+  breakerRefusals_(0),
+  forcedRefreshes_(0),
+  consecutiveFailures_(0),
+  breakerState_(CircuitBreaker::State_Closed),
+  lastDiscoverySuccess_(false)
+{
+}
+
+
+AccountRefresher::AccountRefresher(const GoogleAccount& account) :
+  account_(account),
+  stopping_(false),
+  refreshRequested_(false),
+  forceRequested_(false),
+  refreshing_(false),
+  refreshingForced_(false),
+  completedRefreshes_(0),
+  lastSuccess_(false),
+  tokenExpiration_(boost::posix_time::not_a_date_time),
+  nextAttempt_(boost::posix_time::microsec_clock::universal_time()),
+  breaker_(CircuitBreaker::GetInstance(account.GetTokenEndpoint())),
+  lazyIdleSeconds_(GoogleConfiguration::GetInstance().IsLazyRefresh() ?
+                   GoogleConfiguration::GetInstance().GetLazyRefreshIdleTimeoutSeconds() : 0),
+  lastActivity_(boost::posix_time::microsec_clock::universal_time()),
+  dormant_(false),
+  wakeTarget_(0),
+  random_(std::random_device()()),
+  nextDiscovery_(boost::posix_time::microsec_clock::universal_time()),
+  status_(std::make_shared<Status>())
+{
+  if (account.IsDiscovery())
+  {
+    current_.servers_ = std::make_shared<std::set<std::string> >();
+  }
+}
+
+
+void AccountRefresher::PublishStatus(WorkerState state)
+{
+  current_.workerState_ = state;
+  current_.breakerState_ = breaker_.GetState();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    current_.nextAttempt_ = nextAttempt_;
+  }
+
+  std::shared_ptr<const Status> snapshot = std::make_shared<Status>(current_);
+  std::atomic_store(&status_, snapshot);
+}
+
+
+boost::posix_time::time_duration AccountRefresher::ComputeBackoff()
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  // "Full jitter": Uniform delay between zero and the exponential bound
+  const uint64_t maxDelay = static_cast<uint64_t>(configuration.GetRetryMaxDelaySeconds()) * 1000;
+  const unsigned int exponent = std::min(current_.consecutiveFailures_ - 1, 30u);
+  const uint64_t bound = std::min(maxDelay, (static_cast<uint64_t>(configuration.GetRetryInitialDelaySeconds()) * 1000) << exponent);
+
+  std::uniform_int_distribution<uint64_t> distribution(0, bound);
+  return boost::posix_time::milliseconds(distribution(random_));
+}
+
+
+bool AccountRefresher::Refresh(std::string& error,
+                               bool force,
+                               const std::string& dicomWebPluginRoot,
+                               const std::string& baseGoogleUrl)
+{
+  if (force ||
+      credentials_.get() == NULL)
+  {
+    // New credentials have an empty cache, which forces a new token
+    credentials_ = account_.CreateCredentials();
+  }
+
+  google::cloud::StatusOr<std::string> token = credentials_->AuthorizationHeader();
+  if (!token)
+  {
+    if (!CurlBuilder::IsAborted())
+    {
+      LOG(WARNING) << "Cannot generate Google Cloud Platform token for account: " << account_.GetName();
+    }
+
+    error = "Cannot generate token: " + token.status().message();
+    return false;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (*token == token_)
+    {
+      return true;  // Unchanged token
+    }
+  }
+
+  // Read the lifetime of the token before any other HTTP request is issued by this thread
+  unsigned int expiresIn = 0;
+  const bool hasExpiresIn = CurlBuilder::LookupLastExpiresIn(expiresIn);
+
+  if (UpdateServerDefinitions(dicomWebPluginRoot, baseGoogleUrl, *token))
+  {
+    current_.hasToken_ = true;
+    current_.tokenTime_ = boost::posix_time::microsec_clock::universal_time();
+
+    if (hasExpiresIn)
+    {
+      current_.tokenExpiration_ = current_.tokenTime_ + boost::posix_time::seconds(expiresIn);
+    }
+    else
+    {
+      current_.tokenExpiration_ = boost::posix_time::ptime();
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      token_ = *token;
+      tokenExpiration_ = current_.tokenExpiration_;
+    }
+
+    return true;
+  }
+  else
+  {
+    error = "Cannot update the server definitions in the DICOMweb plugin";
+    return false;
+  }
+}
+
+
+bool AccountRefresher::UpdateServerDefinitions(const std::string& dicomWebPluginRoot,
+                                               const std::string& baseGoogleUrl,
+                                               const std::string& token)
+{
+  if (account_.IsDiscovery())
+  {
+    // "dicomStores_" is only modified by the thread running "Run()"
+    bool success = true;
+
+    for (std::set<DicomStoreDiscovery::DicomStore>::const_iterator
+           it = dicomStores_.begin(); it != dicomStores_.end(); ++it)
+    {
+      if (!account_.UpdateServerDefinition(dicomWebPluginRoot, baseGoogleUrl, it->first, it->second, token))
+      {
+        success = false;
+      }
+    }
+
+    return success;
+  }
+  else
+  {
+    return account_.UpdateServerDefinition(dicomWebPluginRoot, baseGoogleUrl, token);
+  }
+}
+
+
+void AccountRefresher::Discover(const std::string& dicomWebPluginRoot,
+                                const std::string& baseGoogleUrl)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  std::string token;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    token = token_;
+  }
+
+  if (token.empty())
+  {
+    return;
+  }
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  DicomStoreDiscovery discovery(account_, baseGoogleUrl, token);
+
+  std::set<DicomStoreDiscovery::DicomStore> stores;
+  const bool success = discovery.Run(stores, configuration.GetDiscoveryThreads());
+
+  const boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+
+  current_.lastDiscovery_ = end;
+  current_.lastDiscoverySuccess_ = success;
+
+  if (!success)
+  {
+    // Keep the current servers, and try again after the next refresh
+    current_.lastDiscoveryError_ = discovery.GetError();
+    return;
+  }
+
+  current_.lastDiscoveryError_.clear();
+  nextDiscovery_ = end + boost::posix_time::seconds(configuration.GetDiscoveryIntervalSeconds());
+
+  // Incremental update: The servers of the unchanged DICOM stores are left untouched
+  std::vector<DicomStoreDiscovery::DicomStore> added, removed;
+
+  std::set_difference(stores.begin(), stores.end(), dicomStores_.begin(), dicomStores_.end(),
+                      std::back_inserter(added));
+  std::set_difference(dicomStores_.begin(), dicomStores_.end(), stores.begin(), stores.end(),
+                      std::back_inserter(removed));
+
+  for (size_t i = 0; i < added.size(); i++)
+  {
+    if (account_.UpdateServerDefinition(dicomWebPluginRoot, baseGoogleUrl,
+                                        added[i].first, added[i].second, token))
+    {
+      dicomStores_.insert(added[i]);
+    }
+  }
+
+  for (size_t i = 0; i < removed.size(); i++)
+  {
+    // A server that cannot be removed keeps on receiving the tokens
+    if (account_.RemoveServerDefinition(dicomWebPluginRoot, removed[i].first, removed[i].second))
+    {
+      dicomStores_.erase(removed[i]);
+    }
+  }
+
+  std::shared_ptr<std::set<std::string> > servers = std::make_shared<std::set<std::string> >();
+
+  for (std::set<DicomStoreDiscovery::DicomStore>::const_iterator
+         it = dicomStores_.begin(); it != dicomStores_.end(); ++it)
+  {
+    std::vector<std::string> names;
+    account_.ListServerNames(names, it->first, it->second);
+    servers->insert(names.begin(), names.end());
+  }
+
+  current_.servers_ = servers;
+
+  if (added.empty() &&
+      removed.empty())
+  {
+    LOG(INFO) << "No change in the " << dicomStores_.size() << " DICOM store(s) of Google Cloud Platform account \""
+              << account_.GetName() << "\"";
+  }
+  else
+  {
+    LOG(WARNING) << "Discovery of the DICOM stores of Google Cloud Platform account \"" << account_.GetName()
+                 << "\": " << added.size() << " new, " << removed.size() << " removed, "
+                 << dicomStores_.size() << " in total (" << discovery.GetDatasetsCount() << " dataset(s), "
+                 << discovery.GetRequestsCount() << " request(s), " << (end - start).total_milliseconds() << "ms)";
+  }
+}
+
+
+void AccountRefresher::Run(unsigned int refreshIntervalSeconds)
+{
+  const std::string dicomWebPluginRoot = GoogleConfiguration::GetInstance().GetDicomWebPluginRoot();
+  const std::string baseGoogleUrl = GoogleConfiguration::GetInstance().GetBaseGoogleUrl();
+
+  for (;;)
+  {
+    bool force;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (completedRefreshes_ != 0)  // The first refresh is immediate
+      {
+        const boost::system_time timeout = nextAttempt_;
+
+        while (!stopping_ &&
+               !refreshRequested_)
+        {
+          if (dormant_)
+          {
+            changed_.wait(lock);  // No periodic refresh until the next activity
+          }
+          else if (!changed_.timed_wait(lock, timeout))
+          {
+            break;
+          }
+        }
+      }
+
+      if (stopping_)
+      {
+        refreshing_ = false;
+        changed_.notify_all();
+        break;
+      }
+
+      force = forceRequested_;
+      refreshRequested_ = false;
+      forceRequested_ = false;
+      refreshing_ = true;
+      refreshingForced_ = force;
+    }
+
+    PublishStatus(WorkerState_Refreshing);
+
+    bool success = false;
+    std::string error;
+    boost::posix_time::time_duration delay;
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    const bool attempted = breaker_.Acquire(delay);
+
+    if (attempted)
+    {
+      CurlBuilder::ResetLastResponse();
+
+      try
+      {
+        success = Refresh(error, force, dicomWebPluginRoot, baseGoogleUrl);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Cannot refresh the token of Google Cloud Platform account \""
+                   << account_.GetName() << "\": " << e.What();
+        error = e.What();
+      }
+
+      /**
+       * Only the failures of the endpoint itself are reported to the
+       * circuit breaker: An account with invalid credentials (HTTP
+       * 400 or 401) must not prevent the other accounts to refresh.
+       **/
+      const long status = CurlBuilder::GetLastHttpStatus();
+      const bool healthy = (success ||
+                            (status != 0 &&
+                             status != 429 &&
+                             status < 500));
+
+      unsigned int retryAfter = 0;
+      if (status == 429 ||
+          status == 503)
+      {
+        CurlBuilder::LookupLastRetryAfter(retryAfter);
+      }
+
+      if (!CurlBuilder::IsAborted())
+      {
+        breaker_.Report(healthy, retryAfter);
+      }
+
+      if (success)
+      {
+        current_.consecutiveFailures_ = 0;
+        delay = boost::posix_time::seconds(refreshIntervalSeconds);
+      }
+      else
+      {
+        current_.consecutiveFailures_++;
+        delay = std::max(ComputeBackoff(), boost::posix_time::time_duration(boost::posix_time::seconds(retryAfter)));
+      }
+    }
+    else
+    {
+      LOG(INFO) << "Circuit breaker of " << breaker_.GetEndpoint() << " is not closed, postponing "
+                << "the refresh of Google Cloud Platform account: " << account_.GetName();
+      error = "The circuit breaker of the token endpoint is not closed";
+    }
+
+    const boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+
+    if (success &&
+        account_.IsDiscovery() &&
+        end >= nextDiscovery_)
+    {
+      Discover(dicomWebPluginRoot, baseGoogleUrl);
+    }
+
+    current_.lastRefresh_ = end;
+    current_.lastLatencyMs_ = static_cast<unsigned int>((end - start).total_milliseconds());
+    current_.lastSuccess_ = success;
+    current_.lastError_ = error;
+
+    // The refusals of the circuit breaker are not failures of the
+    // token endpoint, as no request has been made
+    if (!attempted)
+    {
+      current_.breakerRefusals_++;
+    }
+    else if (success)
+    {
+      current_.successes_++;
+    }
+    else
+    {
+      current_.failures_++;
+    }
+
+    if (force)
+    {
+      current_.forcedRefreshes_++;
+    }
+
+    bool dormant = false;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      refreshing_ = false;
+      completedRefreshes_++;
+      lastSuccess_ = success;
+      nextAttempt_ = end + delay;
+
+      // In the lazy mode, stop refreshing the idle accounts once they have a valid token
+      if (lazyIdleSeconds_ != 0 &&
+          success &&
+          !refreshRequested_ &&
+          end - lastActivity_ >= boost::posix_time::seconds(lazyIdleSeconds_))
+      {
+        dormant_ = true;
+        dormant = true;
+      }
+
+      changed_.notify_all();
+    }
+
+    if (dormant)
+    {
+      LOG(INFO) << "No recent activity, the token of Google Cloud Platform account \""
+                << account_.GetName() << "\" will be refreshed on its next use";
+    }
+
+    PublishStatus(dormant ? WorkerState_Dormant : WorkerState_Idle);
+  }
+
+  PublishStatus(WorkerState_Stopped);
+}
+
+
+void AccountRefresher::Stop()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  stopping_ = true;
+  changed_.notify_all();
+}
+
+
+bool AccountRefresher::IsTokenValid() const
+{
+  if (token_.empty())
+  {
+    return false;
+  }
+  else if (tokenExpiration_.is_not_a_date_time())
+  {
+    return true;  // Unknown lifetime, the token is assumed to be valid
+  }
+  else
+  {
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    return now + boost::posix_time::seconds(TOKEN_EXPIRATION_MARGIN) < tokenExpiration_;
+  }
+}
+
+
+bool AccountRefresher::WaitForToken(boost::mutex::scoped_lock& lock,
+                                    unsigned int timeoutSeconds)
+{
+  const boost::system_time timeout =
+    boost::get_system_time() + boost::posix_time::seconds(timeoutSeconds);
+
+  lastActivity_ = boost::posix_time::microsec_clock::universal_time();
+
+  if (dormant_)
+  {
+    LOG(INFO) << "Waking up the token updater of Google Cloud Platform account: " << account_.GetName();
+
+    // The token cached by google-cloud-cpp is only renewed if it is about to expire
+    dormant_ = false;
+    refreshRequested_ = true;
+    wakeTarget_ = completedRefreshes_ + 1;
+    changed_.notify_all();
+  }
+
+  if (IsTokenValid())
+  {
+    return true;  // The wake-up refresh, if any, runs in the background
+  }
+
+  // Wait for the wake-up refresh, possibly triggered by another caller
+  while (completedRefreshes_ < wakeTarget_)
+  {
+    if (stopping_ ||
+        !changed_.timed_wait(lock, timeout))
+    {
+      return false;
+    }
+  }
+
+  return (lastSuccess_ &&
+          IsTokenValid());
+}
+
+
+bool AccountRefresher::GetToken(std::string& token,
+                                unsigned int timeoutSeconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  WaitForToken(lock, timeoutSeconds);
+
+  if (token_.empty())
+  {
+    return false;
+  }
+  else
+  {
+    token = token_;
+    return true;
+  }
+}
+
+
+bool AccountRefresher::RefreshNow(unsigned int timeoutSeconds)
+{
+  const boost::system_time timeout =
+    boost::get_system_time() + boost::posix_time::seconds(timeoutSeconds);
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  lastActivity_ = boost::posix_time::microsec_clock::universal_time();
+  dormant_ = false;
+
+  /**
+   * A periodic refresh that is in flight might return the token that
+   * is cached by google-cloud-cpp, which is the one that was
+   * rejected: In such a case, wait for the next refresh, that will be
+   * forced. A forced refresh that is in flight is always shared.
+   **/
+  const uint64_t target = completedRefreshes_ + ((refreshing_ && !refreshingForced_) ? 2 : 1);
+
+  if (!refreshing_ ||
+      !refreshingForced_)
+  {
+    refreshRequested_ = true;
+    forceRequested_ = true;
+    changed_.notify_all();
+  }
+
+  while (completedRefreshes_ < target)
+  {
+    if (stopping_ ||
+        !changed_.timed_wait(lock, timeout))
+    {
+      return false;
+    }
+  }
+
+  return lastSuccess_;
+}
+
+
+bool AccountRefresher::NotifyActivity(unsigned int timeoutSeconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return WaitForToken(lock, timeoutSeconds);
+}
+
+
+bool AccountRefresher::HandleRejectedToken(const std::string& rejectedToken,
+                                           unsigned int timeoutSeconds)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!token_.empty() &&
+        token_ != rejectedToken)
+    {
+      return true;  // Another thread has already replaced the rejected token
+    }
+  }
+
+  LOG(WARNING) << "The token of Google Cloud Platform account \"" << account_.GetName()
+               << "\" was rejected, requesting a new one";
+
+  return RefreshNow(timeoutSeconds);
+}
+
+
+unsigned int AccountRefresher::GetSecondsUntilNextAttempt()
+{
+  const std::shared_ptr<const Status> status = GetStatus();
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  if (status->workerState_ != WorkerState_Idle ||
+      status->nextAttempt_ <= now)
+  {
+    return 0;
+  }
+  else
+  {
+    return static_cast<unsigned int>((status->nextAttempt_ - now).total_seconds());
+  }
+}
+
+
+bool AccountRefresher::HasServer(const std::string& serverName) const
+{
+  if (account_.IsDiscovery())
+  {
+    const std::shared_ptr<const Status> status = GetStatus();
+    return (status->servers_.get() != NULL &&
+            status->servers_->find(serverName) != status->servers_->end());
+  }
+  else
+  {
+    std::vector<std::string> names;
+    account_.ListServerNames(names, account_.GetDataset(), account_.GetDicomStore());
+    return std::find(names.begin(), names.end(), serverName) != names.end();
+  }
+}
+
+
+std::shared_ptr<const AccountRefresher::Status> AccountRefresher::GetStatus() const
+{
+  return std::atomic_load(&status_);
+}
+
+
+static void FormatTimestamp(Json::Value& target,
+                            const boost::posix_time::ptime& timestamp)
+{
+  if (timestamp.is_not_a_date_time())
+  {
+    target = Json::nullValue;
+  }
+  else
+  {
+    target = boost::posix_time::to_iso_string(timestamp);
+  }
+}
+
+
+void AccountRefresher::FormatStatus(Json::Value& target) const
+{
+  const std::shared_ptr<const Status> status = GetStatus();
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  target = Json::objectValue;
+  target["Name"] = account_.GetName();
+  target["Type"] = (account_.GetType() == GoogleAccount::Type_ServiceAccount ?
+                    "ServiceAccount" : "AuthorizedUser");
+  target["Project"] = account_.GetProject();
+  target["Location"] = account_.GetLocation();
+  target["Dataset"] = account_.GetDataset();
+  target["DicomStore"] = account_.GetDicomStore();
+  target["Discovery"] = account_.IsDiscovery();
+  target["Lanes"] = account_.GetLanesCount();
+
+  if (account_.IsDiscovery())
+  {
+    target["ServerUrl"] = Json::nullValue;
+    target["ServerUri"] = Json::nullValue;
+
+    Json::Value servers = Json::arrayValue;
+    if (status->servers_.get() != NULL)
+    {
+      for (std::set<std::string>::const_iterator it = status->servers_->begin();
+           it != status->servers_->end(); ++it)
+      {
+        servers.append(*it);
+      }
+    }
+
+    target["DiscoveredServers"] = servers;
+    FormatTimestamp(target["LastDiscovery"], status->lastDiscovery_);
+    target["LastDiscoverySuccess"] = status->lastDiscoverySuccess_;
+    target["LastDiscoveryError"] = status->lastDiscoveryError_;
+  }
+  else
+  {
+    target["ServerUrl"] = account_.GetDicomWebUrl(configuration.GetBaseGoogleUrl());
+    target["ServerUri"] = account_.GetServerUri(configuration.GetDicomWebPluginRoot());
+  }
+
+  target["TokenEndpoint"] = breaker_.GetEndpoint();
+  target["WorkerState"] = EnumerationToString(status->workerState_);
+  target["HasToken"] = status->hasToken_;
+
+  if (status->hasToken_)
+  {
+    FormatTimestamp(target["TokenTime"], status->tokenTime_);
+    target["TokenAgeSeconds"] = static_cast<Json::Int64>((now - status->tokenTime_).total_seconds());
+  }
+  else
+  {
+    target["TokenTime"] = Json::nullValue;
+    target["TokenAgeSeconds"] = Json::nullValue;
+  }
+
+  FormatTimestamp(target["TokenExpiration"], status->tokenExpiration_);
+
+  if (status->tokenExpiration_.is_not_a_date_time())
+  {
+    target["TokenExpiresInSeconds"] = Json::nullValue;
+  }
+  else
+  {
+    target["TokenExpiresInSeconds"] = static_cast<Json::Int64>((status->tokenExpiration_ - now).total_seconds());
+  }
+
+  FormatTimestamp(target["LastRefresh"], status->lastRefresh_);
+  target["LastRefreshLatencyMs"] = status->lastLatencyMs_;
+  target["LastRefreshSuccess"] = status->lastSuccess_;
+  target["LastError"] = status->lastError_;
+  target["SuccessfulRefreshes"] = static_cast<Json::UInt64>(status->successes_);
+  target["FailedRefreshes"] = static_cast<Json::UInt64>(status->failures_);
+  target["BreakerRefusals"] = static_cast<Json::UInt64>(status->breakerRefusals_);
+  target["ForcedRefreshes"] = static_cast<Json::UInt64>(status->forcedRefreshes_);
+  target["ConsecutiveFailures"] = status->consecutiveFailures_;
+  FormatTimestamp(target["NextAttempt"], status->nextAttempt_);
+  target["CircuitBreaker"] = CircuitBreaker::EnumerationToString(status->breakerState_);
+}
+
+
+const char* AccountRefresher::EnumerationToString(WorkerState state)
+{
+  switch (state)
+  {
+    case WorkerState_Starting:
+      return "Starting";
+
+    case WorkerState_Idle:
+      return "Idle";
+
+    case WorkerState_Refreshing:
+      return "Refreshing";
+
+    case WorkerState_Dormant:
+      return "Dormant";
+
+    case WorkerState_Stopped:
+      return "Stopped";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
@@ -0,0 +1,208 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "CircuitBreaker.h"
+#include "DicomStoreDiscovery.h"
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <memory>
+
+
+/**
+ * Keeps the token of one Google Cloud Platform account up-to-date,
+ * and pushes it to the DICOMweb plugin. The refresh loop is run by a
+ * thread of "GoogleUpdater". Besides the periodic refresh, other
+ * threads can request an immediate refresh (e.g. because Google has
+ * rejected the current token): Concurrent requests are collapsed into
+ * one single refresh, whose result is shared by all the callers.
+ * Failed refreshes are retried with an exponential backoff with full
+ * jitter, under the control of the circuit breaker of the endpoint.
+ * In the discovery mode, the same thread periodically lists the
+ * DICOM stores of the account, and updates the set of DICOMweb
+ * servers incrementally.
+ **/
+class AccountRefresher : public boost::noncopyable
+{
+public:
+  enum WorkerState
+  {
+    WorkerState_Starting,
+    WorkerState_Idle,
+    WorkerState_Refreshing,
+    WorkerState_Dormant,    // Lazy mode, no recent activity
+    WorkerState_Stopped
+  };
+
+  // Immutable snapshot of the state of the refresher, that is
+  // published after each step of the refresh loop. Readers never
+  // take the mutex of the refresher.
+  struct Status
+  {
+    WorkerState               workerState_;
+    bool                      hasToken_;
+    boost::posix_time::ptime  tokenTime_;         // Reception of the current token
+    boost::posix_time::ptime  tokenExpiration_;   // "not_a_date_time" if unknown
+    boost::posix_time::ptime  lastRefresh_;
+    unsigned int              lastLatencyMs_;
+    bool                      lastSuccess_;
+    std::string               lastError_;
+    uint64_t                  successes_;
+    uint64_t                  failures_;          // Token requests that have failed
+    uint64_t                  breakerRefusals_;   // Refreshes postponed by the circuit breaker
+    uint64_t                  forcedRefreshes_;
+    unsigned int              consecutiveFailures_;
+    boost::posix_time::ptime  nextAttempt_;
+    CircuitBreaker::State     breakerState_;
+    boost::posix_time::ptime  lastDiscovery_;
+    bool                      lastDiscoverySuccess_;
+    std::string               lastDiscoveryError_;
+
+    // Names of the discovered DICOMweb servers, shared by the
+    // successive snapshots (NULL if not in the discovery mode)
+    std::shared_ptr<const std::set<std::string> >  servers_;
+
+    Status();
+  };
+
+private:
+  const GoogleAccount&       account_;
+  boost::mutex               mutex_;
+  boost::condition_variable  changed_;
+  bool                       stopping_;
+  bool                       refreshRequested_;
+  bool                       forceRequested_;
+  bool                       refreshing_;
+  bool                       refreshingForced_;
+  uint64_t                   completedRefreshes_;
+  bool                       lastSuccess_;
+  std::string                token_;
+  boost::posix_time::ptime   tokenExpiration_;   // "not_a_date_time" if unknown
+  boost::posix_time::ptime   nextAttempt_;
+  CircuitBreaker&            breaker_;
+  unsigned int               lazyIdleSeconds_;   // Zero if the lazy mode is disabled
+  boost::posix_time::ptime   lastActivity_;
+  bool                       dormant_;
+  uint64_t                   wakeTarget_;
+
+  // Only accessed by the thread running "Run()"
+  std::shared_ptr<google::cloud::storage::oauth2::Credentials>  credentials_;
+  std::mt19937               random_;
+  Status                     current_;
+  std::set<DicomStoreDiscovery::DicomStore>  dicomStores_;
+  boost::posix_time::ptime   nextDiscovery_;
+
+  // Only accessed through "std::atomic_load()" and "std::atomic_store()"
+  std::shared_ptr<const Status>  status_;
+
+  boost::posix_time::time_duration ComputeBackoff();
+
+  bool Refresh(std::string& error,
+               bool force,
+               const std::string& dicomWebPluginRoot,
+               const std::string& baseGoogleUrl);
+
+  bool UpdateServerDefinitions(const std::string& dicomWebPluginRoot,
+                               const std::string& baseGoogleUrl,
+                               const std::string& token);
+
+  void Discover(const std::string& dicomWebPluginRoot,
+                const std::string& baseGoogleUrl);
+
+  void PublishStatus(WorkerState state);
+
+  // The mutex must be locked by the caller
+  bool IsTokenValid() const;
+
+  // The mutex must be locked by the caller
+  bool WaitForToken(boost::mutex::scoped_lock& lock,
+                    unsigned int timeoutSeconds);
+
+public:
+  explicit AccountRefresher(const GoogleAccount& account);
+
+  const GoogleAccount& GetAccount() const
+  {
+    return account_;
+  }
+
+  // Refresh loop, returns once "Stop()" is called
+  void Run(unsigned int refreshIntervalSeconds);
+
+  void Stop();
+
+  // Returns the current "Authorization" header, if available. This
+  // counts as an activity of the account: In the lazy mode, a dormant
+  // refresher is woken up, and if its token has expired, the caller
+  // waits for the new one (at most "timeoutSeconds").
+  bool GetToken(std::string& token,
+                unsigned int timeoutSeconds);
+
+  // Forces a new token to be requested from Google, and waits for it
+  // (at most "timeoutSeconds"). If a forced refresh is already in
+  // flight, the caller waits for it instead of issuing another one.
+  bool RefreshNow(unsigned int timeoutSeconds);
+
+  // To be called if Google has answered HTTP 401 to a request that
+  // was authorized using "rejectedToken". Returns immediately if the
+  // token has already been replaced in the meantime.
+  bool HandleRejectedToken(const std::string& rejectedToken,
+                           unsigned int timeoutSeconds);
+
+  // Signals that the account is in use. In the lazy mode, if the
+  // refresher is dormant, this wakes it up. The caller only waits
+  // (at most "timeoutSeconds") if the current token has expired, in
+  // which case concurrent callers share the same refresh. Returns
+  // whether a valid token is available.
+  bool NotifyActivity(unsigned int timeoutSeconds);
+
+  CircuitBreaker& GetCircuitBreaker()
+  {
+    return breaker_;
+  }
+
+  // Tells whether the given DICOMweb server receives the tokens of this account
+  bool HasServer(const std::string& serverName) const;
+
+  // Time until the next scheduled refresh (zero if it is running)
+  unsigned int GetSecondsUntilNextAttempt();
+
+  std::shared_ptr<const Status> GetStatus() const;
+
+  void FormatStatus(Json::Value& target) const;
+
+  static const char* EnumerationToString(WorkerState state);
+};
@@ -0,0 +1,238 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BulkExportJob.h"
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+
+#include <Logging.h>
+
+
+const char* const BulkExportJob::JOB_TYPE = "GcpBulkExport";
+
+static const unsigned int OPERATION_WAIT = 1000;  // Maximum duration of one step while the operation runs, in ms
+
+
+BulkExportJob::BulkExportJob(const Json::Value& source) :
+  BulkTransferJob(JOB_TYPE, source, "orthanc-export/", true)
+{
+  const Json::Value checkpoint = GetCheckpoint(source);
+  phase_ = StringToPhase(GetStringField(checkpoint, "Phase", EnumerationToString(Phase_Export)));
+  exportedCount_ = GetIntegerField(checkpoint, "ExportedInstances", 0);
+  position_ = GetIntegerField(checkpoint, "Position", 0);
+  downloadedBytes_ = GetIntegerField(checkpoint, "DownloadedBytes", 0);
+  lastObject_ = GetStringField(checkpoint, "LastObject", "");
+
+  Checkpoint();
+}
+
+
+const char* BulkExportJob::EnumerationToString(Phase phase)
+{
+  switch (phase)
+  {
+    case Phase_Export:
+      return "Export";
+
+    case Phase_Download:
+      return "Download";
+
+    case Phase_Done:
+      return "Done";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+BulkExportJob::Phase BulkExportJob::StringToPhase(const std::string& phase)
+{
+  if (phase == "Export")
+  {
+    return Phase_Export;
+  }
+  else if (phase == "Download")
+  {
+    return Phase_Download;
+  }
+  else if (phase == "Done")
+  {
+    return Phase_Done;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Unknown phase of a bulk export: " + phase);
+  }
+}
+
+
+void BulkExportJob::Checkpoint()
+{
+  Json::Value checkpoint = Json::objectValue;
+  checkpoint["Phase"] = EnumerationToString(phase_);
+  checkpoint["ExportedInstances"] = static_cast<Json::UInt64>(exportedCount_);
+  checkpoint["Position"] = static_cast<Json::UInt64>(position_);
+  checkpoint["DownloadedBytes"] = static_cast<Json::UInt64>(downloadedBytes_);
+  checkpoint["LastObject"] = lastObject_;
+
+  Json::Value details = Json::objectValue;
+  details["GcsDestination"] = "gs://" + bucket_ + "/" + prefix_;
+
+  // The export operation accounts for 20% of the progress, the downloads for the rest
+  switch (phase_)
+  {
+    case Phase_Export:
+      SaveCheckpoint(checkpoint, details, 0.2f * operationProgress_);
+      break;
+
+    case Phase_Download:
+      SaveCheckpoint(checkpoint, details, exportedCount_ == 0 ? 0.2f :
+                     0.2f + 0.8f * static_cast<float>(position_) / static_cast<float>(exportedCount_));
+      break;
+
+    case Phase_Done:
+      SaveCheckpoint(checkpoint, details, 1.0f);
+      break;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+OrthancPluginJobStepStatus BulkExportJob::StepExport()
+{
+  if (operation_.empty())
+  {
+    // The files are named after the UIDs of the instances, below the prefix
+    Json::Value body = Json::objectValue;
+    body["gcsDestination"] = Json::objectValue;
+    body["gcsDestination"]["uriPrefix"] = "gs://" + bucket_ + "/" + prefix_;
+
+    StartOperation("export", body);
+    Checkpoint();
+
+    LOG(WARNING) << "Bulk export of DICOM store \"" << dataset_ << "/" << dicomStore_
+                 << "\" to gs://" << bucket_ << "/" << prefix_ << ": " << operation_;
+    return OrthancPluginJobStepStatus_Continue;
+  }
+
+  if (WaitOperation(OPERATION_WAIT))
+  {
+    exportedCount_ = GetOperationSuccessCount();
+    phase_ = Phase_Download;
+    Checkpoint();
+
+    LOG(WARNING) << "Bulk export of DICOM store \"" << dataset_ << "/" << dicomStore_ << "\" is done ("
+                 << exportedCount_ << " instances), downloading into Orthanc";
+  }
+  else
+  {
+    Checkpoint();
+  }
+
+  return OrthancPluginJobStepStatus_Continue;
+}
+
+
+OrthancPluginJobStepStatus BulkExportJob::StepDownload()
+{
+  StorageStaging& staging = GetStaging();
+
+  if (lister_.get() == NULL)
+  {
+    lister_.reset(new StorageStaging::ObjectLister(staging, prefix_, lastObject_));
+  }
+
+  std::vector<std::string> batch;
+  if (lister_->Next(batch, GetBatchSize()))
+  {
+    OrthancInstanceTarget target;
+    const uint64_t bytes = staging.DownloadInstances(target, batch, threads_);
+
+    position_ += batch.size();
+    downloadedBytes_ += bytes;
+    lastObject_ = batch.back();
+    AddTransferredBytes(bytes);
+
+    Checkpoint();
+    return OrthancPluginJobStepStatus_Continue;
+  }
+  else
+  {
+    phase_ = Phase_Done;
+    Checkpoint();
+
+    LOG(WARNING) << "Bulk retrieval of DICOM store \"" << dataset_ << "/" << dicomStore_ << "\" is done: "
+                 << position_ << " instance(s) stored into Orthanc";
+    return OrthancPluginJobStepStatus_Success;
+  }
+}
+
+
+OrthancPluginJobStepStatus BulkExportJob::StepPhase()
+{
+  switch (phase_)
+  {
+    case Phase_Export:
+      return StepExport();
+
+    case Phase_Download:
+      return StepDownload();
+
+    case Phase_Done:
+      return OrthancPluginJobStepStatus_Success;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+void BulkExportJob::Stop(OrthancPluginJobStopReason reason)
+{
+  // The listing depends on the client of Cloud Storage, that is released
+  lister_.reset();
+  BulkTransferJob::Stop(reason);
+}
+
+
+void BulkExportJob::Reset()
+{
+  lister_.reset();
+  BulkTransferJob::Reset();
+}
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "BulkTransferJob.h"
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+
+
+/**
+ * Orthanc job that restores a DICOM store of Google Healthcare into
+ * Orthanc in bulk: One "export" long-running operation of the
+ * Healthcare API writes the DICOM files to a prefix of Google Cloud
+ * Storage, then the files are downloaded by concurrent streams and
+ * stored into Orthanc as soon as each of them is received.
+ *
+ * The objects are processed by batches, in the lexicographic order of
+ * their names: The checkpoint records the name of the last object of
+ * the last completed batch, so that a resumed job skips the objects
+ * that are already stored. The memory usage is bounded by the size
+ * of one batch of names and of one DICOM file per stream, whatever
+ * the size of the DICOM store.
+ **/
+class BulkExportJob : public BulkTransferJob
+{
+public:
+  static const char* const JOB_TYPE;
+
+private:
+  enum Phase
+  {
+    Phase_Export,
+    Phase_Download,
+    Phase_Done
+  };
+
+  // Checkpoint
+  Phase                                          phase_;
+  uint64_t                                       exportedCount_;   // As reported by the operation
+  uint64_t                                       position_;        // Number of instances already stored
+  uint64_t                                       downloadedBytes_;
+  std::string                                    lastObject_;
+
+  // Not serialized
+  std::unique_ptr<StorageStaging::ObjectLister>  lister_;
+
+  OrthancPluginJobStepStatus StepExport();
+
+  OrthancPluginJobStepStatus StepDownload();
+
+  static const char* EnumerationToString(Phase phase);
+
+  static Phase StringToPhase(const std::string& phase);
+
+protected:
+  OrthancPluginJobStepStatus StepPhase() override;
+
+  void Checkpoint() override;
+
+public:
+  // "source" is either the body of the REST request, or the
+  // serialized job (which is the request plus the checkpoint)
+  explicit BulkExportJob(const Json::Value& source);
+
+  void Stop(OrthancPluginJobStopReason reason) override;
+
+  void Reset() override;
+};
+
+#endif
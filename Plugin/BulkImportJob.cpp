@@ -0,0 +1,572 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BulkImportJob.h"
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+
+#include "PresenceFilters.h"
+
+#include <Logging.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <set>
+
+
+const char* const BulkImportJob::JOB_TYPE = "GcpBulkImport";
+
+static const char* const DEFAULT_PREFIX = "orthanc-import/";
+static const unsigned int OPERATION_WAIT = 1000;  // Maximum duration of one step while the operation runs, in ms
+
+
+BulkImportJob::BulkImportJob(const Json::Value& source) :
+  BulkTransferJob(JOB_TYPE, source, DEFAULT_PREFIX, true),
+  hasInstances_(false),
+  instancesCount_(0),
+  next_(0)
+{
+  if (source.isMember("Resources"))
+  {
+    const Json::Value& resources = source["Resources"];
+    if (resources.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "The field \"Resources\" must be a list of Orthanc identifiers");
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < resources.size(); i++)
+    {
+      if (resources[i].type() != Json::stringValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "The field \"Resources\" must be a list of Orthanc identifiers");
+      }
+
+      resources_.push_back(resources[i].asString());
+    }
+  }
+
+  const Json::Value checkpoint = GetCheckpoint(source);
+  phase_ = StringToPhase(GetStringField(checkpoint, "Phase", EnumerationToString(Phase_Upload)));
+  position_ = GetIntegerField(checkpoint, "Position", 0);
+  lastInstance_ = GetStringField(checkpoint, "LastInstance", "");
+  uploadedBytes_ = GetIntegerField(checkpoint, "UploadedBytes", 0);
+  skippedCount_ = GetIntegerField(checkpoint, "SkippedInstances", 0);
+  skippedBytes_ = GetIntegerField(checkpoint, "SkippedBytes", 0);
+
+  Checkpoint();
+}
+
+
+const char* BulkImportJob::EnumerationToString(Phase phase)
+{
+  switch (phase)
+  {
+    case Phase_Upload:
+      return "Upload";
+
+    case Phase_Import:
+      return "Import";
+
+    case Phase_Done:
+      return "Done";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+BulkImportJob::Phase BulkImportJob::StringToPhase(const std::string& phase)
+{
+  if (phase == "Upload")
+  {
+    return Phase_Upload;
+  }
+  else if (phase == "Import")
+  {
+    return Phase_Import;
+  }
+  else if (phase == "Done")
+  {
+    return Phase_Done;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Unknown phase of a bulk import: " + phase);
+  }
+}
+
+
+void BulkImportJob::SerializeParameters(Json::Value& target) const
+{
+  BulkTransferJob::SerializeParameters(target);
+
+  if (!resources_.empty())
+  {
+    target["Resources"] = Json::arrayValue;
+    for (size_t i = 0; i < resources_.size(); i++)
+    {
+      target["Resources"].append(resources_[i]);
+    }
+  }
+}
+
+
+void BulkImportJob::Checkpoint()
+{
+  Json::Value checkpoint = Json::objectValue;
+  checkpoint["Phase"] = EnumerationToString(phase_);
+  checkpoint["Position"] = static_cast<Json::UInt64>(position_);
+  checkpoint["LastInstance"] = lastInstance_;
+  checkpoint["UploadedBytes"] = static_cast<Json::UInt64>(uploadedBytes_);
+  checkpoint["SkippedInstances"] = static_cast<Json::UInt64>(skippedCount_);
+  checkpoint["SkippedBytes"] = static_cast<Json::UInt64>(skippedBytes_);
+
+  Json::Value details = Json::objectValue;
+  details["GcsSource"] = "gs://" + bucket_ + "/" + prefix_;
+
+  if (hasInstances_)
+  {
+    details["InstancesCount"] = static_cast<Json::UInt64>(instancesCount_);
+  }
+
+  // The uploads account for 90% of the progress, the import operation for the rest
+  switch (phase_)
+  {
+    case Phase_Upload:
+      SaveCheckpoint(checkpoint, details, instancesCount_ == 0 ? 0.0f :
+                     0.9f * static_cast<float>(position_) / static_cast<float>(instancesCount_));
+      break;
+
+    case Phase_Import:
+      SaveCheckpoint(checkpoint, details, 0.9f + 0.1f * operationProgress_);
+      break;
+
+    case Phase_Done:
+      SaveCheckpoint(checkpoint, details, 1.0f);
+      break;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+void BulkImportJob::ListInstances()
+{
+  if (resources_.empty())
+  {
+    Json::Value statistics;
+    if (!OrthancPlugins::RestApiGet(statistics, "/statistics", false) ||
+        !statistics.isMember("CountInstances"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                      "Cannot count the instances stored by Orthanc");
+    }
+
+    instancesCount_ = statistics["CountInstances"].asUInt64();
+
+    // First guess, that is checked against "lastInstance_" by "GetNextBatch()"
+    next_ = position_;
+  }
+  else
+  {
+    // The list is sorted, so that the last instance of the checkpoint
+    // designates the same instances if the job is resumed
+    std::set<std::string> instances;
+
+    for (size_t i = 0; i < resources_.size(); i++)
+    {
+      static const char* const LEVELS[] = { "patients", "studies", "series" };
+
+      Json::Value children;
+      bool found = false;
+
+      for (size_t j = 0; j < sizeof(LEVELS) / sizeof(LEVELS[0]) && !found; j++)
+      {
+        found = OrthancPlugins::RestApiGet(children, "/" + std::string(LEVELS[j]) + "/" +
+                                           resources_[i] + "/instances", false);
+      }
+
+      if (found &&
+          children.type() == Json::arrayValue)
+      {
+        for (Json::Value::ArrayIndex j = 0; j < children.size(); j++)
+        {
+          instances.insert(children[j]["ID"].asString());
+        }
+      }
+      else if (OrthancPlugins::RestApiGet(children, "/instances/" + resources_[i], false))
+      {
+        instances.insert(resources_[i]);
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                        "Unknown Orthanc resource: " + resources_[i]);
+      }
+    }
+
+    instances_.assign(instances.begin(), instances.end());
+    instancesCount_ = instances_.size();
+
+    if (lastInstance_.empty())
+    {
+      next_ = std::min(position_, instancesCount_);  // Nothing processed yet, or checkpoint of an older version
+    }
+    else
+    {
+      next_ = std::upper_bound(instances_.begin(), instances_.end(), lastInstance_) - instances_.begin();
+    }
+  }
+
+  hasInstances_ = true;
+}
+
+
+void BulkImportJob::ListPage(std::vector<std::string>& page,
+                             uint64_t since,
+                             uint64_t limit) const
+{
+  page.clear();
+
+  if (limit == 0)
+  {
+    return;  // Orthanc would interpret this as "no limit"
+  }
+
+  // Paging through all the instances, in the order of their insertion in Orthanc
+  Json::Value answer;
+  if (!OrthancPlugins::RestApiGet(answer, "/instances?since=" + boost::lexical_cast<std::string>(since) +
+                                  "&limit=" + boost::lexical_cast<std::string>(limit), false) ||
+      answer.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                    "Cannot list the instances stored by Orthanc");
+  }
+
+  page.reserve(answer.size());
+  for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+  {
+    page.push_back(answer[i].asString());
+  }
+}
+
+
+void BulkImportJob::LocateLastInstance()
+{
+  const uint64_t batchSize = GetBatchSize();
+
+  // Orthanc appends the new instances at the end of the listing, so
+  // the deletions can only move the last instance towards its start
+  uint64_t end = next_;
+
+  while (end > 0)
+  {
+    const uint64_t start = (end > batchSize ? end - batchSize : 0);
+
+    std::vector<std::string> page;
+    ListPage(page, start, end - start);
+
+    std::vector<std::string>::const_iterator found = std::find(page.begin(), page.end(), lastInstance_);
+    if (found != page.end())
+    {
+      next_ = start + (found - page.begin()) + 1;
+      return;
+    }
+
+    end = start;
+  }
+
+  // The last instance was deleted from Orthanc: Restart from the
+  // beginning, which is safe as the staged files are overwritten
+  LOG(WARNING) << "Bulk import into DICOM store \"" << dataset_ << "/" << dicomStore_
+               << "\": Instance " << lastInstance_ << " was deleted, restarting the uploads";
+  next_ = 0;
+  lastInstance_.clear();
+}
+
+
+void BulkImportJob::GetNextBatch(std::vector<std::string>& batch)
+{
+  const uint64_t batchSize = GetBatchSize();
+
+  batch.clear();
+
+  if (resources_.empty())
+  {
+    if (!lastInstance_.empty())
+    {
+      // The listing is shifted if instances were deleted since the previous batch
+      std::vector<std::string> previous;
+      if (next_ > 0)
+      {
+        ListPage(previous, next_ - 1, 1);
+      }
+
+      if (previous.empty() ||
+          previous[0] != lastInstance_)
+      {
+        LocateLastInstance();
+      }
+    }
+
+    ListPage(batch, next_, batchSize);
+  }
+  else if (next_ < instances_.size())
+  {
+    const uint64_t end = std::min(next_ + batchSize, static_cast<uint64_t>(instances_.size()));
+    batch.assign(instances_.begin() + next_, instances_.begin() + end);
+  }
+}
+
+
+void BulkImportJob::SkipPresentInstances(std::vector<std::string>& batch,
+                                         std::vector<std::string>& sopInstanceUids)
+{
+  PresenceFilters& filters = PresenceFilters::GetInstance();
+
+  std::vector<std::string> missing;
+  missing.reserve(batch.size());
+
+  sopInstanceUids.clear();
+  sopInstanceUids.reserve(batch.size());
+
+  for (size_t i = 0; i < batch.size(); i++)
+  {
+    Json::Value instance;
+    if (!OrthancPlugins::RestApiGet(instance, "/instances/" + batch[i], false) ||
+        !instance.isMember("MainDicomTags") ||
+        !instance["MainDicomTags"].isMember("SOPInstanceUID"))
+    {
+      // Let the upload report the error
+      missing.push_back(batch[i]);
+      continue;
+    }
+
+    const std::string uid = instance["MainDicomTags"]["SOPInstanceUID"].asString();
+    const uint64_t size = (instance.isMember("FileSize") ? instance["FileSize"].asUInt64() : 0);
+
+    if (filters.IsPresent(account_.GetName(), dataset_, dicomStore_, uid, size))
+    {
+      skippedCount_++;
+      skippedBytes_ += size;
+    }
+    else
+    {
+      missing.push_back(batch[i]);
+      sopInstanceUids.push_back(uid);
+    }
+  }
+
+  batch.swap(missing);
+}
+
+
+OrthancPluginJobStepStatus BulkImportJob::StepUpload()
+{
+  StorageStaging& staging = GetStaging();
+
+  if (!hasInstances_)
+  {
+    ListInstances();
+  }
+
+  std::vector<std::string> batch;
+  GetNextBatch(batch);
+
+  if (batch.empty() &&
+      position_ == skippedCount_)
+  {
+    // All the instances were already in the DICOM store: Nothing to import
+    phase_ = Phase_Done;
+    Checkpoint();
+
+    LOG(WARNING) << "Bulk import into DICOM store \"" << dataset_ << "/" << dicomStore_
+                 << "\": The " << skippedCount_ << " instance(s) are already present";
+    return OrthancPluginJobStepStatus_Success;
+  }
+  else if (batch.empty())
+  {
+    Json::Value body = Json::objectValue;
+    body["gcsSource"] = Json::objectValue;
+    body["gcsSource"]["uri"] = staging.GetSourceUri(prefix_);
+
+    StartOperation("import", body);
+    phase_ = Phase_Import;
+
+    LOG(WARNING) << "Bulk import of " << (position_ - skippedCount_) << " instance(s) from "
+                 << staging.GetSourceUri(prefix_) << " into DICOM store \"" << dataset_ << "/" << dicomStore_ << "\": " << operation_;
+  }
+  else
+  {
+    const size_t batchSize = batch.size();
+    const std::string last = batch.back();
+    const bool hasFilter = PresenceFilters::GetInstance().HasFilter(account_.GetName(), dataset_, dicomStore_);
+
+    std::vector<std::string> sopInstanceUids;
+    if (hasFilter)
+    {
+      SkipPresentInstances(batch, sopInstanceUids);
+    }
+
+    if (!batch.empty())
+    {
+      OrthancInstanceSource source;
+      const uint64_t bytes = staging.UploadInstances(source, batch, prefix_, threads_);
+
+      uploadedBytes_ += bytes;
+      AddTransferredBytes(bytes);
+    }
+
+    if (hasFilter)
+    {
+      // The staged instances are recorded before the import: If the
+      // import fails, the next hits are refuted by the confirmation
+      for (size_t i = 0; i < sopInstanceUids.size(); i++)
+      {
+        PresenceFilters::GetInstance().Add(account_.GetName(), dataset_, dicomStore_, sopInstanceUids[i]);
+      }
+    }
+
+    position_ += batchSize;
+    next_ += batchSize;
+    lastInstance_ = last;
+  }
+
+  Checkpoint();
+  return OrthancPluginJobStepStatus_Continue;
+}
+
+
+OrthancPluginJobStepStatus BulkImportJob::StepImport()
+{
+  if (WaitOperation(OPERATION_WAIT))
+  {
+    // Before the checkpoint, so that the deletion is retried if Orthanc stops in the meantime
+    DeleteStagedFiles();
+
+    phase_ = Phase_Done;
+    Checkpoint();
+
+    LOG(WARNING) << "Bulk import into DICOM store \"" << dataset_ << "/" << dicomStore_ << "\" is done: " << operation_;
+    return OrthancPluginJobStepStatus_Success;
+  }
+  else
+  {
+    Checkpoint();
+    return OrthancPluginJobStepStatus_Continue;
+  }
+}
+
+
+OrthancPluginJobStepStatus BulkImportJob::StepPhase()
+{
+  switch (phase_)
+  {
+    case Phase_Upload:
+      return StepUpload();
+
+    case Phase_Import:
+      return StepImport();
+
+    case Phase_Done:
+      return OrthancPluginJobStepStatus_Success;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+void BulkImportJob::DeleteStagedFiles()
+{
+  if (!boost::starts_with(prefix_, DEFAULT_PREFIX))
+  {
+    LOG(INFO) << "Keeping the staged files of the bulk import below gs://" << bucket_ << "/" << prefix_
+              << ", as this prefix was provided in the request";
+    return;
+  }
+
+  try
+  {
+    StorageStaging& staging = GetStaging();
+    StorageStaging::ObjectLister lister(staging, prefix_, "");
+
+    uint64_t count = 0;
+
+    std::vector<std::string> objectNames;
+    while (lister.Next(objectNames, GetBatchSize()))
+    {
+      staging.DeleteObjects(objectNames, threads_);
+      count += objectNames.size();
+    }
+
+    LOG(INFO) << "Deleted the " << count << " staged file(s) of the bulk import below gs://"
+              << bucket_ << "/" << prefix_;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Not a failure of the import itself
+    LOG(WARNING) << "Cannot delete the staged files of the bulk import below gs://"
+                 << bucket_ << "/" << prefix_ << ": " << e.What();
+  }
+}
+
+
+void BulkImportJob::Stop(OrthancPluginJobStopReason reason)
+{
+  // Once the import operation is started, it reads the staged files
+  if (reason == OrthancPluginJobStopReason_Canceled &&
+      phase_ == Phase_Upload)
+  {
+    DeleteStagedFiles();
+  }
+
+  BulkTransferJob::Stop(reason);
+}
+
+
+void BulkImportJob::Reset()
+{
+  hasInstances_ = false;
+  instances_.clear();
+  BulkTransferJob::Reset();
+}
+
+#endif
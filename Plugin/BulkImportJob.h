@@ -0,0 +1,133 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "BulkTransferJob.h"
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+
+
+/**
+ * Orthanc job that migrates instances to a DICOM store of Google
+ * Healthcare in bulk: The DICOM files are staged in Google Cloud
+ * Storage by concurrent streams, then loaded by one "import"
+ * long-running operation of the Healthcare API, which avoids the
+ * per-request overhead of STOW-RS. The job is checkpointed after each
+ * batch of uploads and once the operation is started, on the last
+ * instance that was processed, so that a resumed job neither skips
+ * instances nor depends on the instances deleted in the meantime. If
+ * the account has a presence filter, the instances that are already
+ * in the DICOM store are skipped.
+ *
+ * The staged files are deleted once the import has succeeded, or if
+ * the job is canceled before the import. They are kept if the job
+ * fails, so that it can be resumed: A lifecycle rule on the bucket
+ * should delete the files of the jobs that are never resumed. Only
+ * the default prefixes ("orthanc-import/{uuid}/") are deleted, as a
+ * prefix provided in the request might hold other files.
+ **/
+class BulkImportJob : public BulkTransferJob
+{
+public:
+  static const char* const JOB_TYPE;
+
+private:
+  enum Phase
+  {
+    Phase_Upload,
+    Phase_Import,
+    Phase_Done
+  };
+
+  std::vector<std::string>  resources_;   // Empty means all the instances of Orthanc
+
+  // Checkpoint
+  Phase                     phase_;
+  uint64_t                  position_;    // Number of instances already uploaded or skipped
+  std::string               lastInstance_;  // Orthanc identifier of the last processed instance
+  uint64_t                  uploadedBytes_;
+  uint64_t                  skippedCount_;  // Instances already in the DICOM store
+  uint64_t                  skippedBytes_;
+
+  // Not serialized
+  bool                      hasInstances_;
+  std::vector<std::string>  instances_;   // Only if "resources_" is not empty
+  uint64_t                  instancesCount_;
+  uint64_t                  next_;        // Index of the next instance in the listing
+
+  void ListInstances();
+
+  void ListPage(std::vector<std::string>& page,
+                uint64_t since,
+                uint64_t limit) const;
+
+  // Sets "next_" after "lastInstance_" in the listing of all the
+  // instances of Orthanc, that is shifted by the deletions
+  void LocateLastInstance();
+
+  void GetNextBatch(std::vector<std::string>& batch);
+
+  void DeleteStagedFiles();
+
+  // Removes the instances that are confirmed to be in the DICOM store
+  // from the batch, and lists the SOP instance UIDs of the others
+  void SkipPresentInstances(std::vector<std::string>& batch,
+                            std::vector<std::string>& sopInstanceUids);
+
+  OrthancPluginJobStepStatus StepUpload();
+
+  OrthancPluginJobStepStatus StepImport();
+
+  static const char* EnumerationToString(Phase phase);
+
+  static Phase StringToPhase(const std::string& phase);
+
+protected:
+  void SerializeParameters(Json::Value& target) const override;
+
+  OrthancPluginJobStepStatus StepPhase() override;
+
+  void Checkpoint() override;
+
+public:
+  // "source" is either the body of the REST request, or the
+  // serialized job (which is the request plus the checkpoint)
+  explicit BulkImportJob(const Json::Value& source);
+
+  void Stop(OrthancPluginJobStopReason reason) override;
+
+  void Reset() override;
+};
+
+#endif
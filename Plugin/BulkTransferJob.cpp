@@ -0,0 +1,389 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BulkTransferJob.h"
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+
+#include "GoogleConfiguration.h"
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+#include <algorithm>
+
+
+static const unsigned int BATCH_SIZE_PER_STREAM = 32;
+
+
+static const GoogleAccount& LookupAccount(const std::string& name)
+{
+  const GoogleAccount* account = GoogleConfiguration::GetInstance().LookupAccount(name);
+  if (account == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Unknown Google Cloud Platform account: " + name);
+  }
+  else
+  {
+    return *account;
+  }
+}
+
+
+std::string BulkTransferJob::GetStringField(const Json::Value& source,
+                                            const std::string& key,
+                                            const std::string& defaultValue)
+{
+  if (!source.isMember(key))
+  {
+    return defaultValue;
+  }
+  else if (source[key].type() == Json::stringValue)
+  {
+    return source[key].asString();
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The field \"" + key + "\" must be a string");
+  }
+}
+
+
+uint64_t BulkTransferJob::GetIntegerField(const Json::Value& source,
+                                          const std::string& key,
+                                          uint64_t defaultValue)
+{
+  if (!source.isMember(key))
+  {
+    return defaultValue;
+  }
+  else if (source[key].isIntegral() &&
+           source[key].asInt64() >= 0)
+  {
+    return source[key].asUInt64();
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The field \"" + key + "\" must be a positive integer");
+  }
+}
+
+
+Json::Value BulkTransferJob::GetCheckpoint(const Json::Value& source)
+{
+  if (!source.isMember("Checkpoint"))
+  {
+    return Json::objectValue;
+  }
+  else if (source["Checkpoint"].type() == Json::objectValue)
+  {
+    return source["Checkpoint"];
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The field \"Checkpoint\" must be a JSON object");
+  }
+}
+
+
+void BulkTransferJob::OrthancInstanceSource::ReadInstance(std::string& dicom,
+                                                          const std::string& instanceId)
+{
+  if (!OrthancPlugins::RestApiGetString(dicom, "/instances/" + instanceId + "/file", false))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Cannot read instance: " + instanceId);
+  }
+}
+
+
+void BulkTransferJob::OrthancInstanceTarget::StoreInstance(const std::string& dicom,
+                                                           const std::string& objectName)
+{
+  // Storing an instance that is already in Orthanc is harmless,
+  // which makes the batches of a resumed job idempotent
+  Json::Value answer;
+  if (!OrthancPlugins::RestApiPost(answer, "/instances", dicom, false))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "Orthanc cannot store the DICOM file: " + objectName);
+  }
+}
+
+
+BulkTransferJob::BulkTransferJob(const char* jobType,
+                                 const Json::Value& source,
+                                 const std::string& defaultPrefix,
+                                 bool hasStaging) :
+  OrthancJob(jobType),
+  sessionBytes_(0),
+  account_(LookupAccount(GetStringField(source, "Account", ""))),
+  operationProgress_(0)
+{
+  if (account_.IsDiscovery())
+  {
+    // The filters of the discovery cannot designate one DICOM store
+    dataset_ = GetStringField(source, "Dataset", "");
+    dicomStore_ = GetStringField(source, "DicomStore", "");
+  }
+  else
+  {
+    dataset_ = GetStringField(source, "Dataset", account_.GetDataset());
+    dicomStore_ = GetStringField(source, "DicomStore", account_.GetDicomStore());
+  }
+
+  if (dataset_.empty() ||
+      dicomStore_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "The \"Dataset\" and \"DicomStore\" must be provided");
+  }
+
+  bucket_ = GetStringField(source, "Bucket", "");
+  if (bucket_.empty() &&
+      hasStaging)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "The staging \"Bucket\" must be provided");
+  }
+
+  // Each job has its own staging prefix by default, so that the
+  // long-running operation only sees the files of this job
+  prefix_ = StorageStaging::NormalizePrefix(
+    GetStringField(source, "Prefix", defaultPrefix + Orthanc::Toolbox::GenerateUuid()));
+
+  threads_ = std::max(1u, static_cast<unsigned int>(
+                        GetIntegerField(source, "Threads", GoogleConfiguration::GetInstance().GetBulkTransferThreads())));
+
+  operation_ = GetStringField(GetCheckpoint(source), "Operation", "");
+}
+
+
+uint64_t BulkTransferJob::GetBatchSize() const
+{
+  return static_cast<uint64_t>(threads_) * BATCH_SIZE_PER_STREAM;
+}
+
+
+StorageStaging& BulkTransferJob::GetStaging()
+{
+  if (staging_.get() == NULL)
+  {
+    staging_.reset(new StorageStaging(account_, bucket_, threads_));
+  }
+
+  if (sessionStart_.is_not_a_date_time())
+  {
+    sessionStart_ = boost::posix_time::microsec_clock::universal_time();
+    sessionBytes_ = 0;
+  }
+
+  return *staging_;
+}
+
+
+std::string BulkTransferJob::GetAuthorizationHeader() const
+{
+  std::string header;
+  if (GoogleUpdater::GetInstance().GetAuthorizationHeader(header, account_.GetName()))
+  {
+    return header;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "No token is available for Google Cloud Platform account: " +
+                                    account_.GetName());
+  }
+}
+
+
+void BulkTransferJob::StartOperation(const std::string& method,
+                                     const Json::Value& body)
+{
+  const std::string url = (account_.GetDicomStoreUrl(GoogleConfiguration::GetInstance().GetBaseGoogleUrl(),
+                                                     dataset_, dicomStore_) + ":" + method);
+
+  Json::Value operation;
+  HealthcareClient::Post(operation, url, body, GetAuthorizationHeader(), HttpTimings::EndpointClass_Operations);
+
+  if (!operation.isMember("name") ||
+      operation["name"].type() != Json::stringValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "No long-running operation was returned by: " + url);
+  }
+
+  operation_ = operation["name"].asString();
+  operationProgress_ = 0;
+  operationHandle_ = OperationPoller::GetInstance().Track(account_.GetName(), operation_);
+}
+
+
+bool BulkTransferJob::WaitOperation(unsigned int milliseconds)
+{
+  if (operationHandle_.get() == NULL)
+  {
+    // Also done if resuming a job, as the handles are not serialized
+    operationHandle_ = OperationPoller::GetInstance().Track(account_.GetName(), operation_);
+  }
+
+  const bool done = operationHandle_->Wait(milliseconds);
+
+  operationProgress_ = operationHandle_->GetProgress();
+
+  if (done)
+  {
+    operationHandle_->CheckSuccess();
+  }
+
+  return done;
+}
+
+
+uint64_t BulkTransferJob::GetOperationSuccessCount()
+{
+  if (operationHandle_.get() == NULL)
+  {
+    return 0;
+  }
+  else
+  {
+    uint64_t success, failure, pending;
+    operationHandle_->GetCounters(success, failure, pending);
+    return success;
+  }
+}
+
+
+void BulkTransferJob::AddTransferredBytes(uint64_t bytes)
+{
+  sessionBytes_ += bytes;
+}
+
+
+void BulkTransferJob::SerializeParameters(Json::Value& target) const
+{
+  target["Account"] = account_.GetName();
+  target["Dataset"] = dataset_;
+  target["DicomStore"] = dicomStore_;
+  target["Bucket"] = bucket_;
+  target["Prefix"] = prefix_;
+  target["Threads"] = threads_;
+}
+
+
+void BulkTransferJob::SaveCheckpoint(const Json::Value& checkpoint,
+                                     const Json::Value& details,
+                                     float progress)
+{
+  Json::Value serialized = Json::objectValue;
+  SerializeParameters(serialized);
+  serialized["Checkpoint"] = checkpoint;
+  serialized["Checkpoint"]["Operation"] = operation_;
+  UpdateSerialized(serialized);
+
+  Json::Value content = Json::objectValue;
+  BulkTransferJob::SerializeParameters(content);
+  content["Operation"] = operation_;
+
+  for (Json::Value::const_iterator it = checkpoint.begin(); it != checkpoint.end(); ++it)
+  {
+    content[it.name()] = *it;
+  }
+
+  for (Json::Value::const_iterator it = details.begin(); it != details.end(); ++it)
+  {
+    content[it.name()] = *it;
+  }
+
+  if (!sessionStart_.is_not_a_date_time())
+  {
+    const int64_t elapsed = (boost::posix_time::microsec_clock::universal_time() - sessionStart_).total_milliseconds();
+    if (elapsed > 0)
+    {
+      content["ThroughputMBs"] = (static_cast<double>(sessionBytes_) / (1024.0 * 1024.0) /
+                                  (static_cast<double>(elapsed) / 1000.0));
+    }
+  }
+
+  if (!error_.empty())
+  {
+    content["Error"] = error_;
+  }
+
+  UpdateContent(content);
+  UpdateProgress(std::max(0.0f, std::min(1.0f, progress)));
+}
+
+
+OrthancPluginJobStepStatus BulkTransferJob::Step()
+{
+  try
+  {
+    return StepPhase();
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Error in the bulk transfer with Google Cloud Platform account \""
+               << account_.GetName() << "\": " << e.What();
+    error_ = e.What();
+    Checkpoint();
+    return OrthancPluginJobStepStatus_Failure;
+  }
+}
+
+
+void BulkTransferJob::Stop(OrthancPluginJobStopReason reason)
+{
+  // Release the connections to Google Cloud Storage while the job is not running
+  staging_.reset();
+  operationHandle_.reset();
+  sessionStart_ = boost::posix_time::ptime();
+}
+
+
+void BulkTransferJob::Reset()
+{
+  // Resubmission of a failed job: Resume from the last checkpoint
+  error_.clear();
+  Checkpoint();
+}
+
+#endif
@@ -0,0 +1,155 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "OperationPoller.h"
+#include "StorageStaging.h"
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+
+/**
+ * Base class of the Orthanc jobs that transfer DICOM files in bulk
+ * between Orthanc and one DICOM store of Google Healthcare, through a
+ * staging prefix in Google Cloud Storage and a long-running operation
+ * of the Healthcare API ("import" or "export").
+ *
+ * The serialized job is the body of the REST request that created
+ * it, plus a "Checkpoint" object that is updated after each step. A
+ * failed job that is resubmitted, or a job that is reloaded after a
+ * restart of Orthanc, resumes from its last checkpoint.
+ **/
+class BulkTransferJob : public OrthancPlugins::OrthancJob
+{
+private:
+  std::unique_ptr<StorageStaging>           staging_;
+  std::shared_ptr<OperationPoller::Handle>  operationHandle_;
+  boost::posix_time::ptime                  sessionStart_;
+  uint64_t                                  sessionBytes_;
+
+protected:
+  // Reads the DICOM files to be transferred from Orthanc
+  class OrthancInstanceSource : public StorageStaging::IInstanceSource
+  {
+  public:
+    void ReadInstance(std::string& dicom,
+                      const std::string& instanceId) override;
+  };
+
+  // Stores the transferred DICOM files into Orthanc
+  class OrthancInstanceTarget : public StorageStaging::IInstanceTarget
+  {
+  public:
+    void StoreInstance(const std::string& dicom,
+                       const std::string& objectName) override;
+  };
+
+  const GoogleAccount&             account_;
+  std::string                      dataset_;
+  std::string                      dicomStore_;
+  std::string                      bucket_;
+  std::string                      prefix_;
+  unsigned int                     threads_;
+  std::string                      operation_;   // Name of the long-running operation
+  float                            operationProgress_;
+  std::string                      error_;
+
+  static std::string GetStringField(const Json::Value& source,
+                                    const std::string& key,
+                                    const std::string& defaultValue);
+
+  static uint64_t GetIntegerField(const Json::Value& source,
+                                  const std::string& key,
+                                  uint64_t defaultValue);
+
+  // Number of files between two checkpoints
+  uint64_t GetBatchSize() const;
+
+  StorageStaging& GetStaging();
+
+  std::string GetAuthorizationHeader() const;
+
+  // Calls "{dicomStore}:{method}", and stores the name of the
+  // returned long-running operation into "operation_"
+  void StartOperation(const std::string& method,
+                      const Json::Value& body);
+
+  // Waits for the long-running operation, which is polled by the
+  // shared "OperationPoller", during at most "milliseconds". Updates
+  // "operationProgress_", and returns "true" once the operation is
+  // done. Throws an exception if the operation has failed.
+  bool WaitOperation(unsigned int milliseconds);
+
+  // Number of the files that were successfully processed by the
+  // long-running operation, as reported by its last poll
+  uint64_t GetOperationSuccessCount();
+
+  void AddTransferredBytes(uint64_t bytes);
+
+  // Fields of the last checkpoint, or an empty object for a new job
+  static Json::Value GetCheckpoint(const Json::Value& source);
+
+  // Parameters of the REST request that created the job
+  virtual void SerializeParameters(Json::Value& target) const;
+
+  // Serializes the parameters of the job together with the given
+  // checkpoint. The public content of the job is made of the common
+  // parameters, the checkpoint, "details" and the throughput.
+  void SaveCheckpoint(const Json::Value& checkpoint,
+                      const Json::Value& details,
+                      float progress);
+
+  virtual OrthancPluginJobStepStatus StepPhase() = 0;
+
+  virtual void Checkpoint() = 0;
+
+public:
+  // "source" is either the body of the REST request, or the
+  // serialized job. "defaultPrefix" is followed by a UUID. The
+  // "Bucket" field is mandatory if "hasStaging" is true.
+  BulkTransferJob(const char* jobType,
+                  const Json::Value& source,
+                  const std::string& defaultPrefix,
+                  bool hasStaging);
+
+  OrthancPluginJobStepStatus Step() override;
+
+  void Stop(OrthancPluginJobStopReason reason) override;
+
+  void Reset() override;
+};
+
+#endif
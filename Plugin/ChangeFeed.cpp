@@ -0,0 +1,511 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ChangeFeed.h"
+
+#include "GoogleConfiguration.h"
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+#include "PluginToolbox.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <cassert>
+
+
+class ChangeFeed::Subscriber : public boost::noncopyable
+{
+public:
+  std::string  accountName_;
+  std::string  subscription_;
+  std::string  url_;
+
+  // Protected by the mutex of the feed
+  uint64_t  pullsCount_;
+  uint64_t  emptyPullsCount_;
+  uint64_t  batchesCount_;
+  uint64_t  messagesCount_;
+  uint64_t  changesCount_;
+  uint64_t  ackRequestsCount_;
+  uint64_t  failuresCount_;
+  size_t    lastBatchSize_;
+  double    lagSeconds_;   // Age of the oldest notification of the last batch
+  time_t    lastPull_;     // 0 if never pulled
+
+  Subscriber(const std::string& accountName,
+             const std::string& subscription,
+             const std::string& url) :
+    accountName_(accountName),
+    subscription_(subscription),
+    url_(url),
+    pullsCount_(0),
+    emptyPullsCount_(0),
+    batchesCount_(0),
+    messagesCount_(0),
+    changesCount_(0),
+    ackRequestsCount_(0),
+    failuresCount_(0),
+    lastBatchSize_(0),
+    lagSeconds_(0),
+    lastPull_(0)
+  {
+  }
+};
+
+
+static void GetAuthorizationHeader(std::string& header,
+                                   const std::string& accountName)
+{
+  if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Unauthorized,
+                                    "No token is available yet for Google Cloud Platform account: " + accountName);
+  }
+}
+
+
+static void PostPubSub(Json::Value& answer,
+                       const std::string& accountName,
+                       const std::string& url,
+                       const Json::Value& body)
+{
+  std::string header;
+  GetAuthorizationHeader(header, accountName);
+
+  try
+  {
+    HealthcareClient::Post(answer, url, body, header, HttpTimings::EndpointClass_Other);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Retry once if the token has expired in the meantime
+    if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+        GoogleUpdater::GetInstance().HandleRejectedToken(accountName, header))
+    {
+      GetAuthorizationHeader(header, accountName);
+      HealthcareClient::Post(answer, url, body, header, HttpTimings::EndpointClass_Other);
+    }
+    else
+    {
+      throw;
+    }
+  }
+}
+
+
+// "publishTime" is formatted as RFC 3339 ("2019-06-26T10:00:00.123456789Z"),
+// the fractional seconds are ignored
+static bool ParsePublishTime(boost::posix_time::ptime& target,
+                             const Json::Value& message)
+{
+  if (!message.isMember("publishTime") ||
+      message["publishTime"].type() != Json::stringValue)
+  {
+    return false;
+  }
+
+  const std::string s = message["publishTime"].asString();
+  if (s.size() < 19)
+  {
+    return false;
+  }
+
+  try
+  {
+    target = boost::posix_time::from_iso_extended_string(s.substr(0, 19));
+    return !target.is_not_a_date_time();
+  }
+  catch (std::exception&)
+  {
+    return false;
+  }
+}
+
+
+ChangeFeed::ChangeFeed() :
+  stopped_(false)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  for (size_t i = 0; i < configuration.GetAccountsCount(); i++)
+  {
+    const GoogleAccount& account = configuration.GetAccount(i);
+
+    if (!account.GetSubscription().empty())
+    {
+      subscribers_[account.GetName()] = new Subscriber(account.GetName(), account.GetSubscription(),
+                                                       account.GetSubscriptionUrl(configuration.GetPubSubUrl()));
+
+      LOG(WARNING) << "The notifications of account \"" << account.GetName()
+                   << "\" are pulled from Pub/Sub subscription: " << account.GetSubscription();
+    }
+  }
+}
+
+
+ChangeFeed& ChangeFeed::GetInstance()
+{
+  static ChangeFeed instance;
+  return instance;
+}
+
+
+ChangeFeed::~ChangeFeed()
+{
+  if (!threads_.empty())
+  {
+    LOG(ERROR) << "ChangeFeed::Stop() should have been called";
+    Stop();
+  }
+
+  for (std::map<std::string, Subscriber*>::iterator it = subscribers_.begin(); it != subscribers_.end(); ++it)
+  {
+    assert(it->second != NULL);
+    delete it->second;
+  }
+}
+
+
+bool ChangeFeed::IsStopped()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return stopped_;
+}
+
+
+bool ChangeFeed::ParseResourceName(Change& target,
+                                   const std::string& name)
+{
+  std::vector<std::string> tokens;
+  Orthanc::Toolbox::TokenizeString(tokens, name, '/');
+
+  if (tokens.size() == 15 &&
+      tokens[0] == "projects" &&
+      tokens[2] == "locations" &&
+      tokens[4] == "datasets" &&
+      tokens[6] == "dicomStores" &&
+      tokens[8] == "dicomWeb" &&
+      tokens[9] == "studies" &&
+      tokens[11] == "series" &&
+      tokens[13] == "instances" &&
+      !tokens[10].empty() &&
+      !tokens[12].empty() &&
+      !tokens[14].empty())
+  {
+    target.dataset_ = tokens[5];
+    target.dicomStore_ = tokens[7];
+    target.study_ = tokens[10];
+    target.series_ = tokens[12];
+    target.instance_ = tokens[14];
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+size_t ChangeFeed::ProcessBatch(Subscriber& subscriber)
+{
+  Json::Value request = Json::objectValue;
+  request["maxMessages"] = GoogleConfiguration::GetInstance().GetChangeFeedBatchSize();
+  request["returnImmediately"] = true;  // The feed waits by itself once drained, to be stopped promptly
+
+  Json::Value answer;
+  PostPubSub(answer, subscriber.accountName_, subscriber.url_ + ":pull", request);
+
+  const time_t now = time(NULL);
+  const boost::posix_time::ptime pullTime = boost::posix_time::second_clock::universal_time();
+
+  // An empty subscription answers with an empty object
+  const Json::Value& messages = answer["receivedMessages"];
+  if (!messages.isNull() &&
+      messages.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "Bad answer from Pub/Sub: " + subscriber.url_);
+  }
+
+  std::vector<Change> changes;
+  changes.reserve(messages.size());
+
+  Json::Value ackIds = Json::arrayValue;
+  boost::posix_time::ptime oldest = pullTime;
+
+  for (Json::Value::ArrayIndex i = 0; i < messages.size(); i++)
+  {
+    const Json::Value& received = messages[i];
+
+    if (received.type() != Json::objectValue ||
+        !received.isMember("ackId") ||
+        received["ackId"].type() != Json::stringValue)
+    {
+      continue;
+    }
+
+    ackIds.append(received["ackId"]);
+
+    // The notifications that are not about a DICOM instance are acknowledged and ignored
+    const Json::Value& message = received["message"];
+
+    std::string name;
+    Change change;
+
+    if (message.type() == Json::objectValue &&
+        message.isMember("data") &&
+        message["data"].type() == Json::stringValue)
+    {
+      Orthanc::Toolbox::DecodeBase64(name, message["data"].asString());
+
+      if (ParseResourceName(change, name))
+      {
+        changes.push_back(change);
+      }
+      else
+      {
+        LOG(INFO) << "Ignoring notification from Pub/Sub subscription "
+                  << subscriber.subscription_ << ": " << name;
+      }
+
+      boost::posix_time::ptime published;
+      if (ParsePublishTime(published, message) &&
+          published < oldest)
+      {
+        oldest = published;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < listeners_.size(); i++)
+  {
+    listeners_[i]->ApplyChanges(subscriber.accountName_, changes);
+  }
+
+  if (ackIds.size() > 0)
+  {
+    Json::Value body = Json::objectValue;
+    body["ackIds"] = ackIds;
+
+    Json::Value ignored;
+    PostPubSub(ignored, subscriber.accountName_, subscriber.url_ + ":acknowledge", body);
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  subscriber.pullsCount_++;
+  subscriber.lastPull_ = now;
+  subscriber.lastBatchSize_ = messages.size();
+  subscriber.lagSeconds_ = static_cast<double>((pullTime - oldest).total_seconds());
+
+  if (messages.size() == 0)
+  {
+    subscriber.emptyPullsCount_++;
+  }
+  else
+  {
+    subscriber.batchesCount_++;
+    subscriber.messagesCount_ += messages.size();
+    subscriber.changesCount_ += changes.size();
+  }
+
+  if (ackIds.size() > 0)
+  {
+    subscriber.ackRequestsCount_++;
+  }
+
+  return messages.size();
+}
+
+
+void ChangeFeed::Worker(ChangeFeed* that,
+                        Subscriber* subscriber)
+{
+  assert(subscriber != NULL);
+
+  const unsigned int interval = GoogleConfiguration::GetInstance().GetChangeFeedPollIntervalSeconds();
+
+  while (!that->IsStopped())
+  {
+    bool drained;
+
+    try
+    {
+      drained = (that->ProcessBatch(*subscriber) == 0);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot process the notifications of account \"" << subscriber->accountName_
+                 << "\": " << e.What();
+
+      boost::mutex::scoped_lock lock(that->mutex_);
+      subscriber->failuresCount_++;
+      drained = true;  // Don't retry immediately
+    }
+
+    if (drained)
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      if (!that->stopped_)
+      {
+        that->wakeUp_.timed_wait(lock, boost::posix_time::seconds(interval));
+      }
+    }
+  }
+}
+
+
+void ChangeFeed::Register(IListener& listener)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!threads_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
+
+  listeners_.push_back(&listener);
+}
+
+
+void ChangeFeed::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (threads_.empty())
+  {
+    stopped_ = false;
+
+    for (std::map<std::string, Subscriber*>::iterator it = subscribers_.begin(); it != subscribers_.end(); ++it)
+    {
+      threads_.push_back(new boost::thread(Worker, this, it->second));
+    }
+  }
+}
+
+
+void ChangeFeed::Stop()
+{
+  std::vector<boost::thread*> threads;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    threads.swap(threads_);
+  }
+
+  wakeUp_.notify_all();
+
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    assert(threads[i] != NULL);
+
+    if (threads[i]->joinable())
+    {
+      threads[i]->join();
+    }
+
+    delete threads[i];
+  }
+}
+
+
+void ChangeFeed::Format(Json::Value& target)
+{
+  target = Json::objectValue;
+
+  const time_t now = time(NULL);
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (std::map<std::string, Subscriber*>::const_iterator it = subscribers_.begin(); it != subscribers_.end(); ++it)
+  {
+    const Subscriber& subscriber = *it->second;
+
+    Json::Value item = Json::objectValue;
+    item["Subscription"] = subscriber.subscription_;
+
+    if (subscriber.lastPull_ != 0)
+    {
+      item["LastPull"] = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(subscriber.lastPull_));
+      item["LastPullAge"] = static_cast<Json::Int64>(now - subscriber.lastPull_);
+    }
+
+    item["PullsCount"] = static_cast<Json::UInt64>(subscriber.pullsCount_);
+    item["EmptyPullsCount"] = static_cast<Json::UInt64>(subscriber.emptyPullsCount_);
+    item["MessagesCount"] = static_cast<Json::UInt64>(subscriber.messagesCount_);
+    item["ChangesCount"] = static_cast<Json::UInt64>(subscriber.changesCount_);
+    item["AcknowledgeRequestsCount"] = static_cast<Json::UInt64>(subscriber.ackRequestsCount_);
+    item["FailuresCount"] = static_cast<Json::UInt64>(subscriber.failuresCount_);
+    item["LastBatchSize"] = static_cast<Json::UInt64>(subscriber.lastBatchSize_);
+    item["MeanBatchSize"] = (subscriber.batchesCount_ == 0 ? 0.0 :
+                             static_cast<double>(subscriber.messagesCount_) /
+                             static_cast<double>(subscriber.batchesCount_));
+    item["Lag"] = subscriber.lagSeconds_;
+
+    target[it->first] = item;
+  }
+}
+
+
+void ChangeFeed::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (std::map<std::string, Subscriber*>::const_iterator it = subscribers_.begin(); it != subscribers_.end(); ++it)
+  {
+    const Subscriber& subscriber = *it->second;
+    const std::string& name = it->first;
+
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_feed_lag_s_", name).c_str(),
+                                    static_cast<float>(subscriber.lagSeconds_));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_feed_batch_size_", name).c_str(),
+                                    static_cast<float>(subscriber.lastBatchSize_));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_feed_batch_size_mean_", name).c_str(),
+                                    subscriber.batchesCount_ == 0 ? 0.0f :
+                                    static_cast<float>(static_cast<double>(subscriber.messagesCount_) /
+                                                       static_cast<double>(subscriber.batchesCount_)));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_feed_messages_", name).c_str(),
+                                    static_cast<float>(subscriber.messagesCount_));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_feed_ack_requests_", name).c_str(),
+                                    static_cast<float>(subscriber.ackRequestsCount_));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_feed_failures_", name).c_str(),
+                                    static_cast<float>(subscriber.failuresCount_));
+  }
+#endif
+}
@@ -0,0 +1,134 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+
+/**
+ * Incremental updates of the state managed by the plugin (metadata
+ * mirrors...), from the notifications that the Healthcare API
+ * publishes to Pub/Sub each time an instance is stored in a DICOM
+ * store. One thread per account with the "Subscription" option pulls
+ * the notifications by batches of "ChangeFeedBatchSize", hands each
+ * batch to the registered listeners, and acknowledges the batch with
+ * one single request once all the listeners have applied it. If a
+ * listener fails, the batch is not acknowledged, and Pub/Sub delivers
+ * it again after the acknowledgment deadline of the subscription.
+ * The deletions are not notified by Google, and are left to the
+ * periodic synchronizations of the listeners.
+ **/
+class ChangeFeed : public boost::noncopyable
+{
+public:
+  // One instance stored in a DICOM store, as notified by Google
+  struct Change
+  {
+    std::string  dataset_;
+    std::string  dicomStore_;
+    std::string  study_;
+    std::string  series_;
+    std::string  instance_;
+  };
+
+  class IListener : public boost::noncopyable
+  {
+  public:
+    virtual ~IListener()
+    {
+    }
+
+    // Invoked by the thread of the account after each successful
+    // pull, possibly with an empty batch, which means that the
+    // subscription has been drained. Throwing an exception prevents
+    // the acknowledgment of the batch.
+    virtual void ApplyChanges(const std::string& accountName,
+                              const std::vector<Change>& changes) = 0;
+  };
+
+private:
+  class Subscriber;
+
+  boost::mutex                         mutex_;
+  boost::condition_variable            wakeUp_;
+  bool                                 stopped_;
+  std::vector<IListener*>              listeners_;    // Constant once started
+  std::map<std::string, Subscriber*>   subscribers_;  // Constant after construction
+  std::vector<boost::thread*>          threads_;
+
+  ChangeFeed();  // Singleton pattern
+
+  static void Worker(ChangeFeed* that,
+                     Subscriber* subscriber);
+
+  bool IsStopped();
+
+  // Returns the number of notifications in the batch
+  size_t ProcessBatch(Subscriber& subscriber);
+
+public:
+  static ChangeFeed& GetInstance();
+
+  ~ChangeFeed();
+
+  bool IsEnabled() const
+  {
+    return !subscribers_.empty();
+  }
+
+  // The listeners must be registered before "Start()", and must
+  // outlive the feed
+  void Register(IListener& listener);
+
+  void Start();
+
+  void Stop();
+
+  // Parses the resource name carried by a notification, i.e.
+  // "projects/.../datasets/{dataset}/dicomStores/{store}/dicomWeb/
+  // studies/{study}/series/{series}/instances/{instance}"
+  static bool ParseResourceName(Change& target,
+                                const std::string& name);
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
@@ -0,0 +1,218 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "CircuitBreaker.h"
+
+#include "GoogleConfiguration.h"
+
+#include <Logging.h>
+
+#include <algorithm>
+#include <map>
+#include <memory>
+
+
+static const unsigned int MAX_COOLDOWN_FACTOR = 16;
+
+
+CircuitBreaker::CircuitBreaker(const std::string& endpoint,
+                               unsigned int threshold,
+                               unsigned int cooldownSeconds) :
+  endpoint_(endpoint),
+  threshold_(std::max(1u, threshold)),
+  cooldownSeconds_(std::max(1u, cooldownSeconds)),
+  state_(State_Closed),
+  consecutiveFailures_(0),
+  consecutiveOpenings_(0),
+  probing_(false),
+  random_(std::random_device()())
+{
+}
+
+
+void CircuitBreaker::Open(const boost::posix_time::ptime& now,
+                          unsigned int retryAfterSeconds)
+{
+  // The cooldown doubles each time the probe fails, up to a limit
+  const unsigned int factor = std::min(MAX_COOLDOWN_FACTOR, 1u << std::min(consecutiveOpenings_, 4u));
+  const unsigned int cooldown = std::max(cooldownSeconds_ * factor, retryAfterSeconds);
+
+  if (state_ != State_Open)
+  {
+    LOG(WARNING) << "Opening the circuit breaker of the token endpoint " << endpoint_
+                 << " for " << cooldown << " seconds";
+  }
+
+  state_ = State_Open;
+  probing_ = false;
+  consecutiveOpenings_++;
+  reopenTime_ = now + boost::posix_time::seconds(cooldown);
+}
+
+
+bool CircuitBreaker::Acquire(boost::posix_time::time_duration& delay)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  if (state_ == State_Open &&
+      now >= reopenTime_)
+  {
+    state_ = State_HalfOpen;
+  }
+
+  switch (state_)
+  {
+    case State_Closed:
+      return true;
+
+    case State_HalfOpen:
+      if (!probing_)
+      {
+        probing_ = true;  // This caller is the probe
+        return true;
+      }
+      else
+      {
+        // Full jitter over the cooldown, to desynchronize the accounts
+        std::uniform_int_distribution<unsigned int> distribution(0, cooldownSeconds_ * 1000);
+        delay = boost::posix_time::milliseconds(distribution(random_));
+        return false;
+      }
+
+    case State_Open:
+    {
+      std::uniform_int_distribution<unsigned int> distribution(0, cooldownSeconds_ * 1000);
+      delay = (reopenTime_ - now) + boost::posix_time::milliseconds(distribution(random_));
+      return false;
+    }
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+void CircuitBreaker::Report(bool healthy,
+                            unsigned int retryAfterSeconds)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  if (retryAfterSeconds != 0)
+  {
+    // The endpoint explicitly asks all its clients to back off
+    Open(now, retryAfterSeconds);
+  }
+  else if (healthy)
+  {
+    if (state_ != State_Closed)
+    {
+      LOG(WARNING) << "Closing the circuit breaker of the token endpoint " << endpoint_;
+    }
+
+    state_ = State_Closed;
+    probing_ = false;
+    consecutiveFailures_ = 0;
+    consecutiveOpenings_ = 0;
+  }
+  else
+  {
+    consecutiveFailures_++;
+
+    if (state_ == State_HalfOpen ||
+        (state_ == State_Closed &&
+         consecutiveFailures_ >= threshold_))
+    {
+      Open(now, 0);
+    }
+  }
+}
+
+
+CircuitBreaker::State CircuitBreaker::GetState()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (state_ == State_Open &&
+      boost::posix_time::microsec_clock::universal_time() >= reopenTime_)
+  {
+    return State_HalfOpen;
+  }
+  else
+  {
+    return state_;
+  }
+}
+
+
+const char* CircuitBreaker::EnumerationToString(State state)
+{
+  switch (state)
+  {
+    case State_Closed:
+      return "Closed";
+
+    case State_HalfOpen:
+      return "HalfOpen";
+
+    case State_Open:
+      return "Open";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+CircuitBreaker& CircuitBreaker::GetInstance(const std::string& endpoint)
+{
+  typedef std::map<std::string, std::unique_ptr<CircuitBreaker> >  Breakers;
+
+  static boost::mutex mutex_;
+  static Breakers breakers_;
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::unique_ptr<CircuitBreaker>& breaker = breakers_[endpoint];
+  if (breaker.get() == NULL)
+  {
+    const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+    breaker.reset(new CircuitBreaker(endpoint, configuration.GetCircuitBreakerThreshold(),
+                                     configuration.GetCircuitBreakerCooldownSeconds()));
+  }
+
+  return *breaker;
+}
@@ -0,0 +1,103 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <random>
+#include <string>
+
+
+/**
+ * Circuit breaker that is shared by all the accounts whose tokens
+ * are delivered by the same OAuth 2.0 endpoint. After a number of
+ * consecutive failures of the endpoint (network errors, HTTP 429 or
+ * HTTP 5xx), or if the endpoint asks to back off ("Retry-After"), no
+ * token request is issued until the end of a cooldown period. Then,
+ * one single request probes the endpoint ("half-open" state), and
+ * the other accounts are spread over the next cooldown period.
+ **/
+class CircuitBreaker : public boost::noncopyable
+{
+public:
+  enum State
+  {
+    State_Closed = 0,
+    State_HalfOpen = 1,
+    State_Open = 2
+  };
+
+private:
+  boost::mutex              mutex_;
+  std::string               endpoint_;
+  unsigned int              threshold_;
+  unsigned int              cooldownSeconds_;
+  State                     state_;
+  unsigned int              consecutiveFailures_;
+  unsigned int              consecutiveOpenings_;
+  boost::posix_time::ptime  reopenTime_;
+  bool                      probing_;
+  std::mt19937              random_;
+
+  void Open(const boost::posix_time::ptime& now,
+            unsigned int retryAfterSeconds);
+
+public:
+  CircuitBreaker(const std::string& endpoint,
+                 unsigned int threshold,
+                 unsigned int cooldownSeconds);
+
+  const std::string& GetEndpoint() const
+  {
+    return endpoint_;
+  }
+
+  // Returns "true" if a token request can be issued now. Otherwise,
+  // "delay" is set to the (jittered) time to wait before retrying.
+  bool Acquire(boost::posix_time::time_duration& delay);
+
+  // Reports the outcome of a request that was allowed by "Acquire()".
+  // "healthy" must be "false" only if the endpoint itself has failed.
+  void Report(bool healthy,
+              unsigned int retryAfterSeconds);
+
+  State GetState();
+
+  static const char* EnumerationToString(State state);
+
+  // One circuit breaker per endpoint, created on first use
+  static CircuitBreaker& GetInstance(const std::string& endpoint);
+};
@@ -0,0 +1,798 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ColdTierStorage.h"
+
+#include "GoogleConfiguration.h"
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+#include "PluginToolbox.h"
+
+#include <DicomFormat/DicomStreamReader.h>
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cassert>
+#include <streambuf>
+
+
+static const unsigned int FETCH_WAIT_MARGIN = 10;  // In seconds, beyond the HTTP timeouts of the leader
+
+
+class ColdTierStorage::Fetch : public boost::noncopyable
+{
+public:
+  bool                 done_;     // Protected by the mutex of the storage
+  Orthanc::ErrorCode   error_;
+  std::string          dicom_;    // Immutable once "done_" is set
+
+  Fetch() :
+    done_(false),
+    error_(Orthanc::ErrorCode_InternalError)
+  {
+  }
+};
+
+
+class ColdTierStorage::FetchGuard : public boost::noncopyable
+{
+private:
+  ColdTierStorage&        storage_;
+  std::string             uuid_;
+  std::shared_ptr<Fetch>  fetch_;
+  Orthanc::ErrorCode      error_;
+  double                  elapsedMs_;
+
+public:
+  FetchGuard(ColdTierStorage& storage,
+             const std::string& uuid,
+             std::shared_ptr<Fetch> fetch) :
+    storage_(storage),
+    uuid_(uuid),
+    fetch_(fetch),
+    error_(Orthanc::ErrorCode_InternalError),
+    elapsedMs_(0)
+  {
+  }
+
+  ~FetchGuard()
+  {
+    {
+      boost::mutex::scoped_lock lock(storage_.mutex_);
+
+      fetch_->done_ = true;
+      fetch_->error_ = error_;
+      storage_.fetches_.erase(uuid_);
+
+      if (error_ == Orthanc::ErrorCode_Success)
+      {
+        storage_.missLatency_.Add(elapsedMs_);
+      }
+    }
+
+    storage_.fetchDone_.notify_all();
+  }
+
+  void SetResult(Orthanc::ErrorCode error,
+                 double elapsedMs)
+  {
+    error_ = error;
+    elapsedMs_ = elapsedMs;
+  }
+};
+
+
+namespace
+{
+  // Read-only "std::istream" over the buffer provided by Orthanc, to
+  // avoid copying the full DICOM file just to read a few tags
+  class MemoryBuffer : public std::streambuf
+  {
+  public:
+    MemoryBuffer(const void* data,
+                 size_t size)
+    {
+      char* start = const_cast<char*>(reinterpret_cast<const char*>(data));
+      setg(start, start, start + size);
+    }
+  };
+
+
+  class LocationVisitor : public Orthanc::DicomStreamReader::IVisitor
+  {
+  private:
+    ColdTierStorage::Location&  location_;
+
+    static std::string CleanUid(const std::string& value)
+    {
+      // UIDs are padded with a NULL byte to get an even length
+      size_t length = value.size();
+      while (length > 0 &&
+             (value[length - 1] == '\0' ||
+              value[length - 1] == ' '))
+      {
+        length--;
+      }
+
+      return Orthanc::Toolbox::StripSpaces(value.substr(0, length));
+    }
+
+  public:
+    explicit LocationVisitor(ColdTierStorage::Location& location) :
+      location_(location)
+    {
+    }
+
+    virtual void VisitMetaHeaderTag(const Orthanc::DicomTag& tag,
+                                    const Orthanc::ValueRepresentation& vr,
+                                    const std::string& value) override
+    {
+    }
+
+    virtual void VisitTransferSyntax(Orthanc::DicomTransferSyntax transferSyntax) override
+    {
+    }
+
+    virtual bool VisitDatasetTag(const Orthanc::DicomTag& tag,
+                                 const Orthanc::ValueRepresentation& vr,
+                                 const std::string& value,
+                                 bool isLittleEndian,
+                                 uint64_t fileOffset) override
+    {
+      if (tag == Orthanc::DicomTag(0x0008, 0x0018))
+      {
+        location_.instance_ = CleanUid(value);
+      }
+      else if (tag == Orthanc::DicomTag(0x0020, 0x000d))
+      {
+        location_.study_ = CleanUid(value);
+      }
+      else if (tag == Orthanc::DicomTag(0x0020, 0x000e))
+      {
+        location_.series_ = CleanUid(value);
+        return false;  // The tags are sorted, no need to go further
+      }
+
+      return (tag.GetGroup() <= 0x0020);
+    }
+  };
+}
+
+
+static bool ReadLocalFile(void*& content,
+                          int64_t& size,
+                          const boost::filesystem::path& path)
+{
+  boost::filesystem::ifstream f(path, std::ios::in | std::ios::binary);
+  if (!f.good())
+  {
+    return false;
+  }
+
+  f.seekg(0, std::ios::end);
+  const std::streamsize length = f.tellg();
+  f.seekg(0, std::ios::beg);
+
+  if (length < 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+  }
+
+  content = malloc(length == 0 ? 1 : static_cast<size_t>(length));
+  if (content == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+  }
+
+  if (length > 0 &&
+      !f.read(reinterpret_cast<char*>(content), length))
+  {
+    free(content);
+    content = NULL;
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile,
+                                    "Cannot read file: " + path.string());
+  }
+
+  size = static_cast<int64_t>(length);
+  return true;
+}
+
+
+ColdTierStorage::ColdTierStorage() :
+  tracker_(GoogleConfiguration::GetInstance().GetColdTierHalfLifeSeconds()),
+  readsCount_(0),
+  localHitsCount_(0),
+  coldHitsCount_(0),
+  sharedFetchesCount_(0),
+  failuresCount_(0)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  accountName_ = configuration.GetColdTierAccount();
+  if (accountName_.empty())
+  {
+    return;
+  }
+
+  const GoogleAccount* account = configuration.LookupAccount(accountName_);
+  if (account == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Unknown Google Cloud Platform account for the cold tier: " + accountName_);
+  }
+
+  std::string dataset = configuration.GetColdTierDataset();
+  std::string dicomStore = configuration.GetColdTierDicomStore();
+
+  if (dataset.empty() ||
+      dicomStore.empty())
+  {
+    if (account->IsDiscovery())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The cold tier must provide \"Dataset\" and \"DicomStore\", as account \"" +
+                                      accountName_ + "\" uses the discovery mode");
+    }
+
+    dataset = account->GetDataset();
+    dicomStore = account->GetDicomStore();
+  }
+
+  root_ = PluginToolbox::ResolveConfigurationPath(configuration.GetStorageDirectory());
+  dicomWebUrl_ = account->GetDicomWebUrl(configuration.GetBaseGoogleUrl(), dataset, dicomStore);
+
+  LOG(WARNING) << "The DICOM store \"" << dataset << "/" << dicomStore << "\" of account \""
+               << accountName_ << "\" is the cold tier of the storage area: " << root_.string();
+}
+
+
+ColdTierStorage& ColdTierStorage::GetInstance()
+{
+  static ColdTierStorage storage;
+  return storage;
+}
+
+
+boost::filesystem::path ColdTierStorage::GetPath(const std::string& uuid) const
+{
+  // Same layout as "Orthanc::FilesystemStorage"
+  if (uuid.size() < 4 ||
+      uuid.find('/') != std::string::npos ||
+      uuid.find('\\') != std::string::npos)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  return root_ / uuid.substr(0, 2) / uuid.substr(2, 2) / uuid;
+}
+
+
+boost::filesystem::path ColdTierStorage::GetLocationPath(const std::string& uuid) const
+{
+  boost::filesystem::path path = GetPath(uuid);
+  path += ".gcp";
+  return path;
+}
+
+
+bool ColdTierStorage::ReadLocation(Location& location,
+                                   const std::string& uuid) const
+{
+  const boost::filesystem::path path = GetLocationPath(uuid);
+  if (!Orthanc::SystemToolbox::IsRegularFile(path.string()))
+  {
+    return false;
+  }
+
+  std::string content;
+  Orthanc::SystemToolbox::ReadFile(content, path.string());
+
+  Json::Value json;
+  if (!OrthancPlugins::ReadJson(json, content) ||
+      json.type() != Json::objectValue ||
+      !json.isMember("StudyInstanceUID") ||
+      !json.isMember("SeriesInstanceUID") ||
+      !json.isMember("SOPInstanceUID"))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile,
+                                    "Bad cold tier location: " + path.string());
+  }
+
+  location.study_ = json["StudyInstanceUID"].asString();
+  location.series_ = json["SeriesInstanceUID"].asString();
+  location.instance_ = json["SOPInstanceUID"].asString();
+  return true;
+}
+
+
+void ColdTierStorage::WriteLocation(const std::string& uuid,
+                                    const Location& location) const
+{
+  Json::Value json = Json::objectValue;
+  json["StudyInstanceUID"] = location.study_;
+  json["SeriesInstanceUID"] = location.series_;
+  json["SOPInstanceUID"] = location.instance_;
+
+  std::string s;
+  OrthancPlugins::WriteFastJson(s, json);
+  Orthanc::SystemToolbox::WriteFile(s, GetLocationPath(uuid).string());
+}
+
+
+void ColdTierStorage::GetAuthorizationHeader(std::string& header) const
+{
+  if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName_))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Unauthorized,
+                                    "No token is available yet for Google Cloud Platform account: " + accountName_);
+  }
+}
+
+
+void ColdTierStorage::RetrieveInstance(std::string& dicom,
+                                       const Location& location) const
+{
+  const std::string url = (dicomWebUrl_ + "studies/" + location.study_ + "/series/" +
+                           location.series_ + "/instances/" + location.instance_);
+
+  std::string header;
+  GetAuthorizationHeader(header);
+
+  try
+  {
+    HealthcareClient::RetrieveInstance(dicom, url, header);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Retry once if the token has expired in the meantime
+    if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+        GoogleUpdater::GetInstance().HandleRejectedToken(accountName_, header))
+    {
+      GetAuthorizationHeader(header);
+      HealthcareClient::RetrieveInstance(dicom, url, header);
+    }
+    else
+    {
+      throw;
+    }
+  }
+}
+
+
+void ColdTierStorage::ListRemoteInstances(std::set<std::string>& target,
+                                          const std::string& study,
+                                          const std::string& series) const
+{
+  static const unsigned int PAGE_SIZE = 5000;  // Maximum "limit" accepted by Google for instances
+
+  target.clear();
+
+  std::string header;
+  GetAuthorizationHeader(header);
+
+  for (unsigned int offset = 0; ; offset += PAGE_SIZE)
+  {
+    const std::string url = (dicomWebUrl_ + "studies/" + study + "/series/" + series +
+                             "/instances?includefield=00080018&limit=" +
+                             boost::lexical_cast<std::string>(PAGE_SIZE) + "&offset=" +
+                             boost::lexical_cast<std::string>(offset));
+
+    Json::Value answer;
+
+    try
+    {
+      HealthcareClient::Search(answer, url, header);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+          GoogleUpdater::GetInstance().HandleRejectedToken(accountName_, header))
+      {
+        GetAuthorizationHeader(header);
+        HealthcareClient::Search(answer, url, header);
+      }
+      else
+      {
+        throw;
+      }
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+    {
+      const Json::Value& value = answer[i]["00080018"]["Value"];
+      if (value.type() == Json::arrayValue &&
+          value.size() == 1 &&
+          value[0].type() == Json::stringValue)
+      {
+        target.insert(value[0].asString());
+      }
+    }
+
+    if (answer.size() < PAGE_SIZE)
+    {
+      return;
+    }
+  }
+}
+
+
+bool ColdTierStorage::EvictLocalFile(const std::string& uuid)
+{
+  if (!Orthanc::SystemToolbox::IsRegularFile(GetLocationPath(uuid).string()))
+  {
+    return false;
+  }
+
+  // A concurrent reader that has already opened the file keeps on
+  // reading it, the next readers will fetch it from Google
+  boost::system::error_code error;
+  boost::filesystem::remove(GetPath(uuid), error);
+
+  if (error)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                    "Cannot evict file: " + GetPath(uuid).string());
+  }
+
+  tracker_.NotifyEvicted(uuid);
+  return true;
+}
+
+
+void ColdTierStorage::FetchMissingFile(std::string& dicom,
+                                       const std::string& uuid)
+{
+  std::shared_ptr<Fetch> fetch;
+  bool isLeader = false;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Fetches::const_iterator found = fetches_.find(uuid);
+    if (found == fetches_.end())
+    {
+      fetch.reset(new Fetch);
+      fetches_[uuid] = fetch;
+      isLeader = true;
+    }
+    else
+    {
+      fetch = found->second;
+      sharedFetchesCount_++;
+    }
+  }
+
+  if (isLeader)
+  {
+    FetchGuard guard(*this, uuid, fetch);
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    const boost::filesystem::path path = GetPath(uuid);
+    Orthanc::ErrorCode error = Orthanc::ErrorCode_Success;
+
+    try
+    {
+      if (Orthanc::SystemToolbox::IsRegularFile(path.string()))
+      {
+        // Written back by a fetch that completed after our local miss
+        Orthanc::SystemToolbox::ReadFile(fetch->dicom_, path.string());
+      }
+      else
+      {
+        Location location;
+        if (!ReadLocation(location, uuid))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile,
+                                          "Missing file without cold tier location: " + path.string());
+        }
+
+        RetrieveInstance(fetch->dicom_, location);
+
+        try
+        {
+          // Write back locally, atomically for the concurrent readers
+          boost::filesystem::path tmp = path;
+          tmp += ".tmp";
+          Orthanc::SystemToolbox::WriteFile(fetch->dicom_, tmp.string());
+          boost::filesystem::rename(tmp, path);
+        }
+        catch (std::exception& e)
+        {
+          LOG(WARNING) << "Cannot write back the file fetched from the cold tier: " << e.what();
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(WARNING) << "Cannot write back the file fetched from the cold tier: " << e.What();
+        }
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot fetch attachment " << uuid << " from the cold tier: " << e.What();
+      error = e.GetErrorCode();
+    }
+    catch (std::bad_alloc&)
+    {
+      LOG(ERROR) << "Cannot fetch attachment " << uuid << " from the cold tier: Not enough memory";
+      error = Orthanc::ErrorCode_NotEnoughMemory;
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "Cannot fetch attachment " << uuid << " from the cold tier: " << e.what();
+      error = Orthanc::ErrorCode_InternalError;
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "Cannot fetch attachment " << uuid << " from the cold tier: Native exception";
+      error = Orthanc::ErrorCode_InternalError;
+    }
+
+    const double elapsedMs = static_cast<double>(
+      (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000.0;
+
+    guard.SetResult(error, elapsedMs);
+  }
+  else
+  {
+    // The leader waits at most for the token, and for the retrieval
+    // of the instance that is retried once if the token is rejected
+    const unsigned int timeout = GoogleConfiguration::GetInstance().GetTimeoutSeconds();
+    const boost::posix_time::ptime deadline = (boost::posix_time::microsec_clock::universal_time() +
+                                               boost::posix_time::seconds(3 * timeout + FETCH_WAIT_MARGIN));
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (!fetch->done_)
+    {
+      if (!fetchDone_.timed_wait(lock, deadline) &&
+          !fetch->done_)
+      {
+        failuresCount_++;
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Timeout,
+                                        "Timeout while waiting for the cold tier to fetch attachment " + uuid);
+      }
+    }
+  }
+
+  {
+    // Each miss is accounted, whether it has issued the fetch or not
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (fetch->error_ == Orthanc::ErrorCode_Success)
+    {
+      coldHitsCount_++;
+    }
+    else
+    {
+      failuresCount_++;
+    }
+  }
+
+  if (fetch->error_ == Orthanc::ErrorCode_Success)
+  {
+    dicom = fetch->dicom_;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(fetch->error_);
+  }
+}
+
+
+void ColdTierStorage::Create(const std::string& uuid,
+                             const void* content,
+                             int64_t size,
+                             OrthancPluginContentType type)
+{
+  const boost::filesystem::path path = GetPath(uuid);
+
+  try
+  {
+    boost::filesystem::create_directories(path.parent_path());
+  }
+  catch (boost::filesystem::filesystem_error&)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                    "Cannot create directory: " + path.parent_path().string());
+  }
+
+  Orthanc::SystemToolbox::WriteFile(content, static_cast<size_t>(size), path.string());
+
+  if (type == OrthancPluginContentType_Dicom)
+  {
+    Location location;
+    const bool hasLocation = ParseLocation(location, content, static_cast<size_t>(size));
+
+    if (hasLocation)
+    {
+      WriteLocation(uuid, location);
+    }
+
+    tracker_.NotifyCreated(uuid, static_cast<uint64_t>(size), hasLocation);
+
+    if (!hasLocation)
+    {
+      LOG(WARNING) << "Attachment " << uuid << " cannot be served by the cold tier, "
+                   << "as its UIDs cannot be read (is \"StorageCompression\" enabled?)";
+    }
+  }
+}
+
+
+void ColdTierStorage::Read(void*& content,
+                           int64_t& size,
+                           const std::string& uuid,
+                           OrthancPluginContentType type)
+{
+  const bool isDicom = (type == OrthancPluginContentType_Dicom);
+
+  if (ReadLocalFile(content, size, GetPath(uuid)))
+  {
+    if (isDicom)
+    {
+      tracker_.NotifyAccess(uuid, static_cast<uint64_t>(size));
+
+      boost::mutex::scoped_lock lock(mutex_);
+      readsCount_++;
+      localHitsCount_++;
+    }
+
+    return;
+  }
+
+  if (!isDicom)
+  {
+    // Only the DICOM files are in the cold tier
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile);
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    readsCount_++;
+  }
+
+  std::string dicom;
+  FetchMissingFile(dicom, uuid);
+  tracker_.NotifyAccess(uuid, dicom.size());
+
+  content = malloc(dicom.empty() ? 1 : dicom.size());
+  if (content == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+  }
+
+  if (!dicom.empty())
+  {
+    memcpy(content, dicom.c_str(), dicom.size());
+  }
+
+  size = static_cast<int64_t>(dicom.size());
+}
+
+
+void ColdTierStorage::Remove(const std::string& uuid,
+                             OrthancPluginContentType type)
+{
+  const boost::filesystem::path path = GetPath(uuid);
+
+  boost::system::error_code error;
+  boost::filesystem::remove(path, error);
+  boost::filesystem::remove(GetLocationPath(uuid), error);
+  tracker_.NotifyRemoved(uuid);
+
+  // Remove the parent directories if they are empty, as Orthanc does
+  boost::filesystem::remove(path.parent_path(), error);
+  if (!error)
+  {
+    boost::filesystem::remove(path.parent_path().parent_path(), error);
+  }
+}
+
+
+bool ColdTierStorage::ParseLocation(Location& location,
+                                    const void* dicom,
+                                    size_t size)
+{
+  MemoryBuffer buffer(dicom, size);
+  std::istream stream(&buffer);
+  return ParseLocation(location, stream);
+}
+
+
+bool ColdTierStorage::ParseLocation(Location& location,
+                                    std::istream& dicom)
+{
+  location = Location();
+
+  try
+  {
+    LocationVisitor visitor(location);
+    Orthanc::DicomStreamReader reader(dicom);
+    reader.Consume(visitor);
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    return false;
+  }
+
+  return (!location.study_.empty() &&
+          !location.series_.empty() &&
+          !location.instance_.empty());
+}
+
+
+void ColdTierStorage::Format(Json::Value& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target = Json::objectValue;
+  target["Account"] = accountName_;
+  target["DicomWebUrl"] = dicomWebUrl_;
+  target["StorageDirectory"] = root_.string();
+  target["ReadsCount"] = static_cast<Json::UInt64>(readsCount_);
+  target["LocalHitsCount"] = static_cast<Json::UInt64>(localHitsCount_);
+  target["ColdHitsCount"] = static_cast<Json::UInt64>(coldHitsCount_);
+  target["SharedFetchesCount"] = static_cast<Json::UInt64>(sharedFetchesCount_);
+  target["FailuresCount"] = static_cast<Json::UInt64>(failuresCount_);
+  target["PendingFetches"] = static_cast<Json::UInt64>(fetches_.size());
+  missLatency_.Format(target["MissLatency"]);
+}
+
+
+void ColdTierStorage::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const uint64_t misses = readsCount_ - localHitsCount_;
+
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_cold_tier_reads", static_cast<float>(readsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_cold_tier_local_hits", static_cast<float>(localHitsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_cold_tier_cold_hits", static_cast<float>(coldHitsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_cold_tier_shared_fetches", static_cast<float>(sharedFetchesCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_cold_tier_failures", static_cast<float>(failuresCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_cold_tier_local_hit_rate",
+                                  readsCount_ == 0 ? 0.0f : static_cast<float>(localHitsCount_) / static_cast<float>(readsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_cold_tier_cold_hit_rate",
+                                  misses == 0 ? 0.0f : static_cast<float>(coldHitsCount_) / static_cast<float>(misses));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_cold_tier_miss_latency_p50_ms", static_cast<float>(missLatency_.GetPercentile(0.5)));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_cold_tier_miss_latency_p95_ms", static_cast<float>(missLatency_.GetPercentile(0.95)));
+#endif
+}
@@ -0,0 +1,167 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "AccessTracker.h"
+#include "HttpTimings.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/filesystem/path.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <memory>
+#include <set>
+
+
+/**
+ * Storage area of Orthanc that uses a DICOM store of Google as a cold
+ * tier behind the local filesystem. The local layout is the one of
+ * the default storage area of Orthanc ("StorageDirectory"), so that
+ * existing storages can be reused. When a DICOM file is created, the
+ * UIDs of the instance are saved in a small sidecar file next to it.
+ * If the DICOM file is later missing locally, the read path fetches
+ * the instance from Google through WADO-RS, using the UIDs of the
+ * sidecar and the token of the account, and writes it back locally.
+ * Concurrent misses on the same file share one single fetch.
+ **/
+class ColdTierStorage : public boost::noncopyable
+{
+public:
+  struct Location
+  {
+    std::string  study_;
+    std::string  series_;
+    std::string  instance_;
+  };
+
+private:
+  class Fetch;        // One fetch from Google, shared by the concurrent misses
+  class FetchGuard;   // Completes the fetch and wakes its waiters, whatever happens
+  typedef std::map<std::string, std::shared_ptr<Fetch> >  Fetches;
+
+  std::string              accountName_;
+  std::string              dicomWebUrl_;   // Empty if the cold tier is disabled
+  boost::filesystem::path  root_;
+  AccessTracker            tracker_;
+
+  boost::mutex               mutex_;
+  boost::condition_variable  fetchDone_;
+  Fetches                    fetches_;
+  uint64_t                   readsCount_;
+  uint64_t                   localHitsCount_;
+  uint64_t                   coldHitsCount_;
+  uint64_t                   sharedFetchesCount_;
+  uint64_t                   failuresCount_;
+  HttpTimings::Histogram     missLatency_;
+
+  ColdTierStorage();  // Singleton pattern
+
+  boost::filesystem::path GetPath(const std::string& uuid) const;
+
+  boost::filesystem::path GetLocationPath(const std::string& uuid) const;
+
+  void GetAuthorizationHeader(std::string& header) const;
+
+  void RetrieveInstance(std::string& dicom,
+                        const Location& location) const;
+
+  void FetchMissingFile(std::string& dicom,
+                        const std::string& uuid);
+
+public:
+  static ColdTierStorage& GetInstance();
+
+  bool IsEnabled() const
+  {
+    return !dicomWebUrl_.empty();
+  }
+
+  void Create(const std::string& uuid,
+              const void* content,
+              int64_t size,
+              OrthancPluginContentType type);
+
+  // The content is allocated with "malloc()", as expected by the SDK
+  void Read(void*& content,
+            int64_t& size,
+            const std::string& uuid,
+            OrthancPluginContentType type);
+
+  void Remove(const std::string& uuid,
+              OrthancPluginContentType type);
+
+  const boost::filesystem::path& GetRoot() const
+  {
+    return root_;
+  }
+
+  AccessTracker& GetTracker()
+  {
+    return tracker_;
+  }
+
+  // Returns "false" if the UIDs of the file are unknown
+  bool ReadLocation(Location& location,
+                    const std::string& uuid) const;
+
+  // Saves the UIDs of an existing local file (e.g. found by a scan)
+  void WriteLocation(const std::string& uuid,
+                     const Location& location) const;
+
+  // SOP instance UIDs of one series in the DICOM store of Google
+  void ListRemoteInstances(std::set<std::string>& target,
+                           const std::string& study,
+                           const std::string& series) const;
+
+  // Removes the local copy of a file, that will be served by Google.
+  // Returns "false" if the UIDs of the file are unknown.
+  bool EvictLocalFile(const std::string& uuid);
+
+  // Reads the study, series and SOP instance UIDs from a DICOM file,
+  // without parsing it beyond these tags. Returns "false" if the file
+  // cannot be parsed (e.g. if "StorageCompression" is enabled).
+  static bool ParseLocation(Location& location,
+                            const void* dicom,
+                            size_t size);
+
+  static bool ParseLocation(Location& location,
+                            std::istream& dicom);
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
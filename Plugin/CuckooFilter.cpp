@@ -0,0 +1,321 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "CuckooFilter.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+#include <string.h>
+
+
+static const char     FILE_MAGIC[] = "GCPCKO01";
+static const size_t   FILE_MAGIC_SIZE = 8;
+static const unsigned int MAX_KICKS = 500;
+
+
+static uint64_t HashString(const std::string& value)
+{
+  // 64-bit FNV-1a, followed by the finalizer of MurmurHash3 so that
+  // the low bits (bucket) and the high bits (fingerprint) are mixed
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < value.size(); i++)
+  {
+    hash ^= static_cast<uint8_t>(value[i]);
+    hash *= 1099511628211ull;
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
+
+CuckooFilter::CuckooFilter(uint64_t capacity) :
+  count_(0),
+  droppedCount_(0),
+  random_(0x9e3779b97f4a7c15ull)
+{
+  size_t buckets = 1;
+  while (buckets * SLOTS_PER_BUCKET < capacity)
+  {
+    buckets *= 2;
+  }
+
+  slots_.resize(buckets * SLOTS_PER_BUCKET, 0);
+  bucketsMask_ = buckets - 1;
+}
+
+
+void CuckooFilter::GetPosition(uint16_t& fingerprint,
+                               size_t& bucket1,
+                               size_t& bucket2,
+                               const std::string& item) const
+{
+  const uint64_t hash = HashString(item);
+
+  fingerprint = static_cast<uint16_t>(hash >> 48);
+  if (fingerprint == 0)
+  {
+    fingerprint = 1;   // 0 marks the empty slots
+  }
+
+  bucket1 = static_cast<size_t>(hash) & bucketsMask_;
+  bucket2 = GetAlternateBucket(bucket1, fingerprint);
+}
+
+
+size_t CuckooFilter::GetAlternateBucket(size_t bucket,
+                                        uint16_t fingerprint) const
+{
+  // Partial-key cuckoo hashing: The alternate bucket only depends on
+  // the current bucket and on the fingerprint, which is an involution
+  return (bucket ^ static_cast<size_t>(fingerprint * 0x5bd1e995u)) & bucketsMask_;
+}
+
+
+bool CuckooFilter::InsertIntoBucket(size_t bucket,
+                                    uint16_t fingerprint)
+{
+  uint16_t* slots = &slots_[bucket * SLOTS_PER_BUCKET];
+
+  for (size_t i = 0; i < SLOTS_PER_BUCKET; i++)
+  {
+    if (slots[i] == 0)
+    {
+      slots[i] = fingerprint;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+bool CuckooFilter::ContainsInBucket(size_t bucket,
+                                    uint16_t fingerprint) const
+{
+  const uint16_t* slots = &slots_[bucket * SLOTS_PER_BUCKET];
+
+  for (size_t i = 0; i < SLOTS_PER_BUCKET; i++)
+  {
+    if (slots[i] == fingerprint)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+bool CuckooFilter::RemoveFromBucket(size_t bucket,
+                                    uint16_t fingerprint)
+{
+  uint16_t* slots = &slots_[bucket * SLOTS_PER_BUCKET];
+
+  for (size_t i = 0; i < SLOTS_PER_BUCKET; i++)
+  {
+    if (slots[i] == fingerprint)
+    {
+      slots[i] = 0;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+bool CuckooFilter::Add(const std::string& item)
+{
+  uint16_t fingerprint;
+  size_t bucket1, bucket2;
+  GetPosition(fingerprint, bucket1, bucket2, item);
+
+  if (ContainsInBucket(bucket1, fingerprint) ||
+      ContainsInBucket(bucket2, fingerprint))
+  {
+    // Already present (or collision with another item): Adding the
+    // same fingerprint again would waste the slots of the bucket
+    return true;
+  }
+
+  if (InsertIntoBucket(bucket1, fingerprint) ||
+      InsertIntoBucket(bucket2, fingerprint))
+  {
+    count_++;
+    return true;
+  }
+
+  // Both buckets are full: Relocate fingerprints at random
+  size_t bucket = ((random_ & 1) ? bucket1 : bucket2);
+
+  for (unsigned int kick = 0; kick < MAX_KICKS; kick++)
+  {
+    // xorshift64
+    random_ ^= random_ << 13;
+    random_ ^= random_ >> 7;
+    random_ ^= random_ << 17;
+
+    std::swap(fingerprint, slots_[bucket * SLOTS_PER_BUCKET + (random_ % SLOTS_PER_BUCKET)]);
+
+    bucket = GetAlternateBucket(bucket, fingerprint);
+    if (InsertIntoBucket(bucket, fingerprint))
+    {
+      count_++;
+      return true;
+    }
+  }
+
+  // The fingerprint that is left over is dropped
+  droppedCount_++;
+  return false;
+}
+
+
+bool CuckooFilter::MightContain(const std::string& item) const
+{
+  uint16_t fingerprint;
+  size_t bucket1, bucket2;
+  GetPosition(fingerprint, bucket1, bucket2, item);
+
+  return (ContainsInBucket(bucket1, fingerprint) ||
+          ContainsInBucket(bucket2, fingerprint));
+}
+
+
+bool CuckooFilter::Remove(const std::string& item)
+{
+  uint16_t fingerprint;
+  size_t bucket1, bucket2;
+  GetPosition(fingerprint, bucket1, bucket2, item);
+
+  if (RemoveFromBucket(bucket1, fingerprint) ||
+      RemoveFromBucket(bucket2, fingerprint))
+  {
+    count_--;
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+void CuckooFilter::Clear()
+{
+  std::fill(slots_.begin(), slots_.end(), 0);
+  count_ = 0;
+  droppedCount_ = 0;
+}
+
+
+void CuckooFilter::Save(const std::string& path) const
+{
+  const std::string tmp = path + ".tmp";
+
+  {
+    std::ofstream stream(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!stream.good())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot write the presence filter: " + tmp);
+    }
+
+    const uint64_t size = slots_.size();
+    stream.write(FILE_MAGIC, FILE_MAGIC_SIZE);
+    stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    stream.write(reinterpret_cast<const char*>(&count_), sizeof(count_));
+    stream.write(reinterpret_cast<const char*>(&droppedCount_), sizeof(droppedCount_));
+    stream.write(reinterpret_cast<const char*>(&slots_[0]), slots_.size() * sizeof(uint16_t));
+
+    stream.flush();
+    if (!stream.good())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot write the presence filter: " + tmp);
+    }
+  }
+
+  if (rename(tmp.c_str(), path.c_str()) != 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot write the presence filter: " + path);
+  }
+}
+
+
+bool CuckooFilter::Load(const std::string& path)
+{
+  std::ifstream stream(path.c_str(), std::ios::in | std::ios::binary);
+  if (!stream.good())
+  {
+    return false;
+  }
+
+  char magic[FILE_MAGIC_SIZE];
+  uint64_t size, count, dropped;
+
+  if (!stream.read(magic, FILE_MAGIC_SIZE) ||
+      memcmp(magic, FILE_MAGIC, FILE_MAGIC_SIZE) != 0 ||
+      !stream.read(reinterpret_cast<char*>(&size), sizeof(size)) ||
+      !stream.read(reinterpret_cast<char*>(&count), sizeof(count)) ||
+      !stream.read(reinterpret_cast<char*>(&dropped), sizeof(dropped)))
+  {
+    LOG(WARNING) << "Ignoring invalid presence filter: " << path;
+    return false;
+  }
+
+  if (size != slots_.size())
+  {
+    LOG(WARNING) << "Ignoring the presence filter, as its capacity has changed: " << path;
+    return false;
+  }
+
+  if (!stream.read(reinterpret_cast<char*>(&slots_[0]), slots_.size() * sizeof(uint16_t)))
+  {
+    LOG(WARNING) << "Ignoring truncated presence filter: " << path;
+    Clear();
+    return false;
+  }
+
+  count_ = count;
+  droppedCount_ = dropped;
+  return true;
+}
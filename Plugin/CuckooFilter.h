@@ -0,0 +1,123 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * Approximate set of strings, that answers "possibly present" or
+ * "definitely absent" with 16-bit fingerprints stored in buckets of
+ * 4 slots (cuckoo filter, Fan et al., 2014). Contrarily to a Bloom
+ * filter, the items can be removed. With 16-bit fingerprints, the
+ * false positive rate is about 0.01% at a load of 95%. The filter has
+ * a fixed capacity: Once full, the insertions may drop an older
+ * fingerprint, which then becomes a false negative. This class is
+ * not thread-safe.
+ **/
+class CuckooFilter : public boost::noncopyable
+{
+private:
+  static const size_t SLOTS_PER_BUCKET = 4;
+
+  std::vector<uint16_t>  slots_;
+  size_t                 bucketsMask_;
+  uint64_t               count_;
+  uint64_t               droppedCount_;
+  uint64_t               random_;
+
+  void GetPosition(uint16_t& fingerprint,
+                   size_t& bucket1,
+                   size_t& bucket2,
+                   const std::string& item) const;
+
+  size_t GetAlternateBucket(size_t bucket,
+                            uint16_t fingerprint) const;
+
+  bool InsertIntoBucket(size_t bucket,
+                        uint16_t fingerprint);
+
+  bool ContainsInBucket(size_t bucket,
+                        uint16_t fingerprint) const;
+
+  bool RemoveFromBucket(size_t bucket,
+                        uint16_t fingerprint);
+
+public:
+  // The number of buckets is rounded to a power of two
+  explicit CuckooFilter(uint64_t capacity);
+
+  // Returns "false" if the filter is full, in which case another
+  // item has possibly been dropped
+  bool Add(const std::string& item);
+
+  bool MightContain(const std::string& item) const;
+
+  // Removing an item that was not added may remove another item
+  // sharing the same fingerprint, which becomes a false negative
+  bool Remove(const std::string& item);
+
+  void Clear();
+
+  uint64_t GetCount() const
+  {
+    return count_;
+  }
+
+  uint64_t GetDroppedCount() const
+  {
+    return droppedCount_;
+  }
+
+  uint64_t GetCapacity() const
+  {
+    return slots_.size();
+  }
+
+  uint64_t GetMemoryUsage() const
+  {
+    return slots_.size() * sizeof(uint16_t);
+  }
+
+  // Native byte order: The file is only meant to be read back on the
+  // same host. The capacity of the file must match this filter.
+  void Save(const std::string& path) const;
+
+  // Returns "false" if the file is missing or invalid
+  bool Load(const std::string& path);
+};
@@ -0,0 +1,292 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "CurlBuilder.h"
+
+#include "GoogleConfiguration.h"
+#include "HttpTimings.h"
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+
+static std::atomic<bool>  aborted_(false);
+
+namespace
+{
+  struct LastResponse
+  {
+    long          httpStatus_;
+    bool          hasRetryAfter_;
+    unsigned int  retryAfter_;
+  };
+}
+
+static thread_local LastResponse  lastResponse_ = { 0, false, 0 };
+static thread_local std::string   lastBody_;    // Truncated to "MAX_BODY_SIZE"
+
+static const size_t MAX_BODY_SIZE = 16384;
+
+
+namespace
+{
+  class HandleFactory : public google::cloud::storage::internal::DefaultCurlHandleFactory
+  {
+  private:
+    // Called by libcurl about once per second, even if the transfer
+    // is stalled. A non-zero value aborts the transfer.
+    static int ProgressCallback(void* clientp,
+                                curl_off_t dltotal,
+                                curl_off_t dlnow,
+                                curl_off_t ultotal,
+                                curl_off_t ulnow)
+    {
+      return aborted_ ? 1 : 0;
+    }
+
+    // Receives the header lines of the HTTP answers, that are not
+    // exposed by the "Status" objects of google-cloud-cpp
+    static int DebugCallback(CURL* handle,
+                             curl_infotype type,
+                             char* data,
+                             size_t size,
+                             void* userptr)
+    {
+      if (type == CURLINFO_HEADER_IN)
+      {
+        std::string line(data, size);
+        boost::algorithm::trim(line);
+
+        if (boost::starts_with(line, "HTTP/"))
+        {
+          // New status line (there can be several of them, e.g. "100 Continue")
+          const size_t space = line.find(' ');
+          lastResponse_.httpStatus_ = 0;
+          lastResponse_.hasRetryAfter_ = false;
+          lastBody_.clear();
+
+          if (space != std::string::npos)
+          {
+            try
+            {
+              lastResponse_.httpStatus_ = boost::lexical_cast<long>(line.substr(space + 1, 3));
+            }
+            catch (boost::bad_lexical_cast&)
+            {
+            }
+          }
+        }
+        else if (boost::istarts_with(line, "retry-after:"))
+        {
+          try
+          {
+            std::string value = line.substr(12);
+            boost::algorithm::trim(value);
+            lastResponse_.retryAfter_ = boost::lexical_cast<unsigned int>(value);
+            lastResponse_.hasRetryAfter_ = true;
+          }
+          catch (boost::bad_lexical_cast&)
+          {
+            // HTTP-date form, ignored
+          }
+        }
+      }
+      else if (type == CURLINFO_DATA_IN &&
+               lastBody_.size() < MAX_BODY_SIZE)
+      {
+        lastBody_.append(data, std::min(size, MAX_BODY_SIZE - lastBody_.size()));
+      }
+
+      return 0;
+    }
+
+    // Replaces "curl_easy_cleanup()" as the deleter of the handles,
+    // in order to collect their timings once the transfer is over
+    static void CleanupHandle(CURL* handle)
+    {
+      if (handle != NULL)
+      {
+        try
+        {
+          HttpTimings::GetInstance().Record(HttpTimings::EndpointClass_Token, handle);
+        }
+        catch (...)
+        {
+          // Never throw from a deleter
+        }
+
+        curl_easy_cleanup(handle);
+      }
+    }
+
+  public:
+    google::cloud::storage::internal::CurlPtr CreateHandle() override
+    {
+      google::cloud::storage::internal::CurlPtr handle
+        (google::cloud::storage::internal::DefaultCurlHandleFactory::CreateHandle());
+
+      const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+      long timeout = static_cast<long>(configuration.GetTimeoutSeconds());
+
+      if (!configuration.GetCaInfo().empty() &&
+          curl_easy_setopt(handle.get(), CURLOPT_CAINFO, configuration.GetCaInfo().c_str()) != CURLE_OK)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                        "Cannot set the trusted Certificate Authorities");
+      }
+
+      bool ok;
+        
+      if (configuration.IsHttpsVerifyPeers())
+      {
+        ok = (curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYHOST, 2) == CURLE_OK &&
+              curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYPEER, 1) == CURLE_OK &&
+              curl_easy_setopt(handle.get(), CURLOPT_TIMEOUT, timeout) == CURLE_OK);
+      }
+      else
+      {
+        ok = (curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYHOST, 0) == CURLE_OK &&
+              curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYPEER, 0) == CURLE_OK);
+      }
+
+      ok = (ok &&
+            curl_easy_setopt(handle.get(), CURLOPT_NOPROGRESS, 0L) == CURLE_OK &&
+            curl_easy_setopt(handle.get(), CURLOPT_XFERINFOFUNCTION, ProgressCallback) == CURLE_OK &&
+            curl_easy_setopt(handle.get(), CURLOPT_DEBUGFUNCTION, DebugCallback) == CURLE_OK &&
+            curl_easy_setopt(handle.get(), CURLOPT_VERBOSE, 1L) == CURLE_OK);
+
+      if (!ok)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                        "Cannot initialize a libcurl handle");
+      }
+
+      return google::cloud::storage::internal::CurlPtr(handle.release(), &CleanupHandle);
+    }
+
+    google::cloud::storage::internal::CurlMulti CreateMultiHandle() override
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+  };
+}
+
+
+CurlBuilder::CurlBuilder(const std::string& base_url,
+                         const std::shared_ptr<google::cloud::storage::internal::CurlHandleFactory>& factory) :
+  CurlRequestBuilder(base_url, std::make_shared<HandleFactory>())
+{
+}
+
+
+void CurlBuilder::SetAborted(bool aborted)
+{
+  aborted_ = aborted;
+}
+
+
+bool CurlBuilder::IsAborted()
+{
+  return aborted_;
+}
+
+
+void CurlBuilder::ResetLastResponse()
+{
+  lastResponse_.httpStatus_ = 0;
+  lastResponse_.hasRetryAfter_ = false;
+  lastResponse_.retryAfter_ = 0;
+  lastBody_.clear();
+}
+
+
+long CurlBuilder::GetLastHttpStatus()
+{
+  return lastResponse_.httpStatus_;
+}
+
+
+bool CurlBuilder::LookupLastRetryAfter(unsigned int& seconds)
+{
+  if (lastResponse_.hasRetryAfter_)
+  {
+    seconds = lastResponse_.retryAfter_;
+    return true;
+  }
+  else
+  {
+    return false;
+  }
+}
+
+
+bool CurlBuilder::LookupLastExpiresIn(unsigned int& seconds)
+{
+  // Lightweight lookup of the "expires_in" field of the JSON answer
+  // of the token endpoint, without parsing (nor copying) the token
+  static const char* const FIELD = "\"expires_in\"";
+
+  if (lastResponse_.httpStatus_ != 200)
+  {
+    return false;
+  }
+
+  size_t pos = lastBody_.find(FIELD);
+  if (pos == std::string::npos)
+  {
+    return false;
+  }
+
+  pos = lastBody_.find_first_not_of(" \t\r\n:", pos + strlen(FIELD));
+  if (pos == std::string::npos)
+  {
+    return false;
+  }
+
+  const size_t end = lastBody_.find_first_not_of("0123456789", pos);
+
+  try
+  {
+    seconds = boost::lexical_cast<unsigned int>(lastBody_.substr(pos, end == std::string::npos ? std::string::npos : end - pos));
+    return true;
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    return false;
+  }
+}
@@ -0,0 +1,70 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <google/cloud/storage/internal/curl_handle_factory.h>
+#include <google/cloud/storage/internal/curl_request_builder.h>
+
+
+/**
+ * Builder for the HTTP requests that are issued by the OAuth 2.0
+ * credentials of google-cloud-cpp. The libcurl handles are configured
+ * according to the "HttpsCACertificates", "HttpsVerifyPeers" and
+ * "GoogleCloudPlatform.Timeout" options of Orthanc.
+ **/
+class CurlBuilder : public google::cloud::storage::internal::CurlRequestBuilder
+{
+public:
+  CurlBuilder(const std::string& base_url,
+              const std::shared_ptr<google::cloud::storage::internal::CurlHandleFactory>& factory);
+
+  // Once set, all the in-flight and future transfers are aborted
+  // (typically because Orthanc is stopping)
+  static void SetAborted(bool aborted);
+
+  static bool IsAborted();
+
+  // Information about the last HTTP response that was received by
+  // the calling thread, as libcurl runs the transfers synchronously
+  static void ResetLastResponse();
+
+  // Returns 0 if no HTTP response was received (e.g. network error)
+  static long GetLastHttpStatus();
+
+  // Only the "delta-seconds" form of the "Retry-After" header is supported
+  static bool LookupLastRetryAfter(unsigned int& seconds);
+
+  // Lifetime of the token delivered by the last OAuth 2.0 answer
+  static bool LookupLastExpiresIn(unsigned int& seconds);
+};
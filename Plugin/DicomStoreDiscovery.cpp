@@ -0,0 +1,310 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "DicomStoreDiscovery.h"
+
+#include "CurlBuilder.h"
+#include "HealthcareClient.h"
+#include "PluginToolbox.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+#include <boost/thread.hpp>
+
+
+static const char* const PAGE_SIZE = "1000";   // Maximum allowed by the Healthcare API
+
+
+DicomStoreDiscovery::DicomStoreDiscovery(const GoogleAccount& account,
+                                         const std::string& baseGoogleUrl,
+                                         const std::string& authorizationHeader) :
+  account_(account),
+  baseGoogleUrl_(baseGoogleUrl),
+  authorizationHeader_(authorizationHeader),
+  lastPage_(false),
+  failed_(false),
+  datasetsCount_(0),
+  requestsCount_(0)
+{
+}
+
+
+std::string DicomStoreDiscovery::GetResourceId(const std::string& resourceName)
+{
+  const size_t slash = resourceName.rfind('/');
+  if (slash == std::string::npos)
+  {
+    return resourceName;
+  }
+  else
+  {
+    return resourceName.substr(slash + 1);
+  }
+}
+
+
+void DicomStoreDiscovery::GetPage(Json::Value& page,
+                                  const std::string& url,
+                                  const std::string& pageToken)
+{
+  std::string uri = url + "?pageSize=" + PAGE_SIZE;
+
+  if (!pageToken.empty())
+  {
+    std::string encoded;
+    Orthanc::Toolbox::UriEncode(encoded, pageToken);
+    uri += "&pageToken=" + encoded;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    requestsCount_++;
+  }
+
+  HealthcareClient::Get(page, uri, authorizationHeader_, HttpTimings::EndpointClass_Other);
+}
+
+
+bool DicomStoreDiscovery::DequeueDataset(std::string& dataset)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (pendingDatasets_.empty() &&
+         !lastPage_ &&
+         !failed_)
+  {
+    changed_.wait(lock);
+  }
+
+  if (pendingDatasets_.empty() ||
+      failed_)
+  {
+    return false;
+  }
+  else
+  {
+    dataset = pendingDatasets_.front();
+    pendingDatasets_.pop_front();
+    return true;
+  }
+}
+
+
+void DicomStoreDiscovery::ListDicomStores(const std::string& dataset)
+{
+  const std::string url = (account_.GetDatasetsUrl(baseGoogleUrl_) + "/" + dataset + "/dicomStores");
+
+  std::string pageToken;
+
+  do
+  {
+    Json::Value page;
+    GetPage(page, url, pageToken);
+
+    std::set<DicomStore> matches;
+
+    if (page.isMember("dicomStores") &&
+        page["dicomStores"].type() == Json::arrayValue)
+    {
+      const Json::Value& stores = page["dicomStores"];
+      for (Json::Value::ArrayIndex i = 0; i < stores.size(); i++)
+      {
+        if (stores[i].isMember("name") &&
+            stores[i]["name"].type() == Json::stringValue)
+        {
+          const std::string store = GetResourceId(stores[i]["name"].asString());
+          if (PluginToolbox::MatchWildcard(account_.GetDicomStore(), store))
+          {
+            matches.insert(std::make_pair(dataset, store));
+          }
+        }
+      }
+    }
+
+    if (page.isMember("nextPageToken") &&
+        page["nextPageToken"].type() == Json::stringValue)
+    {
+      pageToken = page["nextPageToken"].asString();
+    }
+    else
+    {
+      pageToken.clear();
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    stores_.insert(matches.begin(), matches.end());
+
+    if (failed_)
+    {
+      return;  // Another thread has failed, the result will be discarded
+    }
+  }
+  while (!pageToken.empty());
+}
+
+
+void DicomStoreDiscovery::SetFailure(const std::string& error)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!failed_)
+  {
+    failed_ = true;
+    error_ = error;
+  }
+
+  changed_.notify_all();
+}
+
+
+void DicomStoreDiscovery::Worker(DicomStoreDiscovery* that)
+{
+  std::string dataset;
+
+  while (that->DequeueDataset(dataset))
+  {
+    try
+    {
+      that->ListDicomStores(dataset);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      that->SetFailure(e.What());
+    }
+  }
+}
+
+
+bool DicomStoreDiscovery::Run(std::set<DicomStore>& target,
+                              unsigned int threadsCount)
+{
+  std::vector<boost::thread*> workers(std::max(1u, threadsCount));
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    workers[i] = new boost::thread(Worker, this);
+  }
+
+  try
+  {
+    // The pages of datasets are chained by their tokens, but the
+    // DICOM stores of one page are listed while reading the next one
+    const std::string url = account_.GetDatasetsUrl(baseGoogleUrl_);
+    std::string pageToken;
+
+    do
+    {
+      if (CurlBuilder::IsAborted())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                        "Orthanc is stopping");
+      }
+
+      Json::Value page;
+      GetPage(page, url, pageToken);
+
+      if (page.isMember("datasets") &&
+          page["datasets"].type() == Json::arrayValue)
+      {
+        const Json::Value& datasets = page["datasets"];
+
+        boost::mutex::scoped_lock lock(mutex_);
+
+        for (Json::Value::ArrayIndex i = 0; i < datasets.size(); i++)
+        {
+          if (datasets[i].isMember("name") &&
+              datasets[i]["name"].type() == Json::stringValue)
+          {
+            const std::string dataset = GetResourceId(datasets[i]["name"].asString());
+            if (PluginToolbox::MatchWildcard(account_.GetDataset(), dataset))
+            {
+              pendingDatasets_.push_back(dataset);
+              datasetsCount_++;
+            }
+          }
+        }
+
+        changed_.notify_all();
+      }
+
+      if (page.isMember("nextPageToken") &&
+          page["nextPageToken"].type() == Json::stringValue)
+      {
+        pageToken = page["nextPageToken"].asString();
+      }
+      else
+      {
+        pageToken.clear();
+      }
+
+      boost::mutex::scoped_lock lock(mutex_);
+      if (failed_)
+      {
+        break;  // A worker has failed, don't read the next pages
+      }
+    }
+    while (!pageToken.empty());
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    SetFailure(e.What());
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    lastPage_ = true;
+    changed_.notify_all();
+  }
+
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    if (workers[i]->joinable())
+    {
+      workers[i]->join();
+    }
+
+    delete workers[i];
+  }
+
+  if (failed_)
+  {
+    LOG(ERROR) << "Cannot discover the DICOM stores of Google Cloud Platform account \""
+               << account_.GetName() << "\": " << error_;
+    return false;
+  }
+  else
+  {
+    target.swap(stores_);
+    return true;
+  }
+}
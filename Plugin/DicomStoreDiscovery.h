@@ -0,0 +1,111 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "GoogleAccount.h"
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <list>
+#include <set>
+
+
+/**
+ * Lists the DICOM stores of the project/location of one account
+ * through the Healthcare API, keeping those that match the wildcard
+ * filters of the account. The pages of datasets are read by the
+ * calling thread, while a pool of threads lists the DICOM stores of
+ * the datasets that have already been received. One object is
+ * created for each discovery.
+ **/
+class DicomStoreDiscovery : public boost::noncopyable
+{
+public:
+  typedef std::pair<std::string, std::string>  DicomStore;  // (dataset, DICOM store)
+
+private:
+  const GoogleAccount&       account_;
+  std::string                baseGoogleUrl_;
+  std::string                authorizationHeader_;
+  boost::mutex               mutex_;
+  boost::condition_variable  changed_;
+  std::list<std::string>     pendingDatasets_;
+  bool                       lastPage_;      // All the datasets have been queued
+  bool                       failed_;
+  std::string                error_;
+  std::set<DicomStore>       stores_;
+  unsigned int               datasetsCount_;
+  unsigned int               requestsCount_;
+
+  void GetPage(Json::Value& page,
+               const std::string& url,
+               const std::string& pageToken);
+
+  bool DequeueDataset(std::string& dataset);
+
+  void ListDicomStores(const std::string& dataset);
+
+  void SetFailure(const std::string& error);
+
+  static void Worker(DicomStoreDiscovery* that);
+
+public:
+  DicomStoreDiscovery(const GoogleAccount& account,
+                      const std::string& baseGoogleUrl,
+                      const std::string& authorizationHeader);
+
+  // Returns "false" if any request has failed: In such a case, the
+  // caller must keep its previous list of DICOM stores
+  bool Run(std::set<DicomStore>& target,
+           unsigned int threadsCount);
+
+  const std::string& GetError() const
+  {
+    return error_;
+  }
+
+  unsigned int GetDatasetsCount() const
+  {
+    return datasetsCount_;
+  }
+
+  unsigned int GetRequestsCount() const
+  {
+    return requestsCount_;
+  }
+
+  // "projects/p/locations/l/datasets/d" => "d"
+  static std::string GetResourceId(const std::string& resourceName);
+};
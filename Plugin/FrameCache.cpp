@@ -0,0 +1,1032 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "FrameCache.h"
+
+#include "GoogleConfiguration.h"
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+#include "PluginToolbox.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+static const size_t SHARDS_COUNT = 16;
+static const size_t MAX_QUEUE_SIZE = 1024;      // The oldest prefetches are dropped beyond this size
+static const size_t MAX_PATTERNS = 4096;        // Instances whose access pattern is tracked
+static const size_t STRIDES_HISTORY = 16;
+static const char* const DISK_MAGIC = "GCPFRM01";
+static const size_t DISK_MAGIC_SIZE = 8;
+static const char* const DISK_EXTENSION = ".frame";
+
+
+class FrameCache::Shard : public boost::noncopyable
+{
+public:
+  typedef std::list<std::pair<std::string, uint64_t> >  DiskFrames;  // Key and file size
+
+  boost::mutex                               mutex_;
+  boost::condition_variable                  fetched_;
+  Frames                                     memory_;
+  std::map<std::string, Frames::iterator>    memoryIndex_;
+  uint64_t                                   memorySize_;
+  DiskFrames                                 disk_;
+  std::map<std::string, DiskFrames::iterator>  diskIndex_;
+  uint64_t                                   diskSize_;
+  std::set<std::string>                      pending_;   // Frames being fetched
+
+  Shard() :
+    memorySize_(0),
+    diskSize_(0)
+  {
+  }
+};
+
+
+static uint64_t HashKey(const std::string& key)
+{
+  // 64-bit FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+
+  for (size_t i = 0; i < key.size(); i++)
+  {
+    hash ^= static_cast<uint8_t>(key[i]);
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
+
+
+static uint64_t GetFrameSize(const std::string& key,
+                             const std::string& body,
+                             const std::string& contentType)
+{
+  return key.size() + body.size() + contentType.size();
+}
+
+
+static void RetrieveFrames(std::string& body,
+                           std::string& contentType,
+                           const std::string& accountName,
+                           const std::string& url,
+                           const std::string& accept)
+{
+  std::string header;
+  if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Unauthorized,
+                                    "No token is available yet for Google Cloud Platform account: " + accountName);
+  }
+
+  try
+  {
+    HealthcareClient::RetrieveFrames(body, contentType, url, header, accept);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Retry once if the token has expired in the meantime
+    if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+        GoogleUpdater::GetInstance().HandleRejectedToken(accountName, header) &&
+        GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+    {
+      HealthcareClient::RetrieveFrames(body, contentType, url, header, accept);
+    }
+    else
+    {
+      throw;
+    }
+  }
+}
+
+
+static void WriteDiskFile(const std::string& path,
+                          const std::string& key,
+                          const std::string& body,
+                          const std::string& contentType)
+{
+  // Magic, size of the key, size of the content type, key, content type, body
+  const uint32_t sizes[2] = { static_cast<uint32_t>(key.size()), static_cast<uint32_t>(contentType.size()) };
+
+  std::string file;
+  file.reserve(DISK_MAGIC_SIZE + sizeof(sizes) + key.size() + contentType.size() + body.size());
+  file.append(DISK_MAGIC, DISK_MAGIC_SIZE);
+  file.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+  file.append(key);
+  file.append(contentType);
+  file.append(body);
+
+  Orthanc::SystemToolbox::WriteFile(file, path);
+}
+
+
+static bool ParseDiskFile(std::string& body,
+                          std::string& contentType,
+                          const std::string& file,
+                          const std::string& key)
+{
+  uint32_t sizes[2];
+
+  if (file.size() < DISK_MAGIC_SIZE + sizeof(sizes) ||
+      memcmp(file.c_str(), DISK_MAGIC, DISK_MAGIC_SIZE) != 0)
+  {
+    return false;
+  }
+
+  memcpy(sizes, file.c_str() + DISK_MAGIC_SIZE, sizeof(sizes));
+
+  const size_t header = DISK_MAGIC_SIZE + sizeof(sizes);
+  if (file.size() < header + static_cast<size_t>(sizes[0]) + static_cast<size_t>(sizes[1]) ||
+      file.compare(header, sizes[0], key) != 0)  // Collision of the hashes of two keys
+  {
+    return false;
+  }
+
+  contentType.assign(file, header + sizes[0], sizes[1]);
+  body.assign(file, header + sizes[0] + sizes[1], std::string::npos);
+  return true;
+}
+
+
+FrameCache::FrameCache() :
+  memoryBudget_(0),
+  diskBudget_(0),
+  prefetchCount_(0),
+  threadsCount_(0),
+  stopped_(false),
+  requestsCount_(0),
+  memoryHitsCount_(0),
+  diskHitsCount_(0),
+  sharedFetchesCount_(0),
+  missesCount_(0),
+  prefetchesCount_(0),
+  prefetchHitsCount_(0),
+  prefetchDroppedCount_(0),
+  prefetchFailuresCount_(0),
+  memoryEvictionsCount_(0),
+  diskEvictionsCount_(0)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  memoryBudget_ = configuration.GetFrameCacheSize() / SHARDS_COUNT;
+  prefetchCount_ = configuration.GetFrameCachePrefetch();
+  threadsCount_ = configuration.GetFrameCachePrefetchThreads();
+
+  if (memoryBudget_ > 0 &&
+      !configuration.GetFrameCacheDirectory().empty())
+  {
+    diskBudget_ = configuration.GetFrameCacheDiskSize() / SHARDS_COUNT;
+    directory_ = PluginToolbox::ResolveConfigurationPath(configuration.GetFrameCacheDirectory());
+
+    try
+    {
+      boost::filesystem::create_directories(directory_);
+
+      // The index of the disk tier is not persistent: Discard the frames of a previous run
+      for (boost::filesystem::directory_iterator it(directory_); it != boost::filesystem::directory_iterator(); ++it)
+      {
+        if (boost::filesystem::is_regular_file(it->status()) &&
+            it->path().extension().string() == DISK_EXTENSION)
+        {
+          boost::filesystem::remove(it->path());
+        }
+      }
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                      "Cannot prepare the directory of the frame cache: " + std::string(e.what()));
+    }
+  }
+
+  shards_.resize(SHARDS_COUNT);
+  for (size_t i = 0; i < SHARDS_COUNT; i++)
+  {
+    shards_[i] = new Shard;
+  }
+}
+
+
+FrameCache::~FrameCache()
+{
+  if (!threads_.empty())
+  {
+    LOG(ERROR) << "FrameCache::Stop() should have been called";
+    Stop();
+  }
+
+  for (size_t i = 0; i < shards_.size(); i++)
+  {
+    assert(shards_[i] != NULL);
+    delete shards_[i];
+  }
+}
+
+
+FrameCache& FrameCache::GetInstance()
+{
+  static FrameCache instance;
+  return instance;
+}
+
+
+std::string FrameCache::GetFrameKey(const std::string& instanceUrl,
+                                    unsigned int frame,
+                                    const std::string& accept)
+{
+  return instanceUrl + "frames/" + boost::lexical_cast<std::string>(frame) + "\n" + accept;
+}
+
+
+FrameCache::Shard& FrameCache::GetShard(const std::string& key) const
+{
+  return *shards_[HashKey(key) % SHARDS_COUNT];
+}
+
+
+std::string FrameCache::GetDiskPath(const std::string& key) const
+{
+  char name[32];
+  sprintf(name, "%016llx", static_cast<unsigned long long>(HashKey(key)));
+  return (boost::filesystem::path(directory_) / (std::string(name) + DISK_EXTENSION)).string();
+}
+
+
+void FrameCache::Worker(FrameCache* that)
+{
+  for (;;)
+  {
+    PrefetchTask task;
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      while (!that->stopped_ &&
+             that->queue_.empty())
+      {
+        that->wakeUp_.wait(lock);
+      }
+
+      if (that->stopped_)
+      {
+        return;
+      }
+
+      // The most recent tasks first, as they follow the current viewport
+      task = that->queue_.back();
+      that->queue_.pop_back();
+    }
+
+    that->Prefetch(task);
+  }
+}
+
+
+FrameCache::Source FrameCache::Acquire(Shard& shard,
+                                       const std::string& key,
+                                       std::string& body,
+                                       std::string& contentType,
+                                       bool& prefetched)
+{
+  boost::mutex::scoped_lock lock(shard.mutex_);
+
+  bool waited = false;
+
+  for (;;)
+  {
+    std::map<std::string, Frames::iterator>::iterator found = shard.memoryIndex_.find(key);
+
+    if (found != shard.memoryIndex_.end())
+    {
+      shard.memory_.splice(shard.memory_.begin(), shard.memory_, found->second);
+
+      Frame& frame = *found->second;
+      body = frame.body_;
+      contentType = frame.contentType_;
+      prefetched = frame.prefetched_;
+      frame.prefetched_ = false;
+
+      return (waited ? Source_Shared : Source_Memory);
+    }
+    else if (shard.pending_.find(key) != shard.pending_.end())
+    {
+      // Another thread is fetching this frame: Wait for its result.
+      // If its fetch fails, this thread takes over.
+      waited = true;
+      shard.fetched_.wait(lock);
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  shard.pending_.insert(key);
+
+  std::map<std::string, Shard::DiskFrames::iterator>::iterator found = shard.diskIndex_.find(key);
+  if (found == shard.diskIndex_.end())
+  {
+    return Source_Google;
+  }
+  else
+  {
+    shard.disk_.splice(shard.disk_.begin(), shard.disk_, found->second);
+    return Source_Disk;
+  }
+}
+
+
+void FrameCache::Release(Shard& shard,
+                         const std::string& key)
+{
+  {
+    boost::mutex::scoped_lock lock(shard.mutex_);
+    shard.pending_.erase(key);
+  }
+
+  shard.fetched_.notify_all();
+}
+
+
+void FrameCache::Insert(Shard& shard,
+                        const std::string& key,
+                        const std::string& body,
+                        const std::string& contentType,
+                        bool prefetched)
+{
+  Frames evicted;
+  uint64_t evictionsCount = 0;
+
+  {
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    shard.pending_.erase(key);
+
+    std::map<std::string, Frames::iterator>::iterator found = shard.memoryIndex_.find(key);
+    if (found != shard.memoryIndex_.end())
+    {
+      const Frame& previous = *found->second;
+      shard.memorySize_ -= GetFrameSize(previous.key_, previous.body_, previous.contentType_);
+      shard.memory_.erase(found->second);
+      shard.memoryIndex_.erase(found);
+    }
+
+    const uint64_t size = GetFrameSize(key, body, contentType);
+
+    if (size <= memoryBudget_)
+    {
+      shard.memory_.push_front(Frame());
+
+      Frame& frame = shard.memory_.front();
+      frame.key_ = key;
+      frame.body_ = body;
+      frame.contentType_ = contentType;
+      frame.prefetched_ = prefetched;
+
+      shard.memoryIndex_[key] = shard.memory_.begin();
+      shard.memorySize_ += size;
+    }
+
+    while (shard.memorySize_ > memoryBudget_)
+    {
+      assert(!shard.memory_.empty());
+      Frames::iterator last = --shard.memory_.end();
+
+      shard.memorySize_ -= GetFrameSize(last->key_, last->body_, last->contentType_);
+      shard.memoryIndex_.erase(last->key_);
+      evictionsCount++;
+
+      if (directory_.empty() ||
+          shard.diskIndex_.find(last->key_) != shard.diskIndex_.end())
+      {
+        shard.memory_.erase(last);
+      }
+      else
+      {
+        // Written to the disk tier once the lock is released
+        evicted.splice(evicted.end(), shard.memory_, last);
+      }
+    }
+  }
+
+  shard.fetched_.notify_all();
+
+  if (evictionsCount > 0)
+  {
+    {
+      boost::mutex::scoped_lock lock(statisticsMutex_);
+      memoryEvictionsCount_ += evictionsCount;
+    }
+
+    Spill(shard, evicted);
+  }
+}
+
+
+void FrameCache::Spill(Shard& shard,
+                       Frames& evicted)
+{
+  for (Frames::const_iterator it = evicted.begin(); it != evicted.end(); ++it)
+  {
+    const std::string path = GetDiskPath(it->key_);
+    const uint64_t size = GetFrameSize(it->key_, it->body_, it->contentType_);
+
+    if (size > diskBudget_)
+    {
+      continue;
+    }
+
+    try
+    {
+      WriteDiskFile(path, it->key_, it->body_, it->contentType_);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(WARNING) << "Cannot write to the disk tier of the frame cache: " << e.What();
+      continue;
+    }
+
+    std::vector<std::string> removed;
+
+    {
+      boost::mutex::scoped_lock lock(shard.mutex_);
+
+      if (shard.diskIndex_.find(it->key_) == shard.diskIndex_.end())
+      {
+        shard.disk_.push_front(std::make_pair(it->key_, size));
+        shard.diskIndex_[it->key_] = shard.disk_.begin();
+        shard.diskSize_ += size;
+      }
+
+      while (shard.diskSize_ > diskBudget_)
+      {
+        assert(!shard.disk_.empty());
+        Shard::DiskFrames::iterator last = --shard.disk_.end();
+
+        shard.diskSize_ -= last->second;
+        removed.push_back(GetDiskPath(last->first));
+        shard.diskIndex_.erase(last->first);
+        shard.disk_.erase(last);
+      }
+    }
+
+    if (!removed.empty())
+    {
+      for (size_t i = 0; i < removed.size(); i++)
+      {
+        boost::system::error_code error;
+        boost::filesystem::remove(removed[i], error);
+      }
+
+      boost::mutex::scoped_lock lock(statisticsMutex_);
+      diskEvictionsCount_ += removed.size();
+    }
+  }
+}
+
+
+bool FrameCache::ReadDisk(std::string& body,
+                          std::string& contentType,
+                          Shard& shard,
+                          const std::string& key)
+{
+  const std::string path = GetDiskPath(key);
+
+  std::string file;
+
+  try
+  {
+    Orthanc::SystemToolbox::ReadFile(file, path, false);
+
+    if (ParseDiskFile(body, contentType, file, key))
+    {
+      return true;
+    }
+  }
+  catch (Orthanc::OrthancException&)
+  {
+  }
+
+  // The file has been removed or overwritten in the meantime
+  {
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    std::map<std::string, Shard::DiskFrames::iterator>::iterator found = shard.diskIndex_.find(key);
+    if (found != shard.diskIndex_.end())
+    {
+      shard.diskSize_ -= found->second->second;
+      shard.disk_.erase(found->second);
+      shard.diskIndex_.erase(found);
+    }
+  }
+
+  return false;
+}
+
+
+void FrameCache::RetrieveFrame(std::string& body,
+                               std::string& contentType,
+                               const std::string& accountName,
+                               const std::string& instanceUrl,
+                               unsigned int frame,
+                               const std::string& accept)
+{
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  const std::string key = GetFrameKey(instanceUrl, frame, accept);
+  Shard& shard = GetShard(key);
+
+  bool prefetched = false;
+  Source source = Acquire(shard, key, body, contentType, prefetched);
+
+  if (source == Source_Disk)
+  {
+    if (ReadDisk(body, contentType, shard, key))
+    {
+      Insert(shard, key, body, contentType, false);
+    }
+    else
+    {
+      source = Source_Google;
+    }
+  }
+
+  if (source == Source_Google)
+  {
+    try
+    {
+      RetrieveFrames(body, contentType, accountName, instanceUrl + "frames/" + boost::lexical_cast<std::string>(frame), accept);
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      Release(shard, key);
+      throw;
+    }
+
+    Insert(shard, key, body, contentType, false);
+  }
+
+  const double elapsedMs = static_cast<double>(
+    (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000.0;
+
+  {
+    boost::mutex::scoped_lock lock(statisticsMutex_);
+
+    requestsCount_++;
+
+    switch (source)
+    {
+      case Source_Memory:
+        memoryHitsCount_++;
+        break;
+
+      case Source_Shared:
+        sharedFetchesCount_++;
+        break;
+
+      case Source_Disk:
+        diskHitsCount_++;
+        break;
+
+      case Source_Google:
+        missesCount_++;
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    if (prefetched)
+    {
+      prefetchHitsCount_++;
+    }
+
+    if (source == Source_Google)
+    {
+      missLatency_.Add(elapsedMs);
+    }
+    else
+    {
+      hitLatency_.Add(elapsedMs);
+    }
+  }
+
+  SchedulePrefetch(accountName, instanceUrl, frame, accept);
+}
+
+
+void FrameCache::SchedulePrefetch(const std::string& accountName,
+                                  const std::string& instanceUrl,
+                                  unsigned int frame,
+                                  const std::string& accept)
+{
+  if (prefetchCount_ == 0)
+  {
+    return;
+  }
+
+  const std::string instanceKey = instanceUrl + "\n" + accept;
+  uint64_t droppedCount = 0;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (threads_.empty() ||
+        stopped_)
+    {
+      return;
+    }
+
+    if (patterns_.size() >= MAX_PATTERNS &&
+        patterns_.find(instanceKey) == patterns_.end())
+    {
+      patterns_.clear();  // The patterns of the active instances are quickly learned again
+    }
+
+    Pattern& pattern = patterns_[instanceKey];
+
+    int stride = 0;
+    if (pattern.lastFrame_ != 0)
+    {
+      stride = static_cast<int>(frame) - static_cast<int>(pattern.lastFrame_);
+    }
+
+    if (stride != 0)
+    {
+      pattern.strides_.push_back(stride);
+      if (pattern.strides_.size() > STRIDES_HISTORY)
+      {
+        pattern.strides_.pop_front();
+      }
+    }
+
+    pattern.lastFrame_ = frame;
+
+    // The number of tiles per row is the most frequent stride above
+    // one, i.e. the vertical steps of the viewport
+    std::map<int, unsigned int> counts;
+    for (std::deque<int>::const_iterator it = pattern.strides_.begin(); it != pattern.strides_.end(); ++it)
+    {
+      if (*it > 1 || *it < -1)
+      {
+        counts[std::abs(*it)]++;
+      }
+    }
+
+    int row = 0;
+    unsigned int best = 1;  // A stride must be seen twice to be trusted
+    for (std::map<int, unsigned int>::const_iterator it = counts.begin(); it != counts.end(); ++it)
+    {
+      if (it->second > best)
+      {
+        row = it->first;
+        best = it->second;
+      }
+    }
+
+    // Offsets of the candidates, by decreasing priority: Continuation
+    // of the scan, then the horizontal and vertical neighbours, then
+    // the diagonal ones
+    std::vector<int> offsets;
+
+    if (stride == 1 || stride == -1 ||
+        (row != 0 && (stride == row || stride == -row)))
+    {
+      offsets.push_back(stride);
+      offsets.push_back(2 * stride);
+    }
+
+    offsets.push_back(1);
+    offsets.push_back(-1);
+
+    if (row != 0)
+    {
+      offsets.push_back(row);
+      offsets.push_back(-row);
+      offsets.push_back(row + 1);
+      offsets.push_back(row - 1);
+      offsets.push_back(-row + 1);
+      offsets.push_back(-row - 1);
+    }
+
+    std::vector<unsigned int> candidates;
+
+    for (size_t i = 0; i < offsets.size() && candidates.size() < prefetchCount_; i++)
+    {
+      const int64_t candidate = static_cast<int64_t>(frame) + offsets[i];
+
+      if (candidate >= 1 &&
+          (pattern.limit_ == 0 || candidate < static_cast<int64_t>(pattern.limit_)) &&
+          std::find(candidates.begin(), candidates.end(), static_cast<unsigned int>(candidate)) == candidates.end())
+      {
+        candidates.push_back(static_cast<unsigned int>(candidate));
+      }
+    }
+
+    // Queued in reverse order, as the workers take the most recent tasks first
+    for (size_t i = candidates.size(); i > 0; i--)
+    {
+      PrefetchTask task;
+      task.accountName_ = accountName;
+      task.instanceUrl_ = instanceUrl;
+      task.frame_ = candidates[i - 1];
+      task.accept_ = accept;
+      queue_.push_back(task);
+
+      if (queue_.size() > MAX_QUEUE_SIZE)
+      {
+        queue_.pop_front();
+        droppedCount++;
+      }
+    }
+  }
+
+  wakeUp_.notify_all();
+
+  if (droppedCount > 0)
+  {
+    boost::mutex::scoped_lock lock(statisticsMutex_);
+    prefetchDroppedCount_ += droppedCount;
+  }
+}
+
+
+void FrameCache::Prefetch(const PrefetchTask& task)
+{
+  const std::string key = GetFrameKey(task.instanceUrl_, task.frame_, task.accept_);
+  Shard& shard = GetShard(key);
+
+  {
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    if (shard.memoryIndex_.find(key) != shard.memoryIndex_.end() ||
+        shard.diskIndex_.find(key) != shard.diskIndex_.end() ||
+        shard.pending_.find(key) != shard.pending_.end())
+    {
+      return;  // Already available, or being fetched
+    }
+
+    shard.pending_.insert(key);
+  }
+
+  std::string body, contentType;
+
+  try
+  {
+    RetrieveFrames(body, contentType, task.accountName_,
+                   task.instanceUrl_ + "frames/" + boost::lexical_cast<std::string>(task.frame_), task.accept_);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    Release(shard, key);
+
+    if (e.GetErrorCode() == Orthanc::ErrorCode_InexistentItem)
+    {
+      // Beyond the last frame of the instance: Do not prefetch further
+      boost::mutex::scoped_lock lock(mutex_);
+
+      std::map<std::string, Pattern>::iterator found = patterns_.find(task.instanceUrl_ + "\n" + task.accept_);
+      if (found != patterns_.end() &&
+          (found->second.limit_ == 0 || task.frame_ < found->second.limit_))
+      {
+        found->second.limit_ = task.frame_;
+      }
+    }
+    else
+    {
+      LOG(INFO) << "Cannot prefetch frame " << task.frame_ << " of " << task.instanceUrl_ << ": " << e.What();
+
+      boost::mutex::scoped_lock lock(statisticsMutex_);
+      prefetchFailuresCount_++;
+    }
+
+    return;
+  }
+
+  Insert(shard, key, body, contentType, true);
+
+  boost::mutex::scoped_lock lock(statisticsMutex_);
+  prefetchesCount_++;
+}
+
+
+void FrameCache::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (threads_.empty() &&
+      IsEnabled() &&
+      prefetchCount_ > 0)
+  {
+    stopped_ = false;
+
+    for (unsigned int i = 0; i < threadsCount_; i++)
+    {
+      threads_.push_back(new boost::thread(Worker, this));
+    }
+  }
+}
+
+
+void FrameCache::Stop()
+{
+  std::vector<boost::thread*> threads;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    threads.swap(threads_);
+    queue_.clear();
+  }
+
+  wakeUp_.notify_all();
+
+  for (size_t i = 0; i < threads.size(); i++)
+  {
+    if (threads[i]->joinable())
+    {
+      threads[i]->join();
+    }
+
+    delete threads[i];
+  }
+}
+
+
+void FrameCache::GetFrames(std::string& body,
+                           std::string& contentType,
+                           const std::string& accountName,
+                           const std::string& studyInstanceUid,
+                           const std::string& seriesInstanceUid,
+                           const std::string& sopInstanceUid,
+                           const std::string& frames,
+                           const std::string& accept)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  const GoogleAccount* account = configuration.LookupAccount(accountName);
+  if (account == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Unknown Google Cloud Platform account: " + accountName);
+  }
+
+  if (account->IsDiscovery())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
+                                    "The frames are not available for an account in the discovery mode: " + accountName);
+  }
+
+  const std::string instanceUrl = (account->GetDicomWebUrl(configuration.GetBaseGoogleUrl()) +
+                                   "studies/" + studyInstanceUid + "/series/" + seriesInstanceUid +
+                                   "/instances/" + sopInstanceUid + "/");
+
+  bool single = (!frames.empty() && frames.size() <= 9);
+  for (size_t i = 0; single && i < frames.size(); i++)
+  {
+    single = (frames[i] >= '0' && frames[i] <= '9');
+  }
+
+  const unsigned int frame = (single ? boost::lexical_cast<unsigned int>(frames) : 0);
+
+  if (frame > 0)
+  {
+    RetrieveFrame(body, contentType, accountName, instanceUrl, frame, accept);
+  }
+  else
+  {
+    RetrieveFrames(body, contentType, accountName, instanceUrl + "frames/" + frames, accept);
+  }
+}
+
+
+void FrameCache::Format(Json::Value& target)
+{
+  target = Json::objectValue;
+  target["MemoryBudget"] = static_cast<Json::UInt64>(memoryBudget_ * SHARDS_COUNT);
+  target["PrefetchCount"] = prefetchCount_;
+
+  if (!directory_.empty())
+  {
+    target["Directory"] = directory_;
+    target["DiskBudget"] = static_cast<Json::UInt64>(diskBudget_ * SHARDS_COUNT);
+  }
+
+  uint64_t memoryFrames = 0, memorySize = 0, diskFrames = 0, diskSize = 0, pending = 0;
+
+  for (size_t i = 0; i < shards_.size(); i++)
+  {
+    boost::mutex::scoped_lock lock(shards_[i]->mutex_);
+    memoryFrames += shards_[i]->memoryIndex_.size();
+    memorySize += shards_[i]->memorySize_;
+    diskFrames += shards_[i]->diskIndex_.size();
+    diskSize += shards_[i]->diskSize_;
+    pending += shards_[i]->pending_.size();
+  }
+
+  target["MemoryFramesCount"] = static_cast<Json::UInt64>(memoryFrames);
+  target["MemoryUsage"] = static_cast<Json::UInt64>(memorySize);
+  target["DiskFramesCount"] = static_cast<Json::UInt64>(diskFrames);
+  target["DiskUsage"] = static_cast<Json::UInt64>(diskSize);
+  target["PendingFetches"] = static_cast<Json::UInt64>(pending);
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    target["PrefetchQueueSize"] = static_cast<Json::UInt64>(queue_.size());
+  }
+
+  boost::mutex::scoped_lock lock(statisticsMutex_);
+
+  const uint64_t hits = memoryHitsCount_ + diskHitsCount_ + sharedFetchesCount_;
+
+  target["RequestsCount"] = static_cast<Json::UInt64>(requestsCount_);
+  target["MemoryHitsCount"] = static_cast<Json::UInt64>(memoryHitsCount_);
+  target["DiskHitsCount"] = static_cast<Json::UInt64>(diskHitsCount_);
+  target["SharedFetchesCount"] = static_cast<Json::UInt64>(sharedFetchesCount_);
+  target["MissesCount"] = static_cast<Json::UInt64>(missesCount_);
+  target["HitRate"] = (requestsCount_ == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(requestsCount_));
+  target["PrefetchesCount"] = static_cast<Json::UInt64>(prefetchesCount_);
+  target["PrefetchHitsCount"] = static_cast<Json::UInt64>(prefetchHitsCount_);
+  target["PrefetchDroppedCount"] = static_cast<Json::UInt64>(prefetchDroppedCount_);
+  target["PrefetchFailuresCount"] = static_cast<Json::UInt64>(prefetchFailuresCount_);
+  target["MemoryEvictionsCount"] = static_cast<Json::UInt64>(memoryEvictionsCount_);
+  target["DiskEvictionsCount"] = static_cast<Json::UInt64>(diskEvictionsCount_);
+  hitLatency_.Format(target["HitLatency"]);
+  missLatency_.Format(target["MissLatency"]);
+}
+
+
+void FrameCache::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  uint64_t memorySize = 0, diskSize = 0;
+
+  for (size_t i = 0; i < shards_.size(); i++)
+  {
+    boost::mutex::scoped_lock lock(shards_[i]->mutex_);
+    memorySize += shards_[i]->memorySize_;
+    diskSize += shards_[i]->diskSize_;
+  }
+
+  boost::mutex::scoped_lock lock(statisticsMutex_);
+
+  const uint64_t hits = memoryHitsCount_ + diskHitsCount_ + sharedFetchesCount_;
+
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_memory", static_cast<float>(memorySize));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_disk", static_cast<float>(diskSize));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_requests", static_cast<float>(requestsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_memory_hits", static_cast<float>(memoryHitsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_disk_hits", static_cast<float>(diskHitsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_misses", static_cast<float>(missesCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_hit_rate",
+                                  requestsCount_ == 0 ? 0.0f : static_cast<float>(hits) / static_cast<float>(requestsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_prefetches", static_cast<float>(prefetchesCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_prefetch_hits", static_cast<float>(prefetchHitsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_hit_latency_p50_ms", static_cast<float>(hitLatency_.GetPercentile(0.5)));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_hit_latency_p99_ms", static_cast<float>(hitLatency_.GetPercentile(0.99)));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_miss_latency_p50_ms", static_cast<float>(missLatency_.GetPercentile(0.5)));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_frame_cache_miss_latency_p99_ms", static_cast<float>(missLatency_.GetPercentile(0.99)));
+#endif
+}
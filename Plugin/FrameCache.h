@@ -0,0 +1,220 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "HttpTimings.h"
+
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+
+
+/**
+ * Cache of the frames retrieved by WADO-RS from the DICOM stores,
+ * through "/gcp/accounts/{name}/studies/{study}/series/{series}/
+ * instances/{instance}/frames/{frame}". It is meant for the tiles of
+ * the whole-slide images, where each pan of the viewer sends hundreds
+ * of small requests that would each cost a round trip to Google.
+ *
+ * The frames are keyed by the DICOM store, the instance, the frame
+ * number and the "Accept" header (that selects the transfer syntax).
+ * The index is split into shards with their own lock, so that the
+ * concurrent requests of a viewer rarely contend. Each shard has a
+ * least-recently-used memory tier within its part of "FrameCacheSize",
+ * whose evicted frames are spilled to the optional disk tier in
+ * "FrameCacheDirectory". Concurrent requests for the same frame share
+ * one single fetch.
+ *
+ * After each access, up to "FrameCachePrefetch" neighbouring frames
+ * are fetched in the background. The neighbours are predicted from
+ * the access pattern of the instance: The stride between successive
+ * frames gives the scan direction of the viewport, and the most
+ * frequent stride above one gives the number of tiles per row.
+ **/
+class FrameCache : public boost::noncopyable
+{
+private:
+  struct Frame
+  {
+    std::string  key_;
+    std::string  body_;
+    std::string  contentType_;
+    bool         prefetched_;   // Fetched by a prefetch, not accessed yet
+  };
+
+  typedef std::list<Frame>  Frames;   // The most recently used frame first
+
+  class Shard;
+
+  struct PrefetchTask
+  {
+    std::string   accountName_;
+    std::string   instanceUrl_;
+    unsigned int  frame_;
+    std::string   accept_;
+  };
+
+  // Access pattern of the frames of one instance
+  struct Pattern
+  {
+    unsigned int      lastFrame_;
+    std::deque<int>   strides_;
+    unsigned int      limit_;      // First frame known to be missing (0 if unknown)
+  };
+
+  enum Source
+  {
+    Source_Memory,
+    Source_Shared,
+    Source_Disk,
+    Source_Google
+  };
+
+  uint64_t                       memoryBudget_;   // Per shard
+  uint64_t                       diskBudget_;     // Per shard
+  std::string                    directory_;      // Empty if no disk tier
+  unsigned int                   prefetchCount_;
+  unsigned int                   threadsCount_;
+  std::vector<Shard*>            shards_;
+
+  boost::mutex                   mutex_;          // Protects the prefetch queue and the patterns
+  boost::condition_variable      wakeUp_;
+  bool                           stopped_;
+  std::deque<PrefetchTask>       queue_;
+  std::map<std::string, Pattern> patterns_;
+  std::vector<boost::thread*>    threads_;
+
+  boost::mutex                   statisticsMutex_;
+  uint64_t                       requestsCount_;
+  uint64_t                       memoryHitsCount_;
+  uint64_t                       diskHitsCount_;
+  uint64_t                       sharedFetchesCount_;
+  uint64_t                       missesCount_;
+  uint64_t                       prefetchesCount_;
+  uint64_t                       prefetchHitsCount_;
+  uint64_t                       prefetchDroppedCount_;
+  uint64_t                       prefetchFailuresCount_;
+  uint64_t                       memoryEvictionsCount_;
+  uint64_t                       diskEvictionsCount_;
+  HttpTimings::Histogram         hitLatency_;
+  HttpTimings::Histogram         missLatency_;
+
+  FrameCache();  // Singleton pattern
+
+  static void Worker(FrameCache* that);
+
+  static std::string GetFrameKey(const std::string& instanceUrl,
+                                 unsigned int frame,
+                                 const std::string& accept);
+
+  Shard& GetShard(const std::string& key) const;
+
+  std::string GetDiskPath(const std::string& key) const;
+
+  // Looks for the frame in the memory tier, possibly waiting for a
+  // concurrent fetch. If "Source_Disk" or "Source_Google" is
+  // returned, the caller is in charge of the fetch, and must call
+  // "Insert()" or "Release()".
+  Source Acquire(Shard& shard,
+                 const std::string& key,
+                 std::string& body,
+                 std::string& contentType,
+                 bool& prefetched);
+
+  void Insert(Shard& shard,
+              const std::string& key,
+              const std::string& body,
+              const std::string& contentType,
+              bool prefetched);
+
+  void Release(Shard& shard,
+               const std::string& key);
+
+  // Moves the frames evicted from the memory tier to the disk tier
+  void Spill(Shard& shard,
+             Frames& evicted);
+
+  bool ReadDisk(std::string& body,
+                std::string& contentType,
+                Shard& shard,
+                const std::string& key);
+
+  void RetrieveFrame(std::string& body,
+                     std::string& contentType,
+                     const std::string& accountName,
+                     const std::string& instanceUrl,
+                     unsigned int frame,
+                     const std::string& accept);
+
+  void SchedulePrefetch(const std::string& accountName,
+                        const std::string& instanceUrl,
+                        unsigned int frame,
+                        const std::string& accept);
+
+  void Prefetch(const PrefetchTask& task);
+
+public:
+  static FrameCache& GetInstance();
+
+  ~FrameCache();
+
+  bool IsEnabled() const
+  {
+    return memoryBudget_ > 0;
+  }
+
+  void Start();
+
+  void Stop();
+
+  // Retrieves the frames of one instance of the DICOM store that is
+  // configured in the account (not in the discovery mode). "frames"
+  // is the list of the WADO-RS URI: Only the requests for one single
+  // frame are cached, the other ones are forwarded to Google.
+  void GetFrames(std::string& body,
+                 std::string& contentType,
+                 const std::string& accountName,
+                 const std::string& studyInstanceUid,
+                 const std::string& seriesInstanceUid,
+                 const std::string& sopInstanceUid,
+                 const std::string& frames,
+                 const std::string& accept);
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
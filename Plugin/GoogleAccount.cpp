@@ -33,9 +33,50 @@
 
 #include "GoogleAccount.h"
 
+#include "CurlBuilder.h"
+
 #include <Logging.h>
 #include <Toolbox.h>
 
+#include <boost/lexical_cast.hpp>
+
+#include <cctype>
+#include <cstring>
+
+
+static const unsigned int MAX_LANES_COUNT = 64;
+static const char DISCOVERY_SEPARATOR = '~';  // Not allowed in the IDs of Healthcare
+static const char* const LANE_SUFFIX = "-lane";
+
+
+// Whether the name ends with the suffix of the lanes of the static
+// accounts, e.g. "foo-lane2"
+static bool HasLaneSuffix(const std::string& name)
+{
+  const size_t pos = name.rfind(LANE_SUFFIX);
+  if (pos == std::string::npos)
+  {
+    return false;
+  }
+
+  const size_t digits = pos + strlen(LANE_SUFFIX);
+  if (digits == name.size())
+  {
+    return false;
+  }
+
+  for (size_t i = digits; i < name.size(); i++)
+  {
+    if (!isdigit(static_cast<unsigned char>(name[i])))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
 void GoogleAccount::LoadAuthorizedUser(const std::string& json)
 {
   google::cloud::StatusOr<google::cloud::storage::oauth2::AuthorizedUserCredentialsInfo> info = 
@@ -133,6 +174,23 @@ GoogleAccount::GoogleAccount(const OrthancPlugins::OrthancConfiguration& account
                              const std::string& name) :
   name_(name)
 {
+  // The names of the DICOMweb servers are derived from the names of
+  // the accounts, that must not collide with the names of the lanes
+  // or of the discovered DICOM stores of another account
+  if (name.find(DISCOVERY_SEPARATOR) != std::string::npos)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The name of account \"" + name + "\" cannot contain '" +
+                                    DISCOVERY_SEPARATOR + "'");
+  }
+
+  if (HasLaneSuffix(name))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The name of account \"" + name + "\" cannot end with \"" +
+                                    LANE_SUFFIX + "{index}\"");
+  }
+
   if (!account.LookupStringValue(project_, "Project"))
   {
     throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
@@ -145,16 +203,70 @@ GoogleAccount::GoogleAccount(const OrthancPlugins::OrthancConfiguration& account
                                     "Missing \"Location\" option for account \"" + name + "\"");
   }
 
-  if (!account.LookupStringValue(dataset_, "Dataset"))
+  discovery_ = account.GetBooleanValue("Discovery", false);
+
+  if (discovery_)
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
-                                    "Missing \"Dataset\" option for account \"" + name + "\"");
+    // The datasets and DICOM stores are listed through the Healthcare
+    // API, "Dataset" and "DicomStore" are optional wildcard filters
+    dataset_ = account.GetStringValue("Dataset", "*");
+    dicomStore_ = account.GetStringValue("DicomStore", "*");
+  }
+  else
+  {
+    if (!account.LookupStringValue(dataset_, "Dataset"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Missing \"Dataset\" option for account \"" + name + "\"");
+    }
+
+    if (!account.LookupStringValue(dicomStore_, "DicomStore"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Missing \"DicomStore\" option for account \"" + name + "\"");
+    }
   }
 
-  if (!account.LookupStringValue(dicomStore_, "DicomStore"))
+  lanesCount_ = account.GetUnsignedIntegerValue("Lanes", 1);
+
+  if (lanesCount_ == 0 ||
+      lanesCount_ > MAX_LANES_COUNT)
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
-                                    "Missing \"DicomStore\" option for account \"" + name + "\"");
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "The \"Lanes\" option of account \"" + name + "\" must be between 1 and " +
+                                    boost::lexical_cast<std::string>(MAX_LANES_COUNT));
+  }
+
+  // Local metadata mirror of the DICOM store, for the QIDO-RS queries
+  mirror_ = account.GetBooleanValue("Mirror", false);
+
+  if (mirror_ &&
+      discovery_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "The \"Mirror\" option of account \"" + name +
+                                    "\" is not available in the discovery mode");
+  }
+
+  // Pub/Sub subscription to the notifications of the DICOM store, a
+  // short name refers to a subscription in the project of the account
+  subscription_ = account.GetStringValue("Subscription", "");
+
+  if (!subscription_.empty() &&
+      subscription_.find('/') == std::string::npos)
+  {
+    subscription_ = "projects/" + project_ + "/subscriptions/" + subscription_;
+  }
+
+  // Filter of the SOP instance UIDs of the DICOM store
+  presenceFilter_ = account.GetBooleanValue("PresenceFilter", false);
+
+  if (presenceFilter_ &&
+      discovery_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "The \"PresenceFilter\" option of account \"" + name +
+                                    "\" is not available in the discovery mode");
   }
 
   if (!LoadServiceAccount(account) &&
@@ -194,6 +306,78 @@ google::cloud::storage::oauth2::ServiceAccountCredentialsInfo& GoogleAccount::Ge
 }
 
 
+std::shared_ptr<google::cloud::storage::oauth2::Credentials> GoogleAccount::CreateCredentials() const
+{
+  switch (type_)
+  {
+    case Type_ServiceAccount:
+      return std::make_shared<google::cloud::storage::oauth2::ServiceAccountCredentials
+                              <CurlBuilder>>(GetServiceAccount());
+
+    case Type_AuthorizedUser:
+      return std::make_shared<google::cloud::storage::oauth2::AuthorizedUserCredentials
+                              <CurlBuilder>>(GetAuthorizedUser());
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+  }
+}
+
+
+std::shared_ptr<google::cloud::storage::oauth2::Credentials> GoogleAccount::CreateCredentials(
+  const std::set<std::string>& scopes) const
+{
+  if (scopes.empty())
+  {
+    return CreateCredentials();
+  }
+  else if (type_ == Type_ServiceAccount)
+  {
+    google::cloud::storage::oauth2::ServiceAccountCredentialsInfo info = GetServiceAccount();
+    info.scopes = scopes;
+
+    return std::make_shared<google::cloud::storage::oauth2::ServiceAccountCredentials
+                            <CurlBuilder>>(info);
+  }
+  else
+  {
+    // The scopes of an authorized user are fixed by its refresh token
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Custom OAuth 2.0 scopes are only available for service accounts, "
+                                    "not for account: " + name_);
+  }
+}
+
+
+std::string GoogleAccount::GetTokenEndpoint() const
+{
+  std::string endpoint;
+
+  switch (type_)
+  {
+    case Type_ServiceAccount:
+      endpoint = GetServiceAccount().token_uri;
+      break;
+
+    case Type_AuthorizedUser:
+      endpoint = GetAuthorizedUser().token_uri;
+      break;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+  }
+
+  if (endpoint.empty())
+  {
+    return "https://oauth2.googleapis.com/token";  // Default of google-cloud-cpp
+  }
+  else
+  {
+    return endpoint;
+  }
+}
+
+
 static std::string AddTrailingSlash(const std::string& url)
 {
   // Add a trailing slash if needed
@@ -209,43 +393,201 @@ static std::string AddTrailingSlash(const std::string& url)
 }
 
 
-bool GoogleAccount::UpdateServerDefinition(const std::string& dicomWebPluginRoot,
-                                           const std::string& baseGoogleUrl,
-                                           const std::string& token) const
+std::string GoogleAccount::GetDatasetsUrl(const std::string& baseGoogleUrl) const
 {
-  std::string url = (AddTrailingSlash(baseGoogleUrl) +
-                     "projects/" + project_ + 
-                     "/locations/" + location_ +
-                     "/datasets/" + dataset_ +
-                     "/dicomStores/" + dicomStore_ + 
-                     "/dicomWeb/");
+  return (AddTrailingSlash(baseGoogleUrl) +
+          "projects/" + project_ + 
+          "/locations/" + location_ +
+          "/datasets");
+}
+
+
+std::string GoogleAccount::GetSubscriptionUrl(const std::string& basePubSubUrl) const
+{
+  if (subscription_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                    "No Pub/Sub subscription for account: " + name_);
+  }
+  else
+  {
+    return AddTrailingSlash(basePubSubUrl) + subscription_;
+  }
+}
+
+
+std::string GoogleAccount::GetDicomStoreUrl(const std::string& baseGoogleUrl,
+                                            const std::string& dataset,
+                                            const std::string& dicomStore) const
+{
+  return (GetDatasetsUrl(baseGoogleUrl) + "/" + dataset +
+          "/dicomStores/" + dicomStore);
+}
+
+
+std::string GoogleAccount::GetDicomWebUrl(const std::string& baseGoogleUrl,
+                                          const std::string& dataset,
+                                          const std::string& dicomStore) const
+{
+  return GetDicomStoreUrl(baseGoogleUrl, dataset, dicomStore) + "/dicomWeb/";
+}
+
+
+std::string GoogleAccount::GetDicomWebUrl(const std::string& baseGoogleUrl) const
+{
+  return GetDicomWebUrl(baseGoogleUrl, dataset_, dicomStore_);
+}
+
+
+std::string GoogleAccount::GetServerName(const std::string& dataset,
+                                         const std::string& dicomStore,
+                                         unsigned int lane) const
+{
+  if (!discovery_)
+  {
+    if (lane == 0)
+    {
+      return name_;
+    }
+    else
+    {
+      return name_ + LANE_SUFFIX + boost::lexical_cast<std::string>(lane);
+    }
+  }
+
+  // The IDs of the datasets and DICOM stores cannot contain '~', and
+  // neither can the names of the accounts: The discovered names are
+  // unambiguous, including the suffix of the lanes
+  std::string name = name_ + DISCOVERY_SEPARATOR + dataset + DISCOVERY_SEPARATOR + dicomStore;
+
+  if (lane != 0)
+  {
+    name += DISCOVERY_SEPARATOR + std::string("lane") + boost::lexical_cast<std::string>(lane);
+  }
+
+  return name;
+}
+
+
+void GoogleAccount::ListServerNames(std::vector<std::string>& target,
+                                    const std::string& dataset,
+                                    const std::string& dicomStore) const
+{
+  target.resize(lanesCount_);
+
+  for (unsigned int lane = 0; lane < lanesCount_; lane++)
+  {
+    target[lane] = GetServerName(dataset, dicomStore, lane);
+  }
+}
+
+
+std::string GoogleAccount::GetServerUri(const std::string& dicomWebPluginRoot,
+                                        const std::string& dataset,
+                                        const std::string& dicomStore,
+                                        unsigned int lane) const
+{
+  return AddTrailingSlash(dicomWebPluginRoot) + "servers/" + GetServerName(dataset, dicomStore, lane);
+}
 
+
+std::string GoogleAccount::GetServerUri(const std::string& dicomWebPluginRoot) const
+{
+  return GetServerUri(dicomWebPluginRoot, dataset_, dicomStore_);
+}
+
+
+void GoogleAccount::ParseAuthorizationHeader(std::string& key,
+                                             std::string& value,
+                                             const std::string& token)
+{
   size_t colon = token.find(':');
   if (colon == std::string::npos)
   {
     throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
   }
 
-  std::string headerKey = Orthanc::Toolbox::StripSpaces(token.substr(0, colon));
-  std::string headerValue = Orthanc::Toolbox::StripSpaces(token.substr(colon + 1));
+  key = Orthanc::Toolbox::StripSpaces(token.substr(0, colon));
+  value = Orthanc::Toolbox::StripSpaces(token.substr(colon + 1));
+}
+
+
+void GoogleAccount::FormatServerDefinition(Json::Value& target,
+                                           const std::string& baseGoogleUrl,
+                                           const std::string& dataset,
+                                           const std::string& dicomStore,
+                                           const std::string& token) const
+{
+  std::string headerKey, headerValue;
+  ParseAuthorizationHeader(headerKey, headerValue, token);
 
   Json::Value headers = Json::objectValue;
   headers[headerKey] = headerValue;
 
-  Json::Value server = Json::objectValue;
-  server["Url"] = url;
-  server["HasDelete"] = "1";   // Google Cloud Platform allows "-X DELETE"
-  server["HttpHeaders"] = headers;
+  target = Json::objectValue;
+  target["Url"] = GetDicomWebUrl(baseGoogleUrl, dataset, dicomStore);
+  target["HasDelete"] = "1";   // Google Cloud Platform allows "-X DELETE"
+  target["HttpHeaders"] = headers;
+}
+
 
-  Json::Value answer;
-  if (OrthancPlugins::RestApiPut(answer, AddTrailingSlash(dicomWebPluginRoot) + "servers/" + name_, 
-                                 server, true))
+void GoogleAccount::FormatServerDefinition(Json::Value& target,
+                                           const std::string& baseGoogleUrl,
+                                           const std::string& token) const
+{
+  FormatServerDefinition(target, baseGoogleUrl, dataset_, dicomStore_, token);
+}
+
+
+bool GoogleAccount::UpdateServerDefinition(const std::string& dicomWebPluginRoot,
+                                           const std::string& baseGoogleUrl,
+                                           const std::string& dataset,
+                                           const std::string& dicomStore,
+                                           const std::string& token) const
+{
+  Json::Value server;
+  FormatServerDefinition(server, baseGoogleUrl, dataset, dicomStore, token);
+
+  bool success = true;
+
+  for (unsigned int lane = 0; lane < lanesCount_; lane++)
   {
-    return true;
+    Json::Value answer;
+    if (!OrthancPlugins::RestApiPut(answer, GetServerUri(dicomWebPluginRoot, dataset, dicomStore, lane), server, true))
+    {
+      LOG(ERROR) << "Cannot update DICOMweb access to Google Cloud Platform: "
+                 << GetServerName(dataset, dicomStore, lane);
+      success = false;
+    }
   }
-  else
+
+  return success;
+}
+
+
+bool GoogleAccount::UpdateServerDefinition(const std::string& dicomWebPluginRoot,
+                                           const std::string& baseGoogleUrl,
+                                           const std::string& token) const
+{
+  return UpdateServerDefinition(dicomWebPluginRoot, baseGoogleUrl, dataset_, dicomStore_, token);
+}
+
+
+bool GoogleAccount::RemoveServerDefinition(const std::string& dicomWebPluginRoot,
+                                           const std::string& dataset,
+                                           const std::string& dicomStore) const
+{
+  bool success = true;
+
+  for (unsigned int lane = 0; lane < lanesCount_; lane++)
   {
-    LOG(ERROR) << "Cannot update DICOMweb access to Google Cloud Platform: " << name_;
-    return false;
+    if (!OrthancPlugins::RestApiDelete(GetServerUri(dicomWebPluginRoot, dataset, dicomStore, lane), true))
+    {
+      LOG(ERROR) << "Cannot remove DICOMweb access to Google Cloud Platform: "
+                 << GetServerName(dataset, dicomStore, lane);
+      success = false;
+    }
   }
+
+  return success;
 }
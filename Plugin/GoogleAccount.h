@@ -38,6 +38,10 @@
 #include <google/cloud/storage/oauth2/authorized_user_credentials.h>
 #include <google/cloud/storage/oauth2/service_account_credentials.h>
 
+#include <memory>
+#include <set>
+#include <vector>
+
 
 class GoogleAccount : public boost::noncopyable
 {
@@ -55,6 +59,11 @@ private:
   std::string  location_;
   std::string  dataset_;
   std::string  dicomStore_;
+  bool         discovery_;
+  unsigned int lanesCount_;
+  bool         mirror_;
+  std::string  subscription_;
+  bool         presenceFilter_;
 
   std::unique_ptr<google::cloud::storage::oauth2::AuthorizedUserCredentialsInfo>  authorizedUser_;
   std::unique_ptr<google::cloud::storage::oauth2::ServiceAccountCredentialsInfo>  serviceAccount_;
@@ -92,6 +101,8 @@ public:
     return location_;
   }
 
+  // In the discovery mode, the dataset and the DICOM store are
+  // wildcard patterns filtering the stores listed by Google
   const std::string& GetDataset() const
   {
     return dataset_;
@@ -102,11 +113,136 @@ public:
     return dicomStore_;
   }
 
+  bool IsDiscovery() const
+  {
+    return discovery_;
+  }
+
+  // Number of equivalent DICOMweb servers registered for each DICOM
+  // store, so that the transfers of the DICOMweb plugin, that are
+  // serialized per server, can run in parallel
+  unsigned int GetLanesCount() const
+  {
+    return lanesCount_;
+  }
+
+  // Whether the metadata of the DICOM store is mirrored locally
+  bool IsMirrored() const
+  {
+    return mirror_;
+  }
+
+  // Full name of the Pub/Sub subscription receiving the notifications
+  // of the DICOM store ("projects/{project}/subscriptions/{name}"),
+  // empty if the change feed is disabled for this account
+  const std::string& GetSubscription() const
+  {
+    return subscription_;
+  }
+
+  // Whether the uploads to the DICOM store skip the instances that
+  // are known to be present, according to a local filter
+  bool HasPresenceFilter() const
+  {
+    return presenceFilter_;
+  }
+
   const google::cloud::storage::oauth2::AuthorizedUserCredentialsInfo& GetAuthorizedUser() const;
 
   google::cloud::storage::oauth2::ServiceAccountCredentialsInfo& GetServiceAccount() const;
 
+  // URL of the OAuth 2.0 endpoint that delivers the tokens of this account
+  std::string GetTokenEndpoint() const;
+
+  // Creates a new set of OAuth 2.0 credentials, with an empty cache of tokens
+  std::shared_ptr<google::cloud::storage::oauth2::Credentials> CreateCredentials() const;
+
+  // Same as above, with explicit OAuth 2.0 scopes instead of the
+  // default "cloud-platform" scope (only for service accounts)
+  std::shared_ptr<google::cloud::storage::oauth2::Credentials> CreateCredentials(
+    const std::set<std::string>& scopes) const;
+
+  // URL of the Pub/Sub subscription, below which ":pull" and
+  // ":acknowledge" are invoked
+  std::string GetSubscriptionUrl(const std::string& basePubSubUrl) const;
+
+  // URL of the Healthcare API listing the datasets of the project/location
+  std::string GetDatasetsUrl(const std::string& baseGoogleUrl) const;
+
+  // URL of one DICOM store in the Healthcare API (e.g. for "import" and "export")
+  std::string GetDicomStoreUrl(const std::string& baseGoogleUrl,
+                               const std::string& dataset,
+                               const std::string& dicomStore) const;
+
+  // The steps below are the building blocks of "UpdateServerDefinition()".
+  // The overloads without a dataset refer to the configured DICOM store.
+  std::string GetDicomWebUrl(const std::string& baseGoogleUrl,
+                             const std::string& dataset,
+                             const std::string& dicomStore) const;
+
+  std::string GetDicomWebUrl(const std::string& baseGoogleUrl) const;
+
+  // Name of the DICOMweb server: "{account}~{dataset}~{store}" in the
+  // discovery mode, the name of the account otherwise. The name of
+  // the lanes after the first one gets the "~lane{index}" suffix in
+  // the discovery mode, "-lane{index}" otherwise.
+  std::string GetServerName(const std::string& dataset,
+                            const std::string& dicomStore,
+                            unsigned int lane) const;
+
+  std::string GetServerName(const std::string& dataset,
+                            const std::string& dicomStore) const
+  {
+    return GetServerName(dataset, dicomStore, 0);
+  }
+
+  // Names of the servers of all the lanes of one DICOM store
+  void ListServerNames(std::vector<std::string>& target,
+                       const std::string& dataset,
+                       const std::string& dicomStore) const;
+
+  std::string GetServerUri(const std::string& dicomWebPluginRoot,
+                           const std::string& dataset,
+                           const std::string& dicomStore,
+                           unsigned int lane) const;
+
+  std::string GetServerUri(const std::string& dicomWebPluginRoot,
+                           const std::string& dataset,
+                           const std::string& dicomStore) const
+  {
+    return GetServerUri(dicomWebPluginRoot, dataset, dicomStore, 0);
+  }
+
+  std::string GetServerUri(const std::string& dicomWebPluginRoot) const;
+
+  // Splits the "Authorization: Bearer ..." header returned by google-cloud-cpp
+  static void ParseAuthorizationHeader(std::string& key,
+                                       std::string& value,
+                                       const std::string& token);
+
+  void FormatServerDefinition(Json::Value& target,
+                              const std::string& baseGoogleUrl,
+                              const std::string& dataset,
+                              const std::string& dicomStore,
+                              const std::string& token) const;
+
+  void FormatServerDefinition(Json::Value& target,
+                              const std::string& baseGoogleUrl,
+                              const std::string& token) const;
+
+  // Pushes the same definition (hence the same token) to all the
+  // lanes of the DICOM store, in one pass
   bool UpdateServerDefinition(const std::string& dicomWebPluginRoot,
                               const std::string& baseGoogleUrl,
+                              const std::string& dataset,
+                              const std::string& dicomStore,
                               const std::string& token) const;
+
+  bool UpdateServerDefinition(const std::string& dicomWebPluginRoot,
+                              const std::string& baseGoogleUrl,
+                              const std::string& token) const;
+
+  bool RemoveServerDefinition(const std::string& dicomWebPluginRoot,
+                              const std::string& dataset,
+                              const std::string& dicomStore) const;
 };
@@ -38,17 +38,129 @@
 
 #include <boost/thread/mutex.hpp>
 
+#include <algorithm>
+
 
 #define DEFAULT_GOOGLE_URL "https://healthcare.googleapis.com/v1beta1/"
 #define DEFAULT_DICOMWEB_PLUGIN_ROOT "/dicom-web"
 #define HAS_ORTHANC_FRAMEWORK_1_5_7  0    // TODO - Update to 1.5.7 once available + CMakeLists.txt
  
 
+static void ParseModalities(std::set<std::string>& target,
+                            const Json::Value& rule,
+                            const char* key)
+{
+  target.clear();
+
+  if (rule.isMember(key))
+  {
+    const Json::Value& value = rule[key];
+    if (value.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "The \"" + std::string(key) + "\" field of the prior prefetch rules must be a list");
+    }
+
+    for (Json::Value::ArrayIndex i = 0; i < value.size(); i++)
+    {
+      if (value[i].type() != Json::stringValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "The modalities of the prior prefetch rules must be strings");
+      }
+
+      target.insert(value[i].asString());
+    }
+  }
+}
+
+
+static unsigned int ParseRuleInteger(const Json::Value& rule,
+                                     const char* key,
+                                     unsigned int defaultValue)
+{
+  if (!rule.isMember(key))
+  {
+    return defaultValue;
+  }
+  else if (rule[key].isUInt())
+  {
+    return rule[key].asUInt();
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The \"" + std::string(key) + "\" field of the prior prefetch rules must be a positive integer");
+  }
+}
+
+
+static void ParseRoutingRule(RoutingTree::Rule& target,
+                             const Json::Value& rule)
+{
+  if (rule.type() != Json::objectValue ||
+      !rule.isMember("Account") ||
+      rule["Account"].type() != Json::stringValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "The routing rules must be objects with an \"Account\" field");
+  }
+
+  target.account_ = rule["Account"].asString();
+  target.conditions_.clear();
+
+  if (rule.isMember("Match"))
+  {
+    const Json::Value& match = rule["Match"];
+    if (match.type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "The \"Match\" field of the routing rules must map tags to values");
+    }
+
+    const Json::Value::Members tags = match.getMemberNames();
+
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      RoutingTree::Condition condition(RoutingTree::ParseTag(tags[i]));
+      const Json::Value& values = match[tags[i]];
+
+      if (values.type() == Json::stringValue)
+      {
+        condition.values_.push_back(values.asString());
+      }
+      else if (values.type() == Json::arrayValue &&
+               values.size() > 0)
+      {
+        for (Json::Value::ArrayIndex j = 0; j < values.size(); j++)
+        {
+          if (values[j].type() != Json::stringValue)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                            "The values of the routing rules must be strings, for tag: " + tags[i]);
+          }
+
+          condition.values_.push_back(values[j].asString());
+        }
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "The value of a routing rule must be a string or a non-empty list of strings, for tag: " + tags[i]);
+      }
+
+      target.conditions_.push_back(condition);
+    }
+  }
+}
+
+
 GoogleConfiguration::GoogleConfiguration()
 {
   OrthancPlugins::OrthancConfiguration configuration;
   caInfo_ = configuration.GetStringValue("HttpsCACertificates", "");
   httpsVerifyPeers_ = configuration.GetBooleanValue("HttpsVerifyPeers", true);
+  storageDirectory_ = configuration.GetStringValue("StorageDirectory", "OrthancStorage");
     
   {
 #if HAS_ORTHANC_FRAMEWORK_1_5_7 == 1
@@ -79,6 +191,180 @@ GoogleConfiguration::GoogleConfiguration()
       refreshIntervalSeconds_ = 60;
     }
 
+    // Upper bound on the time spent by Orthanc to stop the token updaters
+    shutdownTimeoutSeconds_ = google.GetUnsignedIntegerValue("ShutdownTimeout", 10);
+
+    // Exponential backoff of the failed token requests, and circuit
+    // breaker shared by the accounts using the same token endpoint
+    retryInitialDelaySeconds_ = std::max(1u, google.GetUnsignedIntegerValue("RetryInitialDelay", 1));
+    retryMaxDelaySeconds_ = std::max(retryInitialDelaySeconds_,
+                                     google.GetUnsignedIntegerValue("RetryMaxDelay", refreshIntervalSeconds_));
+    circuitBreakerThreshold_ = std::max(1u, google.GetUnsignedIntegerValue("CircuitBreakerThreshold", 5));
+    circuitBreakerCooldownSeconds_ = std::max(1u, google.GetUnsignedIntegerValue("CircuitBreakerCooldown", 30));
+
+    tokenBrokerSecret_ = google.GetStringValue("TokenBrokerSecret", "");
+
+    // In the lazy mode, the accounts without recent activity are not refreshed anymore
+    lazyRefresh_ = google.GetBooleanValue("LazyRefresh", false);
+    lazyRefreshIdleTimeoutSeconds_ = std::max(1u, google.GetUnsignedIntegerValue("LazyRefreshIdleTimeout", 3600));
+
+    // Tokens with non-default scopes that are unused for this duration are evicted
+    scopedTokensIdleTimeoutSeconds_ = std::max(1u, google.GetUnsignedIntegerValue("ScopedTokensIdleTimeout", 3600));
+
+    // Periodic listing of the DICOM stores of the accounts in the discovery mode
+    discoveryIntervalSeconds_ = std::max(60u, google.GetUnsignedIntegerValue("DiscoveryInterval", 3600));
+    discoveryThreads_ = std::max(1u, google.GetUnsignedIntegerValue("DiscoveryThreads", 8));
+
+    // Bulk transfers through Google Cloud Storage. An empty URL
+    // selects the default endpoint of google-cloud-cpp.
+    storageUrl_ = google.GetStringValue("StorageUrl", "");
+    bulkTransferThreads_ = std::max(1u, google.GetUnsignedIntegerValue("BulkTransferThreads", 16));
+
+    {
+      // DICOM store of Google backing the local storage of Orthanc
+#if HAS_ORTHANC_FRAMEWORK_1_5_7 == 1
+      OrthancPlugins::OrthancConfiguration coldTier(false);
+#else
+      OrthancPlugins::OrthancConfiguration coldTier;
+#endif
+
+      google.GetSection(coldTier, "ColdTier");
+      coldTierAccount_ = coldTier.GetStringValue("Account", "");
+      coldTierDataset_ = coldTier.GetStringValue("Dataset", "");
+      coldTierDicomStore_ = coldTier.GetStringValue("DicomStore", "");
+
+      // Eviction of the coldest local files once "MaxLocalSize" (in MB) is exceeded
+      coldTierMaxLocalSize_ = static_cast<uint64_t>(coldTier.GetUnsignedIntegerValue("MaxLocalSize", 0)) * 1024 * 1024;
+      coldTierLowWatermark_ = std::min(100u, coldTier.GetUnsignedIntegerValue("LowWatermark", 90));
+      coldTierEvictionIntervalSeconds_ = std::max(1u, coldTier.GetUnsignedIntegerValue("EvictionInterval", 60));
+      coldTierHalfLifeSeconds_ = std::max(1u, coldTier.GetUnsignedIntegerValue("AccessHalfLife", 24)) * 3600;
+    }
+
+    // Local mirrors of the metadata of the DICOM stores, for the
+    // accounts with the "Mirror" option
+    mirrorDirectory_ = google.GetStringValue("MirrorDirectory", storageDirectory_);
+    mirrorRefreshIntervalSeconds_ = std::max(10u, google.GetUnsignedIntegerValue("MirrorRefreshInterval", 300));
+    mirrorMaxStalenessSeconds_ = std::max(mirrorRefreshIntervalSeconds_,
+                                          google.GetUnsignedIntegerValue("MirrorMaxStaleness", 900));
+
+    // Notifications of the DICOM stores, pulled from the Pub/Sub
+    // subscriptions of the accounts with the "Subscription" option
+    pubSubUrl_ = google.GetStringValue("PubSubUrl", "https://pubsub.googleapis.com/v1/");
+    changeFeedBatchSize_ = std::min(1000u, std::max(1u, google.GetUnsignedIntegerValue("ChangeFeedBatchSize", 1000)));
+    changeFeedPollIntervalSeconds_ = std::max(1u, google.GetUnsignedIntegerValue("ChangeFeedPollInterval", 5));
+
+    // Filters of the SOP instance UIDs known to be in the DICOM stores
+    // of the accounts with the "PresenceFilter" option
+    presenceFilterDirectory_ = google.GetStringValue("PresenceFilterDirectory", storageDirectory_);
+    presenceFilterCapacity_ = std::max(1000u, google.GetUnsignedIntegerValue("PresenceFilterCapacity", 10000000));
+    presenceFilterSaveIntervalSeconds_ = std::max(1u, google.GetUnsignedIntegerValue("PresenceFilterSaveInterval", 60));
+
+    // Cache of the WADO-RS metadata of the studies (size in MB)
+    metadataCacheSize_ = static_cast<uint64_t>(google.GetUnsignedIntegerValue("MetadataCacheSize", 64)) * 1024 * 1024;
+    metadataCacheRevalidationSeconds_ = google.GetUnsignedIntegerValue("MetadataCacheRevalidation", 60);
+
+    // Cache of the WADO-RS frames, e.g. the tiles of whole-slide images (sizes in MB)
+    frameCacheSize_ = static_cast<uint64_t>(google.GetUnsignedIntegerValue("FrameCacheSize", 256)) * 1024 * 1024;
+    frameCacheDirectory_ = google.GetStringValue("FrameCacheDirectory", "");
+    frameCacheDiskSize_ = static_cast<uint64_t>(google.GetUnsignedIntegerValue("FrameCacheDiskSize", 4096)) * 1024 * 1024;
+    frameCachePrefetch_ = google.GetUnsignedIntegerValue("FrameCachePrefetch", 8);
+    frameCachePrefetchThreads_ = std::max(1u, google.GetUnsignedIntegerValue("FrameCachePrefetchThreads", 4));
+
+    {
+      // Prefetch of the prior studies of the patients from Google
+#if HAS_ORTHANC_FRAMEWORK_1_5_7 == 1
+      OrthancPlugins::OrthancConfiguration priorPrefetch(false);
+#else
+      OrthancPlugins::OrthancConfiguration priorPrefetch;
+#endif
+
+      google.GetSection(priorPrefetch, "PriorPrefetch");
+      priorPrefetch.LookupListOfStrings(priorPrefetchAccounts_, "Accounts", true);
+
+      const std::string trigger = priorPrefetch.GetStringValue("Trigger", "StableStudy");
+      if (trigger == "StableStudy")
+      {
+        priorPrefetchOnNewStudy_ = false;
+      }
+      else if (trigger == "NewStudy")
+      {
+        priorPrefetchOnNewStudy_ = true;
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "The trigger of the prior prefetch must be \"StableStudy\" or \"NewStudy\": " + trigger);
+      }
+
+      // Bandwidth in MB/s
+      priorPrefetchBandwidth_ = static_cast<uint64_t>(priorPrefetch.GetUnsignedIntegerValue("Bandwidth", 10)) * 1024 * 1024;
+
+      const Json::Value& rules = priorPrefetch.GetJson()["Rules"];
+
+      if (rules.isNull())
+      {
+        // By default, the 3 most recent priors of any modality
+        PriorPrefetchRule rule;
+        rule.maxPriors_ = 3;
+        rule.maxAgeDays_ = 0;
+        priorPrefetchRules_.push_back(rule);
+      }
+      else if (rules.type() != Json::arrayValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "The rules of the prior prefetch must be a list of objects");
+      }
+      else
+      {
+        for (Json::Value::ArrayIndex i = 0; i < rules.size(); i++)
+        {
+          if (rules[i].type() != Json::objectValue)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                            "The rules of the prior prefetch must be a list of objects");
+          }
+
+          PriorPrefetchRule rule;
+          ParseModalities(rule.modalities_, rules[i], "Modalities");
+          ParseModalities(rule.priorModalities_, rules[i], "PriorModalities");
+          rule.maxPriors_ = ParseRuleInteger(rules[i], "MaxPriors", 3);
+          rule.maxAgeDays_ = ParseRuleInteger(rules[i], "MaxAge", 0);
+          priorPrefetchRules_.push_back(rule);
+        }
+      }
+    }
+
+    {
+      // Forwarding of the received instances to the DICOM stores of
+      // the accounts, depending on the value of their tags
+#if HAS_ORTHANC_FRAMEWORK_1_5_7 == 1
+      OrthancPlugins::OrthancConfiguration routing(false);
+#else
+      OrthancPlugins::OrthancConfiguration routing;
+#endif
+
+      google.GetSection(routing, "Routing");
+      routingBatchSize_ = std::max(1u, routing.GetUnsignedIntegerValue("BatchSize", 100));
+
+      const Json::Value& rules = routing.GetJson()["Rules"];
+
+      if (!rules.isNull())
+      {
+        if (rules.type() != Json::arrayValue)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                          "The routing rules must be a list of objects");
+        }
+
+        routingRules_.resize(rules.size());
+
+        for (Json::Value::ArrayIndex i = 0; i < rules.size(); i++)
+        {
+          ParseRoutingRule(routingRules_[i], rules[i]);
+        }
+      }
+    }
+
 #if HAS_ORTHANC_FRAMEWORK_1_5_7 == 1
     OrthancPlugins::OrthancConfiguration accounts(false);
 #else
@@ -152,6 +438,21 @@ const GoogleAccount& GoogleConfiguration::GetAccount(size_t i) const
 }
 
 
+const GoogleAccount* GoogleConfiguration::LookupAccount(const std::string& name) const
+{
+  for (size_t i = 0; i < accounts_.size(); i++)
+  {
+    assert(accounts_[i] != NULL);
+    if (accounts_[i]->GetName() == name)
+    {
+      return accounts_[i];
+    }
+  }
+
+  return NULL;
+}
+
+
 const GoogleConfiguration& GoogleConfiguration::GetInstance()
 {
   static boost::mutex mutex_;
@@ -35,16 +35,73 @@
 #pragma once
 
 #include "GoogleAccount.h"
+#include "RoutingTree.h"
+
+#include <list>
 
 class GoogleConfiguration : public boost::noncopyable
 {
+public:
+  // Selection of the prior studies to be prefetched when a new study
+  // arrives in Orthanc. The first rule matching the new study applies.
+  struct PriorPrefetchRule
+  {
+    std::set<std::string>  modalities_;        // Modalities of the new study (empty for any)
+    std::set<std::string>  priorModalities_;   // Modalities of the priors (empty for any)
+    unsigned int           maxPriors_;         // The most recent priors are kept
+    unsigned int           maxAgeDays_;        // Relative to the new study (0 for no limit)
+  };
+
 private:
   std::string                  caInfo_;
   std::string                  baseGoogleUrl_;
   std::string                  dicomWebPluginRoot_;
+  std::string                  tokenBrokerSecret_;
+  std::string                  storageUrl_;
+  std::string                  storageDirectory_;
+  std::string                  coldTierAccount_;
+  std::string                  coldTierDataset_;
+  std::string                  coldTierDicomStore_;
+  uint64_t                     coldTierMaxLocalSize_;
+  unsigned int                 coldTierLowWatermark_;
+  unsigned int                 coldTierEvictionIntervalSeconds_;
+  unsigned int                 coldTierHalfLifeSeconds_;
+  std::string                  mirrorDirectory_;
+  unsigned int                 mirrorRefreshIntervalSeconds_;
+  unsigned int                 mirrorMaxStalenessSeconds_;
+  std::string                  pubSubUrl_;
+  unsigned int                 changeFeedBatchSize_;
+  unsigned int                 changeFeedPollIntervalSeconds_;
+  std::string                  presenceFilterDirectory_;
+  uint64_t                     presenceFilterCapacity_;
+  unsigned int                 presenceFilterSaveIntervalSeconds_;
+  uint64_t                     metadataCacheSize_;
+  unsigned int                 metadataCacheRevalidationSeconds_;
+  uint64_t                     frameCacheSize_;
+  std::string                  frameCacheDirectory_;
+  uint64_t                     frameCacheDiskSize_;
+  unsigned int                 frameCachePrefetch_;
+  unsigned int                 frameCachePrefetchThreads_;
+  std::list<std::string>       priorPrefetchAccounts_;
+  bool                         priorPrefetchOnNewStudy_;
+  uint64_t                     priorPrefetchBandwidth_;
+  std::vector<PriorPrefetchRule>  priorPrefetchRules_;
+  std::vector<RoutingTree::Rule>  routingRules_;
+  unsigned int                 routingBatchSize_;
   std::vector<GoogleAccount*>  accounts_;
   unsigned int                 timeoutSeconds_;
   unsigned int                 refreshIntervalSeconds_;
+  unsigned int                 shutdownTimeoutSeconds_;
+  unsigned int                 retryInitialDelaySeconds_;
+  unsigned int                 retryMaxDelaySeconds_;
+  unsigned int                 circuitBreakerThreshold_;
+  unsigned int                 circuitBreakerCooldownSeconds_;
+  unsigned int                 scopedTokensIdleTimeoutSeconds_;
+  unsigned int                 discoveryIntervalSeconds_;
+  unsigned int                 discoveryThreads_;
+  unsigned int                 bulkTransferThreads_;
+  bool                         lazyRefresh_;
+  unsigned int                 lazyRefreshIdleTimeoutSeconds_;
   bool                         httpsVerifyPeers_;
 
   GoogleConfiguration();  // Singleton pattern
@@ -66,6 +123,9 @@ public:
 
   const GoogleAccount& GetAccount(size_t i) const;
 
+  // Returns NULL if the account is unknown
+  const GoogleAccount* LookupAccount(const std::string& name) const;
+
   const std::string& GetBaseGoogleUrl() const
   {
     return baseGoogleUrl_;
@@ -81,6 +141,252 @@ public:
     return refreshIntervalSeconds_;
   }
 
+  unsigned int GetShutdownTimeoutSeconds() const
+  {
+    return shutdownTimeoutSeconds_;
+  }
+
+  unsigned int GetRetryInitialDelaySeconds() const
+  {
+    return retryInitialDelaySeconds_;
+  }
+
+  unsigned int GetRetryMaxDelaySeconds() const
+  {
+    return retryMaxDelaySeconds_;
+  }
+
+  unsigned int GetCircuitBreakerThreshold() const
+  {
+    return circuitBreakerThreshold_;
+  }
+
+  unsigned int GetCircuitBreakerCooldownSeconds() const
+  {
+    return circuitBreakerCooldownSeconds_;
+  }
+
+  bool IsLazyRefresh() const
+  {
+    return lazyRefresh_;
+  }
+
+  unsigned int GetLazyRefreshIdleTimeoutSeconds() const
+  {
+    return lazyRefreshIdleTimeoutSeconds_;
+  }
+
+  unsigned int GetScopedTokensIdleTimeoutSeconds() const
+  {
+    return scopedTokensIdleTimeoutSeconds_;
+  }
+
+  unsigned int GetDiscoveryIntervalSeconds() const
+  {
+    return discoveryIntervalSeconds_;
+  }
+
+  // Number of datasets whose DICOM stores are listed concurrently
+  unsigned int GetDiscoveryThreads() const
+  {
+    return discoveryThreads_;
+  }
+
+  // Empty if the default endpoint of Google Cloud Storage is used
+  const std::string& GetStorageUrl() const
+  {
+    return storageUrl_;
+  }
+
+  // Storage directory of Orthanc ("StorageDirectory" option)
+  const std::string& GetStorageDirectory() const
+  {
+    return storageDirectory_;
+  }
+
+  // The cold tier is disabled if the account is empty. The dataset
+  // and the DICOM store are empty to use those of the account.
+  const std::string& GetColdTierAccount() const
+  {
+    return coldTierAccount_;
+  }
+
+  const std::string& GetColdTierDataset() const
+  {
+    return coldTierDataset_;
+  }
+
+  const std::string& GetColdTierDicomStore() const
+  {
+    return coldTierDicomStore_;
+  }
+
+  // Budget of the local DICOM files in bytes (0 to disable eviction)
+  uint64_t GetColdTierMaxLocalSize() const
+  {
+    return coldTierMaxLocalSize_;
+  }
+
+  // Percentage of the budget down to which the files are evicted
+  unsigned int GetColdTierLowWatermark() const
+  {
+    return coldTierLowWatermark_;
+  }
+
+  unsigned int GetColdTierEvictionIntervalSeconds() const
+  {
+    return coldTierEvictionIntervalSeconds_;
+  }
+
+  // Half-life of the access counts that rank the files to be evicted
+  unsigned int GetColdTierHalfLifeSeconds() const
+  {
+    return coldTierHalfLifeSeconds_;
+  }
+
+  // Directory of the snapshots of the metadata mirrors
+  const std::string& GetMirrorDirectory() const
+  {
+    return mirrorDirectory_;
+  }
+
+  unsigned int GetMirrorRefreshIntervalSeconds() const
+  {
+    return mirrorRefreshIntervalSeconds_;
+  }
+
+  // Age of the last synchronization beyond which the QIDO-RS queries
+  // are forwarded to Google instead of being answered by the mirror
+  unsigned int GetMirrorMaxStalenessSeconds() const
+  {
+    return mirrorMaxStalenessSeconds_;
+  }
+
+  // Root of the Pub/Sub API, from which the notifications of the
+  // DICOM stores are pulled
+  const std::string& GetPubSubUrl() const
+  {
+    return pubSubUrl_;
+  }
+
+  // Maximum number of notifications per pull (at most 1000)
+  unsigned int GetChangeFeedBatchSize() const
+  {
+    return changeFeedBatchSize_;
+  }
+
+  // Delay before the next pull once the subscription is drained
+  unsigned int GetChangeFeedPollIntervalSeconds() const
+  {
+    return changeFeedPollIntervalSeconds_;
+  }
+
+  // Directory of the presence filters of the DICOM stores
+  const std::string& GetPresenceFilterDirectory() const
+  {
+    return presenceFilterDirectory_;
+  }
+
+  // Number of SOP instance UIDs that each presence filter can hold
+  uint64_t GetPresenceFilterCapacity() const
+  {
+    return presenceFilterCapacity_;
+  }
+
+  unsigned int GetPresenceFilterSaveIntervalSeconds() const
+  {
+    return presenceFilterSaveIntervalSeconds_;
+  }
+
+  // Budget of the compressed study metadata in bytes (0 to disable the cache)
+  uint64_t GetMetadataCacheSize() const
+  {
+    return metadataCacheSize_;
+  }
+
+  // Age beyond which the cached metadata is revalidated with Google
+  unsigned int GetMetadataCacheRevalidationSeconds() const
+  {
+    return metadataCacheRevalidationSeconds_;
+  }
+
+  // Budget of the frames cached in memory in bytes (0 to disable the cache)
+  uint64_t GetFrameCacheSize() const
+  {
+    return frameCacheSize_;
+  }
+
+  // Directory of the disk tier of the frame cache (empty if disabled)
+  const std::string& GetFrameCacheDirectory() const
+  {
+    return frameCacheDirectory_;
+  }
+
+  uint64_t GetFrameCacheDiskSize() const
+  {
+    return frameCacheDiskSize_;
+  }
+
+  // Number of neighbouring frames that are prefetched after each access
+  unsigned int GetFrameCachePrefetch() const
+  {
+    return frameCachePrefetch_;
+  }
+
+  unsigned int GetFrameCachePrefetchThreads() const
+  {
+    return frameCachePrefetchThreads_;
+  }
+
+  // Accounts whose DICOM stores are searched for the prior studies
+  // (the prefetch is disabled if empty)
+  const std::list<std::string>& GetPriorPrefetchAccounts() const
+  {
+    return priorPrefetchAccounts_;
+  }
+
+  // Whether the prefetch is triggered by "NewStudy" instead of "StableStudy"
+  bool IsPriorPrefetchOnNewStudy() const
+  {
+    return priorPrefetchOnNewStudy_;
+  }
+
+  // Bytes per second downloaded by the prefetch (0 for no limit)
+  uint64_t GetPriorPrefetchBandwidth() const
+  {
+    return priorPrefetchBandwidth_;
+  }
+
+  const std::vector<PriorPrefetchRule>& GetPriorPrefetchRules() const
+  {
+    return priorPrefetchRules_;
+  }
+
+  // Rules forwarding the instances received by Orthanc to the DICOM
+  // stores of the accounts (the routing is disabled if empty)
+  const std::vector<RoutingTree::Rule>& GetRoutingRules() const
+  {
+    return routingRules_;
+  }
+
+  // Maximum number of instances in one STOW-RS job of the routing
+  unsigned int GetRoutingBatchSize() const
+  {
+    return routingBatchSize_;
+  }
+
+  // Default number of concurrent streams of the bulk transfers
+  unsigned int GetBulkTransferThreads() const
+  {
+    return bulkTransferThreads_;
+  }
+
+  // The token broker is disabled if the secret is empty
+  const std::string& GetTokenBrokerSecret() const
+  {
+    return tokenBrokerSecret_;
+  }
+
   const std::string& GetCaInfo() const
   {
     return caInfo_;
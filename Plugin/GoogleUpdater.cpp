@@ -33,200 +33,408 @@
 
 #include "GoogleUpdater.h"
 
+#include "CurlBuilder.h"
 #include "GoogleConfiguration.h"
+#include "PluginToolbox.h"
 
 #include <Logging.h>
+#include <Toolbox.h>
 
-#include <google/cloud/storage/internal/curl_handle_factory.h>
-#include <google/cloud/storage/oauth2/google_credentials.h>
+#include <boost/algorithm/string/predicate.hpp>
 
+#include <cassert>
 
-namespace
+
+static const unsigned int SERVER_ACCESS_WAIT = 2;  // Maximum wait for an expired token in the HTTP filter, in seconds
+
+
+void GoogleUpdater::Worker(GoogleUpdater* that,
+                           size_t index,
+                           AccountRefresher* refresher,
+                           unsigned int refreshIntervalSeconds)
 {
-  class CurlBuilder : public google::cloud::storage::internal::CurlRequestBuilder
+  try
   {
-  private:
-    class HandleFactory : public google::cloud::storage::internal::DefaultCurlHandleFactory
-    {
-    public:
-      google::cloud::storage::internal::CurlPtr CreateHandle() override
-      {
-        google::cloud::storage::internal::CurlPtr handle
-          (google::cloud::storage::internal::DefaultCurlHandleFactory::CreateHandle());
+    refresher->Run(refreshIntervalSeconds);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Cannot initialize the token updater for Google Cloud Platform account: " 
+               << refresher->GetAccount().GetName();
+  }
 
-        const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  that->SetWorkerFinished(index);
+}
 
-        long timeout = static_cast<long>(configuration.GetTimeoutSeconds());
 
-        if (!configuration.GetCaInfo().empty() &&
-            curl_easy_setopt(handle.get(), CURLOPT_CAINFO, configuration.GetCaInfo().c_str()) != CURLE_OK)
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
-                                          "Cannot set the trusted Certificate Authorities");
-        }
+void GoogleUpdater::SetWorkerFinished(size_t index)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  finished_[index] = true;
+  stateChanged_.notify_all();
+}
 
-        bool ok;
-        
-        if (configuration.IsHttpsVerifyPeers())
-        {
-          ok = (curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYHOST, 2) == CURLE_OK &&
-                curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYPEER, 1) == CURLE_OK &&
-                curl_easy_setopt(handle.get(), CURLOPT_TIMEOUT, timeout) == CURLE_OK);
-        }
-        else
-        {
-          ok = (curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYHOST, 0) == CURLE_OK &&
-                curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYPEER, 0) == CURLE_OK);
-        }
 
-        if (!ok)
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
-                                          "Cannot initialize a libcurl handle");
-        }
+GoogleUpdater::~GoogleUpdater()
+{
+  bool running;
 
-        return handle;
-      }
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    running = (state_ == State_Running);
+  }
 
-      google::cloud::storage::internal::CurlMulti CreateMultiHandle() override
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
-      }
-    };
+  if (running)
+  {
+    LOG(ERROR) << "GoogleUpdater::Stop() should have been manually called";
+    Stop();
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (size_t i = 0; i < refreshers_.size(); i++)
+  {
+    assert(refreshers_[i] != NULL);
 
-  public:
-    CurlBuilder(const std::string& base_url,
-                const std::shared_ptr<google::cloud::storage::internal::CurlHandleFactory>& factory) :
-      CurlRequestBuilder(base_url, std::make_shared<HandleFactory>())
+    // The refreshers of the workers detached by "Stop()" are leaked,
+    // as these workers might still be using them
+    if (finished_[i])
     {
+      delete refreshers_[i];
     }
-  };
+  }
 }
 
 
-
-static boost::posix_time::ptime GetNow()
+void GoogleUpdater::Start()
 {
-  return boost::posix_time::second_clock::local_time();
-} 
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (state_ != State_Setup)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+  }
 
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  workers_.resize(configuration.GetAccountsCount());
+  finished_.resize(workers_.size(), false);
+  refreshers_.resize(workers_.size());
 
-void GoogleUpdater::Worker(const State* state,
-                           const GoogleAccount* account,
-                           long refreshIntervalSeconds)
+  for (size_t i = 0; i < workers_.size(); i++)
+  {
+    refreshers_[i] = new AccountRefresher(configuration.GetAccount(i));
+    workers_[i] = new boost::thread(Worker, this, i, refreshers_[i],
+                                    configuration.GetRefreshIntervalSeconds());
+  }
+
+  // Publishes "refreshers_" to the lock-free readers
+  state_ = State_Running;
+}
+
+  
+void GoogleUpdater::Stop()
 {
-  std::shared_ptr<google::cloud::storage::oauth2::Credentials> credentials;
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+  const unsigned int timeout = GoogleConfiguration::GetInstance().GetShutdownTimeoutSeconds();
 
-  try
   {
-    switch (account->GetType())
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (state_ != State_Running)
     {
-      case GoogleAccount::Type_ServiceAccount:
-        credentials = std::make_shared<google::cloud::storage::oauth2::ServiceAccountCredentials
-                                       <CurlBuilder>>(account->GetServiceAccount());
-        break;
+      return;
+    }
+
+    // Wake up all the workers at once, and abort their in-flight HTTP requests
+    state_ = State_Done;
+    CurlBuilder::SetAborted(true);
 
-      case GoogleAccount::Type_AuthorizedUser:
-        credentials = std::make_shared<google::cloud::storage::oauth2::AuthorizedUserCredentials
-                                       <CurlBuilder>>(account->GetAuthorizedUser());
+    for (size_t i = 0; i < refreshers_.size(); i++)
+    {
+      refreshers_[i]->Stop();
+    }
+
+    const boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(timeout);
+
+    for (;;)
+    {
+      bool done = true;
+      for (size_t i = 0; i < finished_.size(); i++)
+      {
+        done = done && finished_[i];
+      }
+
+      if (done ||
+          !stateChanged_.timed_wait(lock, deadline))
+      {
         break;
+      }
+    }
+  }
 
-      default:
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+  unsigned int countLate = 0;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    for (size_t i = 0; i < finished_.size(); i++)
+    {
+      if (!finished_[i])
+      {
+        countLate++;
+      }
     }
   }
-  catch (Orthanc::OrthancException& e)
+
+  if (countLate != 0)
   {
-    credentials.reset();
+    // The HTTP requests of the Healthcare API (e.g. the discovery of
+    // the DICOM stores) cannot be aborted, contrarily to the token
+    // requests: Joining the late workers would hold the shutdown of
+    // Orthanc for up to "GoogleCloudPlatform.Timeout" seconds
+    LOG(ERROR) << countLate << " Google Cloud Platform token updater(s) have not stopped within "
+               << timeout << " seconds, detaching them";
   }
 
-  if (credentials.get() == NULL)
   {
-    LOG(ERROR) << "Cannot initialize the token updater for Google Cloud Platform account: " 
-               << account->GetName();
-    return;
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      if (workers_[i] != NULL)
+      {
+        if (!finished_[i])
+        {
+          // The refresher of a detached worker is never deleted, see
+          // the destructor, and it stops once its request completes
+          workers_[i]->detach();
+        }
+        else if (workers_[i]->joinable())
+        {
+          workers_[i]->join();  // Immediate, as the worker has finished
+        }
+
+        delete workers_[i];
+      }
+    }
   }
 
-  const std::string dicomWebPluginRoot = GoogleConfiguration::GetInstance().GetDicomWebPluginRoot();
-  const std::string baseGoogleUrl = GoogleConfiguration::GetInstance().GetBaseGoogleUrl();
+  workers_.clear();
+
+  // Logged instead of being published as a metric, as Orthanc does
+  // not collect the metrics anymore once it is stopping
+  LOG(WARNING) << "The Google Cloud Platform token updaters have stopped in "
+               << (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds() << "ms";
+}
 
-  std::string lastToken;
-  std::unique_ptr<boost::posix_time::ptime> lastUpdate;
 
-  while (*state == State_Running)
+AccountRefresher* GoogleUpdater::LookupRefresher(const std::string& accountName)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (state_ == State_Running)
   {
-    if (lastUpdate.get() == NULL ||
-        (GetNow() - *lastUpdate).total_seconds() >= refreshIntervalSeconds)
+    for (size_t i = 0; i < refreshers_.size(); i++)
     {
-      google::cloud::StatusOr<std::string> token = credentials->AuthorizationHeader();
-      if (!token)
+      if (refreshers_[i]->GetAccount().GetName() == accountName)
       {
-        LOG(WARNING) << "Cannot generate Google Cloud Platform token for account: " << account->GetName();
+        return refreshers_[i];
       }
-      else if (*token != lastToken &&
-               account->UpdateServerDefinition(dicomWebPluginRoot, baseGoogleUrl, *token))
+    }
+  }
+
+  return NULL;
+}
+
+
+AccountRefresher* GoogleUpdater::LookupServerRefresher(const std::string& serverName)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (state_ == State_Running)
+  {
+    for (size_t i = 0; i < refreshers_.size(); i++)
+    {
+      if (refreshers_[i]->HasServer(serverName))
       {
-        lastToken = *token;
+        return refreshers_[i];
       }
-
-      lastUpdate.reset(new boost::posix_time::ptime(GetNow()));
     }
-      
-    boost::this_thread::sleep(boost::posix_time::milliseconds(100));
   }
+
+  return NULL;
 }
 
 
-GoogleUpdater::~GoogleUpdater()
+bool GoogleUpdater::HandleRejectedToken(const std::string& accountName,
+                                        const std::string& rejectedToken)
 {
-  if (state_ == State_Running)
+  AccountRefresher* refresher = LookupRefresher(accountName);
+
+  if (refresher == NULL)
   {
-    LOG(ERROR) << "GoogleUpdater::Stop() should have been manually called";
-    Stop();
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Unknown Google Cloud Platform account: " + accountName);
+  }
+  else
+  {
+    // Leave some time for the token request to complete
+    const unsigned int timeout = GoogleConfiguration::GetInstance().GetTimeoutSeconds() + 5;
+    return refresher->HandleRejectedToken(rejectedToken, timeout);
   }
 }
 
 
-void GoogleUpdater::Start()
+bool GoogleUpdater::GetAuthorizationHeader(std::string& header,
+                                           const std::string& accountName)
 {
-  if (state_ != State_Setup)
+  AccountRefresher* refresher = LookupRefresher(accountName);
+
+  if (refresher == NULL)
   {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Unknown Google Cloud Platform account: " + accountName);
+  }
+  else
+  {
+    // Leave some time for the token request to complete, if the account was dormant
+    return refresher->GetToken(header, GoogleConfiguration::GetInstance().GetTimeoutSeconds() + 5);
   }
+}
 
-  state_ = State_Running;
 
+void GoogleUpdater::NotifyServerAccess(const std::string& uri)
+{
   const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
 
-  workers_.resize(configuration.GetAccountsCount());
+  // The server URIs are "{root}/servers/{name}", as in "GoogleAccount::GetServerUri()"
+  std::string prefix = configuration.GetDicomWebPluginRoot();
+  if (prefix.empty() ||
+      prefix[prefix.size() - 1] != '/')
+  {
+    prefix += '/';
+  }
 
-  for (size_t i = 0; i < workers_.size(); i++)
+  prefix += "servers/";
+
+  if (!boost::starts_with(uri, prefix))
   {
-    workers_[i] = new boost::thread(Worker, &state_, &configuration.GetAccount(i), 
-                                    configuration.GetRefreshIntervalSeconds());
+    return;
+  }
+
+  const size_t slash = uri.find('/', prefix.size());
+  std::string name = uri.substr(prefix.size(), slash == std::string::npos ?
+                                std::string::npos : slash - prefix.size());
+
+  // The clients may escape the '~' of the discovered servers as "%7E"
+  Orthanc::Toolbox::UrlDecode(name);
+
+  AccountRefresher* refresher = LookupServerRefresher(name);
+  if (refresher != NULL)
+  {
+    // This runs in the HTTP threads of Orthanc, that must not be held
+    // for the duration of a token request
+    refresher->NotifyActivity(SERVER_ACCESS_WAIT);
   }
 }
 
-  
-void GoogleUpdater::Stop()
+
+void GoogleUpdater::PublishMetrics()
 {
-  if (state_ == State_Running)
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (state_ != State_Running)
   {
-    state_ = State_Done;
+    return;
+  }
 
-    for (size_t i = 0; i < workers_.size(); i++)
+  for (size_t i = 0; i < refreshers_.size(); i++)
+  {
+    const std::string& name = refreshers_[i]->GetAccount().GetName();
+
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_token_breaker_state_", name).c_str(),
+                                    static_cast<float>(refreshers_[i]->GetCircuitBreaker().GetState()));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_token_next_attempt_s_", name).c_str(),
+                                    static_cast<float>(refreshers_[i]->GetSecondsUntilNextAttempt()));
+  }
+#endif
+}
+
+
+const char* GoogleUpdater::EnumerationToString(State state)
+{
+  switch (state)
+  {
+    case State_Setup:
+      return "Setup";
+
+    case State_Running:
+      return "Running";
+
+    case State_Done:
+      return "Stopped";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+void GoogleUpdater::FormatStatus(Json::Value& target)
+{
+  const State state = state_;
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  target = Json::objectValue;
+  target["State"] = EnumerationToString(state);
+  target["RefreshInterval"] = configuration.GetRefreshIntervalSeconds();
+  target["Timeout"] = configuration.GetTimeoutSeconds();
+  target["ShutdownTimeout"] = configuration.GetShutdownTimeoutSeconds();
+  target["BaseUrl"] = configuration.GetBaseGoogleUrl();
+  target["DicomWebRoot"] = configuration.GetDicomWebPluginRoot();
+
+  Json::Value accounts = Json::objectValue;
+
+  if (state != State_Setup)
+  {
+    for (size_t i = 0; i < refreshers_.size(); i++)
     {
-      if (workers_[i] != NULL)
-      {
-        if (workers_[i]->joinable())
-        {
-          workers_[i]->join();
-        }
+      refreshers_[i]->FormatStatus(accounts[refreshers_[i]->GetAccount().GetName()]);
+    }
+  }
 
-        delete workers_[i];
+  target["Accounts"] = accounts;
+}
+
+
+bool GoogleUpdater::FormatAccountStatus(Json::Value& target,
+                                        const std::string& accountName)
+{
+  if (state_ != State_Setup)
+  {
+    for (size_t i = 0; i < refreshers_.size(); i++)
+    {
+      if (refreshers_[i]->GetAccount().GetName() == accountName)
+      {
+        refreshers_[i]->FormatStatus(target);
+        return true;
       }
     }
+  }
+
+  return false;
+}
 
-    workers_.clear();
+
+void GoogleUpdater::ListAccounts(Json::Value& target)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  target = Json::arrayValue;
+
+  for (size_t i = 0; i < configuration.GetAccountsCount(); i++)
+  {
+    target.append(configuration.GetAccount(i).GetName());
   }
 }
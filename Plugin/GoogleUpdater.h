@@ -33,10 +33,12 @@
 
 #pragma once
 
-#include "GoogleAccount.h"
+#include "AccountRefresher.h"
 
 #include <boost/thread.hpp>
 
+#include <atomic>
+
 class GoogleUpdater : public boost::noncopyable
 {
 private:
@@ -47,12 +49,21 @@ private:
     State_Done
   };
 
-  static void Worker(const State* state,
-                     const GoogleAccount* account,
-                     long refreshIntervalSeconds);
+  static void Worker(GoogleUpdater* that,
+                     size_t index,
+                     AccountRefresher* refresher,
+                     unsigned int refreshIntervalSeconds);
+
+  boost::mutex                    mutex_;
+  boost::condition_variable       stateChanged_;
+  std::atomic<State>              state_;      // Written while holding "mutex_"
+  std::vector<boost::thread*>     workers_;
+  std::vector<bool>               finished_;   // Protected by "mutex_"
+  std::vector<AccountRefresher*>  refreshers_;  // Immutable once "state_" has left "State_Setup"
+
+  void SetWorkerFinished(size_t index);
 
-  State                        state_;
-  std::vector<boost::thread*>  workers_;
+  static const char* EnumerationToString(State state);
 
   // Singleton
   GoogleUpdater() :
@@ -72,4 +83,39 @@ public:
   void Start();
   
   void Stop();
+
+  // Returns NULL if the account is unknown or if the updater is not running
+  AccountRefresher* LookupRefresher(const std::string& accountName);
+
+  // Same as above, from the name of a DICOMweb server (which differs
+  // from the name of the account in the discovery mode)
+  AccountRefresher* LookupServerRefresher(const std::string& serverName);
+
+  // Signals that Google has rejected a token of the given account,
+  // and waits for the refreshed token (for plugin-owned data paths)
+  bool HandleRejectedToken(const std::string& accountName,
+                           const std::string& rejectedToken);
+
+  // Returns the current "Authorization" header of the account, for
+  // the requests to Google that are issued by the plugin itself.
+  // Wakes up the account if it is dormant (lazy mode).
+  bool GetAuthorizationHeader(std::string& header,
+                              const std::string& accountName);
+
+  // Signals the activity of the account whose DICOMweb server is
+  // accessed by the given URI (if any), for the lazy mode. Only waits
+  // briefly, and only if the token of the account has expired.
+  void NotifyServerAccess(const std::string& uri);
+
+  // Publishes the state of the token updaters as Orthanc metrics
+  void PublishMetrics();
+
+  // The status is built from the snapshots of the refreshers, without
+  // contending with the refresh threads
+  void FormatStatus(Json::Value& target);
+
+  bool FormatAccountStatus(Json::Value& target,
+                           const std::string& accountName);
+
+  void ListAccounts(Json::Value& target);
 };
@@ -0,0 +1,383 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "HealthcareClient.h"
+
+#include "CurlBuilder.h"
+#include "GoogleAccount.h"
+#include "GoogleConfiguration.h"
+
+#include <HttpClient.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+
+namespace HealthcareClient
+{
+  static void Prepare(Orthanc::HttpClient& client,
+                      const std::string& url,
+                      const std::string& authorizationHeader)
+  {
+    const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+    std::string headerKey, headerValue;
+    GoogleAccount::ParseAuthorizationHeader(headerKey, headerValue, authorizationHeader);
+
+    client.SetUrl(url);
+    client.SetTimeout(configuration.GetTimeoutSeconds());
+    client.SetHttpsVerifyPeers(configuration.IsHttpsVerifyPeers());
+    client.AddHeader(headerKey, headerValue);
+
+    if (!configuration.GetCaInfo().empty())
+    {
+      client.SetHttpsCACertificates(configuration.GetCaInfo());
+    }
+  }
+
+
+  // Runs the request, and records its duration in "HttpTimings"
+  static bool Execute(std::string& body,
+                      Orthanc::HttpClient::HttpHeaders& headers,
+                      Orthanc::HttpClient& client,
+                      HttpTimings::EndpointClass endpointClass)
+  {
+    if (CurlBuilder::IsAborted())
+    {
+      // Orthanc is stopping: Do not start a request that cannot be aborted
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                      "Orthanc is stopping, cannot call Google: " + client.GetUrl());
+    }
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    bool success;
+
+    try
+    {
+      success = client.Apply(body, headers);
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      HttpTimings::GetInstance().RecordError(endpointClass);  // No answer from Google
+      throw;
+    }
+
+    const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+    HttpTimings::GetInstance().RecordTotal(endpointClass, static_cast<double>(elapsed.total_microseconds()) / 1000.0);
+
+    return success;
+  }
+
+
+  // Converts the HTTP status of a failed request into an exception.
+  // "notFound" is the message for HTTP 404, or NULL if this status is
+  // not expected by the caller.
+  static void ThrowHttpError(const Orthanc::HttpClient& client,
+                             const std::string& url,
+                             const std::string& api,
+                             const char* notFound)
+  {
+    const Orthanc::HttpStatus status = client.GetLastStatus();
+
+    if (status == Orthanc::HttpStatus_401_Unauthorized)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Unauthorized,
+                                      "Google has rejected the token: " + url);
+    }
+    else if (status == Orthanc::HttpStatus_404_NotFound &&
+             notFound != NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem,
+                                      std::string(notFound) + ": " + url);
+    }
+    else
+    {
+      throw Orthanc::OrthancException(
+        Orthanc::ErrorCode_NetworkProtocol,
+        "HTTP status " + boost::lexical_cast<std::string>(static_cast<int>(status)) +
+        " from the " + api + ": " + url);
+    }
+  }
+
+
+  static void Apply(Json::Value& answer,
+                    Orthanc::HttpClient& client,
+                    const std::string& url,
+                    const std::string& authorizationHeader,
+                    HttpTimings::EndpointClass endpointClass)
+  {
+    Prepare(client, url, authorizationHeader);
+
+    std::string body;
+    Orthanc::HttpClient::HttpHeaders headers;
+    if (!Execute(body, headers, client, endpointClass))
+    {
+      ThrowHttpError(client, url, "Healthcare API", NULL);
+    }
+
+    if (!OrthancPlugins::ReadJson(answer, body) ||
+        answer.type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Cannot parse the answer of the Healthcare API: " + url);
+    }
+  }
+
+
+  void Get(Json::Value& answer,
+           const std::string& url,
+           const std::string& authorizationHeader,
+           HttpTimings::EndpointClass endpointClass)
+  {
+    Orthanc::HttpClient client;
+    client.SetMethod(Orthanc::HttpMethod_Get);
+    Apply(answer, client, url, authorizationHeader, endpointClass);
+  }
+
+
+  void Post(Json::Value& answer,
+            const std::string& url,
+            const Json::Value& body,
+            const std::string& authorizationHeader,
+            HttpTimings::EndpointClass endpointClass)
+  {
+    std::string s;
+    OrthancPlugins::WriteFastJson(s, body);
+
+    Orthanc::HttpClient client;
+    client.SetMethod(Orthanc::HttpMethod_Post);
+    client.AddHeader("Content-Type", "application/json");
+    client.AssignBody(s);
+    Apply(answer, client, url, authorizationHeader, endpointClass);
+  }
+
+
+  void Search(Json::Value& answer,
+              const std::string& url,
+              const std::string& authorizationHeader)
+  {
+    Orthanc::HttpClient client;
+    client.SetMethod(Orthanc::HttpMethod_Get);
+    client.AddHeader("Accept", "application/dicom+json");
+    Prepare(client, url, authorizationHeader);
+
+    std::string body;
+    Orthanc::HttpClient::HttpHeaders headers;
+    if (!Execute(body, headers, client, HttpTimings::EndpointClass_Qido))
+    {
+      ThrowHttpError(client, url, "DICOMweb API", NULL);
+    }
+
+    if (body.empty())
+    {
+      answer = Json::arrayValue;  // "204 No Content" if nothing matches
+    }
+    else if (!OrthancPlugins::ReadJson(answer, body) ||
+             answer.type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Cannot parse the QIDO-RS answer of Google: " + url);
+    }
+  }
+
+
+  // Extracts the first part of a "multipart/related" answer, which
+  // is the only one as a single instance is requested
+  static bool ExtractFirstPart(std::string& target,
+                               const std::string& body,
+                               const std::string& contentType)
+  {
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, contentType, ';');
+
+    std::string boundary;
+    for (size_t i = 1; i < tokens.size(); i++)
+    {
+      std::string token = Orthanc::Toolbox::StripSpaces(tokens[i]);
+      if (boost::istarts_with(token, "boundary="))
+      {
+        boundary = token.substr(9);
+        if (boundary.size() >= 2 &&
+            boundary[0] == '"' &&
+            boundary[boundary.size() - 1] == '"')
+        {
+          boundary = boundary.substr(1, boundary.size() - 2);
+        }
+      }
+    }
+
+    if (boundary.empty())
+    {
+      return false;
+    }
+
+    const std::string delimiter = "--" + boundary;
+
+    size_t start = body.find(delimiter);
+    if (start == std::string::npos)
+    {
+      return false;
+    }
+
+    start = body.find("\r\n\r\n", start + delimiter.size());
+    if (start == std::string::npos)
+    {
+      return false;
+    }
+
+    start += 4;
+
+    size_t end = body.find("\r\n" + delimiter, start);
+    if (end == std::string::npos)
+    {
+      return false;
+    }
+
+    target.assign(body, start, end - start);
+    return true;
+  }
+
+
+  void RetrieveInstance(std::string& dicom,
+                        const std::string& url,
+                        const std::string& authorizationHeader)
+  {
+    Orthanc::HttpClient client;
+    client.SetMethod(Orthanc::HttpMethod_Get);
+    client.AddHeader("Accept", "multipart/related; type=\"application/dicom\"; transfer-syntax=*");
+    Prepare(client, url, authorizationHeader);
+
+    std::string body;
+    Orthanc::HttpClient::HttpHeaders headers;
+    if (!Execute(body, headers, client, HttpTimings::EndpointClass_Wado))
+    {
+      ThrowHttpError(client, url, "DICOMweb API", "No such instance in the DICOM store");
+    }
+
+    std::string contentType;
+    for (Orthanc::HttpClient::HttpHeaders::const_iterator it = headers.begin(); it != headers.end(); ++it)
+    {
+      if (boost::iequals(it->first, "Content-Type"))
+      {
+        contentType = it->second;
+      }
+    }
+
+    if (boost::istarts_with(contentType, "application/dicom"))
+    {
+      dicom.swap(body);   // Single-part answer
+    }
+    else if (!boost::istarts_with(contentType, "multipart/related") ||
+             !ExtractFirstPart(dicom, body, contentType))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Cannot parse the WADO-RS answer of Google: " + url);
+    }
+  }
+
+
+  void RetrieveFrames(std::string& body,
+                      std::string& contentType,
+                      const std::string& url,
+                      const std::string& authorizationHeader,
+                      const std::string& accept)
+  {
+    Orthanc::HttpClient client;
+    client.SetMethod(Orthanc::HttpMethod_Get);
+    client.AddHeader("Accept", accept);
+    Prepare(client, url, authorizationHeader);
+
+    Orthanc::HttpClient::HttpHeaders headers;
+    if (!Execute(body, headers, client, HttpTimings::EndpointClass_Wado))
+    {
+      ThrowHttpError(client, url, "DICOMweb API", "No such frame in the DICOM store");
+    }
+
+    contentType.clear();
+    for (Orthanc::HttpClient::HttpHeaders::const_iterator it = headers.begin(); it != headers.end(); ++it)
+    {
+      if (boost::iequals(it->first, "Content-Type"))
+      {
+        contentType = it->second;
+      }
+    }
+  }
+
+
+  bool RetrieveMetadata(std::string& metadata,
+                        std::string& etag,
+                        const std::string& url,
+                        const std::string& authorizationHeader,
+                        const std::string& ifNoneMatch)
+  {
+    Orthanc::HttpClient client;
+    client.SetMethod(Orthanc::HttpMethod_Get);
+    client.AddHeader("Accept", "application/dicom+json");
+
+    if (!ifNoneMatch.empty())
+    {
+      client.AddHeader("If-None-Match", ifNoneMatch);
+    }
+
+    Prepare(client, url, authorizationHeader);
+
+    std::string body;
+    Orthanc::HttpClient::HttpHeaders headers;
+    if (!Execute(body, headers, client, HttpTimings::EndpointClass_Wado))
+    {
+      if (client.GetLastStatus() == Orthanc::HttpStatus_304_NotModified)
+      {
+        return false;
+      }
+      else
+      {
+        ThrowHttpError(client, url, "DICOMweb API", "No such resource in the DICOM store");
+      }
+    }
+
+    etag.clear();
+    for (Orthanc::HttpClient::HttpHeaders::const_iterator it = headers.begin(); it != headers.end(); ++it)
+    {
+      if (boost::iequals(it->first, "ETag"))
+      {
+        etag = it->second;
+      }
+    }
+
+    metadata.swap(body);
+    return true;
+  }
+}
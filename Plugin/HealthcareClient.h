@@ -0,0 +1,99 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "HttpTimings.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+
+/**
+ * JSON requests to the REST API of Google Healthcare, outside of the
+ * DICOMweb servers managed by the DICOMweb plugin (listing of the
+ * DICOM stores, long-running operations...). The TLS and timeout
+ * settings are those of the "GoogleCloudPlatform" section. The
+ * methods throw an exception on errors, "ErrorCode_Unauthorized" if
+ * Google rejects the token. The durations of the requests are
+ * recorded in "HttpTimings".
+ **/
+namespace HealthcareClient
+{
+  // "authorizationHeader" is the "Authorization: Bearer ..." header
+  // of the account, as provided by google-cloud-cpp. "endpointClass"
+  // tells under which class the timings of the request are recorded.
+  void Get(Json::Value& answer,
+           const std::string& url,
+           const std::string& authorizationHeader,
+           HttpTimings::EndpointClass endpointClass);
+
+  void Post(Json::Value& answer,
+            const std::string& url,
+            const Json::Value& body,
+            const std::string& authorizationHeader,
+            HttpTimings::EndpointClass endpointClass);
+
+  // QIDO-RS search, whose answer is a JSON array (possibly empty).
+  // Throws "ErrorCode_Unauthorized" if Google rejects the token.
+  void Search(Json::Value& answer,
+              const std::string& url,
+              const std::string& authorizationHeader);
+
+  // WADO-RS retrieval of one DICOM instance, in its stored transfer
+  // syntax. "url" ends with "studies/{study}/series/{series}/instances/{sop}".
+  // Throws "ErrorCode_Unauthorized" if Google rejects the token, and
+  // "ErrorCode_InexistentItem" if the instance is not in the store.
+  void RetrieveInstance(std::string& dicom,
+                        const std::string& url,
+                        const std::string& authorizationHeader);
+
+  // WADO-RS retrieval of frames, with the given "Accept" header that
+  // selects the transfer syntax. The body is left as returned by
+  // Google (usually "multipart/related"), together with its
+  // "Content-Type". Throws "ErrorCode_InexistentItem" on HTTP 404.
+  void RetrieveFrames(std::string& body,
+                      std::string& contentType,
+                      const std::string& url,
+                      const std::string& authorizationHeader,
+                      const std::string& accept);
+
+  // WADO-RS retrieval of metadata (DICOM JSON). If "ifNoneMatch" is
+  // not empty, the request is conditional, and "false" is returned if
+  // Google answers "304 Not Modified". "etag" is empty if Google does
+  // not provide one. Throws "ErrorCode_InexistentItem" on HTTP 404.
+  bool RetrieveMetadata(std::string& metadata,
+                        std::string& etag,
+                        const std::string& url,
+                        const std::string& authorizationHeader,
+                        const std::string& ifNoneMatch);
+}
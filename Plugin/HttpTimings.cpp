@@ -0,0 +1,346 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "HttpTimings.h"
+
+#include "PluginToolbox.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+
+static const double BUCKETS_UPPER_BOUNDS_MS[HttpTimings::Histogram::BUCKETS_COUNT - 1] = {
+  1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000
+};
+
+
+HttpTimings::Histogram::Histogram() :
+  count_(0),
+  sumMs_(0),
+  maxMs_(0)
+{
+  std::fill(buckets_, buckets_ + BUCKETS_COUNT, 0);
+}
+
+
+void HttpTimings::Histogram::Add(double milliseconds)
+{
+  milliseconds = std::max(0.0, milliseconds);
+
+  const double* end = BUCKETS_UPPER_BOUNDS_MS + (BUCKETS_COUNT - 1);
+  const size_t bucket = std::lower_bound(BUCKETS_UPPER_BOUNDS_MS, end, milliseconds) - BUCKETS_UPPER_BOUNDS_MS;
+
+  buckets_[bucket]++;
+  count_++;
+  sumMs_ += milliseconds;
+  maxMs_ = std::max(maxMs_, milliseconds);
+}
+
+
+double HttpTimings::Histogram::GetPercentile(double q) const
+{
+  if (count_ == 0)
+  {
+    return 0;
+  }
+
+  const double target = q * static_cast<double>(count_);
+
+  uint64_t cumulated = 0;
+  for (size_t i = 0; i < BUCKETS_COUNT - 1; i++)
+  {
+    cumulated += buckets_[i];
+    if (static_cast<double>(cumulated) >= target)
+    {
+      return std::min(BUCKETS_UPPER_BOUNDS_MS[i], maxMs_);
+    }
+  }
+
+  return maxMs_;
+}
+
+
+void HttpTimings::Histogram::Format(Json::Value& target) const
+{
+  target = Json::objectValue;
+  target["Count"] = static_cast<Json::UInt64>(count_);
+  target["SumMs"] = sumMs_;
+  target["MaxMs"] = maxMs_;
+  target["P50Ms"] = GetPercentile(0.5);
+  target["P95Ms"] = GetPercentile(0.95);
+  target["P99Ms"] = GetPercentile(0.99);
+
+  // Cumulative buckets, as in Prometheus histograms
+  Json::Value buckets = Json::arrayValue;
+  uint64_t cumulated = 0;
+
+  for (size_t i = 0; i < BUCKETS_COUNT; i++)
+  {
+    cumulated += buckets_[i];
+
+    Json::Value bucket = Json::objectValue;
+    if (i < BUCKETS_COUNT - 1)
+    {
+      bucket["LessOrEqualMs"] = BUCKETS_UPPER_BOUNDS_MS[i];
+    }
+    else
+    {
+      bucket["LessOrEqualMs"] = "+Inf";
+    }
+
+    bucket["Count"] = static_cast<Json::UInt64>(cumulated);
+    buckets.append(bucket);
+  }
+
+  target["Buckets"] = buckets;
+}
+
+
+void HttpTimings::Record(EndpointClass endpointClass,
+                         CURL* handle)
+{
+  char* url = NULL;
+  long responseCode = 0;
+  long numConnects = 0;
+  double nameLookup = 0;
+  double connect = 0;
+  double appConnect = 0;
+  double startTransfer = 0;
+  double total = 0;
+
+  if (curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK ||
+      url == NULL ||
+      curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &responseCode) != CURLE_OK ||
+      curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &numConnects) != CURLE_OK ||
+      curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME, &nameLookup) != CURLE_OK ||
+      curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME, &connect) != CURLE_OK ||
+      curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME, &appConnect) != CURLE_OK ||
+      curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &startTransfer) != CURLE_OK ||
+      curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &total) != CURLE_OK)
+  {
+    return;
+  }
+
+  if (url[0] == '\0')
+  {
+    return;  // The handle was never used
+  }
+
+  if (static_cast<size_t>(endpointClass) >= ENDPOINT_CLASSES_COUNT)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  Endpoint& target = endpoints_[endpointClass];
+
+  if (responseCode == 0)
+  {
+    target.errors_++;
+    return;
+  }
+
+  // The timings of libcurl are cumulative since the start of the transfer, in seconds
+  if (numConnects > 0)
+  {
+    // The DNS, TCP and TLS phases only make sense for new connections
+    target.newConnections_++;
+    target.phases_[Phase_NameLookup].Add(1000.0 * nameLookup);
+    target.phases_[Phase_Connect].Add(1000.0 * (connect - nameLookup));
+
+    if (appConnect > 0)
+    {
+      target.phases_[Phase_TlsHandshake].Add(1000.0 * (appConnect - connect));
+    }
+  }
+  else
+  {
+    target.reusedConnections_++;
+  }
+
+  target.phases_[Phase_Server].Add(1000.0 * (startTransfer - std::max(connect, appConnect)));
+  target.phases_[Phase_Total].Add(1000.0 * total);
+}
+
+
+void HttpTimings::RecordTotal(EndpointClass endpointClass,
+                              double milliseconds)
+{
+  if (static_cast<size_t>(endpointClass) >= ENDPOINT_CLASSES_COUNT)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  endpoints_[endpointClass].phases_[Phase_Total].Add(milliseconds);
+}
+
+
+void HttpTimings::RecordError(EndpointClass endpointClass)
+{
+  if (static_cast<size_t>(endpointClass) >= ENDPOINT_CLASSES_COUNT)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  endpoints_[endpointClass].errors_++;
+}
+
+
+void HttpTimings::Format(Json::Value& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target = Json::objectValue;
+
+  for (size_t i = 0; i < ENDPOINT_CLASSES_COUNT; i++)
+  {
+    const Endpoint& source = endpoints_[i];
+
+    Json::Value endpoint = Json::objectValue;
+    endpoint["NewConnections"] = static_cast<Json::UInt64>(source.newConnections_);
+    endpoint["ReusedConnections"] = static_cast<Json::UInt64>(source.reusedConnections_);
+    endpoint["Errors"] = static_cast<Json::UInt64>(source.errors_);
+
+    Json::Value phases = Json::objectValue;
+    for (size_t j = 0; j < PHASES_COUNT; j++)
+    {
+      source.phases_[j].Format(phases[EnumerationToString(static_cast<Phase>(j))]);
+    }
+
+    endpoint["Phases"] = phases;
+    target[EnumerationToString(static_cast<EndpointClass>(i))] = endpoint;
+  }
+}
+
+
+void HttpTimings::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  boost::mutex::scoped_lock lock(mutex_);
+
+  for (size_t i = 0; i < ENDPOINT_CLASSES_COUNT; i++)
+  {
+    const Endpoint& source = endpoints_[i];
+    const std::string endpoint = boost::algorithm::to_lower_copy(
+      std::string(EnumerationToString(static_cast<EndpointClass>(i))));
+
+    for (size_t j = 0; j < PHASES_COUNT; j++)
+    {
+      const Histogram& histogram = source.phases_[j];
+      const std::string phase = boost::algorithm::to_lower_copy(
+        std::string(EnumerationToString(static_cast<Phase>(j))));
+
+      OrthancPlugins::SetMetricsValue(
+        PluginToolbox::FormatMetricName("orthanc_gcp_http_" + phase + "_p50_ms_", endpoint).c_str(),
+        static_cast<float>(histogram.GetPercentile(0.5)));
+      OrthancPlugins::SetMetricsValue(
+        PluginToolbox::FormatMetricName("orthanc_gcp_http_" + phase + "_p95_ms_", endpoint).c_str(),
+        static_cast<float>(histogram.GetPercentile(0.95)));
+    }
+
+    OrthancPlugins::SetMetricsValue(
+      PluginToolbox::FormatMetricName("orthanc_gcp_http_new_connections_", endpoint).c_str(),
+      static_cast<float>(source.newConnections_));
+    OrthancPlugins::SetMetricsValue(
+      PluginToolbox::FormatMetricName("orthanc_gcp_http_reused_connections_", endpoint).c_str(),
+      static_cast<float>(source.reusedConnections_));
+    OrthancPlugins::SetMetricsValue(
+      PluginToolbox::FormatMetricName("orthanc_gcp_http_errors_", endpoint).c_str(),
+      static_cast<float>(source.errors_));
+  }
+#endif
+}
+
+
+const char* HttpTimings::EnumerationToString(EndpointClass endpointClass)
+{
+  switch (endpointClass)
+  {
+    case EndpointClass_Token:
+      return "Token";
+
+    case EndpointClass_Qido:
+      return "QIDO-RS";
+
+    case EndpointClass_Wado:
+      return "WADO-RS";
+
+    case EndpointClass_Operations:
+      return "Operations";
+
+    case EndpointClass_Other:
+      return "Other";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+const char* HttpTimings::EnumerationToString(Phase phase)
+{
+  switch (phase)
+  {
+    case Phase_NameLookup:
+      return "NameLookup";
+
+    case Phase_Connect:
+      return "Connect";
+
+    case Phase_TlsHandshake:
+      return "TlsHandshake";
+
+    case Phase_Server:
+      return "Server";
+
+    case Phase_Total:
+      return "Total";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+HttpTimings& HttpTimings::GetInstance()
+{
+  static HttpTimings instance;
+  return instance;
+}
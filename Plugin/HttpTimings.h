@@ -0,0 +1,151 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <curl/curl.h>
+#include <json/value.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <stdint.h>
+
+
+/**
+ * Aggregates the timings of the HTTP requests issued by the plugin,
+ * into one set of histograms per class of endpoint. The classes are
+ * a fixed set, so that the number of metrics is bounded whatever the
+ * number of DICOM stores. For the token requests, the per-phase
+ * timings of libcurl allow to tell DNS resolution, TCP connection,
+ * TLS handshake and server latency apart. The requests to the
+ * Healthcare API only report their total duration, as they are
+ * issued by the HTTP client of the Orthanc framework.
+ **/
+class HttpTimings : public boost::noncopyable
+{
+public:
+  enum EndpointClass
+  {
+    EndpointClass_Token,       // OAuth 2.0 token endpoints
+    EndpointClass_Qido,        // DICOMweb searches
+    EndpointClass_Wado,        // DICOMweb retrievals (instances, frames, metadata)
+    EndpointClass_Operations,  // Long-running operations of the Healthcare API
+    EndpointClass_Other        // Other requests (e.g. listings, Pub/Sub)
+  };
+
+  static const size_t ENDPOINT_CLASSES_COUNT = 5;
+
+  enum Phase
+  {
+    Phase_NameLookup,    // DNS resolution
+    Phase_Connect,       // TCP connection, after DNS
+    Phase_TlsHandshake,  // TLS handshake, after TCP connection
+    Phase_Server,        // From the end of the handshake to the first byte of the answer
+    Phase_Total
+  };
+
+  static const size_t PHASES_COUNT = 5;
+
+  class Histogram
+  {
+  public:
+    static const size_t BUCKETS_COUNT = 15;   // The last bucket is "+Inf"
+
+  private:
+    uint64_t  buckets_[BUCKETS_COUNT];
+    uint64_t  count_;
+    double    sumMs_;
+    double    maxMs_;
+
+  public:
+    Histogram();
+
+    void Add(double milliseconds);
+
+    uint64_t GetCount() const
+    {
+      return count_;
+    }
+
+    // Approximation, using the upper bounds of the buckets
+    double GetPercentile(double q) const;
+
+    void Format(Json::Value& target) const;
+  };
+
+private:
+  struct Endpoint
+  {
+    Histogram  phases_[PHASES_COUNT];
+    uint64_t   newConnections_;
+    uint64_t   reusedConnections_;
+    uint64_t   errors_;
+
+    Endpoint() :
+      newConnections_(0),
+      reusedConnections_(0),
+      errors_(0)
+    {
+    }
+  };
+
+  boost::mutex  mutex_;
+  Endpoint      endpoints_[ENDPOINT_CLASSES_COUNT];
+
+  HttpTimings()  // Singleton pattern
+  {
+  }
+
+public:
+  // To be called once the transfer of "handle" is over, before its cleanup
+  void Record(EndpointClass endpointClass,
+              CURL* handle);
+
+  // For the requests whose phases are unknown: Only the total
+  // duration is recorded, or an error if no answer was received
+  void RecordTotal(EndpointClass endpointClass,
+                   double milliseconds);
+
+  void RecordError(EndpointClass endpointClass);
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+
+  static const char* EnumerationToString(EndpointClass endpointClass);
+
+  static const char* EnumerationToString(Phase phase);
+
+  static HttpTimings& GetInstance();
+};
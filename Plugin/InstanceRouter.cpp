@@ -0,0 +1,500 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "InstanceRouter.h"
+
+#include "GoogleConfiguration.h"
+#include "PresenceFilters.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <cassert>
+
+
+static const unsigned int MAX_FORWARD_ATTEMPTS = 5;
+static const unsigned int FORWARD_RETRY_DELAY = 10;  // In seconds, doubled after each failure
+
+
+InstanceRouter::InstanceRouter() :
+  batchSize_(1),
+  stopped_(false),
+  thread_(NULL),
+  instancesCount_(0),
+  unroutedCount_(0),
+  parseFailuresCount_(0),
+  queuedCount_(0),
+  forwardedCount_(0),
+  skippedCount_(0),
+  jobsCount_(0),
+  retriesCount_(0),
+  failuresCount_(0),
+  evaluationMicroseconds_(0)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  if (!configuration.GetRoutingRules().empty())
+  {
+    std::unique_ptr<RoutingTree> tree(new RoutingTree(configuration.GetRoutingRules()));
+
+    for (size_t i = 0; i < tree->GetAccountsCount(); i++)
+    {
+      const GoogleAccount* account = configuration.LookupAccount(tree->GetAccount(i));
+
+      if (account == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Unknown account in the routing rules: " + tree->GetAccount(i));
+      }
+      else if (account->IsDiscovery())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "The routing is not available for an account in the discovery mode: " +
+                                        tree->GetAccount(i));
+      }
+      else
+      {
+        targets_.push_back(account);
+      }
+    }
+
+    lanes_.resize(targets_.size(), 0);
+    batchSize_ = configuration.GetRoutingBatchSize();
+
+    LOG(WARNING) << "The routing rules are compiled: " << tree->GetRulesCount() << " rules, "
+                 << tree->GetTagsCount() << " tags, " << tree->GetNodesCount() << " nodes, depth "
+                 << tree->GetDepth();
+
+    tree_.reset(tree.release());
+  }
+}
+
+
+InstanceRouter::~InstanceRouter()
+{
+  if (thread_ != NULL)
+  {
+    LOG(ERROR) << "InstanceRouter::Stop() should have been called";
+    Stop();
+  }
+}
+
+
+InstanceRouter& InstanceRouter::GetInstance()
+{
+  static InstanceRouter instance;
+  return instance;
+}
+
+
+void InstanceRouter::Worker(InstanceRouter* that)
+{
+  for (;;)
+  {
+    std::deque<Item> items;
+    bool stopped;
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      for (;;)
+      {
+        stopped = that->stopped_;
+
+        const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+        boost::posix_time::ptime nextRetry(boost::posix_time::not_a_date_time);
+
+        // When stopping, the items waiting for a retry get one last attempt
+        std::deque<Item> waiting;
+        for (std::deque<Item>::const_iterator it = that->retries_.begin(); it != that->retries_.end(); ++it)
+        {
+          if (stopped ||
+              it->retryTime_ <= now)
+          {
+            items.push_back(*it);
+          }
+          else
+          {
+            waiting.push_back(*it);
+
+            if (nextRetry.is_not_a_date_time() ||
+                it->retryTime_ < nextRetry)
+            {
+              nextRetry = it->retryTime_;
+            }
+          }
+        }
+
+        that->retries_.swap(waiting);
+
+        items.insert(items.end(), that->queue_.begin(), that->queue_.end());
+        that->queue_.clear();
+
+        if (stopped ||
+            !items.empty())
+        {
+          break;
+        }
+        else if (nextRetry.is_not_a_date_time())
+        {
+          that->wakeUp_.wait(lock);
+        }
+        else
+        {
+          that->wakeUp_.timed_wait(lock, nextRetry);
+        }
+      }
+    }
+
+    if (stopped &&
+        !items.empty())
+    {
+      LOG(WARNING) << "Forwarding the " << items.size() << " instances that are still pending "
+                   << "before stopping the routing to Google Cloud Platform";
+    }
+
+    that->ForwardBatches(items);
+
+    if (stopped)
+    {
+      return;
+    }
+  }
+}
+
+
+void InstanceRouter::ForwardBatches(const std::deque<Item>& items)
+{
+  // Group the instances by account, in batches
+  std::vector<std::vector<Item> > batches(targets_.size());
+
+  for (std::deque<Item>::const_iterator it = items.begin(); it != items.end(); ++it)
+  {
+    std::vector<Item>& batch = batches[it->account_];
+    batch.push_back(*it);
+
+    if (batch.size() >= batchSize_)
+    {
+      Forward(it->account_, batch);
+      batch.clear();
+    }
+  }
+
+  for (size_t i = 0; i < batches.size(); i++)
+  {
+    if (!batches[i].empty())
+    {
+      Forward(i, batches[i]);
+    }
+  }
+}
+
+
+void InstanceRouter::Forward(size_t account,
+                             const std::vector<Item>& items)
+{
+  assert(account < targets_.size());
+  const GoogleAccount& target = *targets_[account];
+
+  Json::Value resources = Json::arrayValue;
+  std::vector<Item> sent;
+  uint64_t skipped = 0;
+
+  for (size_t i = 0; i < items.size(); i++)
+  {
+    if (target.HasPresenceFilter() &&
+        !items[i].sopInstanceUid_.empty() &&
+        PresenceFilters::GetInstance().IsPresent(target.GetName(), target.GetDataset(), target.GetDicomStore(),
+                                                 items[i].sopInstanceUid_, items[i].size_))
+    {
+      skipped++;
+    }
+    else
+    {
+      resources.append(items[i].instanceId_);
+      sent.push_back(items[i]);
+    }
+  }
+
+  bool success = true;
+
+  if (!sent.empty())
+  {
+    // The successive batches are spread over the lanes of the account
+    const unsigned int lane = lanes_[account];
+    lanes_[account] = (lane + 1) % std::max(1u, target.GetLanesCount());
+
+    // The STOW-RS job is synchronous, so that the instances are only
+    // added to the presence filter once Google has stored them: This
+    // runs in the worker thread, not in the callback of Orthanc
+    Json::Value body;
+    body["Resources"] = resources;
+    body["Synchronous"] = true;
+
+    const std::string uri = (target.GetServerUri(GoogleConfiguration::GetInstance().GetDicomWebPluginRoot(),
+                                                 target.GetDataset(), target.GetDicomStore(), lane) + "/stow");
+
+    Json::Value answer;
+    success = OrthancPlugins::RestApiPost(answer, uri, body, false);
+
+    if (success)
+    {
+      for (size_t i = 0; i < sent.size(); i++)
+      {
+        if (!sent[i].sopInstanceUid_.empty())
+        {
+          PresenceFilters::GetInstance().Add(target.GetName(), target.GetDataset(), target.GetDicomStore(),
+                                             sent[i].sopInstanceUid_);
+        }
+      }
+    }
+  }
+
+  uint64_t retried = 0;
+  uint64_t dropped = 0;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    skippedCount_ += skipped;
+
+    if (success)
+    {
+      if (!sent.empty())
+      {
+        jobsCount_++;
+        forwardedCount_ += sent.size();
+      }
+    }
+    else
+    {
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+      for (size_t i = 0; i < sent.size(); i++)
+      {
+        Item item = sent[i];
+        item.attempts_++;
+
+        if (stopped_ ||
+            item.attempts_ >= MAX_FORWARD_ATTEMPTS)
+        {
+          dropped++;
+        }
+        else
+        {
+          item.retryTime_ = now + boost::posix_time::seconds(FORWARD_RETRY_DELAY << (item.attempts_ - 1));
+          retries_.push_back(item);
+          retried++;
+        }
+      }
+
+      retriesCount_ += retried;
+      failuresCount_ += dropped;
+    }
+  }
+
+  if (retried != 0)
+  {
+    LOG(WARNING) << "Cannot forward " << retried << " instances to Google Cloud Platform account \""
+                 << target.GetName() << "\", they will be sent again later";
+  }
+
+  if (dropped != 0)
+  {
+    LOG(ERROR) << "Giving up forwarding " << dropped << " instances to Google Cloud Platform account \""
+               << target.GetName() << "\", the store synchronization job can be used to reconcile";
+  }
+}
+
+
+void InstanceRouter::SignalStoredInstance(const std::string& instanceId,
+                                          const void* dicom,
+                                          size_t size)
+{
+  if (!IsEnabled())
+  {
+    return;
+  }
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  RoutingTree::Values values;
+  std::string sopInstanceUid;
+  std::vector<size_t> accounts;
+
+  const bool parsed = tree_->ExtractValues(values, sopInstanceUid, dicom, size);
+  if (parsed)
+  {
+    tree_->Evaluate(accounts, values);
+  }
+
+  const double elapsed = static_cast<double>(
+    (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds());
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    instancesCount_++;
+    evaluationMicroseconds_ += elapsed;
+
+    if (!parsed)
+    {
+      parseFailuresCount_++;
+    }
+    else if (accounts.empty())
+    {
+      unroutedCount_++;
+    }
+
+    for (size_t i = 0; i < accounts.size(); i++)
+    {
+      Item item;
+      item.instanceId_ = instanceId;
+      item.sopInstanceUid_ = sopInstanceUid;
+      item.size_ = size;
+      item.account_ = accounts[i];
+      item.attempts_ = 0;
+      queue_.push_back(item);
+      queuedCount_++;
+    }
+  }
+
+  if (!parsed)
+  {
+    LOG(WARNING) << "Cannot parse instance " << instanceId << " to evaluate the routing rules";
+  }
+  else if (!accounts.empty())
+  {
+    wakeUp_.notify_all();
+  }
+}
+
+
+void InstanceRouter::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (thread_ == NULL &&
+      IsEnabled())
+  {
+    stopped_ = false;
+    thread_ = new boost::thread(Worker, this);
+  }
+}
+
+
+void InstanceRouter::Stop()
+{
+  boost::thread* thread;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    thread = thread_;
+    thread_ = NULL;
+  }
+
+  wakeUp_.notify_all();
+
+  if (thread != NULL)
+  {
+    if (thread->joinable())
+    {
+      thread->join();
+    }
+
+    delete thread;
+  }
+}
+
+
+void InstanceRouter::Format(Json::Value& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target = Json::objectValue;
+
+  if (!IsEnabled())
+  {
+    return;
+  }
+
+  target["RulesCount"] = static_cast<Json::UInt64>(tree_->GetRulesCount());
+  target["NodesCount"] = static_cast<Json::UInt64>(tree_->GetNodesCount());
+  target["Depth"] = static_cast<Json::UInt64>(tree_->GetDepth());
+  target["BatchSize"] = batchSize_;
+
+  target["Tags"] = Json::arrayValue;
+  for (size_t i = 0; i < tree_->GetTagsCount(); i++)
+  {
+    target["Tags"].append(RoutingTree::FormatTag(tree_->GetTag(i)));
+  }
+
+  target["Accounts"] = Json::arrayValue;
+  for (size_t i = 0; i < tree_->GetAccountsCount(); i++)
+  {
+    target["Accounts"].append(tree_->GetAccount(i));
+  }
+
+  target["InstancesCount"] = static_cast<Json::UInt64>(instancesCount_);
+  target["UnroutedCount"] = static_cast<Json::UInt64>(unroutedCount_);
+  target["ParseFailuresCount"] = static_cast<Json::UInt64>(parseFailuresCount_);
+  target["PendingCount"] = static_cast<Json::UInt64>(queue_.size() + retries_.size());
+  target["QueuedCount"] = static_cast<Json::UInt64>(queuedCount_);
+  target["ForwardedCount"] = static_cast<Json::UInt64>(forwardedCount_);
+  target["SkippedCount"] = static_cast<Json::UInt64>(skippedCount_);
+  target["JobsCount"] = static_cast<Json::UInt64>(jobsCount_);
+  target["RetriesCount"] = static_cast<Json::UInt64>(retriesCount_);
+  target["FailuresCount"] = static_cast<Json::UInt64>(failuresCount_);
+  target["MeanEvaluationMicroseconds"] = (instancesCount_ == 0 ? 0.0 :
+                                          evaluationMicroseconds_ / static_cast<double>(instancesCount_));
+}
+
+
+void InstanceRouter::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  boost::mutex::scoped_lock lock(mutex_);
+
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_routing_instances", static_cast<float>(instancesCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_routing_unrouted", static_cast<float>(unroutedCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_routing_pending", static_cast<float>(queue_.size() + retries_.size()));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_routing_forwarded", static_cast<float>(forwardedCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_routing_skipped", static_cast<float>(skippedCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_routing_retries", static_cast<float>(retriesCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_routing_failures", static_cast<float>(failuresCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_routing_evaluation_us", static_cast<float>(
+                                    instancesCount_ == 0 ? 0.0 : evaluationMicroseconds_ / static_cast<double>(instancesCount_)));
+#endif
+}
@@ -0,0 +1,137 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "RoutingTree.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+#include <memory>
+
+
+class GoogleAccount;
+
+
+/**
+ * Automatic forwarding of the instances received by Orthanc to the
+ * DICOM stores of Google, according to the "Routing" rules of the
+ * configuration, that are compiled once into a "RoutingTree". Each
+ * stored instance is parsed once to extract the tags used by the
+ * rules, and queued for each of the matching accounts: The callback
+ * of Orthanc is not blocked by the transfers. A background thread
+ * sends the queued instances by batches, as synchronous STOW-RS
+ * jobs of the DICOMweb plugin, spread over the lanes of the account.
+ * The batches that fail are queued again with an exponential backoff,
+ * up to a bounded number of attempts, and the pending instances are
+ * sent once more when the router is stopped. The instances known to
+ * be in the DICOM store by its presence filter (if any) are skipped,
+ * so that the instances retrieved from Google are not uploaded back
+ * to the same DICOM store.
+ **/
+class InstanceRouter : public boost::noncopyable
+{
+private:
+  struct Item
+  {
+    std::string  instanceId_;
+    std::string  sopInstanceUid_;
+    size_t       size_;
+    size_t       account_;   // Index in "targets_"
+    unsigned int attempts_;
+    boost::posix_time::ptime  retryTime_;
+  };
+
+  std::unique_ptr<RoutingTree>         tree_;      // NULL if the routing is disabled
+  std::vector<const GoogleAccount*>    targets_;   // Indexed as the accounts of the tree
+  std::vector<unsigned int>            lanes_;     // Next lane of each account (worker only)
+  unsigned int                         batchSize_;
+
+  boost::mutex                 mutex_;
+  boost::condition_variable    wakeUp_;
+  bool                         stopped_;
+  boost::thread*               thread_;
+  std::deque<Item>             queue_;
+  std::deque<Item>             retries_;   // Failed items, waiting for their "retryTime_"
+
+  uint64_t                     instancesCount_;
+  uint64_t                     unroutedCount_;
+  uint64_t                     parseFailuresCount_;
+  uint64_t                     queuedCount_;
+  uint64_t                     forwardedCount_;
+  uint64_t                     skippedCount_;
+  uint64_t                     jobsCount_;
+  uint64_t                     retriesCount_;
+  uint64_t                     failuresCount_;
+  double                       evaluationMicroseconds_;
+
+  InstanceRouter();  // Singleton pattern
+
+  static void Worker(InstanceRouter* that);
+
+  // Sends one batch of instances to the DICOM store of one account,
+  // and queues the instances again for a later attempt on failure
+  void Forward(size_t account,
+               const std::vector<Item>& items);
+
+  void ForwardBatches(const std::deque<Item>& items);
+
+public:
+  static InstanceRouter& GetInstance();
+
+  ~InstanceRouter();
+
+  bool IsEnabled() const
+  {
+    return tree_.get() != NULL;
+  }
+
+  // Invoked from the callback of the stored instances of Orthanc:
+  // Evaluates the rules, and queues the instance for the matching
+  // accounts
+  void SignalStoredInstance(const std::string& instanceId,
+                            const void* dicom,
+                            size_t size);
+
+  void Start();
+
+  void Stop();
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
@@ -0,0 +1,492 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "LocalTierEvictor.h"
+
+#include "ColdTierStorage.h"
+#include "GoogleConfiguration.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+#include <map>
+
+
+static const char* const TRACKER_FILENAME = "gcp-access-tracker.bin";
+static const size_t SCAN_STOP_CHECK = 1000;
+
+
+static std::string GetTrackerPath()
+{
+  return (ColdTierStorage::GetInstance().GetRoot() / TRACKER_FILENAME).string();
+}
+
+
+LocalTierEvictor::LocalTierEvictor() :
+  stopped_(false),
+  thread_(NULL),
+  cyclesCount_(0),
+  evictedCount_(0),
+  reclaimedBytes_(0),
+  notRemoteCount_(0),
+  verificationRequests_(0),
+  verifiedCount_(0),
+  verificationMs_(0),
+  lastThroughput_(0)
+{
+}
+
+
+LocalTierEvictor& LocalTierEvictor::GetInstance()
+{
+  static LocalTierEvictor instance;
+  return instance;
+}
+
+
+LocalTierEvictor::~LocalTierEvictor()
+{
+  if (thread_ != NULL)
+  {
+    LOG(ERROR) << "LocalTierEvictor::Stop() should have been called";
+    Stop();
+  }
+}
+
+
+bool LocalTierEvictor::IsStopped()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return stopped_;
+}
+
+
+bool LocalTierEvictor::IsDicomAttachment(const std::string& uuid,
+                                         const std::string& sopInstanceUid)
+{
+  // The type of an attachment cannot be inferred from its content:
+  // Orthanc is asked for the "dicom" attachment of the instance
+  Json::Value instances;
+  if (!OrthancPlugins::RestApiPost(instances, "/tools/lookup", sopInstanceUid, false) ||
+      instances.type() != Json::arrayValue)
+  {
+    return false;
+  }
+
+  for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+  {
+    if (instances[i].type() == Json::objectValue &&
+        instances[i].isMember("Type") &&
+        instances[i].isMember("ID") &&
+        instances[i]["Type"].asString() == "Instance")
+    {
+      std::string dicomUuid;
+      if (OrthancPlugins::RestApiGetString(dicomUuid, "/instances/" + instances[i]["ID"].asString() +
+                                           "/attachments/dicom/uuid", false) &&
+          Orthanc::Toolbox::StripSpaces(dicomUuid) == uuid)
+      {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+
+void LocalTierEvictor::ScanLocalFiles()
+{
+  // Without saved statistics (first start, or the storage was filled
+  // before the cold tier was enabled), the files are discovered on
+  // disk, using their modification time as their last access
+  ColdTierStorage& storage = ColdTierStorage::GetInstance();
+  AccessTracker& tracker = storage.GetTracker();
+
+  LOG(WARNING) << "Scanning the local storage for the cold tier: " << storage.GetRoot().string();
+
+  size_t count = 0;
+  boost::system::error_code error;
+
+  for (boost::filesystem::recursive_directory_iterator it(storage.GetRoot(), error), end;
+       !error && it != end; it.increment(error))
+  {
+    if (++count % SCAN_STOP_CHECK == 0 &&
+        IsStopped())
+    {
+      return;
+    }
+
+    const boost::filesystem::path& path = it->path();
+
+    // Orthanc may delete the attachments during the scan: Use the
+    // non-throwing overloads, and skip the files that have vanished
+    boost::system::error_code fileError;
+
+    if (!boost::filesystem::is_regular_file(path, fileError) ||
+        fileError)
+    {
+      continue;
+    }
+
+    const std::string filename = path.filename().string();
+    const std::time_t lastWrite = boost::filesystem::last_write_time(path, fileError);
+
+    if (fileError)
+    {
+      continue;
+    }
+
+    const uint32_t lastAccess = static_cast<uint32_t>(lastWrite);
+
+    if (filename.size() == 36)
+    {
+      boost::filesystem::path locationPath = path;
+      locationPath += ".gcp";
+
+      bool evictable = boost::filesystem::is_regular_file(locationPath, fileError);
+
+      if (!evictable)
+      {
+        // File stored before the cold tier was enabled, or other
+        // attachment (e.g. "DicomUntilPixelData"), that cannot be
+        // served by the cold tier once evicted
+        ColdTierStorage::Location location;
+        boost::filesystem::ifstream f(path, std::ios::in | std::ios::binary);
+
+        if (ColdTierStorage::ParseLocation(location, f) &&
+            IsDicomAttachment(filename, location.instance_))
+        {
+          storage.WriteLocation(filename, location);
+          evictable = true;
+        }
+      }
+
+      if (evictable)
+      {
+        const boost::uintmax_t size = boost::filesystem::file_size(path, fileError);
+
+        if (!fileError)
+        {
+          tracker.Discover(filename, size, true, true, lastAccess);
+        }
+      }
+    }
+    else if (filename.size() == 36 + 4 &&
+             path.extension() == ".gcp" &&
+             !boost::filesystem::exists(path.parent_path() / filename.substr(0, 36), fileError) &&
+             !fileError)
+    {
+      tracker.Discover(filename.substr(0, 36), 0, false, true, lastAccess);  // Already evicted
+    }
+  }
+
+  LOG(WARNING) << "The cold tier is tracking " << tracker.GetSize() << " local DICOM files";
+}
+
+
+void LocalTierEvictor::Evict()
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  ColdTierStorage& storage = ColdTierStorage::GetInstance();
+
+  const uint64_t highWatermark = configuration.GetColdTierMaxLocalSize();
+  const uint64_t lowWatermark = highWatermark / 100 * configuration.GetColdTierLowWatermark();
+  const uint64_t usage = storage.GetTracker().GetLocalBytes();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    cyclesCount_++;
+  }
+
+  if (usage <= highWatermark)
+  {
+    return;
+  }
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  std::vector<AccessTracker::Candidate> candidates;
+  storage.GetTracker().SelectColdest(candidates, usage - lowWatermark);
+
+  LOG(INFO) << "Cold tier: " << usage << " bytes are used locally, evicting up to "
+            << candidates.size() << " files";
+
+  // Group the candidates by series, to verify them with one request per series
+  struct Item
+  {
+    std::string  uuid_;
+    std::string  instance_;
+    uint64_t     size_;
+  };
+
+  typedef std::map<std::pair<std::string, std::string>, std::vector<Item> >  Series;
+  Series series;
+
+  for (size_t i = 0; i < candidates.size(); i++)
+  {
+    try
+    {
+      ColdTierStorage::Location location;
+      if (storage.ReadLocation(location, candidates[i].uuid_))
+      {
+        Item item;
+        item.uuid_ = candidates[i].uuid_;
+        item.instance_ = location.instance_;
+        item.size_ = candidates[i].size_;
+        series[std::make_pair(location.study_, location.series_)].push_back(item);
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(WARNING) << "Cold tier: Skipping attachment " << candidates[i].uuid_ << ": " << e.What();
+    }
+  }
+
+  uint64_t evicted = 0;
+
+  for (Series::const_iterator it = series.begin(); it != series.end() && !IsStopped(); ++it)
+  {
+    std::set<std::string> remote;
+
+    const boost::posix_time::ptime verificationStart = boost::posix_time::microsec_clock::universal_time();
+    storage.ListRemoteInstances(remote, it->first.first, it->first.second);
+    const double elapsedMs = static_cast<double>(
+      (boost::posix_time::microsec_clock::universal_time() - verificationStart).total_microseconds()) / 1000.0;
+
+    uint64_t reclaimed = 0;
+    size_t missing = 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < it->second.size(); i++)
+    {
+      const Item& item = it->second[i];
+
+      if (remote.find(item.instance_) == remote.end())
+      {
+        missing++;  // Not in Google (yet), keep the local file
+      }
+      else if (storage.EvictLocalFile(item.uuid_))
+      {
+        count++;
+        reclaimed += item.size_;
+      }
+    }
+
+    evicted += count;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    verificationRequests_++;
+    verificationMs_ += elapsedMs;
+    verifiedCount_ += it->second.size();
+    notRemoteCount_ += missing;
+    evictedCount_ += count;
+    reclaimedBytes_ += reclaimed;
+  }
+
+  const double elapsed = static_cast<double>(
+    (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000000.0;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    lastThroughput_ = (elapsed > 0 ? static_cast<double>(evicted) / elapsed : 0);
+  }
+
+  LOG(INFO) << "Cold tier: " << evicted << " files evicted in " << elapsed << " seconds, "
+            << storage.GetTracker().GetLocalBytes() << " bytes are now used locally";
+}
+
+
+void LocalTierEvictor::Worker(LocalTierEvictor* that)
+{
+  const unsigned int interval = GoogleConfiguration::GetInstance().GetColdTierEvictionIntervalSeconds();
+  AccessTracker& tracker = ColdTierStorage::GetInstance().GetTracker();
+
+  try
+  {
+    if (!tracker.Load(GetTrackerPath()))
+    {
+      that->ScanLocalFiles();
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Cannot load the access statistics of the cold tier: " << e.What();
+  }
+  catch (boost::filesystem::filesystem_error& e)
+  {
+    LOG(ERROR) << "Cannot scan the local storage for the cold tier: " << e.what();
+  }
+
+  for (;;)
+  {
+    try
+    {
+      that->Evict();
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Error during the eviction of the cold tier: " << e.What();
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      LOG(ERROR) << "Error during the eviction of the cold tier: " << e.what();
+    }
+
+    try
+    {
+      tracker.Save(GetTrackerPath());
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot save the access statistics of the cold tier: " << e.What();
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      LOG(ERROR) << "Cannot save the access statistics of the cold tier: " << e.what();
+    }
+
+    boost::mutex::scoped_lock lock(that->mutex_);
+
+    if (!that->stopped_)
+    {
+      that->wakeUp_.timed_wait(lock, boost::posix_time::seconds(interval));
+    }
+
+    if (that->stopped_)
+    {
+      return;
+    }
+  }
+}
+
+
+void LocalTierEvictor::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (thread_ == NULL)
+  {
+    stopped_ = false;
+    thread_ = new boost::thread(Worker, this);
+  }
+}
+
+
+void LocalTierEvictor::Stop()
+{
+  boost::thread* thread;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    thread = thread_;
+    thread_ = NULL;
+  }
+
+  wakeUp_.notify_one();
+
+  if (thread != NULL)
+  {
+    if (thread->joinable())
+    {
+      thread->join();
+    }
+
+    delete thread;
+
+    try
+    {
+      ColdTierStorage::GetInstance().GetTracker().Save(GetTrackerPath());
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot save the access statistics of the cold tier: " << e.What();
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      LOG(ERROR) << "Cannot save the access statistics of the cold tier: " << e.what();
+    }
+  }
+}
+
+
+void LocalTierEvictor::Format(Json::Value& target)
+{
+  AccessTracker& tracker = ColdTierStorage::GetInstance().GetTracker();
+  const uint64_t localBytes = tracker.GetLocalBytes();
+  const size_t tracked = tracker.GetSize();
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target = Json::objectValue;
+  target["MaxLocalSize"] = static_cast<Json::UInt64>(GoogleConfiguration::GetInstance().GetColdTierMaxLocalSize());
+  target["LocalSize"] = static_cast<Json::UInt64>(localBytes);
+  target["TrackedFiles"] = static_cast<Json::UInt64>(tracked);
+  target["CyclesCount"] = static_cast<Json::UInt64>(cyclesCount_);
+  target["EvictedCount"] = static_cast<Json::UInt64>(evictedCount_);
+  target["ReclaimedBytes"] = static_cast<Json::UInt64>(reclaimedBytes_);
+  target["NotRemoteCount"] = static_cast<Json::UInt64>(notRemoteCount_);
+  target["VerificationRequests"] = static_cast<Json::UInt64>(verificationRequests_);
+  target["VerifiedCount"] = static_cast<Json::UInt64>(verifiedCount_);
+  target["VerificationMs"] = verificationMs_;
+  target["LastThroughput"] = lastThroughput_;
+}
+
+
+void LocalTierEvictor::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  AccessTracker& tracker = ColdTierStorage::GetInstance().GetTracker();
+  const uint64_t localBytes = tracker.GetLocalBytes();
+  const size_t tracked = tracker.GetSize();
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_eviction_local_bytes", static_cast<float>(localBytes));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_eviction_tracked_files", static_cast<float>(tracked));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_eviction_evicted", static_cast<float>(evictedCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_eviction_reclaimed_bytes", static_cast<float>(reclaimedBytes_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_eviction_throughput", static_cast<float>(lastThroughput_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_eviction_not_remote", static_cast<float>(notRemoteCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_eviction_verification_requests", static_cast<float>(verificationRequests_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_eviction_verification_ms_mean",
+                                  verificationRequests_ == 0 ? 0.0f :
+                                  static_cast<float>(verificationMs_ / static_cast<double>(verificationRequests_)));
+#endif
+}
@@ -0,0 +1,99 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+#include <stdint.h>
+
+
+/**
+ * Background policy engine of the cold tier. Periodically, if the
+ * local DICOM files exceed "ColdTier.MaxLocalSize", the coldest files
+ * (according to the access tracker of the storage area) are evicted
+ * until the usage falls below the low watermark. A file is only
+ * evicted once its instance has been found in the DICOM store of
+ * Google: The candidates are grouped by series, so that one QIDO-RS
+ * request verifies all the candidates of the same series. The access
+ * statistics are saved in the storage directory after each pass.
+ **/
+class LocalTierEvictor : public boost::noncopyable
+{
+private:
+  boost::mutex               mutex_;
+  boost::condition_variable  wakeUp_;
+  bool                       stopped_;
+  boost::thread*             thread_;
+
+  // Statistics, protected by "mutex_"
+  uint64_t  cyclesCount_;
+  uint64_t  evictedCount_;
+  uint64_t  reclaimedBytes_;
+  uint64_t  notRemoteCount_;
+  uint64_t  verificationRequests_;
+  uint64_t  verifiedCount_;
+  double    verificationMs_;
+  double    lastThroughput_;   // Evicted instances per second, during the last pass
+
+  LocalTierEvictor();  // Singleton pattern
+
+  static void Worker(LocalTierEvictor* that);
+
+  bool IsStopped();
+
+  // Whether Orthanc stores the given file as the "dicom" attachment
+  // of the instance (and not e.g. as "DicomUntilPixelData")
+  static bool IsDicomAttachment(const std::string& uuid,
+                                const std::string& sopInstanceUid);
+
+  void ScanLocalFiles();
+
+  void Evict();
+
+public:
+  static LocalTierEvictor& GetInstance();
+
+  ~LocalTierEvictor();
+
+  void Start();
+
+  void Stop();
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
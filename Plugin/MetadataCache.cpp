@@ -0,0 +1,416 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "MetadataCache.h"
+
+#include "GoogleConfiguration.h"
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+#include "PluginToolbox.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <cassert>
+#include <zlib.h>
+
+
+static void Compress(std::string& compressed,
+                     const std::string& source)
+{
+  uLongf size = compressBound(static_cast<uLong>(source.size()));
+  compressed.resize(size);
+
+  if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &size,
+                reinterpret_cast<const Bytef*>(source.empty() ? NULL : source.c_str()),
+                static_cast<uLong>(source.size()), Z_DEFAULT_COMPRESSION) != Z_OK)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Cannot compress the study metadata");
+  }
+
+  compressed.resize(size);
+}
+
+
+static void Uncompress(std::string& target,
+                       const std::string& compressed,
+                       size_t uncompressedSize)
+{
+  target.resize(uncompressedSize);
+  if (uncompressedSize == 0)
+  {
+    return;
+  }
+
+  uLongf size = static_cast<uLongf>(uncompressedSize);
+  if (uncompress(reinterpret_cast<Bytef*>(&target[0]), &size,
+                 reinterpret_cast<const Bytef*>(compressed.c_str()),
+                 static_cast<uLong>(compressed.size())) != Z_OK ||
+      size != uncompressedSize)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Corrupted entry in the cache of the study metadata");
+  }
+}
+
+
+static bool RetrieveMetadata(std::string& metadata,
+                             std::string& etag,
+                             const std::string& accountName,
+                             const std::string& url,
+                             const std::string& ifNoneMatch)
+{
+  std::string header;
+  if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Unauthorized,
+                                    "No token is available yet for Google Cloud Platform account: " + accountName);
+  }
+
+  try
+  {
+    return HealthcareClient::RetrieveMetadata(metadata, etag, url, header, ifNoneMatch);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Retry once if the token has expired in the meantime
+    if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+        GoogleUpdater::GetInstance().HandleRejectedToken(accountName, header) &&
+        GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+    {
+      return HealthcareClient::RetrieveMetadata(metadata, etag, url, header, ifNoneMatch);
+    }
+    else
+    {
+      throw;
+    }
+  }
+}
+
+
+MetadataCache::MetadataCache() :
+  maxSize_(GoogleConfiguration::GetInstance().GetMetadataCacheSize()),
+  revalidationSeconds_(GoogleConfiguration::GetInstance().GetMetadataCacheRevalidationSeconds()),
+  compressedSize_(0),
+  uncompressedSize_(0),
+  generation_(0),
+  requestsCount_(0),
+  hitsCount_(0),
+  revalidatedCount_(0),
+  missesCount_(0),
+  evictionsCount_(0),
+  invalidationsCount_(0)
+{
+}
+
+
+MetadataCache& MetadataCache::GetInstance()
+{
+  static MetadataCache instance;
+  return instance;
+}
+
+
+std::string MetadataCache::GetKey(const std::string& accountName,
+                                  const std::string& studyInstanceUid)
+{
+  return accountName + "/" + studyInstanceUid;
+}
+
+
+bool MetadataCache::Lookup(std::string& compressed,
+                           size_t& uncompressedSize,
+                           std::string& etag,
+                           bool& fresh,
+                           uint64_t& generation,
+                           const std::string& key)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  requestsCount_++;
+  generation = generation_;
+
+  std::map<std::string, Entries::iterator>::iterator found = index_.find(key);
+  if (found == index_.end())
+  {
+    return false;
+  }
+
+  // Move the entry to the front of the LRU list
+  entries_.splice(entries_.begin(), entries_, found->second);
+
+  const Entry& entry = *found->second;
+  compressed = entry.compressed_;
+  uncompressedSize = entry.uncompressedSize_;
+  etag = entry.etag_;
+  fresh = (entry.validated_ != 0 &&
+           time(NULL) - entry.validated_ < static_cast<time_t>(revalidationSeconds_));
+  return true;
+}
+
+
+void MetadataCache::Remove(Entries::iterator entry)
+{
+  assert(compressedSize_ >= entry->compressed_.size() &&
+         uncompressedSize_ >= entry->uncompressedSize_);
+
+  compressedSize_ -= entry->compressed_.size();
+  uncompressedSize_ -= entry->uncompressedSize_;
+  index_.erase(entry->key_);
+  entries_.erase(entry);
+}
+
+
+void MetadataCache::Store(const std::string& key,
+                          const std::string& compressed,
+                          size_t uncompressedSize,
+                          const std::string& etag,
+                          uint64_t generation)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::map<std::string, Entries::iterator>::iterator found = index_.find(key);
+  if (found != index_.end())
+  {
+    Remove(found->second);
+  }
+
+  if (compressed.size() > maxSize_)
+  {
+    return;  // Too large to be cached
+  }
+
+  entries_.push_front(Entry());
+
+  Entry& entry = entries_.front();
+  entry.key_ = key;
+  entry.compressed_ = compressed;
+  entry.uncompressedSize_ = uncompressedSize;
+  entry.etag_ = etag;
+
+  // If an invalidation has occurred during the request to Google, the
+  // answer might predate the modification: Keep it, but revalidate it
+  // at the next access
+  entry.validated_ = (generation == generation_ ? time(NULL) : 0);
+
+  index_[key] = entries_.begin();
+  compressedSize_ += compressed.size();
+  uncompressedSize_ += uncompressedSize;
+
+  while (compressedSize_ > maxSize_)
+  {
+    assert(!entries_.empty());
+    Remove(--entries_.end());
+    evictionsCount_++;
+  }
+}
+
+
+void MetadataCache::GetStudyMetadata(std::string& metadata,
+                                     std::string& etag,
+                                     const std::string& accountName,
+                                     const std::string& studyInstanceUid)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  const GoogleAccount* account = configuration.LookupAccount(accountName);
+  if (account == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Unknown Google Cloud Platform account: " + accountName);
+  }
+
+  if (account->IsDiscovery())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRequest,
+                                    "The study metadata is not available for an account in the discovery mode: " + accountName);
+  }
+
+  if (studyInstanceUid.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Missing study instance UID");
+  }
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  const std::string key = GetKey(accountName, studyInstanceUid);
+  const std::string url = account->GetDicomWebUrl(configuration.GetBaseGoogleUrl()) +
+    "studies/" + studyInstanceUid + "/metadata";
+
+  std::string compressed, cachedEtag;
+  size_t uncompressedSize = 0;
+  bool fresh = false;
+  uint64_t generation = 0;
+
+  const bool cached = Lookup(compressed, uncompressedSize, cachedEtag, fresh, generation, key);
+
+  bool hit = false;
+  bool revalidated = false;
+
+  if (cached && fresh)
+  {
+    hit = true;
+  }
+  else if (cached &&
+           !cachedEtag.empty() &&
+           !RetrieveMetadata(metadata, etag, accountName, url, cachedEtag))
+  {
+    // "304 Not Modified": Refresh the validation date of the entry
+    Store(key, compressed, uncompressedSize, cachedEtag, generation);
+    hit = true;
+    revalidated = true;
+  }
+  else
+  {
+    if (!cached ||
+        cachedEtag.empty())
+    {
+      RetrieveMetadata(metadata, etag, accountName, url, "");
+    }
+
+    // Otherwise, the conditional request has returned the modified metadata
+    Compress(compressed, metadata);
+    Store(key, compressed, metadata.size(), etag, generation);
+  }
+
+  if (hit)
+  {
+    Uncompress(metadata, compressed, uncompressedSize);
+    etag = cachedEtag;
+  }
+
+  const double elapsedMs = static_cast<double>(
+    (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000.0;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (hit)
+    {
+      hitsCount_++;
+      hitLatency_.Add(elapsedMs);
+
+      if (revalidated)
+      {
+        revalidatedCount_++;
+      }
+    }
+    else
+    {
+      missesCount_++;
+      missLatency_.Add(elapsedMs);
+    }
+  }
+}
+
+
+void MetadataCache::Invalidate(const std::string& accountName,
+                               const std::string& studyInstanceUid)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  generation_++;
+
+  std::map<std::string, Entries::iterator>::iterator found = index_.find(GetKey(accountName, studyInstanceUid));
+  if (found != index_.end())
+  {
+    Remove(found->second);
+    invalidationsCount_++;
+  }
+}
+
+
+void MetadataCache::ApplyChanges(const std::string& accountName,
+                                 const std::vector<ChangeFeed::Change>& changes)
+{
+  const GoogleAccount* account = GoogleConfiguration::GetInstance().LookupAccount(accountName);
+  if (account == NULL ||
+      account->IsDiscovery())
+  {
+    return;
+  }
+
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    if (changes[i].dataset_ == account->GetDataset() &&
+        changes[i].dicomStore_ == account->GetDicomStore())
+    {
+      Invalidate(accountName, changes[i].study_);
+    }
+  }
+}
+
+
+void MetadataCache::Format(Json::Value& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target = Json::objectValue;
+  target["MaxSize"] = static_cast<Json::UInt64>(maxSize_);
+  target["RevalidationSeconds"] = revalidationSeconds_;
+  target["EntriesCount"] = static_cast<Json::UInt64>(index_.size());
+  target["MemoryUsage"] = static_cast<Json::UInt64>(compressedSize_);
+  target["UncompressedSize"] = static_cast<Json::UInt64>(uncompressedSize_);
+  target["RequestsCount"] = static_cast<Json::UInt64>(requestsCount_);
+  target["HitsCount"] = static_cast<Json::UInt64>(hitsCount_);
+  target["RevalidatedCount"] = static_cast<Json::UInt64>(revalidatedCount_);
+  target["MissesCount"] = static_cast<Json::UInt64>(missesCount_);
+  target["HitRate"] = (requestsCount_ == 0 ? 0.0 : static_cast<double>(hitsCount_) / static_cast<double>(requestsCount_));
+  target["EvictionsCount"] = static_cast<Json::UInt64>(evictionsCount_);
+  target["InvalidationsCount"] = static_cast<Json::UInt64>(invalidationsCount_);
+  hitLatency_.Format(target["HitLatency"]);
+  missLatency_.Format(target["MissLatency"]);
+}
+
+
+void MetadataCache::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  boost::mutex::scoped_lock lock(mutex_);
+
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_entries", static_cast<float>(index_.size()));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_memory", static_cast<float>(compressedSize_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_requests", static_cast<float>(requestsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_hits", static_cast<float>(hitsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_revalidated", static_cast<float>(revalidatedCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_hit_rate",
+                                  requestsCount_ == 0 ? 0.0f : static_cast<float>(hitsCount_) / static_cast<float>(requestsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_evictions", static_cast<float>(evictionsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_invalidations", static_cast<float>(invalidationsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_hit_latency_p50_ms", static_cast<float>(hitLatency_.GetPercentile(0.5)));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_hit_latency_p95_ms", static_cast<float>(hitLatency_.GetPercentile(0.95)));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_miss_latency_p50_ms", static_cast<float>(missLatency_.GetPercentile(0.5)));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_metadata_cache_miss_latency_p95_ms", static_cast<float>(missLatency_.GetPercentile(0.95)));
+#endif
+}
@@ -0,0 +1,133 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ChangeFeed.h"
+#include "HttpTimings.h"
+
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+
+
+/**
+ * Cache of the WADO-RS metadata of the studies, as fetched by the
+ * viewers through "/gcp/accounts/{name}/studies/{study}/metadata".
+ * The DICOM JSON of a study can weigh several megabytes and take
+ * seconds to be generated by Google, but is highly compressible: the
+ * entries are kept deflated by zlib, in least-recently-used order,
+ * within the "MetadataCacheSize" budget. An entry that is older than
+ * "MetadataCacheRevalidation" seconds is revalidated by a conditional
+ * request with the ETag of Google, which only costs a round trip if
+ * the study is unchanged. The notifications of the change feed
+ * invalidate the entries of the modified studies right away.
+ **/
+class MetadataCache : public ChangeFeed::IListener
+{
+private:
+  struct Entry
+  {
+    std::string  key_;
+    std::string  compressed_;
+    size_t       uncompressedSize_;
+    std::string  etag_;
+    time_t       validated_;
+  };
+
+  typedef std::list<Entry>  Entries;  // The most recently used entry first
+
+  boost::mutex                                mutex_;
+  uint64_t                                    maxSize_;
+  unsigned int                                revalidationSeconds_;
+  Entries                                     entries_;
+  std::map<std::string, Entries::iterator>    index_;
+  uint64_t                                    compressedSize_;
+  uint64_t                                    uncompressedSize_;
+  uint64_t                                    generation_;   // Incremented by each invalidation
+  uint64_t                                    requestsCount_;
+  uint64_t                                    hitsCount_;
+  uint64_t                                    revalidatedCount_;
+  uint64_t                                    missesCount_;
+  uint64_t                                    evictionsCount_;
+  uint64_t                                    invalidationsCount_;
+  HttpTimings::Histogram                      hitLatency_;
+  HttpTimings::Histogram                      missLatency_;
+
+  MetadataCache();  // Singleton pattern
+
+  static std::string GetKey(const std::string& accountName,
+                            const std::string& studyInstanceUid);
+
+  // Returns "false" if the entry is absent. "fresh" is set to "false"
+  // if the entry must be revalidated with Google.
+  bool Lookup(std::string& compressed,
+              size_t& uncompressedSize,
+              std::string& etag,
+              bool& fresh,
+              uint64_t& generation,
+              const std::string& key);
+
+  void Store(const std::string& key,
+             const std::string& compressed,
+             size_t uncompressedSize,
+             const std::string& etag,
+             uint64_t generation);
+
+  void Remove(Entries::iterator entry);
+
+public:
+  static MetadataCache& GetInstance();
+
+  bool IsEnabled() const
+  {
+    return maxSize_ > 0;
+  }
+
+  // Writes the DICOM JSON metadata of one study of the DICOM store
+  // that is configured in the account (not in the discovery mode)
+  void GetStudyMetadata(std::string& metadata,
+                        std::string& etag,
+                        const std::string& accountName,
+                        const std::string& studyInstanceUid);
+
+  void Invalidate(const std::string& accountName,
+                  const std::string& studyInstanceUid);
+
+  virtual void ApplyChanges(const std::string& accountName,
+                            const std::vector<ChangeFeed::Change>& changes) override;
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
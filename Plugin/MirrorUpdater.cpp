@@ -0,0 +1,766 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "MirrorUpdater.h"
+
+#include "GoogleConfiguration.h"
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+#include "PluginToolbox.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <set>
+
+
+static const unsigned int PAGE_SIZE = 5000;  // Maximum "limit" accepted by Google for QIDO-RS
+
+
+class MirrorUpdater::Mirror : public boost::noncopyable
+{
+public:
+  std::string  accountName_;
+  std::string  dataset_;
+  std::string  dicomStore_;
+  std::string  dicomWebUrl_;
+  std::string  snapshotPath_;
+  StoreMirror  index_;
+
+  // Protected by the mutex of the updater
+  time_t    lastSync_;   // 0 if never synchronized
+  time_t    lastFeed_;   // Last pull of the change feed, 0 if none
+  bool      unsaved_;    // Changes from the feed that are not in the snapshot yet
+  uint64_t  queriesCount_;
+  uint64_t  fallbacksCount_;
+  uint64_t  unsupportedCount_;
+  double    queriesMs_;
+  uint64_t  syncsCount_;
+  uint64_t  syncFailuresCount_;
+  uint64_t  fetchedStudiesCount_;
+  uint64_t  removedStudiesCount_;
+  double    lastSyncSeconds_;
+  uint64_t  notifiedInstancesCount_;
+
+  Mirror(const GoogleAccount& account,
+         const std::string& dicomWebUrl,
+         const std::string& snapshotPath) :
+    accountName_(account.GetName()),
+    dataset_(account.GetDataset()),
+    dicomStore_(account.GetDicomStore()),
+    dicomWebUrl_(dicomWebUrl),
+    snapshotPath_(snapshotPath),
+    lastSync_(0),
+    lastFeed_(0),
+    unsaved_(false),
+    queriesCount_(0),
+    fallbacksCount_(0),
+    unsupportedCount_(0),
+    queriesMs_(0),
+    syncsCount_(0),
+    syncFailuresCount_(0),
+    fetchedStudiesCount_(0),
+    removedStudiesCount_(0),
+    lastSyncSeconds_(0),
+    notifiedInstancesCount_(0)
+  {
+  }
+};
+
+
+static void GetAuthorizationHeader(std::string& header,
+                                   const std::string& accountName)
+{
+  if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Unauthorized,
+                                    "No token is available yet for Google Cloud Platform account: " + accountName);
+  }
+}
+
+
+static void SearchGoogle(Json::Value& answer,
+                         const std::string& accountName,
+                         const std::string& url)
+{
+  std::string header;
+  GetAuthorizationHeader(header, accountName);
+
+  try
+  {
+    HealthcareClient::Search(answer, url, header);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Retry once if the token has expired in the meantime
+    if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+        GoogleUpdater::GetInstance().HandleRejectedToken(accountName, header))
+    {
+      GetAuthorizationHeader(header, accountName);
+      HealthcareClient::Search(answer, url, header);
+    }
+    else
+    {
+      throw;
+    }
+  }
+}
+
+
+// Concatenates all the pages of a QIDO-RS search. "url" must already
+// contain GET arguments.
+static void SearchAllPages(Json::Value& answer,
+                           const std::string& accountName,
+                           const std::string& url)
+{
+  answer = Json::arrayValue;
+
+  for (unsigned int offset = 0; ; offset += PAGE_SIZE)
+  {
+    Json::Value page;
+    SearchGoogle(page, accountName, url + "&limit=" + boost::lexical_cast<std::string>(PAGE_SIZE) +
+                 "&offset=" + boost::lexical_cast<std::string>(offset));
+
+    for (Json::Value::ArrayIndex i = 0; i < page.size(); i++)
+    {
+      answer.append(page[i]);
+    }
+
+    if (page.size() < PAGE_SIZE)
+    {
+      return;
+    }
+  }
+}
+
+
+static uint32_t GetInstancesCount(const Json::Value& study)
+{
+  static const char* const NUMBER_OF_STUDY_RELATED_INSTANCES = "00201208";
+
+  // The answer of Google is validated before being indexed, as
+  // "Json::LogicError" would escape the mirror thread
+  if (study.type() == Json::objectValue &&
+      study.isMember(NUMBER_OF_STUDY_RELATED_INSTANCES) &&
+      study[NUMBER_OF_STUDY_RELATED_INSTANCES].type() == Json::objectValue)
+  {
+    const Json::Value& value = study[NUMBER_OF_STUDY_RELATED_INSTANCES]["Value"];
+    if (value.type() == Json::arrayValue &&
+        value.size() == 1 &&
+        value[0].isConvertibleTo(Json::uintValue))
+    {
+      return value[0].asUInt();
+    }
+  }
+
+  return 0;
+}
+
+
+static void ParsePath(StoreMirror::Query& query,
+                      const std::string& path)
+{
+  std::vector<std::string> tokens;
+  Orthanc::Toolbox::TokenizeString(tokens, path, '/');
+
+  if (tokens.size() == 1 && tokens[0] == "studies")
+  {
+    query.level_ = StoreMirror::Level_Study;
+  }
+  else if (tokens.size() == 1 && tokens[0] == "series")
+  {
+    query.level_ = StoreMirror::Level_Series;
+  }
+  else if (tokens.size() == 1 && tokens[0] == "instances")
+  {
+    query.level_ = StoreMirror::Level_Instance;
+  }
+  else if (tokens.size() == 3 && tokens[0] == "studies" && tokens[2] == "series")
+  {
+    query.level_ = StoreMirror::Level_Series;
+    query.study_ = tokens[1];
+  }
+  else if (tokens.size() == 3 && tokens[0] == "studies" && tokens[2] == "instances")
+  {
+    query.level_ = StoreMirror::Level_Instance;
+    query.study_ = tokens[1];
+  }
+  else if (tokens.size() == 5 && tokens[0] == "studies" && tokens[2] == "series" && tokens[4] == "instances")
+  {
+    query.level_ = StoreMirror::Level_Instance;
+    query.study_ = tokens[1];
+    query.series_ = tokens[3];
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Not a QIDO-RS resource: " + path);
+  }
+}
+
+
+static size_t ParseSize(const std::string& value)
+{
+  try
+  {
+    return boost::lexical_cast<size_t>(value);
+  }
+  catch (boost::bad_lexical_cast&)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Not an unsigned integer: " + value);
+  }
+}
+
+
+MirrorUpdater::MirrorUpdater() :
+  stopped_(false),
+  thread_(NULL)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  const boost::filesystem::path directory(PluginToolbox::ResolveConfigurationPath(configuration.GetMirrorDirectory()));
+
+  for (size_t i = 0; i < configuration.GetAccountsCount(); i++)
+  {
+    const GoogleAccount& account = configuration.GetAccount(i);
+
+    if (account.IsMirrored())
+    {
+      const std::string snapshot = (directory / (account.GetName() + ".mirror")).string();
+      mirrors_[account.GetName()] = new Mirror(account,
+                                               account.GetDicomWebUrl(configuration.GetBaseGoogleUrl()),
+                                               snapshot);
+
+      LOG(WARNING) << "The metadata of the DICOM store of account \"" << account.GetName()
+                   << "\" is mirrored in: " << snapshot;
+    }
+  }
+}
+
+
+MirrorUpdater& MirrorUpdater::GetInstance()
+{
+  static MirrorUpdater instance;
+  return instance;
+}
+
+
+MirrorUpdater::~MirrorUpdater()
+{
+  if (thread_ != NULL)
+  {
+    LOG(ERROR) << "MirrorUpdater::Stop() should have been called";
+    Stop();
+  }
+
+  for (std::map<std::string, Mirror*>::iterator it = mirrors_.begin(); it != mirrors_.end(); ++it)
+  {
+    assert(it->second != NULL);
+    delete it->second;
+  }
+}
+
+
+bool MirrorUpdater::IsStopped()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return stopped_;
+}
+
+
+MirrorUpdater::Mirror& MirrorUpdater::GetMirror(const std::string& accountName) const
+{
+  std::map<std::string, Mirror*>::const_iterator found = mirrors_.find(accountName);
+
+  if (found == mirrors_.end())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "No metadata mirror for Google Cloud Platform account: " + accountName);
+  }
+  else
+  {
+    assert(found->second != NULL);
+    return *found->second;
+  }
+}
+
+
+void MirrorUpdater::Synchronize(Mirror& mirror)
+{
+  const time_t start = time(NULL);
+  const boost::posix_time::ptime startTime = boost::posix_time::microsec_clock::universal_time();
+
+  Json::Value studies;
+  SearchAllPages(studies, mirror.accountName_, mirror.dicomWebUrl_ + "studies?includefield=" +
+                 StoreMirror::GetIncludeFields(StoreMirror::Level_Study));
+
+  std::map<std::string, uint32_t> local;
+  mirror.index_.ListStudies(local);
+
+  const std::string instancesFields = StoreMirror::GetIncludeFields(StoreMirror::Level_Instance);
+
+  std::set<std::string> remote;
+  uint64_t fetched = 0;
+
+  for (Json::Value::ArrayIndex i = 0; i < studies.size(); i++)
+  {
+    if (IsStopped())
+    {
+      return;  // The changes will be committed by the next synchronization
+    }
+
+    StoreMirror::StudyRecord study;
+    StoreMirror::ParseStudy(study, studies[i]);
+
+    const std::string& uid = study.study_[StoreMirror::StudyColumn_StudyInstanceUid];
+    if (uid.empty())
+    {
+      continue;
+    }
+
+    remote.insert(uid);
+
+    // Only the studies whose number of instances has changed are re-fetched
+    std::map<std::string, uint32_t>::const_iterator found = local.find(uid);
+    if (found != local.end() &&
+        found->second == GetInstancesCount(studies[i]))
+    {
+      continue;
+    }
+
+    Json::Value instances;
+    SearchAllPages(instances, mirror.accountName_, mirror.dicomWebUrl_ + "studies/" + uid +
+                   "/instances?includefield=" + instancesFields);
+
+    study.instances_.resize(instances.size());
+    for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+    {
+      StoreMirror::ParseInstance(study.instances_[j], instances[j]);
+    }
+
+    mirror.index_.ReplaceStudy(study);
+    fetched++;
+  }
+
+  uint64_t removed = 0;
+
+  for (std::map<std::string, uint32_t>::const_iterator it = local.begin(); it != local.end(); ++it)
+  {
+    if (remote.find(it->first) == remote.end())
+    {
+      mirror.index_.RemoveStudy(it->first);
+      removed++;
+    }
+  }
+
+  mirror.index_.Commit();
+
+  bool unsaved;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    unsaved = mirror.unsaved_;
+    mirror.unsaved_ = false;
+  }
+
+  if (fetched > 0 ||
+      removed > 0 ||
+      unsaved)
+  {
+    boost::filesystem::create_directories(boost::filesystem::path(mirror.snapshotPath_).parent_path());
+    mirror.index_.SaveSnapshot(mirror.snapshotPath_);
+  }
+  else
+  {
+    // The modification time of the snapshot records the last synchronization
+    boost::system::error_code error;
+    boost::filesystem::last_write_time(mirror.snapshotPath_, start, error);
+  }
+
+  const double elapsed = static_cast<double>(
+    (boost::posix_time::microsec_clock::universal_time() - startTime).total_microseconds()) / 1000000.0;
+
+  LOG(INFO) << "Mirror of account \"" << mirror.accountName_ << "\" synchronized in " << elapsed
+            << " seconds: " << fetched << " studies updated, " << removed << " studies removed";
+
+  boost::mutex::scoped_lock lock(mutex_);
+  mirror.lastSync_ = start;
+  mirror.syncsCount_++;
+  mirror.fetchedStudiesCount_ += fetched;
+  mirror.removedStudiesCount_ += removed;
+  mirror.lastSyncSeconds_ = elapsed;
+}
+
+
+void MirrorUpdater::Worker(MirrorUpdater* that)
+{
+  const unsigned int interval = GoogleConfiguration::GetInstance().GetMirrorRefreshIntervalSeconds();
+
+  for (std::map<std::string, Mirror*>::iterator it = that->mirrors_.begin(); it != that->mirrors_.end(); ++it)
+  {
+    Mirror& mirror = *it->second;
+
+    if (mirror.index_.LoadSnapshot(mirror.snapshotPath_))
+    {
+      boost::system::error_code error;
+      const time_t lastSync = boost::filesystem::last_write_time(mirror.snapshotPath_, error);
+
+      LOG(WARNING) << "Loaded the mirror of account \"" << mirror.accountName_ << "\": "
+                   << mirror.index_.GetStudiesCount() << " studies, "
+                   << mirror.index_.GetInstancesCount() << " instances";
+
+      boost::mutex::scoped_lock lock(that->mutex_);
+      mirror.lastSync_ = (error ? 0 : lastSync);
+    }
+  }
+
+  for (;;)
+  {
+    for (std::map<std::string, Mirror*>::iterator it = that->mirrors_.begin();
+         it != that->mirrors_.end() && !that->IsStopped(); ++it)
+    {
+      try
+      {
+        that->Synchronize(*it->second);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Cannot synchronize the mirror of account \"" << it->first << "\": " << e.What();
+
+        boost::mutex::scoped_lock lock(that->mutex_);
+        it->second->syncFailuresCount_++;
+      }
+      catch (boost::filesystem::filesystem_error& e)
+      {
+        LOG(ERROR) << "Cannot save the mirror of account \"" << it->first << "\": " << e.what();
+
+        boost::mutex::scoped_lock lock(that->mutex_);
+        it->second->syncFailuresCount_++;
+      }
+    }
+
+    boost::mutex::scoped_lock lock(that->mutex_);
+
+    if (!that->stopped_)
+    {
+      that->wakeUp_.timed_wait(lock, boost::posix_time::seconds(interval));
+    }
+
+    if (that->stopped_)
+    {
+      return;
+    }
+  }
+}
+
+
+void MirrorUpdater::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (thread_ == NULL &&
+      !mirrors_.empty())
+  {
+    stopped_ = false;
+    thread_ = new boost::thread(Worker, this);
+  }
+}
+
+
+void MirrorUpdater::Stop()
+{
+  boost::thread* thread;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    thread = thread_;
+    thread_ = NULL;
+  }
+
+  wakeUp_.notify_one();
+
+  if (thread != NULL)
+  {
+    if (thread->joinable())
+    {
+      thread->join();
+    }
+
+    delete thread;
+  }
+}
+
+
+void MirrorUpdater::Search(Json::Value& answer,
+                           const std::string& accountName,
+                           const std::string& path,
+                           const std::map<std::string, std::string>& arguments)
+{
+  Mirror& mirror = GetMirror(accountName);
+
+  StoreMirror::Query query;
+  ParsePath(query, path);
+
+  for (std::map<std::string, std::string>::const_iterator it = arguments.begin(); it != arguments.end(); ++it)
+  {
+    if (it->first == "offset")
+    {
+      query.offset_ = ParseSize(it->second);
+    }
+    else if (it->first == "limit")
+    {
+      query.limit_ = ParseSize(it->second);
+    }
+    else
+    {
+      query.filters_[it->first] = it->second;
+    }
+  }
+
+  bool fresh;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    fresh = (mirror.lastSync_ != 0 &&
+             time(NULL) - std::max(mirror.lastSync_, mirror.lastFeed_) <= static_cast<time_t>(
+               GoogleConfiguration::GetInstance().GetMirrorMaxStalenessSeconds()));
+  }
+
+  if (fresh)
+  {
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    const bool success = mirror.index_.Execute(answer, query);
+    const double elapsedMs = static_cast<double>(
+      (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000.0;
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (success)
+    {
+      mirror.queriesCount_++;
+      mirror.queriesMs_ += elapsedMs;
+      return;
+    }
+    else
+    {
+      mirror.unsupportedCount_++;
+    }
+  }
+
+  // Fallback to the live QIDO-RS API of Google
+  std::string url = mirror.dicomWebUrl_ + path;
+
+  for (std::map<std::string, std::string>::const_iterator it = arguments.begin(); it != arguments.end(); ++it)
+  {
+    std::string key, value;
+    Orthanc::Toolbox::UriEncode(key, it->first);
+    Orthanc::Toolbox::UriEncode(value, it->second);
+    url += (it == arguments.begin() ? "?" : "&") + key + "=" + value;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    mirror.fallbacksCount_++;
+  }
+
+  SearchGoogle(answer, accountName, url);
+}
+
+
+void MirrorUpdater::ApplyChanges(const std::string& accountName,
+                                 const std::vector<ChangeFeed::Change>& changes)
+{
+  std::map<std::string, Mirror*>::const_iterator found = mirrors_.find(accountName);
+  if (found == mirrors_.end())
+  {
+    return;
+  }
+
+  Mirror& mirror = *found->second;
+  const time_t now = time(NULL);
+
+  // Group the notified instances by study, then by series, so that
+  // each study and each series is fetched once per batch
+  typedef std::map<std::string, std::set<std::string> >  SeriesSet;
+  std::map<std::string, SeriesSet> studies;
+
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    if (changes[i].dataset_ == mirror.dataset_ &&
+        changes[i].dicomStore_ == mirror.dicomStore_)
+    {
+      studies[changes[i].study_][changes[i].series_].insert(changes[i].instance_);
+    }
+  }
+
+  const std::string studyFields = StoreMirror::GetIncludeFields(StoreMirror::Level_Study);
+  const std::string instancesFields = StoreMirror::GetIncludeFields(StoreMirror::Level_Instance);
+
+  uint64_t added = 0;
+
+  for (std::map<std::string, SeriesSet>::const_iterator study = studies.begin(); study != studies.end(); ++study)
+  {
+    Json::Value studyAnswer;
+    SearchGoogle(studyAnswer, accountName, mirror.dicomWebUrl_ + "studies?StudyInstanceUID=" +
+                 study->first + "&includefield=" + studyFields);
+
+    if (studyAnswer.size() != 1)
+    {
+      continue;  // The study has been removed since the notification
+    }
+
+    StoreMirror::StudyRecord record;
+    StoreMirror::ParseStudy(record, studyAnswer[0]);
+
+    for (SeriesSet::const_iterator series = study->second.begin(); series != study->second.end(); ++series)
+    {
+      // The whole series is fetched, which also recovers the
+      // instances whose notification has been lost
+      Json::Value instances;
+      SearchAllPages(instances, accountName, mirror.dicomWebUrl_ + "studies/" + study->first + "/series/" +
+                     series->first + "/instances?includefield=" + instancesFields);
+
+      for (Json::Value::ArrayIndex i = 0; i < instances.size(); i++)
+      {
+        StoreMirror::InstanceRecord instance;
+        StoreMirror::ParseInstance(instance, instances[i]);
+        mirror.index_.AddInstance(record, instance);
+      }
+
+      added += series->second.size();
+    }
+  }
+
+  if (!studies.empty())
+  {
+    mirror.index_.Commit();
+  }
+
+  // A concurrent synchronization might overwrite a study that was
+  // just updated with an older state: The next synchronization
+  // repairs it, as its number of instances differs from Google
+
+  boost::mutex::scoped_lock lock(mutex_);
+  mirror.lastFeed_ = now;
+  mirror.notifiedInstancesCount_ += added;
+
+  if (!studies.empty())
+  {
+    mirror.unsaved_ = true;
+  }
+}
+
+
+void MirrorUpdater::Format(Json::Value& target)
+{
+  target = Json::objectValue;
+
+  const time_t now = time(NULL);
+
+  for (std::map<std::string, Mirror*>::const_iterator it = mirrors_.begin(); it != mirrors_.end(); ++it)
+  {
+    const Mirror& mirror = *it->second;
+
+    Json::Value item = Json::objectValue;
+    item["StudiesCount"] = static_cast<Json::UInt64>(mirror.index_.GetStudiesCount());
+    item["InstancesCount"] = static_cast<Json::UInt64>(mirror.index_.GetInstancesCount());
+    item["MemoryUsage"] = static_cast<Json::UInt64>(mirror.index_.GetMemoryUsage());
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (mirror.lastSync_ != 0)
+    {
+      item["LastSynchronization"] = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(mirror.lastSync_));
+      item["Age"] = static_cast<Json::Int64>(now - mirror.lastSync_);
+    }
+
+    item["QueriesCount"] = static_cast<Json::UInt64>(mirror.queriesCount_);
+    item["QueriesMs"] = mirror.queriesMs_;
+    item["FallbacksCount"] = static_cast<Json::UInt64>(mirror.fallbacksCount_);
+    item["UnsupportedCount"] = static_cast<Json::UInt64>(mirror.unsupportedCount_);
+    item["SynchronizationsCount"] = static_cast<Json::UInt64>(mirror.syncsCount_);
+    item["SynchronizationFailures"] = static_cast<Json::UInt64>(mirror.syncFailuresCount_);
+    item["FetchedStudiesCount"] = static_cast<Json::UInt64>(mirror.fetchedStudiesCount_);
+    item["RemovedStudiesCount"] = static_cast<Json::UInt64>(mirror.removedStudiesCount_);
+    item["LastSynchronizationDuration"] = mirror.lastSyncSeconds_;
+    item["NotifiedInstancesCount"] = static_cast<Json::UInt64>(mirror.notifiedInstancesCount_);
+
+    if (mirror.lastFeed_ != 0)
+    {
+      item["LastNotification"] = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(mirror.lastFeed_));
+    }
+
+    target[it->first] = item;
+  }
+}
+
+
+void MirrorUpdater::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  const time_t now = time(NULL);
+
+  for (std::map<std::string, Mirror*>::const_iterator it = mirrors_.begin(); it != mirrors_.end(); ++it)
+  {
+    const Mirror& mirror = *it->second;
+    const std::string& name = it->first;
+
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_mirror_instances_", name).c_str(),
+                                    static_cast<float>(mirror.index_.GetInstancesCount()));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_mirror_memory_bytes_", name).c_str(),
+                                    static_cast<float>(mirror.index_.GetMemoryUsage()));
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_mirror_age_s_", name).c_str(),
+                                    mirror.lastSync_ == 0 ? -1.0f : static_cast<float>(now - mirror.lastSync_));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_mirror_queries_", name).c_str(),
+                                    static_cast<float>(mirror.queriesCount_));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_mirror_fallbacks_", name).c_str(),
+                                    static_cast<float>(mirror.fallbacksCount_));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_mirror_query_ms_mean_", name).c_str(),
+                                    mirror.queriesCount_ == 0 ? 0.0f :
+                                    static_cast<float>(mirror.queriesMs_ / static_cast<double>(mirror.queriesCount_)));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_mirror_sync_failures_", name).c_str(),
+                                    static_cast<float>(mirror.syncFailuresCount_));
+  }
+#endif
+}
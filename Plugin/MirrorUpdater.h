@@ -0,0 +1,110 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ChangeFeed.h"
+#include "StoreMirror.h"
+
+#include <boost/thread.hpp>
+
+
+/**
+ * Maintains the metadata mirrors of the accounts with the "Mirror"
+ * option. A background thread periodically lists the studies of each
+ * DICOM store, and re-fetches the instances of the studies whose
+ * number of instances has changed. The mirrors are saved as snapshots
+ * in "MirrorDirectory" after each synchronization, and reloaded at
+ * startup. The QIDO-RS queries are answered by the mirror as long as
+ * its last synchronization is more recent than "MirrorMaxStaleness",
+ * and forwarded to Google otherwise. If the account also has a Pub/Sub
+ * subscription, the instances notified by the change feed are added
+ * to the mirror as they arrive, and each pull of the feed counts as a
+ * synchronization for the staleness.
+ **/
+class MirrorUpdater : public ChangeFeed::IListener
+{
+private:
+  class Mirror;
+
+  boost::mutex               mutex_;
+  boost::condition_variable  wakeUp_;
+  bool                       stopped_;
+  boost::thread*             thread_;
+  std::map<std::string, Mirror*>  mirrors_;   // Constant after construction
+
+  MirrorUpdater();  // Singleton pattern
+
+  static void Worker(MirrorUpdater* that);
+
+  bool IsStopped();
+
+  Mirror& GetMirror(const std::string& accountName) const;
+
+  void Synchronize(Mirror& mirror);
+
+public:
+  static MirrorUpdater& GetInstance();
+
+  ~MirrorUpdater();
+
+  bool IsEnabled() const
+  {
+    return !mirrors_.empty();
+  }
+
+  bool IsMirrored(const std::string& accountName) const
+  {
+    return mirrors_.find(accountName) != mirrors_.end();
+  }
+
+  void Start();
+
+  void Stop();
+
+  // Answers one QIDO-RS request. "path" is relative to the DICOMweb
+  // root of the store (e.g. "studies/{study}/series"), and "arguments"
+  // are the decoded GET arguments. Throws "ErrorCode_UnknownResource"
+  // if the account is not mirrored.
+  void Search(Json::Value& answer,
+              const std::string& accountName,
+              const std::string& path,
+              const std::map<std::string, std::string>& arguments);
+
+  virtual void ApplyChanges(const std::string& accountName,
+                            const std::vector<ChangeFeed::Change>& changes) override;
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
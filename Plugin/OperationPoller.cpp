@@ -0,0 +1,580 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "OperationPoller.h"
+
+#include "GoogleConfiguration.h"
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+
+static const unsigned int INITIAL_INTERVAL_MS = 1000;
+static const unsigned int MAX_INTERVAL_MS = 60000;
+static const size_t MAX_BATCH_SIZE = 64;        // Operations polled by one wake-up of the thread
+static const unsigned int MAX_POLL_ERRORS = 10;  // Consecutive errors before giving up an operation
+
+
+// The 64-bit integers of the Google APIs are serialized as JSON strings
+static uint64_t GetCounter(const Json::Value& counter,
+                           const std::string& key)
+{
+  if (!counter.isMember(key))
+  {
+    return 0;
+  }
+  else if (counter[key].isIntegral() &&
+           counter[key].asInt64() >= 0)
+  {
+    return counter[key].asUInt64();
+  }
+  else if (counter[key].type() == Json::stringValue)
+  {
+    try
+    {
+      return boost::lexical_cast<uint64_t>(counter[key].asString());
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+    }
+  }
+
+  throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                  "Bad counter in a long-running operation: " + key);
+}
+
+
+OperationPoller::Handle::Handle(const std::string& accountName,
+                                const std::string& name) :
+  accountName_(accountName),
+  name_(name),
+  done_(false),
+  operation_(Json::objectValue)
+{
+}
+
+
+void OperationPoller::Handle::Update(const Json::Value& operation)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  operation_ = operation;
+}
+
+
+void OperationPoller::Handle::Complete(const std::string& error)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    done_ = true;
+    error_ = error;
+  }
+
+  completed_.notify_all();
+
+  if (callback_.get() != NULL)
+  {
+    try
+    {
+      callback_->NotifyCompletion(*this);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Error in the callback of long-running operation " << name_ << ": " << e.What();
+    }
+  }
+}
+
+
+bool OperationPoller::Handle::IsDone()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return done_;
+}
+
+
+bool OperationPoller::Handle::Wait(unsigned int milliseconds)
+{
+  const boost::system_time timeout = boost::get_system_time() + boost::posix_time::milliseconds(milliseconds);
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  while (!done_)
+  {
+    if (!completed_.timed_wait(lock, timeout))
+    {
+      return done_;
+    }
+  }
+
+  return true;
+}
+
+
+void OperationPoller::Handle::GetOperation(Json::Value& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  target = operation_;
+}
+
+
+void OperationPoller::Handle::GetCounters(uint64_t& success,
+                                          uint64_t& failure,
+                                          uint64_t& pending)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (operation_.isMember("metadata") &&
+      operation_["metadata"].isMember("counter") &&
+      operation_["metadata"]["counter"].isObject())
+  {
+    const Json::Value& counter = operation_["metadata"]["counter"];
+    success = GetCounter(counter, "success");
+    failure = GetCounter(counter, "failure");
+    pending = GetCounter(counter, "pending");
+  }
+  else
+  {
+    success = 0;
+    failure = 0;
+    pending = 0;
+  }
+}
+
+
+float OperationPoller::Handle::GetProgress()
+{
+  if (IsDone())
+  {
+    return 1;
+  }
+
+  uint64_t success, failure, pending;
+  GetCounters(success, failure, pending);
+
+  if (success + failure + pending == 0)
+  {
+    return 0;
+  }
+  else
+  {
+    return static_cast<float>(success + failure) / static_cast<float>(success + failure + pending);
+  }
+}
+
+
+void OperationPoller::Handle::CheckSuccess()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (!done_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                    "The long-running operation is not done yet: " + name_);
+  }
+  else if (!error_.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "The long-running operation " + name_ + " has failed: " + error_);
+  }
+}
+
+
+OperationPoller::OperationPoller() :
+  thread_(NULL),
+  stopped_(false),
+  succeededCount_(0),
+  failedCount_(0),
+  pollsCount_(0),
+  sumLatencySeconds_(0),
+  maxLatencySeconds_(0)
+{
+}
+
+
+OperationPoller::~OperationPoller()
+{
+  if (thread_ != NULL)
+  {
+    LOG(ERROR) << "OperationPoller::Stop() should have been called";
+    Stop();
+  }
+}
+
+
+OperationPoller& OperationPoller::GetInstance()
+{
+  static OperationPoller instance;
+  return instance;
+}
+
+
+void OperationPoller::Poll(std::shared_ptr<Handle>& handle,
+                           bool& done,
+                           std::string& error)
+{
+  std::string header;
+  if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, handle->GetAccountName()))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "No token is available for Google Cloud Platform account: " +
+                                    handle->GetAccountName());
+  }
+
+  std::string url = GoogleConfiguration::GetInstance().GetBaseGoogleUrl();
+  if (url.empty() ||
+      url[url.size() - 1] != '/')
+  {
+    url += '/';
+  }
+
+  Json::Value operation;
+  HealthcareClient::Get(operation, url + handle->GetName(), header, HttpTimings::EndpointClass_Operations);
+
+  // The JSON accessors would throw "Json::LogicError" on unexpected types
+  if (operation.isMember("done") &&
+      !operation["done"].isBool())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "Bad \"done\" field in long-running operation: " + handle->GetName());
+  }
+
+  if (operation.isMember("metadata") &&
+      !operation["metadata"].isObject())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "Bad \"metadata\" field in long-running operation: " + handle->GetName());
+  }
+
+  handle->Update(operation);
+
+  done = operation.get("done", false).asBool();
+
+  if (done &&
+      operation.isMember("error"))
+  {
+    const Json::Value& status = operation["error"];
+
+    if (status.isObject() &&
+        status.isMember("message") &&
+        status["message"].isString())
+    {
+      error = status["message"].asString();
+    }
+    else
+    {
+      error = "Unknown error";
+    }
+  }
+  else
+  {
+    error.clear();
+  }
+}
+
+
+void OperationPoller::Worker(OperationPoller* that)
+{
+  std::vector<std::shared_ptr<Handle> > batch;
+
+  for (;;)
+  {
+    batch.clear();
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      if (that->stopped_)
+      {
+        return;
+      }
+
+      // Wait until the earliest poll is due, or until a new operation is tracked
+      boost::posix_time::ptime earliest;
+      for (PendingOperations::const_iterator it = that->pending_.begin(); it != that->pending_.end(); ++it)
+      {
+        if (earliest.is_not_a_date_time() ||
+            it->second.nextPoll_ < earliest)
+        {
+          earliest = it->second.nextPoll_;
+        }
+      }
+
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+      if (earliest.is_not_a_date_time())
+      {
+        that->changed_.wait(lock);
+        continue;
+      }
+      else if (earliest > now)
+      {
+        that->changed_.timed_wait(lock, earliest - now);
+        continue;
+      }
+
+      for (PendingOperations::const_iterator it = that->pending_.begin();
+           it != that->pending_.end() && batch.size() < MAX_BATCH_SIZE; ++it)
+      {
+        if (it->second.nextPoll_ <= now)
+        {
+          batch.push_back(it->second.handle_);
+        }
+      }
+    }
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      bool done = false;
+      bool failure = false;
+      std::string error;
+
+      try
+      {
+        Poll(batch[i], done, error);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        failure = true;
+        error = e.What();
+      }
+      catch (std::exception& e)
+      {
+        // Never let an unexpected answer of Google terminate the thread
+        failure = true;
+        error = e.what();
+      }
+
+      bool complete = done;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        that->pollsCount_++;
+
+        PendingOperations::iterator found = that->pending_.find(batch[i]->GetName());
+        assert(found != that->pending_.end());
+
+        const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+        if (failure)
+        {
+          found->second.errorsCount_++;
+
+          if (found->second.errorsCount_ >= MAX_POLL_ERRORS)
+          {
+            complete = true;
+          }
+          else
+          {
+            LOG(WARNING) << "Cannot poll long-running operation " << batch[i]->GetName() << ", will retry: " << error;
+          }
+        }
+        else
+        {
+          found->second.errorsCount_ = 0;
+        }
+
+        if (complete)
+        {
+          const double latency = static_cast<double>((now - found->second.submitted_).total_milliseconds()) / 1000.0;
+          that->sumLatencySeconds_ += latency;
+          that->maxLatencySeconds_ = std::max(that->maxLatencySeconds_, latency);
+
+          if (error.empty())
+          {
+            that->succeededCount_++;
+          }
+          else
+          {
+            that->failedCount_++;
+          }
+
+          that->pending_.erase(found);
+        }
+        else
+        {
+          // Exponential growth of the polling interval
+          found->second.intervalMs_ = std::min(MAX_INTERVAL_MS, found->second.intervalMs_ * 2);
+          found->second.nextPoll_ = now + boost::posix_time::milliseconds(found->second.intervalMs_);
+        }
+      }
+
+      if (complete)
+      {
+        LOG(INFO) << "Long-running operation " << batch[i]->GetName() << " is done"
+                  << (error.empty() ? "" : " with error: " + error);
+
+        // Outside of the lock, as the callbacks can track new operations
+        batch[i]->Complete(error);
+      }
+    }
+  }
+}
+
+
+std::shared_ptr<OperationPoller::Handle> OperationPoller::Track(const std::string& accountName,
+                                                                const std::string& operationName,
+                                                                ICallback* callback)
+{
+  std::unique_ptr<ICallback> protection(callback);
+
+  if (operationName.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (stopped_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                    "The poller of the long-running operations is stopped");
+  }
+
+  PendingOperations::const_iterator found = pending_.find(operationName);
+  if (found != pending_.end())
+  {
+    return found->second.handle_;
+  }
+
+  Pending pending;
+  pending.handle_.reset(new Handle(accountName, operationName));
+  pending.handle_->callback_.reset(protection.release());
+  pending.submitted_ = boost::posix_time::microsec_clock::universal_time();
+  pending.nextPoll_ = pending.submitted_ + boost::posix_time::milliseconds(INITIAL_INTERVAL_MS);
+  pending.intervalMs_ = INITIAL_INTERVAL_MS;
+  pending.errorsCount_ = 0;
+
+  pending_[operationName] = pending;
+
+  if (thread_ == NULL)
+  {
+    thread_ = new boost::thread(Worker, this);
+  }
+
+  changed_.notify_one();
+
+  return pending.handle_;
+}
+
+
+void OperationPoller::Stop()
+{
+  boost::thread* thread;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    thread = thread_;
+    thread_ = NULL;
+  }
+
+  changed_.notify_one();
+
+  if (thread != NULL)
+  {
+    // The handles of the pending operations are left unresolved: The
+    // jobs waiting on them are stopped by Orthanc, and will track the
+    // operations again once resumed
+    if (thread->joinable())
+    {
+      thread->join();
+    }
+
+    delete thread;
+  }
+}
+
+
+size_t OperationPoller::GetPendingCount()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return pending_.size();
+}
+
+
+void OperationPoller::Format(Json::Value& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  target = Json::objectValue;
+  target["Pending"] = Json::arrayValue;
+
+  for (PendingOperations::const_iterator it = pending_.begin(); it != pending_.end(); ++it)
+  {
+    Json::Value operation = Json::objectValue;
+    operation["Name"] = it->first;
+    operation["Account"] = it->second.handle_->GetAccountName();
+    operation["AgeSeconds"] = static_cast<Json::Int64>((now - it->second.submitted_).total_seconds());
+    operation["PollingIntervalMs"] = it->second.intervalMs_;
+    operation["ConsecutiveErrors"] = it->second.errorsCount_;
+    target["Pending"].append(operation);
+  }
+
+  const uint64_t completed = succeededCount_ + failedCount_;
+
+  target["PendingCount"] = static_cast<Json::UInt64>(pending_.size());
+  target["SucceededCount"] = static_cast<Json::UInt64>(succeededCount_);
+  target["FailedCount"] = static_cast<Json::UInt64>(failedCount_);
+  target["PollsCount"] = static_cast<Json::UInt64>(pollsCount_);
+  target["MeanLatencySeconds"] = (completed == 0 ? 0.0 : sumLatencySeconds_ / static_cast<double>(completed));
+  target["MaxLatencySeconds"] = maxLatencySeconds_;
+}
+
+
+void OperationPoller::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  boost::mutex::scoped_lock lock(mutex_);
+
+  const uint64_t completed = succeededCount_ + failedCount_;
+
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_operations_pending", static_cast<float>(pending_.size()));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_operations_succeeded", static_cast<float>(succeededCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_operations_failed", static_cast<float>(failedCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_operations_polls", static_cast<float>(pollsCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_operations_latency_mean_s",
+                                  completed == 0 ? 0.0f : static_cast<float>(sumLatencySeconds_ / static_cast<double>(completed)));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_operations_latency_max_s", static_cast<float>(maxLatencySeconds_));
+#endif
+}
@@ -0,0 +1,183 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+
+
+/**
+ * Shared engine tracking the long-running operations of the Google
+ * Healthcare API (import, export, de-identification, deletion...).
+ * One single thread polls all the pending operations: Each wake-up
+ * polls the batch of operations that are due, and the interval
+ * between two polls of the same operation grows from 1 second up to
+ * 1 minute, as long operations don't need to be polled as often as
+ * the short ones. The callers are notified of the completion through
+ * their handle, either by waiting on it (future) or by attaching a
+ * callback to it. The thread is only started by the first operation.
+ **/
+class OperationPoller : public boost::noncopyable
+{
+public:
+  class Handle;
+
+  class ICallback : public boost::noncopyable
+  {
+  public:
+    virtual ~ICallback()
+    {
+    }
+
+    // Invoked once by the polling thread, after the operation is
+    // done or has failed. Must not block.
+    virtual void NotifyCompletion(Handle& handle) = 0;
+  };
+
+  class Handle : public boost::noncopyable
+  {
+    friend class OperationPoller;
+
+  private:
+    std::string                 accountName_;
+    std::string                 name_;
+    boost::mutex                mutex_;
+    boost::condition_variable   completed_;
+    bool                        done_;
+    std::string                 error_;       // Empty iff success
+    Json::Value                 operation_;   // Last answer of the Healthcare API
+    std::unique_ptr<ICallback>  callback_;
+
+    void Update(const Json::Value& operation);
+
+    void Complete(const std::string& error);
+
+  public:
+    Handle(const std::string& accountName,
+           const std::string& name);
+
+    const std::string& GetAccountName() const
+    {
+      return accountName_;
+    }
+
+    const std::string& GetName() const
+    {
+      return name_;
+    }
+
+    bool IsDone();
+
+    // Waits for the completion during at most "milliseconds", and
+    // returns whether the operation is done
+    bool Wait(unsigned int milliseconds);
+
+    // Last known state of the operation, that is updated after each
+    // poll, even if the operation is not done yet
+    void GetOperation(Json::Value& target);
+
+    // Values of "metadata.counter" (success, failure, pending) in the
+    // last known state of the operation
+    void GetCounters(uint64_t& success,
+                     uint64_t& failure,
+                     uint64_t& pending);
+
+    // Progress between 0 and 1, from the counters
+    float GetProgress();
+
+    // Throws an exception if the operation has failed, or if it is
+    // not done yet
+    void CheckSuccess();
+  };
+
+private:
+  struct Pending
+  {
+    std::shared_ptr<Handle>   handle_;
+    boost::posix_time::ptime  submitted_;
+    boost::posix_time::ptime  nextPoll_;
+    unsigned int              intervalMs_;
+    unsigned int              errorsCount_;   // Consecutive errors
+  };
+
+  typedef std::map<std::string, Pending>  PendingOperations;
+
+  boost::mutex               mutex_;
+  boost::condition_variable  changed_;
+  PendingOperations          pending_;
+  boost::thread*             thread_;
+  bool                       stopped_;
+
+  // Statistics, protected by "mutex_"
+  uint64_t                   succeededCount_;
+  uint64_t                   failedCount_;
+  uint64_t                   pollsCount_;
+  double                     sumLatencySeconds_;
+  double                     maxLatencySeconds_;
+
+  static void Worker(OperationPoller* that);
+
+  static void Poll(std::shared_ptr<Handle>& handle,
+                   bool& done,
+                   std::string& error);
+
+  OperationPoller();  // Singleton pattern
+
+public:
+  ~OperationPoller();
+
+  static OperationPoller& GetInstance();
+
+  // Starts tracking the given operation of the given account. If the
+  // operation is already tracked, the existing handle is returned
+  // (the callback is only attached to a new handle, and is owned by
+  // the poller).
+  std::shared_ptr<Handle> Track(const std::string& accountName,
+                                const std::string& operationName,
+                                ICallback* callback = NULL);
+
+  void Stop();
+
+  size_t GetPendingCount();
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
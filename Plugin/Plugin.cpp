@@ -31,8 +31,24 @@
  **/
 
 
+#include "BulkExportJob.h"
+#include "BulkImportJob.h"
+#include "ChangeFeed.h"
+#include "ColdTierStorage.h"
+#include "FrameCache.h"
 #include "GoogleConfiguration.h"
 #include "GoogleUpdater.h"
+#include "HttpTimings.h"
+#include "InstanceRouter.h"
+#include "LocalTierEvictor.h"
+#include "MetadataCache.h"
+#include "MirrorUpdater.h"
+#include "OperationPoller.h"
+#include "PresenceFilters.h"
+#include "PriorPrefetcher.h"
+#include "ScopedTokenCache.h"
+#include "StoreSyncJob.h"
+#include "TokenBroker.h"
 
 #include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
@@ -40,6 +56,8 @@
 #include <Logging.h>
 #include <Toolbox.h>
 
+#include <boost/algorithm/string/predicate.hpp>
+
 
 static bool CheckDicomWebVersion()
 {
@@ -92,6 +110,537 @@ static bool CheckDicomWebVersion()
 }
 
 
+void RefreshAccount(OrthancPluginRestOutput* output,
+                    const char* url,
+                    const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "POST");
+    return;
+  }
+
+  const std::string accountName(request->groups[0]);
+
+  AccountRefresher* refresher = GoogleUpdater::GetInstance().LookupRefresher(accountName);
+  if (refresher == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Unknown Google Cloud Platform account: " + accountName);
+  }
+
+  // Leave some time for the token request to complete
+  const unsigned int timeout = GoogleConfiguration::GetInstance().GetTimeoutSeconds() + 5;
+
+  Json::Value answer = Json::objectValue;
+  answer["Account"] = accountName;
+  answer["Success"] = refresher->RefreshNow(timeout);
+
+  OrthancPlugins::AnswerJson(answer, output);
+}
+
+
+void GetStatus(OrthancPluginRestOutput* output,
+               const char* url,
+               const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+    return;
+  }
+
+  Json::Value answer;
+  GoogleUpdater::GetInstance().FormatStatus(answer);
+  ScopedTokenCache::GetInstance().Format(answer["ScopedTokens"]);
+  OperationPoller::GetInstance().Format(answer["Operations"]);
+
+  if (ColdTierStorage::GetInstance().IsEnabled())
+  {
+    ColdTierStorage::GetInstance().Format(answer["ColdTier"]);
+    LocalTierEvictor::GetInstance().Format(answer["ColdTier"]["Eviction"]);
+  }
+
+  if (MirrorUpdater::GetInstance().IsEnabled())
+  {
+    MirrorUpdater::GetInstance().Format(answer["Mirrors"]);
+  }
+
+  if (ChangeFeed::GetInstance().IsEnabled())
+  {
+    ChangeFeed::GetInstance().Format(answer["ChangeFeeds"]);
+  }
+
+  if (PresenceFilters::GetInstance().IsEnabled())
+  {
+    PresenceFilters::GetInstance().Format(answer["PresenceFilters"]);
+  }
+
+  if (MetadataCache::GetInstance().IsEnabled())
+  {
+    MetadataCache::GetInstance().Format(answer["MetadataCache"]);
+  }
+
+  if (FrameCache::GetInstance().IsEnabled())
+  {
+    FrameCache::GetInstance().Format(answer["FrameCache"]);
+  }
+
+  if (PriorPrefetcher::GetInstance().IsEnabled())
+  {
+    PriorPrefetcher::GetInstance().Format(answer["PriorPrefetch"]);
+  }
+
+  if (InstanceRouter::GetInstance().IsEnabled())
+  {
+    InstanceRouter::GetInstance().Format(answer["Routing"]);
+  }
+
+  OrthancPlugins::AnswerJson(answer, output);
+}
+
+
+void ListAccounts(OrthancPluginRestOutput* output,
+                  const char* url,
+                  const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+    return;
+  }
+
+  Json::Value answer;
+  GoogleUpdater::GetInstance().ListAccounts(answer);
+  OrthancPlugins::AnswerJson(answer, output);
+}
+
+
+void GetAccountStatus(OrthancPluginRestOutput* output,
+                      const char* url,
+                      const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+    return;
+  }
+
+  const std::string accountName(request->groups[0]);
+
+  Json::Value answer;
+  if (GoogleUpdater::GetInstance().FormatAccountStatus(answer, accountName))
+  {
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Unknown Google Cloud Platform account: " + accountName);
+  }
+}
+
+
+void GetAccountToken(OrthancPluginRestOutput* output,
+                     const char* url,
+                     const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+    return;
+  }
+
+  // The restriction to the loopback interface is enforced by "FilterHttpRequest()"
+  if (!TokenBroker::IsAuthorized(request, GoogleConfiguration::GetInstance().GetTokenBrokerSecret()))
+  {
+    OrthancPluginSendUnauthorized(OrthancPlugins::GetGlobalContext(), output, "Token broker");
+    return;
+  }
+
+  const std::string accountName(request->groups[0]);
+
+  AccountRefresher* refresher = GoogleUpdater::GetInstance().LookupRefresher(accountName);
+  if (refresher == NULL)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource,
+                                    "Unknown Google Cloud Platform account: " + accountName);
+  }
+
+  std::set<std::string> scopes;
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    if (std::string(request->getKeys[i]) == "scopes")
+    {
+      TokenBroker::ParseScopes(scopes, request->getValues[i]);
+    }
+  }
+
+  // Leave some time for the token request to complete, if the account was dormant
+  const unsigned int timeout = GoogleConfiguration::GetInstance().GetTimeoutSeconds() + 5;
+
+  bool success;
+  Json::Value answer;
+
+  if (scopes.empty())
+  {
+    success = TokenBroker::FormatToken(answer, *refresher, timeout);
+  }
+  else
+  {
+    // Wakes up the account if it is dormant (lazy mode)
+    refresher->NotifyActivity(timeout);
+
+    // Non-default scopes are served by the on-demand cache
+    std::string header;
+    boost::posix_time::ptime expiration;
+    success = (ScopedTokenCache::GetInstance().GetToken(header, expiration, refresher->GetAccount(), scopes) &&
+               TokenBroker::FormatToken(answer, header, expiration));
+  }
+
+  if (success)
+  {
+    OrthancPluginSetHttpHeader(OrthancPlugins::GetGlobalContext(), output, "Cache-Control", "no-store");
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+  else
+  {
+    OrthancPlugins::AnswerHttpError(503, output);  // No token yet
+  }
+}
+
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 2, 0)
+static int32_t FilterHttpRequest(OrthancPluginHttpMethod method,
+                                 const char* uri,
+                                 const char* ip,
+                                 uint32_t headersCount,
+                                 const char* const* headersKeys,
+                                 const char* const* headersValues)
+{
+  // The token broker only answers to the local clients
+  if (TokenBroker::IsBrokerUri(uri) &&
+      !TokenBroker::IsLocalAddress(ip))
+  {
+    LOG(WARNING) << "Refusing access to the token broker from a remote host: " << ip;
+    return 0;
+  }
+
+  try
+  {
+    if (GoogleConfiguration::GetInstance().IsLazyRefresh())
+    {
+      // Wakes up a dormant account before the DICOMweb plugin handles
+      // a request to its server
+      GoogleUpdater::GetInstance().NotifyServerAccess(uri);
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Exception in the HTTP filter: " << e.What();
+  }
+
+  return 1;
+}
+#endif
+
+
+void GetHttpTimings(OrthancPluginRestOutput* output,
+                    const char* url,
+                    const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+    return;
+  }
+
+  Json::Value answer;
+  HttpTimings::GetInstance().Format(answer);
+  OrthancPlugins::AnswerJson(answer, output);
+}
+
+
+void SearchMirror(OrthancPluginRestOutput* output,
+                  const char* url,
+                  const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+    return;
+  }
+
+  std::map<std::string, std::string> arguments;
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    arguments[request->getKeys[i]] = request->getValues[i];
+  }
+
+  Json::Value answer;
+  MirrorUpdater::GetInstance().Search(answer, request->groups[0], request->groups[1], arguments);
+  OrthancPlugins::AnswerJson(answer, output);
+}
+
+
+void GetStudyMetadata(OrthancPluginRestOutput* output,
+                      const char* url,
+                      const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+    return;
+  }
+
+  std::string metadata, etag;
+  MetadataCache::GetInstance().GetStudyMetadata(metadata, etag, request->groups[0], request->groups[1]);
+
+  if (!etag.empty())
+  {
+    OrthancPluginSetHttpHeader(OrthancPlugins::GetGlobalContext(), output, "ETag", etag.c_str());
+  }
+
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, metadata.empty() ? NULL : metadata.c_str(),
+                            metadata.size(), "application/dicom+json");
+}
+
+
+void GetFrames(OrthancPluginRestOutput* output,
+               const char* url,
+               const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+    return;
+  }
+
+  // The "Accept" header selects the transfer syntax of the frames
+  std::string accept = "multipart/related; type=\"application/octet-stream\"";
+  for (uint32_t i = 0; i < request->headersCount; i++)
+  {
+    if (boost::iequals(request->headersKeys[i], "accept"))
+    {
+      accept = request->headersValues[i];
+    }
+  }
+
+  std::string body, contentType;
+  FrameCache::GetInstance().GetFrames(body, contentType, request->groups[0], request->groups[1], request->groups[2],
+                                      request->groups[3], request->groups[4], accept);
+
+  OrthancPluginAnswerBuffer(OrthancPlugins::GetGlobalContext(), output, body.empty() ? NULL : body.c_str(),
+                            body.size(), contentType.c_str());
+}
+
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+template <typename BulkJob>
+static void SubmitBulkTransfer(OrthancPluginRestOutput* output,
+                               const OrthancPluginHttpRequest* request)
+{
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPlugins::AnswerMethodNotAllowed(output, "POST");
+    return;
+  }
+
+  Json::Value body;
+  if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+      body.type() != Json::objectValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "Expected a JSON object in the body");
+  }
+
+  body["Account"] = std::string(request->groups[0]);
+
+  // The checkpoints are only found in the serialized jobs
+  body.removeMember("Checkpoint");
+
+  OrthancPlugins::OrthancJob::SubmitFromRestApiPost(output, body, new BulkJob(body));
+}
+
+
+void ImportToAccount(OrthancPluginRestOutput* output,
+                     const char* url,
+                     const OrthancPluginHttpRequest* request)
+{
+  SubmitBulkTransfer<BulkImportJob>(output, request);
+}
+
+
+void ExportFromAccount(OrthancPluginRestOutput* output,
+                       const char* url,
+                       const OrthancPluginHttpRequest* request)
+{
+  SubmitBulkTransfer<BulkExportJob>(output, request);
+}
+
+
+void SyncWithAccount(OrthancPluginRestOutput* output,
+                     const char* url,
+                     const OrthancPluginHttpRequest* request)
+{
+  SubmitBulkTransfer<StoreSyncJob>(output, request);
+}
+
+
+static OrthancPluginJob* UnserializeJob(const char* jobType,
+                                        const char* serialized)
+{
+  try
+  {
+    Json::Value source;
+
+    if (jobType != NULL &&
+        serialized != NULL &&
+        OrthancPlugins::ReadJson(source, serialized))
+    {
+      const std::string type(jobType);
+
+      if (type == BulkImportJob::JOB_TYPE)
+      {
+        return OrthancPlugins::OrthancJob::Create(new BulkImportJob(source));
+      }
+      else if (type == BulkExportJob::JOB_TYPE)
+      {
+        return OrthancPlugins::OrthancJob::Create(new BulkExportJob(source));
+      }
+      else if (type == StoreSyncJob::JOB_TYPE)
+      {
+        return OrthancPlugins::OrthancJob::Create(new StoreSyncJob(source));
+      }
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Cannot reload a job of the Google Cloud Platform plugin: " << e.What();
+  }
+
+  return NULL;
+}
+#endif
+
+
+static OrthancPluginErrorCode StorageCreate(const char* uuid,
+                                            const void* content,
+                                            int64_t size,
+                                            OrthancPluginContentType type)
+{
+  try
+  {
+    ColdTierStorage::GetInstance().Create(uuid, content, size, type);
+    return OrthancPluginErrorCode_Success;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Cannot store attachment " << uuid << ": " << e.What();
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+  }
+}
+
+
+static OrthancPluginErrorCode StorageRead(void** content,
+                                          int64_t* size,
+                                          const char* uuid,
+                                          OrthancPluginContentType type)
+{
+  try
+  {
+    ColdTierStorage::GetInstance().Read(*content, *size, uuid, type);
+    return OrthancPluginErrorCode_Success;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+  }
+}
+
+
+static OrthancPluginErrorCode StorageRemove(const char* uuid,
+                                            OrthancPluginContentType type)
+{
+  try
+  {
+    ColdTierStorage::GetInstance().Remove(uuid, type);
+    return OrthancPluginErrorCode_Success;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+  }
+}
+
+
+static OrthancPluginErrorCode OnStoredInstance(OrthancPluginDicomInstance* instance,
+                                               const char* instanceId)
+{
+  try
+  {
+    OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+    InstanceRouter::GetInstance().SignalStoredInstance(
+      instanceId, OrthancPluginGetInstanceData(context, instance),
+      static_cast<size_t>(OrthancPluginGetInstanceSize(context, instance)));
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // The routing must not prevent Orthanc from storing the instance
+    LOG(ERROR) << "Cannot route instance " << instanceId << ": " << e.What();
+  }
+
+  return OrthancPluginErrorCode_Success;
+}
+
+
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+static void RefreshMetrics()
+{
+  try
+  {
+    GoogleUpdater::GetInstance().PublishMetrics();
+    HttpTimings::GetInstance().PublishMetrics();
+    OperationPoller::GetInstance().PublishMetrics();
+
+    if (ColdTierStorage::GetInstance().IsEnabled())
+    {
+      ColdTierStorage::GetInstance().PublishMetrics();
+      LocalTierEvictor::GetInstance().PublishMetrics();
+    }
+
+    MirrorUpdater::GetInstance().PublishMetrics();
+    ChangeFeed::GetInstance().PublishMetrics();
+    PresenceFilters::GetInstance().PublishMetrics();
+
+    if (MetadataCache::GetInstance().IsEnabled())
+    {
+      MetadataCache::GetInstance().PublishMetrics();
+    }
+
+    if (FrameCache::GetInstance().IsEnabled())
+    {
+      FrameCache::GetInstance().PublishMetrics();
+    }
+
+    if (PriorPrefetcher::GetInstance().IsEnabled())
+    {
+      PriorPrefetcher::GetInstance().PublishMetrics();
+    }
+
+    if (InstanceRouter::GetInstance().IsEnabled())
+    {
+      InstanceRouter::GetInstance().PublishMetrics();
+    }
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Exception while refreshing the metrics: " << e.What();
+  }
+}
+#endif
+
+
 OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
                                         OrthancPluginResourceType resourceType,
                                         const char* resourceId)
@@ -105,16 +654,41 @@ OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
         if (CheckDicomWebVersion())
         {
           GoogleUpdater::GetInstance().Start();
+
+          if (ColdTierStorage::GetInstance().IsEnabled() &&
+              GoogleConfiguration::GetInstance().GetColdTierMaxLocalSize() > 0)
+          {
+            LocalTierEvictor::GetInstance().Start();
+          }
+
+          MirrorUpdater::GetInstance().Start();
+          PresenceFilters::GetInstance().Start();
+          FrameCache::GetInstance().Start();
+          PriorPrefetcher::GetInstance().Start();
+          InstanceRouter::GetInstance().Start();
+          ChangeFeed::GetInstance().Start();
         }
 
         break;
       }
 
       case OrthancPluginChangeType_OrthancStopped:
+        ChangeFeed::GetInstance().Stop();
+        InstanceRouter::GetInstance().Stop();
+        PriorPrefetcher::GetInstance().Stop();
+        FrameCache::GetInstance().Stop();
+        PresenceFilters::GetInstance().Stop();
+        MirrorUpdater::GetInstance().Stop();
+        LocalTierEvictor::GetInstance().Stop();
+        OperationPoller::GetInstance().Stop();
         GoogleUpdater::GetInstance().Stop();
         break;
 
       default:
+        if (PriorPrefetcher::GetInstance().IsTrigger(changeType, resourceType))
+        {
+          PriorPrefetcher::GetInstance().SignalNewStudy(resourceId);
+        }
         break;
     }
   }
@@ -176,6 +750,112 @@ extern "C"
       GoogleConfiguration::GetInstance();  // Force the initialization of the singleton
 
       OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
+
+      OrthancPlugins::RegisterRestCallback<GetStatus>("/gcp/status", true);
+      OrthancPlugins::RegisterRestCallback<ListAccounts>("/gcp/accounts", true);
+      OrthancPlugins::RegisterRestCallback<GetAccountStatus>("/gcp/accounts/([^/]*)", true);
+      OrthancPlugins::RegisterRestCallback<RefreshAccount>("/gcp/accounts/([^/]*)/refresh", true);
+
+      const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+      bool hasFilter = false;
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 2, 0)
+      if ((!configuration.GetTokenBrokerSecret().empty() ||
+           configuration.IsLazyRefresh()) &&
+          OrthancPlugins::CheckMinimalOrthancVersion(1, 2, 0))
+      {
+        OrthancPluginRegisterIncomingHttpRequestFilter(context, FilterHttpRequest);
+        hasFilter = true;
+      }
+#endif
+
+      if (configuration.GetTokenBrokerSecret().empty())
+      {
+        LOG(INFO) << "The token broker is disabled, as \"GoogleCloudPlatform.TokenBrokerSecret\" is not set";
+      }
+      else if (hasFilter)
+      {
+        OrthancPlugins::RegisterRestCallback<GetAccountToken>("/gcp/accounts/([^/]*)/token", true);
+        LOG(WARNING) << "The token broker is enabled for the local clients";
+      }
+      else
+      {
+        LOG(ERROR) << "The token broker requires Orthanc >= 1.2.0, as it filters the IP address of the clients";
+      }
+
+      if (configuration.IsLazyRefresh() &&
+          !hasFilter)
+      {
+        LOG(WARNING) << "Lazy refresh: Orthanc >= 1.2.0 is required for the accesses to the DICOMweb "
+                     << "servers through the REST API to wake up the dormant accounts";
+      }
+
+      OrthancPlugins::RegisterRestCallback<GetHttpTimings>("/gcp/http-timings", true);
+
+      if (ColdTierStorage::GetInstance().IsEnabled())
+      {
+        // Replaces the default filesystem storage of Orthanc
+        OrthancPluginRegisterStorageArea(context, StorageCreate, StorageRead, StorageRemove);
+      }
+
+      if (MirrorUpdater::GetInstance().IsEnabled())
+      {
+        OrthancPlugins::RegisterRestCallback<SearchMirror>("/gcp/accounts/([^/]*)/mirror/(.*)", true);
+
+        // The notifications of the DICOM stores update the mirrors incrementally
+        ChangeFeed::GetInstance().Register(MirrorUpdater::GetInstance());
+      }
+
+      if (PresenceFilters::GetInstance().IsEnabled())
+      {
+        // The instances notified by the change feed are added to the presence filters
+        ChangeFeed::GetInstance().Register(PresenceFilters::GetInstance());
+      }
+
+      if (MetadataCache::GetInstance().IsEnabled())
+      {
+        OrthancPlugins::RegisterRestCallback<GetStudyMetadata>("/gcp/accounts/([^/]*)/studies/([^/]*)/metadata", true);
+
+        // The notifications of the DICOM stores invalidate the cached metadata
+        ChangeFeed::GetInstance().Register(MetadataCache::GetInstance());
+      }
+
+      if (FrameCache::GetInstance().IsEnabled())
+      {
+        OrthancPlugins::RegisterRestCallback<GetFrames>(
+          "/gcp/accounts/([^/]*)/studies/([^/]*)/series/([^/]*)/instances/([^/]*)/frames/([^/]*)", true);
+      }
+
+      if (PriorPrefetcher::GetInstance().IsEnabled())
+      {
+        // Validates the "PriorPrefetch" section before Orthanc starts
+        LOG(WARNING) << "The prior studies will be prefetched from Google Cloud Platform on \""
+                     << (GoogleConfiguration::GetInstance().IsPriorPrefetchOnNewStudy() ? "NewStudy" : "StableStudy") << "\"";
+      }
+
+      if (InstanceRouter::GetInstance().IsEnabled())
+      {
+        // The routing rules are compiled by the constructor of the singleton
+        OrthancPluginRegisterOnStoredInstanceCallback(context, OnStoredInstance);
+      }
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+      if (OrthancPlugins::CheckMinimalOrthancVersion(1, 4, 2))
+      {
+        OrthancPlugins::RegisterRestCallback<ImportToAccount>("/gcp/accounts/([^/]*)/import", true);
+        OrthancPlugins::RegisterRestCallback<ExportFromAccount>("/gcp/accounts/([^/]*)/export", true);
+        OrthancPlugins::RegisterRestCallback<SyncWithAccount>("/gcp/accounts/([^/]*)/sync", true);
+        OrthancPluginRegisterJobsUnserializer(context, UnserializeJob);
+      }
+      else
+#endif
+      {
+        LOG(WARNING) << "The bulk transfers to Google Cloud Platform require Orthanc >= 1.4.2";
+      }
+
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+      OrthancPluginRegisterRefreshMetricsCallback(context, RefreshMetrics);
+#endif
     }
     catch (Orthanc::OrthancException& e)
     {
@@ -192,6 +872,14 @@ extern "C"
   {
     try
     {
+      ChangeFeed::GetInstance().Stop();
+      InstanceRouter::GetInstance().Stop();
+      PriorPrefetcher::GetInstance().Stop();
+      FrameCache::GetInstance().Stop();
+      PresenceFilters::GetInstance().Stop();
+      MirrorUpdater::GetInstance().Stop();
+      LocalTierEvictor::GetInstance().Stop();
+      OperationPoller::GetInstance().Stop();
       GoogleUpdater::GetInstance().Stop();
       Orthanc::HttpClient::GlobalFinalize();
       Orthanc::Toolbox::FinalizeOpenSsl();
@@ -0,0 +1,133 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PluginToolbox.h"
+
+#include "../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <boost/filesystem.hpp>
+
+
+namespace PluginToolbox
+{
+  std::string FormatMetricName(const std::string& prefix,
+                               const std::string& suffix)
+  {
+    std::string name = prefix;
+    name.reserve(prefix.size() + suffix.size());
+
+    for (size_t i = 0; i < suffix.size(); i++)
+    {
+      const char c = suffix[i];
+      if ((c >= 'a' && c <= 'z') ||
+          (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9'))
+      {
+        name.push_back(c);
+      }
+      else
+      {
+        name.push_back('_');
+      }
+    }
+
+    return name;
+  }
+
+
+  bool MatchWildcard(const std::string& pattern,
+                     const std::string& value)
+  {
+    // Greedy matching with backtracking to the last star
+    size_t p = 0, v = 0;
+    size_t star = std::string::npos, mark = 0;
+
+    while (v < value.size())
+    {
+      if (p < pattern.size() &&
+          (pattern[p] == '?' || pattern[p] == value[v]))
+      {
+        p++;
+        v++;
+      }
+      else if (p < pattern.size() &&
+               pattern[p] == '*')
+      {
+        star = p++;
+        mark = v;
+      }
+      else if (star != std::string::npos)
+      {
+        p = star + 1;
+        v = ++mark;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    while (p < pattern.size() &&
+           pattern[p] == '*')
+    {
+      p++;
+    }
+
+    return (p == pattern.size());
+  }
+
+
+  std::string ResolveConfigurationPath(const std::string& path)
+  {
+    boost::filesystem::path resolved(path);
+
+    if (resolved.is_relative())
+    {
+      char* configurationPath = OrthancPluginGetConfigurationPath(OrthancPlugins::GetGlobalContext());
+      if (configurationPath != NULL)
+      {
+        boost::filesystem::path configuration(configurationPath);
+        OrthancPluginFreeString(OrthancPlugins::GetGlobalContext(), configurationPath);
+
+        if (!boost::filesystem::is_directory(configuration))
+        {
+          configuration = configuration.parent_path();
+        }
+
+        resolved = configuration / resolved;
+      }
+    }
+
+    return resolved.string();
+  }
+}
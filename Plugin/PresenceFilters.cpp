@@ -0,0 +1,569 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PresenceFilters.h"
+
+#include "CuckooFilter.h"
+#include "GoogleConfiguration.h"
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+#include "PluginToolbox.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <cassert>
+
+
+static const unsigned int PAGE_SIZE = 5000;  // Maximum "limit" accepted by Google for QIDO-RS
+
+
+class PresenceFilters::Filter : public boost::noncopyable
+{
+public:
+  std::string   accountName_;
+  std::string   dataset_;
+  std::string   dicomStore_;
+  std::string   dicomWebUrl_;
+  std::string   path_;
+
+  // Protected by the mutex of the filter, as the jobs, the change
+  // feed and the seeding access the filter concurrently
+  boost::mutex  mutex_;
+  CuckooFilter  filter_;
+  bool          seeded_;
+  bool          unsaved_;
+  uint64_t      checksCount_;          // Calls to "IsPresent()"
+  uint64_t      hitsCount_;            // Filter hits, confirmed or not
+  uint64_t      falsePositivesCount_;
+  uint64_t      confirmationFailures_;
+  uint64_t      bytesSaved_;
+  time_t        lastSave_;
+
+  Filter(const GoogleAccount& account,
+         const std::string& dicomWebUrl,
+         const std::string& path,
+         uint64_t capacity) :
+    accountName_(account.GetName()),
+    dataset_(account.GetDataset()),
+    dicomStore_(account.GetDicomStore()),
+    dicomWebUrl_(dicomWebUrl),
+    path_(path),
+    filter_(capacity),
+    seeded_(false),
+    unsaved_(false),
+    checksCount_(0),
+    hitsCount_(0),
+    falsePositivesCount_(0),
+    confirmationFailures_(0),
+    bytesSaved_(0),
+    lastSave_(0)
+  {
+  }
+
+  void Save()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (unsaved_)
+    {
+      boost::filesystem::create_directories(boost::filesystem::path(path_).parent_path());
+      filter_.Save(path_);
+      unsaved_ = false;
+      lastSave_ = time(NULL);
+    }
+  }
+};
+
+
+static void SearchGoogle(Json::Value& answer,
+                         const std::string& accountName,
+                         const std::string& url)
+{
+  std::string header;
+  if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Unauthorized,
+                                    "No token is available yet for Google Cloud Platform account: " + accountName);
+  }
+
+  try
+  {
+    HealthcareClient::Search(answer, url, header);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Retry once if the token has expired in the meantime
+    if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+        GoogleUpdater::GetInstance().HandleRejectedToken(accountName, header) &&
+        GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+    {
+      HealthcareClient::Search(answer, url, header);
+    }
+    else
+    {
+      throw;
+    }
+  }
+}
+
+
+PresenceFilters::PresenceFilters() :
+  stopped_(false),
+  thread_(NULL)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  const boost::filesystem::path directory(PluginToolbox::ResolveConfigurationPath(configuration.GetPresenceFilterDirectory()));
+
+  for (size_t i = 0; i < configuration.GetAccountsCount(); i++)
+  {
+    const GoogleAccount& account = configuration.GetAccount(i);
+
+    if (account.HasPresenceFilter())
+    {
+      const std::string path = (directory / (account.GetName() + ".presence")).string();
+      filters_[account.GetName()] = new Filter(account,
+                                               account.GetDicomWebUrl(configuration.GetBaseGoogleUrl()),
+                                               path, configuration.GetPresenceFilterCapacity());
+
+      LOG(WARNING) << "The uploads to the DICOM store of account \"" << account.GetName()
+                   << "\" skip the instances that are already present, according to: " << path;
+    }
+  }
+}
+
+
+PresenceFilters& PresenceFilters::GetInstance()
+{
+  static PresenceFilters instance;
+  return instance;
+}
+
+
+PresenceFilters::~PresenceFilters()
+{
+  if (thread_ != NULL)
+  {
+    LOG(ERROR) << "PresenceFilters::Stop() should have been called";
+    Stop();
+  }
+
+  for (std::map<std::string, Filter*>::iterator it = filters_.begin(); it != filters_.end(); ++it)
+  {
+    assert(it->second != NULL);
+    delete it->second;
+  }
+}
+
+
+bool PresenceFilters::IsStopped()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return stopped_;
+}
+
+
+PresenceFilters::Filter* PresenceFilters::LookupFilter(const std::string& accountName,
+                                                       const std::string& dataset,
+                                                       const std::string& dicomStore) const
+{
+  std::map<std::string, Filter*>::const_iterator found = filters_.find(accountName);
+
+  if (found != filters_.end() &&
+      found->second->dataset_ == dataset &&
+      found->second->dicomStore_ == dicomStore)
+  {
+    return found->second;
+  }
+  else
+  {
+    return NULL;
+  }
+}
+
+
+void PresenceFilters::Seed(Filter& filter)
+{
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  uint64_t count = 0;
+
+  // The SOP instance UID is part of the default attributes of QIDO-RS at the instance level
+  for (unsigned int offset = 0; ; offset += PAGE_SIZE)
+  {
+    if (IsStopped())
+    {
+      return;  // Seeded again at the next start
+    }
+
+    Json::Value page;
+    SearchGoogle(page, filter.accountName_, filter.dicomWebUrl_ + "instances?limit=" +
+                 boost::lexical_cast<std::string>(PAGE_SIZE) + "&offset=" + boost::lexical_cast<std::string>(offset));
+
+    {
+      boost::mutex::scoped_lock lock(filter.mutex_);
+
+      for (Json::Value::ArrayIndex i = 0; i < page.size(); i++)
+      {
+        const Json::Value& value = page[i]["00080018"]["Value"];
+
+        if (value.type() == Json::arrayValue &&
+            value.size() == 1 &&
+            value[0].type() == Json::stringValue)
+        {
+          filter.filter_.Add(value[0].asString());
+          count++;
+        }
+      }
+
+      filter.unsaved_ = true;
+    }
+
+    if (page.size() < PAGE_SIZE)
+    {
+      break;
+    }
+  }
+
+  {
+    boost::mutex::scoped_lock lock(filter.mutex_);
+    filter.seeded_ = true;
+    filter.unsaved_ = true;
+  }
+
+  filter.Save();
+
+  const double elapsed = static_cast<double>(
+    (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000000.0;
+
+  LOG(WARNING) << "Presence filter of account \"" << filter.accountName_ << "\" seeded with "
+               << count << " instances in " << elapsed << " seconds";
+}
+
+
+void PresenceFilters::Worker(PresenceFilters* that)
+{
+  const unsigned int interval = GoogleConfiguration::GetInstance().GetPresenceFilterSaveIntervalSeconds();
+
+  for (std::map<std::string, Filter*>::iterator it = that->filters_.begin(); it != that->filters_.end(); ++it)
+  {
+    Filter& filter = *it->second;
+
+    boost::mutex::scoped_lock lock(filter.mutex_);
+
+    if (filter.filter_.Load(filter.path_))
+    {
+      filter.seeded_ = true;
+      LOG(WARNING) << "Loaded the presence filter of account \"" << filter.accountName_ << "\": "
+                   << filter.filter_.GetCount() << " instances";
+    }
+  }
+
+  for (;;)
+  {
+    for (std::map<std::string, Filter*>::iterator it = that->filters_.begin();
+         it != that->filters_.end() && !that->IsStopped(); ++it)
+    {
+      Filter& filter = *it->second;
+
+      try
+      {
+        bool seeded;
+
+        {
+          boost::mutex::scoped_lock lock(filter.mutex_);
+          seeded = filter.seeded_;
+        }
+
+        if (seeded)
+        {
+          filter.Save();
+        }
+        else
+        {
+          that->Seed(filter);
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Cannot seed the presence filter of account \"" << it->first << "\": " << e.What();
+      }
+      catch (boost::filesystem::filesystem_error& e)
+      {
+        LOG(ERROR) << "Cannot save the presence filter of account \"" << it->first << "\": " << e.what();
+      }
+    }
+
+    boost::mutex::scoped_lock lock(that->mutex_);
+
+    if (!that->stopped_)
+    {
+      that->wakeUp_.timed_wait(lock, boost::posix_time::seconds(interval));
+    }
+
+    if (that->stopped_)
+    {
+      break;
+    }
+  }
+
+  // Save the latest changes before Orthanc stops
+  for (std::map<std::string, Filter*>::iterator it = that->filters_.begin(); it != that->filters_.end(); ++it)
+  {
+    try
+    {
+      it->second->Save();
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot save the presence filter of account \"" << it->first << "\": " << e.What();
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      LOG(ERROR) << "Cannot save the presence filter of account \"" << it->first << "\": " << e.what();
+    }
+  }
+}
+
+
+void PresenceFilters::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (thread_ == NULL &&
+      !filters_.empty())
+  {
+    stopped_ = false;
+    thread_ = new boost::thread(Worker, this);
+  }
+}
+
+
+void PresenceFilters::Stop()
+{
+  boost::thread* thread;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    thread = thread_;
+    thread_ = NULL;
+  }
+
+  wakeUp_.notify_one();
+
+  if (thread != NULL)
+  {
+    if (thread->joinable())
+    {
+      thread->join();
+    }
+
+    delete thread;
+  }
+}
+
+
+void PresenceFilters::Add(const std::string& accountName,
+                          const std::string& dataset,
+                          const std::string& dicomStore,
+                          const std::string& sopInstanceUid)
+{
+  Filter* filter = LookupFilter(accountName, dataset, dicomStore);
+
+  if (filter != NULL)
+  {
+    boost::mutex::scoped_lock lock(filter->mutex_);
+    filter->filter_.Add(sopInstanceUid);
+    filter->unsaved_ = true;
+  }
+}
+
+
+bool PresenceFilters::IsPresent(const std::string& accountName,
+                                const std::string& dataset,
+                                const std::string& dicomStore,
+                                const std::string& sopInstanceUid,
+                                uint64_t size)
+{
+  Filter* filter = LookupFilter(accountName, dataset, dicomStore);
+
+  if (filter == NULL)
+  {
+    return false;
+  }
+
+  {
+    boost::mutex::scoped_lock lock(filter->mutex_);
+    filter->checksCount_++;
+
+    if (!filter->filter_.MightContain(sopInstanceUid))
+    {
+      return false;
+    }
+
+    filter->hitsCount_++;
+  }
+
+  Json::Value answer;
+
+  try
+  {
+    SearchGoogle(answer, accountName, filter->dicomWebUrl_ + "instances?SOPInstanceUID=" + sopInstanceUid + "&limit=1");
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Uploading is always safe if the presence cannot be confirmed
+    LOG(WARNING) << "Cannot confirm the presence of instance " << sopInstanceUid << " in the DICOM store of account \""
+                 << accountName << "\": " << e.What();
+
+    boost::mutex::scoped_lock lock(filter->mutex_);
+    filter->confirmationFailures_++;
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(filter->mutex_);
+
+  if (answer.size() > 0)
+  {
+    filter->bytesSaved_ += size;
+    return true;
+  }
+  else
+  {
+    // The fingerprint is never removed, as it might belong to another
+    // instance that was inserted (this would create false negatives)
+    filter->falsePositivesCount_++;
+    return false;
+  }
+}
+
+
+void PresenceFilters::ApplyChanges(const std::string& accountName,
+                                   const std::vector<ChangeFeed::Change>& changes)
+{
+  std::map<std::string, Filter*>::const_iterator found = filters_.find(accountName);
+  if (found == filters_.end())
+  {
+    return;
+  }
+
+  Filter& filter = *found->second;
+
+  boost::mutex::scoped_lock lock(filter.mutex_);
+
+  for (size_t i = 0; i < changes.size(); i++)
+  {
+    if (changes[i].dataset_ == filter.dataset_ &&
+        changes[i].dicomStore_ == filter.dicomStore_)
+    {
+      filter.filter_.Add(changes[i].instance_);
+      filter.unsaved_ = true;
+    }
+  }
+}
+
+
+// Fraction of the absent instances that are reported as possibly
+// present by the filter. The checks that are not hits are counted as
+// true negatives, as their presence is not confirmed with Google.
+static double GetFalsePositiveRate(uint64_t checksCount,
+                                   uint64_t hitsCount,
+                                   uint64_t falsePositivesCount)
+{
+  const uint64_t negatives = (checksCount - hitsCount) + falsePositivesCount;
+  return (negatives == 0 ? 0.0 : static_cast<double>(falsePositivesCount) / static_cast<double>(negatives));
+}
+
+
+void PresenceFilters::Format(Json::Value& target)
+{
+  target = Json::objectValue;
+
+  for (std::map<std::string, Filter*>::const_iterator it = filters_.begin(); it != filters_.end(); ++it)
+  {
+    Filter& filter = *it->second;
+
+    boost::mutex::scoped_lock lock(filter.mutex_);
+
+    Json::Value item = Json::objectValue;
+    item["Seeded"] = filter.seeded_;
+    item["InstancesCount"] = static_cast<Json::UInt64>(filter.filter_.GetCount());
+    item["Capacity"] = static_cast<Json::UInt64>(filter.filter_.GetCapacity());
+    item["DroppedCount"] = static_cast<Json::UInt64>(filter.filter_.GetDroppedCount());
+    item["MemoryUsage"] = static_cast<Json::UInt64>(filter.filter_.GetMemoryUsage());
+    item["ChecksCount"] = static_cast<Json::UInt64>(filter.checksCount_);
+    item["HitsCount"] = static_cast<Json::UInt64>(filter.hitsCount_);
+    item["FalsePositivesCount"] = static_cast<Json::UInt64>(filter.falsePositivesCount_);
+    item["FalsePositiveRate"] = GetFalsePositiveRate(filter.checksCount_, filter.hitsCount_, filter.falsePositivesCount_);
+    item["ConfirmationFailures"] = static_cast<Json::UInt64>(filter.confirmationFailures_);
+    item["BytesSaved"] = static_cast<Json::UInt64>(filter.bytesSaved_);
+
+    if (filter.lastSave_ != 0)
+    {
+      item["LastSave"] = boost::posix_time::to_iso_string(boost::posix_time::from_time_t(filter.lastSave_));
+    }
+
+    target[it->first] = item;
+  }
+}
+
+
+void PresenceFilters::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  for (std::map<std::string, Filter*>::const_iterator it = filters_.begin(); it != filters_.end(); ++it)
+  {
+    Filter& filter = *it->second;
+    const std::string& name = it->first;
+
+    boost::mutex::scoped_lock lock(filter.mutex_);
+
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_presence_instances_", name).c_str(),
+                                    static_cast<float>(filter.filter_.GetCount()));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_presence_checks_", name).c_str(),
+                                    static_cast<float>(filter.checksCount_));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_presence_hits_", name).c_str(),
+                                    static_cast<float>(filter.hitsCount_));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_presence_false_positive_rate_", name).c_str(),
+                                    static_cast<float>(GetFalsePositiveRate(filter.checksCount_, filter.hitsCount_,
+                                                                            filter.falsePositivesCount_)));
+    OrthancPlugins::SetMetricsValue(PluginToolbox::FormatMetricName("orthanc_gcp_presence_bytes_saved_", name).c_str(),
+                                    static_cast<float>(filter.bytesSaved_));
+  }
+#endif
+}
@@ -0,0 +1,127 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ChangeFeed.h"
+
+#include <boost/thread.hpp>
+
+
+/**
+ * Filters of the SOP instance UIDs that are present in the DICOM
+ * stores of the accounts with the "PresenceFilter" option, so that
+ * the uploads to Google skip the instances that are already stored,
+ * instead of paying for the transfer of the full DICOM file. Each
+ * filter is a cuckoo filter, seeded at the first start by listing the
+ * instances of the DICOM store with QIDO-RS, then saved in
+ * "PresenceFilterDirectory" every "PresenceFilterSaveInterval" seconds
+ * if modified, and reloaded at the next start. The filter is updated
+ * with the instances uploaded by the plugin, the notifications of the
+ * change feed, and the listings of the store synchronization jobs.
+ *
+ * A hit of the filter is always confirmed by a QIDO-RS query on the
+ * SOP instance UID before skipping the upload. A false positive (e.g.
+ * an instance that was deleted from Google) is only counted: It is
+ * not removed from the filter, as its fingerprint might be shared by
+ * another instance. The false negatives (e.g. instances stored by
+ * another client without change feed) only cost a redundant upload.
+ **/
+class PresenceFilters : public ChangeFeed::IListener
+{
+private:
+  class Filter;
+
+  boost::mutex                     mutex_;
+  boost::condition_variable        wakeUp_;
+  bool                             stopped_;
+  boost::thread*                   thread_;
+  std::map<std::string, Filter*>   filters_;   // Constant after construction
+
+  PresenceFilters();  // Singleton pattern
+
+  static void Worker(PresenceFilters* that);
+
+  bool IsStopped();
+
+  // Returns NULL if the DICOM store has no filter
+  Filter* LookupFilter(const std::string& accountName,
+                       const std::string& dataset,
+                       const std::string& dicomStore) const;
+
+  void Seed(Filter& filter);
+
+public:
+  static PresenceFilters& GetInstance();
+
+  ~PresenceFilters();
+
+  bool IsEnabled() const
+  {
+    return !filters_.empty();
+  }
+
+  bool HasFilter(const std::string& accountName,
+                 const std::string& dataset,
+                 const std::string& dicomStore) const
+  {
+    return LookupFilter(accountName, dataset, dicomStore) != NULL;
+  }
+
+  void Start();
+
+  void Stop();
+
+  // Records an instance that is stored in the DICOM store, or that is
+  // about to be. Ignored if the DICOM store has no filter.
+  void Add(const std::string& accountName,
+           const std::string& dataset,
+           const std::string& dicomStore,
+           const std::string& sopInstanceUid);
+
+  // Returns "true" if the instance is known to be in the DICOM store,
+  // which is confirmed with Google. "size" is the number of bytes
+  // whose upload is saved in this case.
+  bool IsPresent(const std::string& accountName,
+                 const std::string& dataset,
+                 const std::string& dicomStore,
+                 const std::string& sopInstanceUid,
+                 uint64_t size);
+
+  virtual void ApplyChanges(const std::string& accountName,
+                            const std::vector<ChangeFeed::Change>& changes) override;
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
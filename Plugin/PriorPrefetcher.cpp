@@ -0,0 +1,757 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PriorPrefetcher.h"
+
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+#include "MirrorUpdater.h"
+#include "PluginToolbox.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/date_time/gregorian/gregorian.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+
+static const size_t MAX_PENDING_STUDIES = 1000;    // The oldest triggers are dropped beyond this size
+static const size_t MAX_IMPORTED_STUDIES = 10000;  // Remembered to ignore their own notifications
+static const unsigned int MAX_PATIENT_STUDIES = 100;
+static const unsigned int PAGE_SIZE = 5000;        // Maximum "limit" accepted by Google for QIDO-RS
+
+
+static std::string GetMainDicomTag(const Json::Value& resource,
+                                   const char* section,
+                                   const char* tag)
+{
+  if (resource.type() == Json::objectValue &&
+      resource.isMember(section) &&
+      resource[section].type() == Json::objectValue &&
+      resource[section].isMember(tag) &&
+      resource[section][tag].type() == Json::stringValue)
+  {
+    return resource[section][tag].asString();
+  }
+  else
+  {
+    return "";
+  }
+}
+
+
+// Values of one attribute of a DICOM JSON answer of QIDO-RS
+static void GetDicomJsonValues(std::vector<std::string>& target,
+                               const Json::Value& item,
+                               const char* tag)
+{
+  target.clear();
+
+  if (item.type() == Json::objectValue &&
+      item.isMember(tag) &&
+      item[tag].type() == Json::objectValue &&
+      item[tag].isMember("Value") &&
+      item[tag]["Value"].type() == Json::arrayValue)
+  {
+    const Json::Value& values = item[tag]["Value"];
+
+    for (Json::Value::ArrayIndex i = 0; i < values.size(); i++)
+    {
+      if (values[i].type() == Json::stringValue)
+      {
+        target.push_back(values[i].asString());
+      }
+    }
+  }
+}
+
+
+static std::string GetDicomJsonString(const Json::Value& item,
+                                      const char* tag)
+{
+  std::vector<std::string> values;
+  GetDicomJsonValues(values, item, tag);
+  return (values.empty() ? "" : values[0]);
+}
+
+
+static bool ParseDate(boost::gregorian::date& target,
+                      const std::string& date)
+{
+  try
+  {
+    target = boost::gregorian::from_undelimited_string(date);
+    return !target.is_special();
+  }
+  catch (std::exception&)
+  {
+    return false;
+  }
+}
+
+
+static void SearchGoogle(Json::Value& answer,
+                         const std::string& accountName,
+                         const std::string& url)
+{
+  std::string header;
+  if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Unauthorized,
+                                    "No token is available yet for Google Cloud Platform account: " + accountName);
+  }
+
+  try
+  {
+    HealthcareClient::Search(answer, url, header);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Retry once if the token has expired in the meantime
+    if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+        GoogleUpdater::GetInstance().HandleRejectedToken(accountName, header) &&
+        GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+    {
+      HealthcareClient::Search(answer, url, header);
+    }
+    else
+    {
+      throw;
+    }
+  }
+}
+
+
+static void RetrieveInstance(std::string& dicom,
+                             const std::string& accountName,
+                             const std::string& url)
+{
+  std::string header;
+  if (!GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_Unauthorized,
+                                    "No token is available yet for Google Cloud Platform account: " + accountName);
+  }
+
+  try
+  {
+    HealthcareClient::RetrieveInstance(dicom, url, header);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+        GoogleUpdater::GetInstance().HandleRejectedToken(accountName, header) &&
+        GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName))
+    {
+      HealthcareClient::RetrieveInstance(dicom, url, header);
+    }
+    else
+    {
+      throw;
+    }
+  }
+}
+
+
+static bool IsStudyInOrthanc(const std::string& studyInstanceUid)
+{
+  Json::Value answer;
+  if (OrthancPlugins::RestApiPost(answer, "/tools/lookup", studyInstanceUid, false) &&
+      answer.type() == Json::arrayValue)
+  {
+    for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+    {
+      if (answer[i].type() == Json::objectValue &&
+          answer[i].isMember("Type") &&
+          answer[i]["Type"].asString() == "Study")
+      {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+
+static bool IsMatch(const std::set<std::string>& rule,
+                    const std::vector<std::string>& modalities)
+{
+  if (rule.empty())
+  {
+    return true;
+  }
+
+  for (size_t i = 0; i < modalities.size(); i++)
+  {
+    if (rule.find(modalities[i]) != rule.end())
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+bool PriorPrefetcher::IsMoreRecent(const Prior& a,
+                                   const Prior& b)
+{
+  return a.studyDate_ > b.studyDate_;
+}
+
+
+PriorPrefetcher::PriorPrefetcher() :
+  onNewStudy_(false),
+  bandwidth_(0),
+  stopped_(false),
+  thread_(NULL),
+  triggersCount_(0),
+  droppedTriggersCount_(0),
+  searchesCount_(0),
+  priorsFoundCount_(0),
+  priorsLocalCount_(0),
+  studiesFetchedCount_(0),
+  instancesFetchedCount_(0),
+  bytesFetched_(0),
+  failuresCount_(0),
+  throttledSeconds_(0)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  for (std::list<std::string>::const_iterator it = configuration.GetPriorPrefetchAccounts().begin();
+       it != configuration.GetPriorPrefetchAccounts().end(); ++it)
+  {
+    const GoogleAccount* account = configuration.LookupAccount(*it);
+
+    if (account == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Unknown account for the prior prefetch: " + *it);
+    }
+    else if (account->IsDiscovery())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The prior prefetch is not available for an account in the discovery mode: " + *it);
+    }
+    else
+    {
+      accounts_.push_back(*it);
+    }
+  }
+
+  onNewStudy_ = configuration.IsPriorPrefetchOnNewStudy();
+  bandwidth_ = configuration.GetPriorPrefetchBandwidth();
+}
+
+
+PriorPrefetcher::~PriorPrefetcher()
+{
+  if (thread_ != NULL)
+  {
+    LOG(ERROR) << "PriorPrefetcher::Stop() should have been called";
+    Stop();
+  }
+}
+
+
+PriorPrefetcher& PriorPrefetcher::GetInstance()
+{
+  static PriorPrefetcher instance;
+  return instance;
+}
+
+
+bool PriorPrefetcher::IsStopped()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return stopped_;
+}
+
+
+bool PriorPrefetcher::IsImported(const std::string& studyInstanceUid)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return imported_.find(studyInstanceUid) != imported_.end();
+}
+
+
+void PriorPrefetcher::MarkImported(const std::string& studyInstanceUid)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (imported_.insert(studyInstanceUid).second)
+  {
+    importedOrder_.push_back(studyInstanceUid);
+
+    if (importedOrder_.size() > MAX_IMPORTED_STUDIES)
+    {
+      imported_.erase(importedOrder_.front());
+      importedOrder_.pop_front();
+    }
+  }
+}
+
+
+bool PriorPrefetcher::Throttle(size_t bytes)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (bandwidth_ == 0)
+  {
+    return !stopped_;
+  }
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  // No credit is accumulated while idle, so that the budget also
+  // bounds the bursts
+  if (budgetClock_.is_not_a_date_time() ||
+      budgetClock_ < start)
+  {
+    budgetClock_ = start;
+  }
+
+  budgetClock_ += boost::posix_time::microseconds(
+    static_cast<int64_t>(static_cast<double>(bytes) * 1000000.0 / static_cast<double>(bandwidth_)));
+
+  for (;;)
+  {
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    if (stopped_ ||
+        now >= budgetClock_)
+    {
+      throttledSeconds_ += static_cast<double>((now - start).total_microseconds()) / 1000000.0;
+      return !stopped_;
+    }
+
+    wakeUp_.timed_wait(lock, budgetClock_ - now);
+  }
+}
+
+
+void PriorPrefetcher::Worker(PriorPrefetcher* that)
+{
+  for (;;)
+  {
+    std::string orthancId;
+
+    {
+      boost::mutex::scoped_lock lock(that->mutex_);
+
+      while (!that->stopped_ &&
+             that->triggers_.empty())
+      {
+        that->wakeUp_.wait(lock);
+      }
+
+      if (that->stopped_)
+      {
+        return;
+      }
+
+      orthancId = that->triggers_.front();
+      that->triggers_.pop_front();
+    }
+
+    try
+    {
+      that->ProcessStudy(orthancId);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot prefetch the prior studies of study " << orthancId << ": " << e.What();
+
+      boost::mutex::scoped_lock lock(that->mutex_);
+      that->failuresCount_++;
+    }
+  }
+}
+
+
+void PriorPrefetcher::Search(Json::Value& answer,
+                             const std::string& accountName,
+                             const std::string& patientId)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  const GoogleAccount* account = configuration.LookupAccount(accountName);
+  assert(account != NULL);
+
+  if (account->IsMirrored())
+  {
+    // The local mirror avoids one QIDO-RS request to Google
+    std::map<std::string, std::string> arguments;
+    arguments["PatientID"] = patientId;
+    arguments["limit"] = boost::lexical_cast<std::string>(MAX_PATIENT_STUDIES);
+    MirrorUpdater::GetInstance().Search(answer, accountName, "studies", arguments);
+  }
+  else
+  {
+    std::string encoded;
+    Orthanc::Toolbox::UriEncode(encoded, patientId);
+    SearchGoogle(answer, accountName, account->GetDicomWebUrl(configuration.GetBaseGoogleUrl()) +
+                 "studies?PatientID=" + encoded + "&limit=" + boost::lexical_cast<std::string>(MAX_PATIENT_STUDIES));
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  searchesCount_++;
+}
+
+
+void PriorPrefetcher::ProcessStudy(const std::string& orthancId)
+{
+  Json::Value study;
+  if (!OrthancPlugins::RestApiGet(study, "/studies/" + orthancId, false))
+  {
+    return;  // Deleted in the meantime
+  }
+
+  const std::string studyInstanceUid = GetMainDicomTag(study, "MainDicomTags", "StudyInstanceUID");
+  const std::string patientId = GetMainDicomTag(study, "PatientMainDicomTags", "PatientID");
+
+  if (studyInstanceUid.empty() ||
+      IsImported(studyInstanceUid))
+  {
+    return;  // This study has been stored by the prefetch itself
+  }
+
+  if (patientId.empty())
+  {
+    LOG(INFO) << "No PatientID in study " << orthancId << ", its prior studies cannot be prefetched";
+    return;
+  }
+
+  // Modalities of the new study, to select the rule
+  std::vector<std::string> modalities;
+
+  Json::Value series;
+  if (OrthancPlugins::RestApiGet(series, "/studies/" + orthancId + "/series", false) &&
+      series.type() == Json::arrayValue)
+  {
+    for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+    {
+      const std::string modality = GetMainDicomTag(series[i], "MainDicomTags", "Modality");
+      if (!modality.empty())
+      {
+        modalities.push_back(modality);
+      }
+    }
+  }
+
+  const std::vector<GoogleConfiguration::PriorPrefetchRule>& rules = GoogleConfiguration::GetInstance().GetPriorPrefetchRules();
+
+  const GoogleConfiguration::PriorPrefetchRule* rule = NULL;
+  for (size_t i = 0; i < rules.size() && rule == NULL; i++)
+  {
+    if (IsMatch(rules[i].modalities_, modalities))
+    {
+      rule = &rules[i];
+    }
+  }
+
+  if (rule == NULL ||
+      rule->maxPriors_ == 0)
+  {
+    return;
+  }
+
+  // The age of the priors is relative to the new study, or to today
+  boost::gregorian::date reference;
+  if (!ParseDate(reference, GetMainDicomTag(study, "MainDicomTags", "StudyDate")))
+  {
+    reference = boost::gregorian::day_clock::universal_day();
+  }
+
+  std::vector<Prior> priors;
+  std::set<std::string> seen;
+  seen.insert(studyInstanceUid);
+
+  for (size_t i = 0; i < accounts_.size(); i++)
+  {
+    Json::Value answer;
+    Search(answer, accounts_[i], patientId);
+
+    for (Json::Value::ArrayIndex j = 0; j < answer.size(); j++)
+    {
+      Prior prior;
+      prior.accountName_ = accounts_[i];
+      prior.studyInstanceUid_ = GetDicomJsonString(answer[j], "0020000D");
+      prior.studyDate_ = GetDicomJsonString(answer[j], "00080020");
+
+      if (prior.studyInstanceUid_.empty() ||
+          !seen.insert(prior.studyInstanceUid_).second)
+      {
+        continue;  // Already found in another DICOM store
+      }
+
+      if (rule->maxAgeDays_ != 0)
+      {
+        boost::gregorian::date date;
+        if (!ParseDate(date, prior.studyDate_) ||
+            (reference - date).days() > static_cast<int>(rule->maxAgeDays_))
+        {
+          continue;
+        }
+      }
+
+      std::vector<std::string> priorModalities;
+      GetDicomJsonValues(priorModalities, answer[j], "00080061");
+
+      if (IsMatch(rule->priorModalities_, priorModalities))
+      {
+        priors.push_back(prior);
+      }
+    }
+  }
+
+  // The most recent priors first (the dates are formatted as "YYYYMMDD")
+  std::stable_sort(priors.begin(), priors.end(), IsMoreRecent);
+
+  if (priors.size() > rule->maxPriors_)
+  {
+    priors.resize(rule->maxPriors_);
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    priorsFoundCount_ += priors.size();
+  }
+
+  for (size_t i = 0; i < priors.size() && !IsStopped(); i++)
+  {
+    if (IsStudyInOrthanc(priors[i].studyInstanceUid_))
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      priorsLocalCount_++;
+    }
+    else
+    {
+      FetchStudy(priors[i]);
+    }
+  }
+}
+
+
+void PriorPrefetcher::FetchStudy(const Prior& prior)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+  const GoogleAccount* account = configuration.LookupAccount(prior.accountName_);
+  assert(account != NULL);
+
+  const std::string studyUrl = (account->GetDicomWebUrl(configuration.GetBaseGoogleUrl()) +
+                                "studies/" + prior.studyInstanceUid_ + "/");
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+  uint64_t count = 0;
+  uint64_t size = 0;
+
+  Json::Value series;
+  SearchGoogle(series, prior.accountName_, studyUrl + "series");
+
+  for (Json::Value::ArrayIndex i = 0; i < series.size(); i++)
+  {
+    const std::string seriesUrl = studyUrl + "series/" + GetDicomJsonString(series[i], "0020000E") + "/instances";
+
+    for (unsigned int offset = 0; ; offset += PAGE_SIZE)
+    {
+      Json::Value instances;
+      SearchGoogle(instances, prior.accountName_, seriesUrl + "?limit=" + boost::lexical_cast<std::string>(PAGE_SIZE) +
+                   "&offset=" + boost::lexical_cast<std::string>(offset));
+
+      for (Json::Value::ArrayIndex j = 0; j < instances.size(); j++)
+      {
+        std::string dicom;
+        RetrieveInstance(dicom, prior.accountName_, seriesUrl + "/" + GetDicomJsonString(instances[j], "00080018"));
+
+        Json::Value answer;
+        if (!OrthancPlugins::RestApiPost(answer, "/instances", dicom, false))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                          "Orthanc cannot store an instance of prior study: " + prior.studyInstanceUid_);
+        }
+
+        count++;
+        size += dicom.size();
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          instancesFetchedCount_++;
+          bytesFetched_ += dicom.size();
+        }
+
+        if (!Throttle(dicom.size()))
+        {
+          return;  // Stopped
+        }
+      }
+
+      if (instances.size() < PAGE_SIZE)
+      {
+        break;
+      }
+    }
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    studiesFetchedCount_++;
+  }
+
+  /**
+   * Only registered once the whole study is stored. The notifications
+   * of Orthanc about this study are queued while the import runs, and
+   * are only handled by this thread afterwards, so they are ignored.
+   **/
+  MarkImported(prior.studyInstanceUid_);
+
+  LOG(INFO) << "Prefetched prior study " << prior.studyInstanceUid_ << " from Google Cloud Platform account \""
+            << prior.accountName_ << "\": " << count << " instances, " << (size / (1024 * 1024)) << " MB in "
+            << (boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds() << " ms";
+}
+
+
+bool PriorPrefetcher::IsTrigger(OrthancPluginChangeType changeType,
+                                OrthancPluginResourceType resourceType) const
+{
+  return (IsEnabled() &&
+          resourceType == OrthancPluginResourceType_Study &&
+          changeType == (onNewStudy_ ? OrthancPluginChangeType_NewStudy : OrthancPluginChangeType_StableStudy));
+}
+
+
+void PriorPrefetcher::SignalNewStudy(const std::string& orthancId)
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    triggersCount_++;
+    triggers_.push_back(orthancId);
+
+    if (triggers_.size() > MAX_PENDING_STUDIES)
+    {
+      triggers_.pop_front();
+      droppedTriggersCount_++;
+    }
+  }
+
+  wakeUp_.notify_all();
+}
+
+
+void PriorPrefetcher::Start()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (thread_ == NULL &&
+      IsEnabled())
+  {
+    stopped_ = false;
+    thread_ = new boost::thread(Worker, this);
+  }
+}
+
+
+void PriorPrefetcher::Stop()
+{
+  boost::thread* thread;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stopped_ = true;
+    thread = thread_;
+    thread_ = NULL;
+  }
+
+  wakeUp_.notify_all();
+
+  if (thread != NULL)
+  {
+    if (thread->joinable())
+    {
+      thread->join();
+    }
+
+    delete thread;
+  }
+}
+
+
+void PriorPrefetcher::Format(Json::Value& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target = Json::objectValue;
+  target["Accounts"] = Json::arrayValue;
+
+  for (size_t i = 0; i < accounts_.size(); i++)
+  {
+    target["Accounts"].append(accounts_[i]);
+  }
+
+  target["Trigger"] = (onNewStudy_ ? "NewStudy" : "StableStudy");
+  target["Bandwidth"] = static_cast<Json::UInt64>(bandwidth_);
+  target["PendingStudies"] = static_cast<Json::UInt64>(triggers_.size());
+  target["TriggersCount"] = static_cast<Json::UInt64>(triggersCount_);
+  target["DroppedTriggersCount"] = static_cast<Json::UInt64>(droppedTriggersCount_);
+  target["SearchesCount"] = static_cast<Json::UInt64>(searchesCount_);
+  target["PriorsFoundCount"] = static_cast<Json::UInt64>(priorsFoundCount_);
+  target["PriorsAlreadyLocalCount"] = static_cast<Json::UInt64>(priorsLocalCount_);
+  target["StudiesFetchedCount"] = static_cast<Json::UInt64>(studiesFetchedCount_);
+  target["InstancesFetchedCount"] = static_cast<Json::UInt64>(instancesFetchedCount_);
+  target["BytesFetched"] = static_cast<Json::UInt64>(bytesFetched_);
+  target["FailuresCount"] = static_cast<Json::UInt64>(failuresCount_);
+  target["ThrottledSeconds"] = throttledSeconds_;
+}
+
+
+void PriorPrefetcher::PublishMetrics()
+{
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  boost::mutex::scoped_lock lock(mutex_);
+
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_prior_prefetch_pending", static_cast<float>(triggers_.size()));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_prior_prefetch_searches", static_cast<float>(searchesCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_prior_prefetch_priors_found", static_cast<float>(priorsFoundCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_prior_prefetch_priors_local", static_cast<float>(priorsLocalCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_prior_prefetch_studies", static_cast<float>(studiesFetchedCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_prior_prefetch_instances", static_cast<float>(instancesFetchedCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_prior_prefetch_bytes", static_cast<float>(bytesFetched_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_prior_prefetch_failures", static_cast<float>(failuresCount_));
+  OrthancPlugins::SetMetricsValue("orthanc_gcp_prior_prefetch_throttled_seconds", static_cast<float>(throttledSeconds_));
+#endif
+}
@@ -0,0 +1,141 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "GoogleConfiguration.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+
+#include <deque>
+
+
+/**
+ * Background prefetch of the prior studies of a patient from the
+ * DICOM stores of Google, as soon as a new study of this patient
+ * arrives in Orthanc (on "StableStudy" by default, or on "NewStudy").
+ * The priors are looked up by QIDO-RS on the PatientID, in the local
+ * mirror if the account has one, then selected by the first rule of
+ * the "PriorPrefetch" configuration section that matches the
+ * modalities of the new study. The selected priors that are not in
+ * Orthanc yet are retrieved instance by instance by WADO-RS, by one
+ * single low-priority thread whose downloads are paced to the
+ * "Bandwidth" budget, and stored into Orthanc. The notifications
+ * caused by these imports do not trigger any further prefetch.
+ **/
+class PriorPrefetcher : public boost::noncopyable
+{
+private:
+  struct Prior
+  {
+    std::string  accountName_;
+    std::string  studyInstanceUid_;
+    std::string  studyDate_;
+  };
+
+  std::vector<std::string>    accounts_;   // Constant after construction
+  bool                        onNewStudy_;
+  uint64_t                    bandwidth_;
+
+  boost::mutex                mutex_;
+  boost::condition_variable   wakeUp_;
+  bool                        stopped_;
+  boost::thread*              thread_;
+  std::deque<std::string>     triggers_;   // Orthanc identifiers of the new studies
+  std::deque<std::string>     importedOrder_;
+  std::set<std::string>       imported_;   // Study instance UIDs imported by the prefetch
+  boost::posix_time::ptime    budgetClock_;
+
+  uint64_t                    triggersCount_;
+  uint64_t                    droppedTriggersCount_;
+  uint64_t                    searchesCount_;
+  uint64_t                    priorsFoundCount_;
+  uint64_t                    priorsLocalCount_;
+  uint64_t                    studiesFetchedCount_;
+  uint64_t                    instancesFetchedCount_;
+  uint64_t                    bytesFetched_;
+  uint64_t                    failuresCount_;
+  double                      throttledSeconds_;
+
+  PriorPrefetcher();  // Singleton pattern
+
+  static bool IsMoreRecent(const Prior& a,
+                           const Prior& b);
+
+  static void Worker(PriorPrefetcher* that);
+
+  bool IsStopped();
+
+  bool IsImported(const std::string& studyInstanceUid);
+
+  void MarkImported(const std::string& studyInstanceUid);
+
+  // Waits until the downloaded bytes fit in the bandwidth budget.
+  // Returns "false" if the prefetcher is stopped in the meantime.
+  bool Throttle(size_t bytes);
+
+  void Search(Json::Value& answer,
+              const std::string& accountName,
+              const std::string& patientId);
+
+  void ProcessStudy(const std::string& orthancId);
+
+  void FetchStudy(const Prior& prior);
+
+public:
+  static PriorPrefetcher& GetInstance();
+
+  ~PriorPrefetcher();
+
+  bool IsEnabled() const
+  {
+    return !accounts_.empty();
+  }
+
+  // Whether the given change of Orthanc triggers the prefetch
+  bool IsTrigger(OrthancPluginChangeType changeType,
+                 OrthancPluginResourceType resourceType) const;
+
+  // Invoked from the callback of the changes of Orthanc, which must
+  // not be blocked: The study is only queued
+  void SignalNewStudy(const std::string& orthancId);
+
+  void Start();
+
+  void Stop();
+
+  void Format(Json::Value& target);
+
+  void PublishMetrics();
+};
@@ -0,0 +1,727 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "RoutingTree.h"
+
+#include <DicomFormat/DicomStreamReader.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <ctype.h>
+#include <iterator>
+#include <stdio.h>
+#include <unordered_map>
+
+
+static const size_t MAX_NODES = 100000;
+
+
+namespace
+{
+  struct TagKeyword
+  {
+    const char*  keyword_;
+    uint16_t     group_;
+    uint16_t     element_;
+  };
+
+  // The usual tags for routing, the other ones are given by their number
+  static const TagKeyword KEYWORDS[] = {
+    { "SourceApplicationEntityTitle", 0x0002, 0x0016 },
+    { "SOPClassUID", 0x0008, 0x0016 },
+    { "AccessionNumber", 0x0008, 0x0050 },
+    { "Modality", 0x0008, 0x0060 },
+    { "Manufacturer", 0x0008, 0x0070 },
+    { "InstitutionName", 0x0008, 0x0080 },
+    { "ReferringPhysicianName", 0x0008, 0x0090 },
+    { "StationName", 0x0008, 0x1010 },
+    { "StudyDescription", 0x0008, 0x1030 },
+    { "SeriesDescription", 0x0008, 0x103e },
+    { "InstitutionalDepartmentName", 0x0008, 0x1040 },
+    { "ManufacturerModelName", 0x0008, 0x1090 },
+    { "IssuerOfPatientID", 0x0010, 0x0021 },
+    { "BodyPartExamined", 0x0018, 0x0015 },
+    { "ProtocolName", 0x0018, 0x1030 }
+  };
+
+
+  // The values are padded to an even length, with a space or a NULL byte
+  static std::string CleanValue(const std::string& value)
+  {
+    size_t length = value.size();
+    while (length > 0 &&
+           (value[length - 1] == '\0' ||
+            value[length - 1] == ' '))
+    {
+      length--;
+    }
+
+    return Orthanc::Toolbox::StripSpaces(value.substr(0, length));
+  }
+
+
+  static bool HasWildcard(const std::string& value)
+  {
+    return (value.find('*') != std::string::npos ||
+            value.find('?') != std::string::npos);
+  }
+}
+
+
+struct RoutingTree::Node
+{
+  bool                                                  leaf_;
+  size_t                                                tagIndex_;   // Of a branch
+  std::unordered_map<std::string, const Node*>          children_;   // Of a branch, by exact value
+  const Node*                                           otherwise_;  // Of a branch
+  std::vector<size_t>                                   accounts_;   // Of a leaf, sorted and unique
+  std::vector<size_t>                                   residual_;   // Of a leaf, rules with wildcards
+
+  Node() :
+    leaf_(true),
+    tagIndex_(0),
+    otherwise_(NULL)
+  {
+  }
+};
+
+
+class RoutingTree::Compiler : public boost::noncopyable
+{
+private:
+  typedef std::pair<size_t, std::vector<size_t> >  Key;   // Level, sorted indexes of the rules
+
+  RoutingTree&               tree_;
+  std::vector<size_t>        levels_;   // Tag indexes, the most tested first
+  std::map<Key, const Node*> memo_;
+  const Node*                empty_;
+
+  Node& CreateNode()
+  {
+    if (tree_.nodes_.size() >= MAX_NODES)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The routing rules are too complex to be compiled (more than " +
+                                      boost::lexical_cast<std::string>(MAX_NODES) + " nodes)");
+    }
+
+    tree_.nodes_.push_back(new Node);
+    return *tree_.nodes_.back();
+  }
+
+  const Node* CreateLeaf(const std::vector<size_t>& rules)
+  {
+    Node& leaf = CreateNode();
+
+    for (size_t i = 0; i < rules.size(); i++)
+    {
+      const CompiledRule& rule = tree_.compiled_[rules[i]];
+
+      if (rule.residual_.empty())
+      {
+        leaf.accounts_.push_back(rule.account_);
+      }
+      else
+      {
+        leaf.residual_.push_back(rules[i]);
+      }
+    }
+
+    std::sort(leaf.accounts_.begin(), leaf.accounts_.end());
+    leaf.accounts_.erase(std::unique(leaf.accounts_.begin(), leaf.accounts_.end()), leaf.accounts_.end());
+
+    return &leaf;
+  }
+
+  const Node* Build(size_t level,
+                    const std::vector<size_t>& rules)
+  {
+    if (rules.empty())
+    {
+      return empty_;
+    }
+
+    // Skip the levels whose tag is not indexed by any of the rules
+    while (level < levels_.size())
+    {
+      bool found = false;
+      for (size_t i = 0; i < rules.size() && !found; i++)
+      {
+        found = (tree_.compiled_[rules[i]].indexed_.count(levels_[level]) != 0);
+      }
+
+      if (found)
+      {
+        break;
+      }
+      else
+      {
+        level++;
+      }
+    }
+
+    const Key key(level, rules);
+
+    std::map<Key, const Node*>::const_iterator found = memo_.find(key);
+    if (found != memo_.end())
+    {
+      return found->second;  // Shared subtree
+    }
+
+    const Node* result;
+
+    if (level == levels_.size())
+    {
+      result = CreateLeaf(rules);
+    }
+    else
+    {
+      const size_t tagIndex = levels_[level];
+
+      // Partition the rules according to the values they accept for this tag
+      std::map<std::string, std::vector<size_t> > constrained;
+      std::vector<size_t> free;
+
+      for (size_t i = 0; i < rules.size(); i++)
+      {
+        std::map<size_t, std::vector<std::string> >::const_iterator
+          condition = tree_.compiled_[rules[i]].indexed_.find(tagIndex);
+
+        if (condition == tree_.compiled_[rules[i]].indexed_.end())
+        {
+          free.push_back(rules[i]);
+        }
+        else
+        {
+          for (size_t j = 0; j < condition->second.size(); j++)
+          {
+            constrained[condition->second[j]].push_back(rules[i]);
+          }
+        }
+      }
+
+      Node& branch = CreateNode();
+      branch.leaf_ = false;
+      branch.tagIndex_ = tagIndex;
+      branch.otherwise_ = Build(level + 1, free);
+
+      for (std::map<std::string, std::vector<size_t> >::const_iterator
+             it = constrained.begin(); it != constrained.end(); ++it)
+      {
+        // The rules that do not test this tag also apply to its values
+        std::vector<size_t> merged;
+        merged.reserve(it->second.size() + free.size());
+        std::merge(it->second.begin(), it->second.end(), free.begin(), free.end(), std::back_inserter(merged));
+
+        branch.children_[it->first] = Build(level + 1, merged);
+      }
+
+      tree_.depth_ = std::max(tree_.depth_, level + 1);
+      result = &branch;
+    }
+
+    memo_[key] = result;
+    return result;
+  }
+
+public:
+  explicit Compiler(RoutingTree& tree) :
+    tree_(tree),
+    empty_(NULL)
+  {
+    // Order the tags by decreasing number of rules that index them
+    std::vector<size_t> counts(tree_.tags_.size(), 0);
+
+    for (size_t i = 0; i < tree_.compiled_.size(); i++)
+    {
+      for (std::map<size_t, std::vector<std::string> >::const_iterator
+             it = tree_.compiled_[i].indexed_.begin(); it != tree_.compiled_[i].indexed_.end(); ++it)
+      {
+        counts[it->first]++;
+      }
+    }
+
+    std::vector<std::pair<size_t, size_t> > order;  // (- count, tag index)
+    for (size_t i = 0; i < counts.size(); i++)
+    {
+      if (counts[i] > 0)
+      {
+        order.push_back(std::make_pair(tree_.compiled_.size() - counts[i], i));
+      }
+    }
+
+    std::sort(order.begin(), order.end());
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      levels_.push_back(order[i].second);
+    }
+  }
+
+  const Node* Compile()
+  {
+    empty_ = CreateLeaf(std::vector<size_t>());
+
+    std::vector<size_t> all(tree_.compiled_.size());
+    for (size_t i = 0; i < all.size(); i++)
+    {
+      all[i] = i;
+    }
+
+    return Build(0, all);
+  }
+};
+
+
+class RoutingTree::Extractor : public Orthanc::DicomStreamReader::IVisitor
+{
+private:
+  const std::vector<Orthanc::DicomTag>&  tags_;
+  const Orthanc::DicomTag                last_;
+  Values&                                values_;
+  std::string&                           sopInstanceUid_;
+
+  void Store(const Orthanc::DicomTag& tag,
+             const std::string& value)
+  {
+    std::vector<Orthanc::DicomTag>::const_iterator it = std::lower_bound(tags_.begin(), tags_.end(), tag);
+    if (it != tags_.end() &&
+        *it == tag)
+    {
+      values_[it - tags_.begin()] = CleanValue(value);
+    }
+  }
+
+  static Orthanc::DicomTag GetLastTag(const std::vector<Orthanc::DicomTag>& tags)
+  {
+    const Orthanc::DicomTag sopInstanceUid(0x0008, 0x0018);
+
+    if (tags.empty() ||
+        tags.back() < sopInstanceUid)
+    {
+      return sopInstanceUid;
+    }
+    else
+    {
+      return tags.back();
+    }
+  }
+
+public:
+  Extractor(const std::vector<Orthanc::DicomTag>& tags,
+            Values& values,
+            std::string& sopInstanceUid) :
+    tags_(tags),
+    last_(GetLastTag(tags)),
+    values_(values),
+    sopInstanceUid_(sopInstanceUid)
+  {
+  }
+
+  virtual void VisitMetaHeaderTag(const Orthanc::DicomTag& tag,
+                                  const Orthanc::ValueRepresentation& vr,
+                                  const std::string& value) override
+  {
+    Store(tag, value);
+  }
+
+  virtual void VisitTransferSyntax(Orthanc::DicomTransferSyntax transferSyntax) override
+  {
+  }
+
+  virtual bool VisitDatasetTag(const Orthanc::DicomTag& tag,
+                               const Orthanc::ValueRepresentation& vr,
+                               const std::string& value,
+                               bool isLittleEndian,
+                               uint64_t fileOffset) override
+  {
+    if (tag == Orthanc::DicomTag(0x0008, 0x0018))
+    {
+      sopInstanceUid_ = CleanValue(value);
+    }
+
+    Store(tag, value);
+
+    return tag < last_;  // The tags are sorted, no need to go further
+  }
+};
+
+
+namespace
+{
+  // Wraps the DICOM file into a "std::istream", without a copy
+  class MemoryBuffer : public std::streambuf
+  {
+  public:
+    MemoryBuffer(const void* data,
+                 size_t size)
+    {
+      char* start = const_cast<char*>(reinterpret_cast<const char*>(data));
+      setg(start, start, start + size);
+    }
+  };
+}
+
+
+RoutingTree::RoutingTree(const std::vector<Rule>& rules) :
+  rules_(rules),
+  root_(NULL),
+  depth_(0)
+{
+  // Collect the accounts and the tags
+  std::map<std::string, size_t> accounts;
+
+  for (size_t i = 0; i < rules_.size(); i++)
+  {
+    if (accounts.find(rules_[i].account_) == accounts.end())
+    {
+      accounts[rules_[i].account_] = accounts_.size();
+      accounts_.push_back(rules_[i].account_);
+    }
+
+    for (size_t j = 0; j < rules_[i].conditions_.size(); j++)
+    {
+      tags_.push_back(rules_[i].conditions_[j].tag_);
+    }
+  }
+
+  std::sort(tags_.begin(), tags_.end());
+  tags_.erase(std::unique(tags_.begin(), tags_.end()), tags_.end());
+
+  compiled_.resize(rules_.size());
+
+  for (size_t i = 0; i < rules_.size(); i++)
+  {
+    CompiledRule& rule = compiled_[i];
+    rule.account_ = accounts[rules_[i].account_];
+
+    for (size_t j = 0; j < rules_[i].conditions_.size(); j++)
+    {
+      const Condition& condition = rules_[i].conditions_[j];
+      const size_t tagIndex = std::lower_bound(tags_.begin(), tags_.end(), condition.tag_) - tags_.begin();
+
+      bool wildcard = false;
+      for (size_t k = 0; k < condition.values_.size() && !wildcard; k++)
+      {
+        wildcard = HasWildcard(condition.values_[k]);
+      }
+
+      if (wildcard ||
+          rule.indexed_.find(tagIndex) != rule.indexed_.end())
+      {
+        // Two conditions on the same tag are both required, the second
+        // one is checked in the leaves
+        ResidualCondition residual;
+        residual.tagIndex_ = tagIndex;
+        residual.values_ = condition.values_;
+        rule.residual_.push_back(residual);
+      }
+      else
+      {
+        std::vector<std::string>& values = rule.indexed_[tagIndex];
+        values = condition.values_;
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+      }
+    }
+  }
+
+  try
+  {
+    Compiler compiler(*this);
+    root_ = compiler.Compile();
+  }
+  catch (...)
+  {
+    Clear();
+    throw;
+  }
+}
+
+
+RoutingTree::~RoutingTree()
+{
+  Clear();
+}
+
+
+void RoutingTree::Clear()
+{
+  for (size_t i = 0; i < nodes_.size(); i++)
+  {
+    assert(nodes_[i] != NULL);
+    delete nodes_[i];
+  }
+
+  nodes_.clear();
+  root_ = NULL;
+}
+
+
+Orthanc::DicomTag RoutingTree::ParseTag(const std::string& tag)
+{
+  for (size_t i = 0; i < sizeof(KEYWORDS) / sizeof(KEYWORDS[0]); i++)
+  {
+    if (tag == KEYWORDS[i].keyword_)
+    {
+      return Orthanc::DicomTag(KEYWORDS[i].group_, KEYWORDS[i].element_);
+    }
+  }
+
+  bool valid = (tag.size() == 9 &&
+                tag[4] == ',');
+
+  for (size_t i = 0; i < tag.size() && valid; i++)
+  {
+    valid = (i == 4 || isxdigit(static_cast<unsigned char>(tag[i])));
+  }
+
+  unsigned int group, element;
+
+  if (valid &&
+      sscanf(tag.c_str(), "%4x,%4x", &group, &element) == 2)
+  {
+    return Orthanc::DicomTag(static_cast<uint16_t>(group), static_cast<uint16_t>(element));
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Unknown tag in the routing rules (must be \"gggg,eeee\" or a known keyword): " + tag);
+  }
+}
+
+
+std::string RoutingTree::FormatTag(const Orthanc::DicomTag& tag)
+{
+  char buffer[16];
+  sprintf(buffer, "%04x,%04x", tag.GetGroup(), tag.GetElement());
+  return buffer;
+}
+
+
+bool RoutingTree::MatchWildcard(const std::string& pattern,
+                                const std::string& value)
+{
+  // Iterative glob matching, with backtracking to the last "*"
+  size_t p = 0, v = 0;
+  size_t star = std::string::npos, mark = 0;
+
+  while (v < value.size())
+  {
+    if (p < pattern.size() &&
+        (pattern[p] == '?' || pattern[p] == value[v]))
+    {
+      p++;
+      v++;
+    }
+    else if (p < pattern.size() &&
+             pattern[p] == '*')
+    {
+      star = p++;
+      mark = v;
+    }
+    else if (star != std::string::npos)
+    {
+      p = star + 1;
+      v = ++mark;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() &&
+         pattern[p] == '*')
+  {
+    p++;
+  }
+
+  return (p == pattern.size());
+}
+
+
+bool RoutingTree::IsMatch(const std::vector<std::string>& patterns,
+                          const std::string& value)
+{
+  for (size_t i = 0; i < patterns.size(); i++)
+  {
+    if (MatchWildcard(patterns[i], value))
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+bool RoutingTree::IsResidualMatch(size_t rule,
+                                  const Values& values) const
+{
+  const std::vector<ResidualCondition>& residual = compiled_[rule].residual_;
+
+  for (size_t i = 0; i < residual.size(); i++)
+  {
+    if (!IsMatch(residual[i].values_, values[residual[i].tagIndex_]))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+const Orthanc::DicomTag& RoutingTree::GetTag(size_t index) const
+{
+  if (index >= tags_.size())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+  else
+  {
+    return tags_[index];
+  }
+}
+
+
+const std::string& RoutingTree::GetAccount(size_t index) const
+{
+  if (index >= accounts_.size())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+  else
+  {
+    return accounts_[index];
+  }
+}
+
+
+bool RoutingTree::ExtractValues(Values& values,
+                                std::string& sopInstanceUid,
+                                const void* dicom,
+                                size_t size) const
+{
+  values.clear();
+  values.resize(tags_.size());
+  sopInstanceUid.clear();
+
+  try
+  {
+    MemoryBuffer buffer(dicom, size);
+    std::istream stream(&buffer);
+
+    Extractor extractor(tags_, values, sopInstanceUid);
+    Orthanc::DicomStreamReader reader(stream);
+    reader.Consume(extractor);
+    return true;
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    return false;
+  }
+}
+
+
+void RoutingTree::Evaluate(std::vector<size_t>& accounts,
+                           const Values& values) const
+{
+  if (values.size() != tags_.size())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  const Node* node = root_;
+
+  while (!node->leaf_)
+  {
+    std::unordered_map<std::string, const Node*>::const_iterator
+      child = node->children_.find(values[node->tagIndex_]);
+
+    node = (child == node->children_.end() ? node->otherwise_ : child->second);
+  }
+
+  accounts = node->accounts_;
+
+  if (!node->residual_.empty())
+  {
+    for (size_t i = 0; i < node->residual_.size(); i++)
+    {
+      if (IsResidualMatch(node->residual_[i], values))
+      {
+        accounts.push_back(compiled_[node->residual_[i]].account_);
+      }
+    }
+
+    std::sort(accounts.begin(), accounts.end());
+    accounts.erase(std::unique(accounts.begin(), accounts.end()), accounts.end());
+  }
+}
+
+
+void RoutingTree::EvaluateLinear(std::vector<size_t>& accounts,
+                                 const Values& values) const
+{
+  if (values.size() != tags_.size())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  accounts.clear();
+
+  for (size_t i = 0; i < compiled_.size(); i++)
+  {
+    bool match = true;
+
+    for (std::map<size_t, std::vector<std::string> >::const_iterator
+           it = compiled_[i].indexed_.begin(); it != compiled_[i].indexed_.end() && match; ++it)
+    {
+      match = std::binary_search(it->second.begin(), it->second.end(), values[it->first]);
+    }
+
+    if (match &&
+        IsResidualMatch(i, values))
+    {
+      accounts.push_back(compiled_[i].account_);
+    }
+  }
+
+  std::sort(accounts.begin(), accounts.end());
+  accounts.erase(std::unique(accounts.begin(), accounts.end()), accounts.end());
+}
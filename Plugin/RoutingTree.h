@@ -0,0 +1,190 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <DicomFormat/DicomTag.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+
+/**
+ * Rule set that routes the DICOM instances to DICOM stores of Google,
+ * depending on the value of some of their tags (e.g. modality,
+ * institution or private tags). A rule matches an instance if all of
+ * its conditions match: A condition lists the accepted values of one
+ * tag, possibly with the "*" and "?" wildcards. An instance is routed
+ * to the accounts of all the rules it matches.
+ *
+ * The rules are compiled once into a decision tree: Each level of the
+ * tree switches on the value of one tag, through a hash table indexed
+ * by the exact values that are accepted by the rules, and the leaves
+ * list the accounts of the matching rules. The tags that are tested
+ * by the most rules come first. The conditions with wildcards cannot
+ * be indexed, and are checked in the leaves. The evaluation of one
+ * instance is thus independent of the number of rules, except for the
+ * wildcards. The identical subtrees are shared.
+ *
+ * The values are extracted by one single pass over the DICOM file,
+ * that stops after the last tag that is used by the rules. Only the
+ * tags at the root of the dataset (and the tags of the meta header,
+ * e.g. "SourceApplicationEntityTitle") are available, and their
+ * values are compared as a whole, after the removal of the padding.
+ * The private tags are designated by their number, independently of
+ * their private creator.
+ **/
+class RoutingTree : public boost::noncopyable
+{
+public:
+  struct Condition
+  {
+    Orthanc::DicomTag         tag_;
+    std::vector<std::string>  values_;   // Accepted values, possibly with wildcards
+
+    explicit Condition(const Orthanc::DicomTag& tag) :
+      tag_(tag)
+    {
+    }
+  };
+
+  struct Rule
+  {
+    std::string             account_;
+    std::vector<Condition>  conditions_;   // The rule matches all the instances if empty
+  };
+
+  // Values of the tags used by the rules, indexed as in "GetTagsCount()"
+  typedef std::vector<std::string>  Values;
+
+private:
+  struct Node;
+
+  struct ResidualCondition
+  {
+    size_t                    tagIndex_;
+    std::vector<std::string>  values_;
+  };
+
+  struct CompiledRule
+  {
+    size_t                                        account_;
+    std::map<size_t, std::vector<std::string> >   indexed_;    // Tag index => exact values
+    std::vector<ResidualCondition>                residual_;   // Conditions with wildcards
+  };
+
+  class Compiler;
+  class Extractor;
+
+  std::vector<Rule>                rules_;
+  std::vector<std::string>         accounts_;
+  std::vector<Orthanc::DicomTag>   tags_;       // Sorted, as in the DICOM files
+  std::vector<CompiledRule>        compiled_;
+  std::vector<Node*>               nodes_;      // Owned
+  const Node*                      root_;
+  size_t                           depth_;
+
+  void Clear();
+
+  static bool IsMatch(const std::vector<std::string>& patterns,
+                      const std::string& value);
+
+  bool IsResidualMatch(size_t rule,
+                       const Values& values) const;
+
+public:
+  // Throws "ErrorCode_ParameterOutOfRange" if the rule set is too
+  // large to be compiled (the number of nodes is bounded)
+  explicit RoutingTree(const std::vector<Rule>& rules);
+
+  ~RoutingTree();
+
+  // Parses a tag given either as "gggg,eeee", or as the keyword of
+  // one of the usual routing tags (e.g. "Modality", "InstitutionName")
+  static Orthanc::DicomTag ParseTag(const std::string& tag);
+
+  static std::string FormatTag(const Orthanc::DicomTag& tag);
+
+  // Glob matching, with the "*" and "?" wildcards
+  static bool MatchWildcard(const std::string& pattern,
+                            const std::string& value);
+
+  size_t GetRulesCount() const
+  {
+    return rules_.size();
+  }
+
+  size_t GetTagsCount() const
+  {
+    return tags_.size();
+  }
+
+  const Orthanc::DicomTag& GetTag(size_t index) const;
+
+  size_t GetAccountsCount() const
+  {
+    return accounts_.size();
+  }
+
+  const std::string& GetAccount(size_t index) const;
+
+  size_t GetNodesCount() const
+  {
+    return nodes_.size();
+  }
+
+  size_t GetDepth() const
+  {
+    return depth_;
+  }
+
+  // Single pass over the DICOM file. "sopInstanceUid" is extracted
+  // together with the values. Returns "false" if the file cannot be
+  // parsed.
+  bool ExtractValues(Values& values,
+                     std::string& sopInstanceUid,
+                     const void* dicom,
+                     size_t size) const;
+
+  // Indexes of the accounts of the matching rules, sorted and unique
+  void Evaluate(std::vector<size_t>& accounts,
+                const Values& values) const;
+
+  // Reference evaluation that checks all the rules one by one,
+  // without the tree (for the benchmarks)
+  void EvaluateLinear(std::vector<size_t>& accounts,
+                      const Values& values) const;
+};
@@ -0,0 +1,181 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ScopedTokenCache.h"
+
+#include "CurlBuilder.h"
+#include "GoogleConfiguration.h"
+
+#include <Logging.h>
+
+
+ScopedTokenCache::ScopedTokenCache(unsigned int idleSeconds) :
+  idleSeconds_(idleSeconds),
+  lastEviction_(boost::posix_time::microsec_clock::universal_time()),
+  hits_(0),
+  misses_(0),
+  evictions_(0)
+{
+}
+
+
+void ScopedTokenCache::EvictIdleEntries(const boost::posix_time::ptime& now)
+{
+  // Sweep at most twice per idle period, to keep lookups cheap
+  if (now - lastEviction_ < boost::posix_time::seconds(idleSeconds_ / 2))
+  {
+    return;
+  }
+
+  lastEviction_ = now;
+
+  for (Entries::iterator it = entries_.begin(); it != entries_.end(); )
+  {
+    if (now - it->second->lastUse_ >= boost::posix_time::seconds(idleSeconds_))
+    {
+      LOG(INFO) << "Evicting unused scoped token: " << it->first;
+      entries_.erase(it++);
+      evictions_++;
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+
+std::string ScopedTokenCache::FormatKey(const GoogleAccount& account,
+                                        const std::set<std::string>& scopes)
+{
+  // "std::set" is sorted, so that the order of the scopes doesn't matter
+  std::string key = account.GetName() + "|";
+
+  for (std::set<std::string>::const_iterator it = scopes.begin(); it != scopes.end(); ++it)
+  {
+    if (it != scopes.begin())
+    {
+      key += " ";
+    }
+
+    key += *it;
+  }
+
+  return key;
+}
+
+
+bool ScopedTokenCache::GetToken(std::string& authorizationHeader,
+                                boost::posix_time::ptime& expiration,
+                                const GoogleAccount& account,
+                                const std::set<std::string>& scopes)
+{
+  const std::string key = FormatKey(account, scopes);
+  std::shared_ptr<Entry> entry;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    EvictIdleEntries(now);
+
+    Entries::iterator found = entries_.find(key);
+    if (found == entries_.end())
+    {
+      entry = std::make_shared<Entry>();
+      entry->credentials_ = account.CreateCredentials(scopes);
+      entries_[key] = entry;
+      misses_++;
+    }
+    else
+    {
+      entry = found->second;
+      hits_++;
+    }
+
+    entry->lastUse_ = now;
+  }
+
+  // Outside of the mutex of the cache, as this might issue a token request
+  CurlBuilder::ResetLastResponse();
+
+  google::cloud::StatusOr<std::string> token = entry->credentials_->AuthorizationHeader();
+  if (!token)
+  {
+    LOG(WARNING) << "Cannot generate Google Cloud Platform token for account \""
+                 << account.GetName() << "\" with scopes: " << key.substr(account.GetName().size() + 1);
+    return false;
+  }
+
+  unsigned int expiresIn = 0;
+  const bool refreshed = CurlBuilder::LookupLastExpiresIn(expiresIn);
+
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (refreshed)
+  {
+    entry->expiration_ = (boost::posix_time::microsec_clock::universal_time() +
+                          boost::posix_time::seconds(expiresIn));
+  }
+
+  authorizationHeader = *token;
+  expiration = entry->expiration_;
+  return true;
+}
+
+
+void ScopedTokenCache::Format(Json::Value& target)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  target = Json::objectValue;
+  target["IdleTimeout"] = idleSeconds_;
+  target["Hits"] = static_cast<Json::UInt64>(hits_);
+  target["Misses"] = static_cast<Json::UInt64>(misses_);
+  target["Evictions"] = static_cast<Json::UInt64>(evictions_);
+
+  Json::Value entries = Json::arrayValue;
+  for (Entries::const_iterator it = entries_.begin(); it != entries_.end(); ++it)
+  {
+    entries.append(it->first);
+  }
+
+  target["Entries"] = entries;
+}
+
+
+ScopedTokenCache& ScopedTokenCache::GetInstance()
+{
+  static ScopedTokenCache cache(GoogleConfiguration::GetInstance().GetScopedTokensIdleTimeoutSeconds());
+  return cache;
+}
@@ -0,0 +1,93 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "GoogleAccount.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <set>
+
+
+/**
+ * Cache of the tokens of the accounts, for sets of OAuth 2.0 scopes
+ * that differ from the default "cloud-platform" scope (e.g. Cloud
+ * Storage, or read-only downscoped tokens). Tokens are requested on
+ * demand, from the thread of the caller: No refresh thread is
+ * created. The entries that have not been used for a while are
+ * evicted during the next lookups.
+ **/
+class ScopedTokenCache : public boost::noncopyable
+{
+private:
+  struct Entry
+  {
+    // The credentials of google-cloud-cpp are thread-safe, cache
+    // the token and refresh it once it expires: Concurrent callers
+    // share the same refresh ("single flight")
+    std::shared_ptr<google::cloud::storage::oauth2::Credentials>  credentials_;
+    boost::posix_time::ptime  lastUse_;
+    boost::posix_time::ptime  expiration_;   // Protected by the mutex of the cache
+  };
+
+  typedef std::map<std::string, std::shared_ptr<Entry> >  Entries;
+
+  boost::mutex              mutex_;
+  Entries                   entries_;
+  unsigned int              idleSeconds_;
+  boost::posix_time::ptime  lastEviction_;
+  uint64_t                  hits_;
+  uint64_t                  misses_;
+  uint64_t                  evictions_;
+
+  void EvictIdleEntries(const boost::posix_time::ptime& now);
+
+public:
+  explicit ScopedTokenCache(unsigned int idleSeconds);
+
+  static std::string FormatKey(const GoogleAccount& account,
+                               const std::set<std::string>& scopes);
+
+  // "expiration" is "not_a_date_time" if the lifetime of the token is unknown
+  bool GetToken(std::string& authorizationHeader,
+                boost::posix_time::ptime& expiration,
+                const GoogleAccount& account,
+                const std::set<std::string>& scopes);
+
+  void Format(Json::Value& target);
+
+  static ScopedTokenCache& GetInstance();
+};
@@ -0,0 +1,247 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "SortedUidRuns.h"
+
+#include <OrthancException.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <memory>
+
+
+namespace SortedUidRuns
+{
+  static std::string GetRunPath(const std::string& directory,
+                                const std::string& name,
+                                unsigned int index)
+  {
+    return (boost::filesystem::path(directory) /
+            (name + "-" + boost::lexical_cast<std::string>(index) + ".run")).string();
+  }
+
+
+  Writer::Writer(const std::string& directory,
+                 const std::string& name,
+                 size_t runSize,
+                 unsigned int runsCount) :
+    directory_(directory),
+    name_(name),
+    runSize_(std::max(static_cast<size_t>(1), runSize)),
+    runsCount_(runsCount)
+  {
+  }
+
+
+  void Writer::Add(const std::string& uid,
+                   const std::string& payload)
+  {
+    if (uid.empty() ||
+        uid.find_first_of("\t\n") != std::string::npos ||
+        payload.find_first_of("\t\n") != std::string::npos)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Bad UID for an external sort: " + uid);
+    }
+
+    // The tabulation sorts before all the characters of the UIDs,
+    // so that sorting the lines sorts the UIDs
+    buffer_.push_back(uid + '\t' + payload);
+  }
+
+
+  void Writer::Flush()
+  {
+    if (buffer_.empty())
+    {
+      return;
+    }
+
+    std::sort(buffer_.begin(), buffer_.end());
+
+    boost::filesystem::create_directories(directory_);
+
+    const std::string path = GetRunPath(directory_, name_, runsCount_);
+
+    {
+      std::ofstream f(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+
+      for (size_t i = 0; i < buffer_.size() && f.good(); i++)
+      {
+        f << buffer_[i] << '\n';
+      }
+
+      f.flush();
+
+      if (!f.good())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                        "Cannot write the sorted run: " + path);
+      }
+    }
+
+    buffer_.clear();
+    runsCount_++;
+  }
+
+
+  void Writer::Discard()
+  {
+    buffer_.clear();
+  }
+
+
+  void Reader::Push(size_t run)
+  {
+    assert(run < runs_.size());
+
+    std::string line;
+    if (std::getline(*runs_[run], line))
+    {
+      heads_.push(std::make_pair(line, run));
+    }
+  }
+
+
+  Reader::Reader(const std::string& directory,
+                 const std::string& name,
+                 unsigned int runsCount)
+  {
+    runs_.reserve(runsCount);
+
+    for (unsigned int i = 0; i < runsCount; i++)
+    {
+      const std::string path = GetRunPath(directory, name, i);
+
+      std::unique_ptr<std::ifstream> f(new std::ifstream(path.c_str(), std::ios::in | std::ios::binary));
+      if (!f->is_open())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile,
+                                        "Missing sorted run: " + path);
+      }
+
+      runs_.push_back(f.release());
+      Push(runs_.size() - 1);
+    }
+  }
+
+
+  Reader::~Reader()
+  {
+    for (size_t i = 0; i < runs_.size(); i++)
+    {
+      delete runs_[i];
+    }
+  }
+
+
+  bool Reader::Next(std::string& uid,
+                    std::string& payload)
+  {
+    while (!heads_.empty())
+    {
+      const Head head = heads_.top();
+      heads_.pop();
+      Push(head.second);
+
+      const size_t tab = head.first.find('\t');
+      if (tab == std::string::npos)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile,
+                                        "Corrupted sorted run");
+      }
+
+      if (head.first.compare(0, tab, lastUid_) != 0)  // Skip the duplicates
+      {
+        uid.assign(head.first, 0, tab);
+        payload.assign(head.first, tab + 1, std::string::npos);
+        lastUid_ = uid;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  uint64_t ComputeDifferences(IDifferenceVisitor& visitor,
+                              Reader& left,
+                              Reader& right)
+  {
+    std::string leftUid, leftPayload, rightUid, rightPayload;
+
+    bool hasLeft = left.Next(leftUid, leftPayload);
+    bool hasRight = right.Next(rightUid, rightPayload);
+
+    uint64_t common = 0;
+
+    while (hasLeft || hasRight)
+    {
+      if (hasLeft &&
+          (!hasRight || leftUid < rightUid))
+      {
+        visitor.VisitLeftOnly(leftUid, leftPayload);
+        hasLeft = left.Next(leftUid, leftPayload);
+      }
+      else if (hasRight &&
+               (!hasLeft || rightUid < leftUid))
+      {
+        visitor.VisitRightOnly(rightUid, rightPayload);
+        hasRight = right.Next(rightUid, rightPayload);
+      }
+      else
+      {
+        common++;
+        hasLeft = left.Next(leftUid, leftPayload);
+        hasRight = right.Next(rightUid, rightPayload);
+      }
+    }
+
+    return common;
+  }
+
+
+  void RemoveRuns(const std::string& directory,
+                  const std::string& name,
+                  unsigned int runsCount)
+  {
+    for (unsigned int i = 0; i < runsCount; i++)
+    {
+      boost::system::error_code error;
+      boost::filesystem::remove(GetRunPath(directory, name, i), error);
+    }
+  }
+}
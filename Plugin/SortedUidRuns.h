@@ -0,0 +1,143 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+
+#include <fstream>
+#include <queue>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * External sort of large sets of UIDs, used to compare the content of
+ * Orthanc with a DICOM store of Google without keeping the lists in
+ * memory. Each UID comes with an opaque payload (e.g. the Orthanc
+ * identifier of the instance). The entries are buffered up to the
+ * size of one run, then sorted and written to "{directory}/{name}-{index}.run".
+ * The reader merges the runs, keeping one line per run in memory,
+ * and the two sides are compared by a merge join.
+ **/
+namespace SortedUidRuns
+{
+  class Writer : public boost::noncopyable
+  {
+  private:
+    std::string               directory_;
+    std::string               name_;
+    size_t                    runSize_;
+    unsigned int              runsCount_;
+    std::vector<std::string>  buffer_;
+
+  public:
+    // "runsCount" is the number of runs that are already written, if
+    // resuming from a checkpoint
+    Writer(const std::string& directory,
+           const std::string& name,
+           size_t runSize,
+           unsigned int runsCount);
+
+    // Neither the UID nor the payload can contain tabulations or newlines
+    void Add(const std::string& uid,
+             const std::string& payload);
+
+    bool IsFull() const
+    {
+      return buffer_.size() >= runSize_;
+    }
+
+    // Writes the buffered entries as a new run, if any
+    void Flush();
+
+    // Drops the buffered entries, when resuming from a checkpoint
+    void Discard();
+
+    unsigned int GetRunsCount() const
+    {
+      return runsCount_;
+    }
+  };
+
+
+  class Reader : public boost::noncopyable
+  {
+  private:
+    typedef std::pair<std::string, size_t>  Head;   // Line, index of the run
+
+    std::vector<std::ifstream*>  runs_;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head> >  heads_;
+    std::string                  lastUid_;
+
+    void Push(size_t run);
+
+  public:
+    Reader(const std::string& directory,
+           const std::string& name,
+           unsigned int runsCount);
+
+    ~Reader();
+
+    // Returns the entries in increasing order of their UIDs, each UID
+    // only once. Returns "false" once all the runs are consumed.
+    bool Next(std::string& uid,
+              std::string& payload);
+  };
+
+
+  class IDifferenceVisitor : public boost::noncopyable
+  {
+  public:
+    virtual ~IDifferenceVisitor()
+    {
+    }
+
+    virtual void VisitLeftOnly(const std::string& uid,
+                               const std::string& payload) = 0;
+
+    virtual void VisitRightOnly(const std::string& uid,
+                                const std::string& payload) = 0;
+  };
+
+
+  // Merge join of two sorted sets. Returns the number of common UIDs.
+  uint64_t ComputeDifferences(IDifferenceVisitor& visitor,
+                              Reader& left,
+                              Reader& right);
+
+  void RemoveRuns(const std::string& directory,
+                  const std::string& name,
+                  unsigned int runsCount);
+}
@@ -0,0 +1,296 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StorageStaging.h"
+
+#include "GoogleConfiguration.h"
+#include "TransferStreams.h"
+
+#include <Logging.h>
+
+#include <iterator>
+
+
+static google::cloud::storage::ClientOptions CreateClientOptions(const GoogleAccount& account,
+                                                                 unsigned int streamsCount)
+{
+  google::cloud::storage::ClientOptions options(account.CreateCredentials());
+  options.set_connection_pool_size(std::max(1u, streamsCount));
+
+  const std::string& url = GoogleConfiguration::GetInstance().GetStorageUrl();
+  if (!url.empty())
+  {
+    options.set_endpoint(url);
+  }
+
+  return options;
+}
+
+
+StorageStaging::StorageStaging(const GoogleAccount& account,
+                               const std::string& bucket,
+                               unsigned int streamsCount) :
+  bucket_(bucket),
+  client_(CreateClientOptions(account, streamsCount))
+{
+  if (bucket.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "No Google Cloud Storage bucket was provided");
+  }
+}
+
+
+std::string StorageStaging::NormalizePrefix(const std::string& prefix)
+{
+  if (prefix.empty() ||
+      prefix[prefix.size() - 1] == '/')
+  {
+    return prefix;
+  }
+  else
+  {
+    return prefix + '/';
+  }
+}
+
+
+std::string StorageStaging::GetObjectName(const std::string& prefix,
+                                          const std::string& instanceId)
+{
+  return NormalizePrefix(prefix) + instanceId + ".dcm";
+}
+
+
+std::string StorageStaging::GetSourceUri(const std::string& prefix) const
+{
+  return "gs://" + bucket_ + "/" + NormalizePrefix(prefix) + "**.dcm";
+}
+
+
+void StorageStaging::Upload(const std::string& objectName,
+                            const std::string& content)
+{
+  google::cloud::StatusOr<google::cloud::storage::ObjectMetadata> metadata =
+    client_.InsertObject(bucket_, objectName, content,
+                         google::cloud::storage::ContentType("application/dicom"));
+
+  if (!metadata)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "Cannot upload gs://" + bucket_ + "/" + objectName + ": " +
+                                    metadata.status().message());
+  }
+}
+
+
+void StorageStaging::Download(std::string& content,
+                              const std::string& objectName)
+{
+  google::cloud::storage::ObjectReadStream stream = client_.ReadObject(bucket_, objectName);
+
+  content.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+
+  if (!stream.status().ok())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "Cannot download gs://" + bucket_ + "/" + objectName + ": " +
+                                    stream.status().message());
+  }
+}
+
+
+void StorageStaging::Delete(const std::string& objectName)
+{
+  const google::cloud::Status status = client_.DeleteObject(bucket_, objectName);
+
+  if (!status.ok() &&
+      status.code() != google::cloud::StatusCode::kNotFound)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                    "Cannot delete gs://" + bucket_ + "/" + objectName + ": " +
+                                    status.message());
+  }
+}
+
+
+StorageStaging::ObjectLister::ObjectLister(StorageStaging& staging,
+                                           const std::string& prefix,
+                                           const std::string& after) :
+  reader_(staging.client_.ListObjects(staging.bucket_, google::cloud::storage::Prefix(NormalizePrefix(prefix)))),
+  current_(reader_.begin()),
+  after_(after)
+{
+}
+
+
+bool StorageStaging::ObjectLister::Next(std::vector<std::string>& objectNames,
+                                        size_t maxCount)
+{
+  objectNames.clear();
+
+  while (objectNames.size() < maxCount &&
+         current_ != reader_.end())
+  {
+    const google::cloud::StatusOr<google::cloud::storage::ObjectMetadata>& metadata = *current_;
+
+    if (!metadata)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                      "Cannot list the objects of Google Cloud Storage: " +
+                                      metadata.status().message());
+    }
+
+    // Cloud Storage lists the objects in lexicographic order
+    if (metadata->name() > after_ &&
+        metadata->name().size() > 4 &&
+        metadata->name().compare(metadata->name().size() - 4, 4, ".dcm") == 0)
+    {
+      objectNames.push_back(metadata->name());
+      after_ = metadata->name();
+    }
+
+    ++current_;
+  }
+
+  return !objectNames.empty();
+}
+
+
+namespace
+{
+  class UploadStreams : public TransferStreams
+  {
+  private:
+    StorageStaging&                   staging_;
+    StorageStaging::IInstanceSource&  source_;
+    std::string                       prefix_;
+
+  protected:
+    uint64_t Transfer(const std::string& instanceId) override
+    {
+      std::string dicom;
+      source_.ReadInstance(dicom, instanceId);
+      staging_.Upload(StorageStaging::GetObjectName(prefix_, instanceId), dicom);
+      return dicom.size();
+    }
+
+  public:
+    UploadStreams(StorageStaging& staging,
+                  StorageStaging::IInstanceSource& source,
+                  const std::vector<std::string>& instances,
+                  const std::string& prefix) :
+      TransferStreams(instances),
+      staging_(staging),
+      source_(source),
+      prefix_(prefix)
+    {
+    }
+  };
+
+
+  class DownloadStreams : public TransferStreams
+  {
+  private:
+    StorageStaging&                   staging_;
+    StorageStaging::IInstanceTarget&  target_;
+
+  protected:
+    uint64_t Transfer(const std::string& objectName) override
+    {
+      std::string dicom;
+      staging_.Download(dicom, objectName);
+      target_.StoreInstance(dicom, objectName);
+      return dicom.size();
+    }
+
+  public:
+    DownloadStreams(StorageStaging& staging,
+                    StorageStaging::IInstanceTarget& target,
+                    const std::vector<std::string>& objectNames) :
+      TransferStreams(objectNames),
+      staging_(staging),
+      target_(target)
+    {
+    }
+  };
+
+
+  class DeleteStreams : public TransferStreams
+  {
+  private:
+    StorageStaging&  staging_;
+
+  protected:
+    uint64_t Transfer(const std::string& objectName) override
+    {
+      staging_.Delete(objectName);
+      return 0;
+    }
+
+  public:
+    DeleteStreams(StorageStaging& staging,
+                  const std::vector<std::string>& objectNames) :
+      TransferStreams(objectNames),
+      staging_(staging)
+    {
+    }
+  };
+}
+
+
+uint64_t StorageStaging::UploadInstances(IInstanceSource& source,
+                                         const std::vector<std::string>& instances,
+                                         const std::string& prefix,
+                                         unsigned int streamsCount)
+{
+  UploadStreams streams(*this, source, instances, prefix);
+  return streams.Run(streamsCount);
+}
+
+
+uint64_t StorageStaging::DownloadInstances(IInstanceTarget& target,
+                                           const std::vector<std::string>& objectNames,
+                                           unsigned int streamsCount)
+{
+  DownloadStreams streams(*this, target, objectNames);
+  return streams.Run(streamsCount);
+}
+
+
+void StorageStaging::DeleteObjects(const std::vector<std::string>& objectNames,
+                                   unsigned int streamsCount)
+{
+  DeleteStreams streams(*this, objectNames);
+  streams.Run(streamsCount);
+}
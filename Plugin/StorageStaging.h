@@ -0,0 +1,155 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "GoogleAccount.h"
+
+#include <google/cloud/storage/client.h>
+
+#include <stdint.h>
+
+
+/**
+ * Staging area of the bulk transfers in one bucket of Google Cloud
+ * Storage, accessed with the credentials of one account through the
+ * storage client of google-cloud-cpp. The client keeps a pool of
+ * connections that is shared by the concurrent streams, and is
+ * thread-safe.
+ **/
+class StorageStaging : public boost::noncopyable
+{
+public:
+  class IInstanceSource : public boost::noncopyable
+  {
+  public:
+    virtual ~IInstanceSource()
+    {
+    }
+
+    // Called concurrently by the upload streams
+    virtual void ReadInstance(std::string& dicom,
+                              const std::string& instanceId) = 0;
+  };
+
+  class IInstanceTarget : public boost::noncopyable
+  {
+  public:
+    virtual ~IInstanceTarget()
+    {
+    }
+
+    // Called concurrently by the download streams, as soon as each
+    // object is downloaded
+    virtual void StoreInstance(const std::string& dicom,
+                               const std::string& objectName) = 0;
+  };
+
+  /**
+   * Enumerates the DICOM files below one prefix, by batches, in the
+   * lexicographic order of their names. Only the current page of the
+   * listing is kept in memory. The objects up to "after" (that is
+   * the last object of the previous batch) are skipped.
+   **/
+  class ObjectLister : public boost::noncopyable
+  {
+  private:
+    google::cloud::storage::ListObjectsReader    reader_;
+    google::cloud::storage::ListObjectsIterator  current_;
+    std::string                                  after_;
+
+  public:
+    ObjectLister(StorageStaging& staging,
+                 const std::string& prefix,
+                 const std::string& after);
+
+    // Returns "false" once all the objects have been listed
+    bool Next(std::vector<std::string>& objectNames,
+              size_t maxCount);
+  };
+
+private:
+  std::string                      bucket_;
+  google::cloud::storage::Client   client_;
+
+public:
+  StorageStaging(const GoogleAccount& account,
+                 const std::string& bucket,
+                 unsigned int streamsCount);
+
+  const std::string& GetBucket() const
+  {
+    return bucket_;
+  }
+
+  // "prefix" is normalized with a trailing slash, unless empty
+  static std::string NormalizePrefix(const std::string& prefix);
+
+  static std::string GetObjectName(const std::string& prefix,
+                                   const std::string& instanceId);
+
+  // "gs://" URI matching all the DICOM files below the prefix
+  std::string GetSourceUri(const std::string& prefix) const;
+
+  void Upload(const std::string& objectName,
+              const std::string& content);
+
+  // Uploads the given instances using "streamsCount" concurrent
+  // streams, and returns the number of uploaded bytes. Throws an
+  // exception once all the streams have stopped if any upload has
+  // failed. As objects are overwritten, the uploads can be retried.
+  uint64_t UploadInstances(IInstanceSource& source,
+                           const std::vector<std::string>& instances,
+                           const std::string& prefix,
+                           unsigned int streamsCount);
+
+  void Download(std::string& content,
+                const std::string& objectName);
+
+  // Does nothing if the object does not exist
+  void Delete(const std::string& objectName);
+
+  // Downloads the given objects using "streamsCount" concurrent
+  // streams, each of them handing its objects to "target" one by one,
+  // which bounds the memory usage. Returns the number of downloaded
+  // bytes, or throws an exception once all the streams have stopped
+  // if any download has failed.
+  uint64_t DownloadInstances(IInstanceTarget& target,
+                             const std::vector<std::string>& objectNames,
+                             unsigned int streamsCount);
+
+  // Deletes the given objects using "streamsCount" concurrent streams.
+  // The objects that do not exist anymore are ignored.
+  void DeleteObjects(const std::vector<std::string>& objectNames,
+                     unsigned int streamsCount);
+};
@@ -0,0 +1,2226 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StoreMirror.h"
+
+#include "PluginToolbox.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <set>
+#include <string.h>
+
+
+const uint32_t StoreMirror::NONE;
+
+
+static const StoreMirror::Attribute STUDY_ATTRIBUTES[StoreMirror::STUDY_COLUMNS] = {
+  { 0x0020, 0x000d, "UI", "StudyInstanceUID" },
+  { 0x0010, 0x0010, "PN", "PatientName" },
+  { 0x0010, 0x0020, "LO", "PatientID" },
+  { 0x0010, 0x0030, "DA", "PatientBirthDate" },
+  { 0x0010, 0x0040, "CS", "PatientSex" },
+  { 0x0008, 0x0020, "DA", "StudyDate" },
+  { 0x0008, 0x0030, "TM", "StudyTime" },
+  { 0x0008, 0x0050, "SH", "AccessionNumber" },
+  { 0x0008, 0x0090, "PN", "ReferringPhysicianName" },
+  { 0x0020, 0x0010, "SH", "StudyID" },
+  { 0x0008, 0x1030, "LO", "StudyDescription" }
+};
+
+static const StoreMirror::Attribute SERIES_ATTRIBUTES[StoreMirror::SERIES_COLUMNS] = {
+  { 0x0020, 0x000e, "UI", "SeriesInstanceUID" },
+  { 0x0008, 0x0060, "CS", "Modality" },
+  { 0x0020, 0x0011, "IS", "SeriesNumber" },
+  { 0x0008, 0x103e, "LO", "SeriesDescription" }
+};
+
+static const StoreMirror::Attribute INSTANCE_ATTRIBUTES[StoreMirror::INSTANCE_COLUMNS] = {
+  { 0x0008, 0x0018, "UI", "SOPInstanceUID" },
+  { 0x0008, 0x0016, "UI", "SOPClassUID" },
+  { 0x0020, 0x0013, "IS", "InstanceNumber" }
+};
+
+// Computed attributes
+static const StoreMirror::Attribute MODALITIES_IN_STUDY = { 0x0008, 0x0061, "CS", "ModalitiesInStudy" };
+static const StoreMirror::Attribute STUDY_SERIES_COUNT = { 0x0020, 0x1206, "IS", "NumberOfStudyRelatedSeries" };
+static const StoreMirror::Attribute STUDY_INSTANCES_COUNT = { 0x0020, 0x1208, "IS", "NumberOfStudyRelatedInstances" };
+static const StoreMirror::Attribute SERIES_INSTANCES_COUNT = { 0x0020, 0x1209, "IS", "NumberOfSeriesRelatedInstances" };
+
+static const char SNAPSHOT_MAGIC[] = "GCPMIR01";
+static const size_t SNAPSHOT_MAGIC_SIZE = 8;
+
+
+static std::string FormatTag(const StoreMirror::Attribute& attribute)
+{
+  char buffer[16];
+  sprintf(buffer, "%04X%04X", attribute.group_, attribute.element_);
+  return buffer;
+}
+
+
+static size_t GetColumnsCount(StoreMirror::Level level)
+{
+  switch (level)
+  {
+    case StoreMirror::Level_Study:
+      return StoreMirror::STUDY_COLUMNS;
+
+    case StoreMirror::Level_Series:
+      return StoreMirror::SERIES_COLUMNS;
+
+    case StoreMirror::Level_Instance:
+      return StoreMirror::INSTANCE_COLUMNS;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+static uint64_t HashString(const std::string& value)
+{
+  // 64-bit FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < value.size(); i++)
+  {
+    hash ^= static_cast<uint8_t>(value[i]);
+    hash *= 1099511628211ull;
+  }
+
+  return hash;
+}
+
+
+static uint32_t ParseDate(const std::string& date)
+{
+  if (date.size() != 8)
+  {
+    return 0;
+  }
+
+  uint32_t value = 0;
+  for (size_t i = 0; i < 8; i++)
+  {
+    if (date[i] < '0' || date[i] > '9')
+    {
+      return 0;
+    }
+
+    value = value * 10 + static_cast<uint32_t>(date[i] - '0');
+  }
+
+  return value;
+}
+
+
+template <typename T>
+static void WriteVector(std::ostream& stream,
+                        const std::vector<T>& values)
+{
+  const uint64_t size = values.size();
+  stream.write(reinterpret_cast<const char*>(&size), sizeof(size));
+
+  if (!values.empty())
+  {
+    stream.write(reinterpret_cast<const char*>(&values[0]), values.size() * sizeof(T));
+  }
+}
+
+
+template <typename T>
+static void ReadVector(std::istream& stream,
+                       std::vector<T>& values)
+{
+  uint64_t size = 0;
+  if (!stream.read(reinterpret_cast<char*>(&size), sizeof(size)) ||
+      size > (1ull << 32))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+  }
+
+  values.resize(static_cast<size_t>(size));
+
+  if (size > 0 &&
+      !stream.read(reinterpret_cast<char*>(&values[0]), values.size() * sizeof(T)))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+  }
+}
+
+
+template <typename T>
+static uint64_t GetVectorMemory(const std::vector<T>& values)
+{
+  return static_cast<uint64_t>(values.capacity()) * sizeof(T);
+}
+
+
+
+/**
+ * Append-only storage of the strings, in blocks of 1 MB, so that
+ * each string is referenced by a 32-bit offset (at most 4 GB). Each
+ * string is prefixed by its length, on 1 or 2 bytes. Offset 0 is the
+ * empty string.
+ **/
+class StoreMirror::StringArena : public boost::noncopyable
+{
+private:
+  static const unsigned int BLOCK_BITS = 20;
+  static const uint32_t     BLOCK_SIZE = (1u << BLOCK_BITS);
+  static const size_t       MAX_BLOCKS = 4096;
+  static const size_t       MAX_LENGTH = 0x7fff;
+
+  std::vector<char*>  blocks_;
+  uint32_t            used_;   // In the last block
+
+  void AddBlock()
+  {
+    if (blocks_.size() == MAX_BLOCKS)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                      "The metadata mirror is limited to 4 GB of strings");
+    }
+
+    blocks_.push_back(new char[BLOCK_SIZE]);
+    used_ = 0;
+  }
+
+  void Clear()
+  {
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+      delete[] blocks_[i];
+    }
+
+    blocks_.clear();
+  }
+
+public:
+  StringArena()
+  {
+    Reset();
+  }
+
+  ~StringArena()
+  {
+    Clear();
+  }
+
+  void Reset()
+  {
+    Clear();
+    AddBlock();
+    blocks_[0][0] = 0;
+    used_ = 1;
+  }
+
+  uint32_t Append(const std::string& value)
+  {
+    if (value.empty())
+    {
+      return 0;
+    }
+
+    const size_t length = std::min(value.size(), MAX_LENGTH);
+    const size_t header = (length < 0x80 ? 1 : 2);
+
+    if (used_ + header + length > BLOCK_SIZE)
+    {
+      AddBlock();
+    }
+
+    const uint32_t offset = (static_cast<uint32_t>(blocks_.size() - 1) << BLOCK_BITS) | used_;
+    char* target = blocks_.back() + used_;
+
+    if (header == 1)
+    {
+      target[0] = static_cast<char>(length);
+    }
+    else
+    {
+      target[0] = static_cast<char>(0x80 | (length >> 8));
+      target[1] = static_cast<char>(length & 0xff);
+    }
+
+    memcpy(target + header, value.c_str(), length);
+    used_ += static_cast<uint32_t>(header + length);
+
+    return offset;
+  }
+
+  void Get(const char*& data,
+           size_t& size,
+           uint32_t offset) const
+  {
+    const size_t block = (offset >> BLOCK_BITS);
+    if (block >= blocks_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(blocks_[block] + (offset & (BLOCK_SIZE - 1)));
+
+    if (source[0] & 0x80)
+    {
+      size = ((source[0] & 0x7f) << 8) | source[1];
+      data = reinterpret_cast<const char*>(source + 2);
+    }
+    else
+    {
+      size = source[0];
+      data = reinterpret_cast<const char*>(source + 1);
+    }
+  }
+
+  uint64_t GetMemoryUsage() const
+  {
+    return static_cast<uint64_t>(blocks_.size()) * BLOCK_SIZE;
+  }
+
+  void Save(std::ostream& stream) const
+  {
+    const uint64_t count = blocks_.size();
+    stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    stream.write(reinterpret_cast<const char*>(&used_), sizeof(used_));
+
+    for (size_t i = 0; i < blocks_.size(); i++)
+    {
+      stream.write(blocks_[i], (i + 1 == blocks_.size() ? used_ : BLOCK_SIZE));
+    }
+  }
+
+  void Load(std::istream& stream)
+  {
+    uint64_t count = 0;
+    uint32_t used = 0;
+    if (!stream.read(reinterpret_cast<char*>(&count), sizeof(count)) ||
+        !stream.read(reinterpret_cast<char*>(&used), sizeof(used)) ||
+        count == 0 ||
+        count > MAX_BLOCKS ||
+        used > BLOCK_SIZE)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+    }
+
+    Clear();
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+      AddBlock();
+      used_ = (i + 1 == count ? used : BLOCK_SIZE);
+
+      if (!stream.read(blocks_.back(), used_))
+      {
+        Reset();
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+      }
+    }
+  }
+};
+
+
+/**
+ * Interned strings with a low cardinality (modalities, SOP classes).
+ **/
+class StoreMirror::Dictionary : public boost::noncopyable
+{
+private:
+  std::vector<std::string>         values_;
+  std::map<std::string, uint32_t>  ids_;
+
+public:
+  Dictionary()
+  {
+    Reset();
+  }
+
+  void Reset()
+  {
+    values_.clear();
+    ids_.clear();
+    values_.push_back("");
+    ids_[""] = 0;
+  }
+
+  uint32_t Intern(const std::string& value)
+  {
+    std::map<std::string, uint32_t>::const_iterator found = ids_.find(value);
+    if (found == ids_.end())
+    {
+      const uint32_t id = static_cast<uint32_t>(values_.size());
+      values_.push_back(value);
+      ids_[value] = id;
+      return id;
+    }
+    else
+    {
+      return found->second;
+    }
+  }
+
+  const std::string& Get(uint32_t id) const
+  {
+    if (id >= values_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+    else
+    {
+      return values_[id];
+    }
+  }
+
+  uint64_t GetMemoryUsage() const
+  {
+    // Rough estimate, including the nodes of the map
+    uint64_t size = 0;
+    for (size_t i = 0; i < values_.size(); i++)
+    {
+      size += 2 * (sizeof(std::string) + values_[i].size()) + 32;
+    }
+
+    return size;
+  }
+
+  void Save(std::ostream& stream) const
+  {
+    const uint64_t count = values_.size();
+    stream.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+    for (size_t i = 0; i < values_.size(); i++)
+    {
+      const uint32_t length = static_cast<uint32_t>(values_[i].size());
+      stream.write(reinterpret_cast<const char*>(&length), sizeof(length));
+      stream.write(values_[i].c_str(), length);
+    }
+  }
+
+  void Load(std::istream& stream)
+  {
+    uint64_t count = 0;
+    if (!stream.read(reinterpret_cast<char*>(&count), sizeof(count)) ||
+        count == 0 ||
+        count > (1ull << 24))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+    }
+
+    values_.clear();
+    ids_.clear();
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+      uint32_t length = 0;
+      if (!stream.read(reinterpret_cast<char*>(&length), sizeof(length)) ||
+          length > 0xffff)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+      }
+
+      std::string value(length, '\0');
+      if (length > 0 &&
+          !stream.read(&value[0], length))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+      }
+
+      ids_[value] = static_cast<uint32_t>(values_.size());
+      values_.push_back(value);
+    }
+  }
+};
+
+
+/**
+ * Open-addressing hash table (linear probing) mapping the UIDs of one
+ * level to their row. The slots only contain "row + 1" (0 for empty
+ * slots): The UIDs are decoded from the columns to resolve collisions.
+ **/
+class StoreMirror::UidIndex : public boost::noncopyable
+{
+private:
+  const StoreMirror&     mirror_;
+  Level                  level_;
+  std::vector<uint32_t>  slots_;
+  size_t                 count_;
+
+  void Grow()
+  {
+    std::vector<uint32_t> old;
+    old.swap(slots_);
+    slots_.resize(old.size() * 2, 0);
+
+    const size_t mask = slots_.size() - 1;
+
+    for (size_t i = 0; i < old.size(); i++)
+    {
+      if (old[i] != 0)
+      {
+        size_t slot = HashString(mirror_.GetUid(level_, old[i] - 1)) & mask;
+        while (slots_[slot] != 0)
+        {
+          slot = (slot + 1) & mask;
+        }
+
+        slots_[slot] = old[i];
+      }
+    }
+  }
+
+public:
+  UidIndex(const StoreMirror& mirror,
+           Level level) :
+    mirror_(mirror),
+    level_(level),
+    slots_(1024, 0),
+    count_(0)
+  {
+  }
+
+  void Reset()
+  {
+    slots_.assign(1024, 0);
+    count_ = 0;
+  }
+
+  void Reserve(size_t count)
+  {
+    size_t size = 1024;
+    while (count * 10 > size * 7)
+    {
+      size *= 2;
+    }
+
+    if (size > slots_.size())
+    {
+      assert(count_ == 0);
+      slots_.assign(size, 0);
+    }
+  }
+
+  uint32_t Find(const std::string& uid) const
+  {
+    const size_t mask = slots_.size() - 1;
+
+    for (size_t slot = HashString(uid) & mask; slots_[slot] != 0; slot = (slot + 1) & mask)
+    {
+      if (mirror_.GetUid(level_, slots_[slot] - 1) == uid)
+      {
+        return slots_[slot] - 1;
+      }
+    }
+
+    return NONE;
+  }
+
+  // The UID must not be indexed yet
+  void Insert(const std::string& uid,
+              uint32_t row)
+  {
+    if ((count_ + 1) * 10 > slots_.size() * 7)   // Load factor of 70%
+    {
+      Grow();
+    }
+
+    const size_t mask = slots_.size() - 1;
+
+    size_t slot = HashString(uid) & mask;
+    while (slots_[slot] != 0)
+    {
+      slot = (slot + 1) & mask;
+    }
+
+    slots_[slot] = row + 1;
+    count_++;
+  }
+
+  uint64_t GetMemoryUsage() const
+  {
+    return GetVectorMemory(slots_);
+  }
+};
+
+
+/**
+ * Constraints of a QIDO-RS query on the columns of the three levels.
+ **/
+class StoreMirror::Matcher : public boost::noncopyable
+{
+public:
+  enum Type
+  {
+    Type_Exact,
+    Type_List,       // UID lists
+    Type_Wildcard,
+    Type_Range       // Dates and times
+  };
+
+  struct Constraint
+  {
+    Level                     level_;
+    size_t                    column_;
+    Type                      type_;
+    bool                      caseSensitive_;
+    std::vector<std::string>  values_;   // Lower and upper bounds for ranges
+  };
+
+private:
+  std::vector<Constraint>   constraints_;
+  std::set<std::string>     modalitiesInStudy_;
+
+  static bool LookupAttribute(Level& level,
+                              size_t& column,
+                              const std::string& key)
+  {
+    static const Level LEVELS[] = { Level_Study, Level_Series, Level_Instance };
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      for (size_t j = 0; j < GetColumnsCount(LEVELS[i]); j++)
+      {
+        const Attribute& attribute = GetAttribute(LEVELS[i], j);
+        if (key == attribute.keyword_ ||
+            boost::iequals(key, FormatTag(attribute)))
+        {
+          level = LEVELS[i];
+          column = j;
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  static bool IsKnownAttribute(const std::string& key)
+  {
+    Level level;
+    size_t column;
+    return (LookupAttribute(level, column, key) ||
+            key == MODALITIES_IN_STUDY.keyword_ || key == FormatTag(MODALITIES_IN_STUDY) ||
+            key == STUDY_SERIES_COUNT.keyword_ || key == FormatTag(STUDY_SERIES_COUNT) ||
+            key == STUDY_INSTANCES_COUNT.keyword_ || key == FormatTag(STUDY_INSTANCES_COUNT) ||
+            key == SERIES_INSTANCES_COUNT.keyword_ || key == FormatTag(SERIES_INSTANCES_COUNT));
+  }
+
+  static bool MatchConstraint(const Constraint& constraint,
+                              const std::string& value)
+  {
+    switch (constraint.type_)
+    {
+      case Type_Exact:
+        return (constraint.caseSensitive_ ?
+                value == constraint.values_[0] :
+                boost::iequals(value, constraint.values_[0]));
+
+      case Type_List:
+        return std::find(constraint.values_.begin(), constraint.values_.end(), value) != constraint.values_.end();
+
+      case Type_Wildcard:
+        if (constraint.caseSensitive_)
+        {
+          return PluginToolbox::MatchWildcard(constraint.values_[0], value);
+        }
+        else
+        {
+          // The pattern is already in lower case
+          std::string lower;
+          Orthanc::Toolbox::ToLowerCase(lower, value);
+          return PluginToolbox::MatchWildcard(constraint.values_[0], lower);
+        }
+
+      case Type_Range:
+        return (!value.empty() &&
+                (constraint.values_[0].empty() || value >= constraint.values_[0]) &&
+                (constraint.values_[1].empty() || value.substr(0, constraint.values_[1].size()) <= constraint.values_[1]));
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+public:
+  // Returns "false" if the query cannot be answered by the mirror
+  bool Parse(const Query& query)
+  {
+    for (std::map<std::string, std::string>::const_iterator it = query.filters_.begin();
+         it != query.filters_.end(); ++it)
+    {
+      const std::string& key = it->first;
+      const std::string& value = it->second;
+
+      if (key == "includefield")
+      {
+        std::vector<std::string> fields;
+        Orthanc::Toolbox::TokenizeString(fields, value, ',');
+
+        for (size_t i = 0; i < fields.size(); i++)
+        {
+          if (!IsKnownAttribute(Orthanc::Toolbox::StripSpaces(fields[i])))
+          {
+            return false;  // Including "all"
+          }
+        }
+
+        continue;
+      }
+      else if (key == "fuzzymatching")
+      {
+        if (value == "true")
+        {
+          return false;
+        }
+
+        continue;
+      }
+
+      if (key == MODALITIES_IN_STUDY.keyword_ ||
+          key == FormatTag(MODALITIES_IN_STUDY))
+      {
+        std::vector<std::string> modalities;
+        Orthanc::Toolbox::TokenizeString(modalities, value, ',');
+
+        for (size_t i = 0; i < modalities.size(); i++)
+        {
+          const std::string modality = Orthanc::Toolbox::StripSpaces(modalities[i]);
+          if (!modality.empty())
+          {
+            modalitiesInStudy_.insert(modality);
+          }
+        }
+
+        continue;
+      }
+
+      Constraint constraint;
+      if (!LookupAttribute(constraint.level_, constraint.column_, key) ||
+          constraint.level_ > query.level_)
+      {
+        return false;
+      }
+
+      if (value.empty())
+      {
+        continue;  // Universal matching
+      }
+
+      const Attribute& attribute = GetAttribute(constraint.level_, constraint.column_);
+      const std::string vr = attribute.vr_;
+
+      constraint.caseSensitive_ = (vr != "PN");
+
+      if (vr == "UI")
+      {
+        constraint.type_ = Type_List;
+
+        std::string s = value;
+        std::replace(s.begin(), s.end(), '\\', ',');
+        Orthanc::Toolbox::TokenizeString(constraint.values_, s, ',');
+      }
+      else if ((vr == "DA" || vr == "TM") &&
+               value.find('-') != std::string::npos)
+      {
+        const size_t dash = value.find('-');
+        constraint.type_ = Type_Range;
+        constraint.values_.push_back(value.substr(0, dash));
+        constraint.values_.push_back(value.substr(dash + 1));
+      }
+      else if (value.find('*') != std::string::npos ||
+               value.find('?') != std::string::npos)
+      {
+        constraint.type_ = Type_Wildcard;
+
+        if (constraint.caseSensitive_)
+        {
+          constraint.values_.push_back(value);
+        }
+        else
+        {
+          std::string lower;
+          Orthanc::Toolbox::ToLowerCase(lower, value);
+          constraint.values_.push_back(lower);
+        }
+      }
+      else
+      {
+        constraint.type_ = Type_Exact;
+        constraint.values_.push_back(value);
+      }
+
+      constraints_.push_back(constraint);
+    }
+
+    return true;
+  }
+
+  bool HasConstraints(Level level) const
+  {
+    if (level == Level_Study &&
+        !modalitiesInStudy_.empty())
+    {
+      return true;
+    }
+
+    for (size_t i = 0; i < constraints_.size(); i++)
+    {
+      if (constraints_[i].level_ == level)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  // Returns NULL if there is no constraint on this column
+  const Constraint* LookupConstraint(Level level,
+                                     size_t column) const
+  {
+    for (size_t i = 0; i < constraints_.size(); i++)
+    {
+      if (constraints_[i].level_ == level &&
+          constraints_[i].column_ == column)
+      {
+        return &constraints_[i];
+      }
+    }
+
+    return NULL;
+  }
+
+  bool Match(const StoreMirror& mirror,
+             Level level,
+             uint32_t row) const
+  {
+    for (size_t i = 0; i < constraints_.size(); i++)
+    {
+      if (constraints_[i].level_ == level &&
+          !MatchConstraint(constraints_[i], mirror.GetColumn(level, constraints_[i].column_, row)))
+      {
+        return false;
+      }
+    }
+
+    if (level == Level_Study &&
+        !modalitiesInStudy_.empty())
+    {
+      for (uint32_t series = mirror.studyFirstSeries_[row]; series != NONE; series = mirror.seriesNext_[series])
+      {
+        if (mirror.seriesInstancesCount_[series] > 0 &&
+            modalitiesInStudy_.find(mirror.GetColumn(Level_Series, SeriesColumn_Modality, series)) !=
+            modalitiesInStudy_.end())
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    return true;
+  }
+};
+
+
+namespace
+{
+  // Applies "offset" and "limit" while the matching rows are formatted
+  class ResultCollector : public boost::noncopyable
+  {
+  private:
+    Json::Value&  answer_;
+    size_t        toSkip_;
+    size_t        limit_;
+
+  public:
+    ResultCollector(Json::Value& answer,
+                    size_t offset,
+                    size_t limit) :
+      answer_(answer),
+      toSkip_(offset),
+      limit_(limit)
+    {
+      answer_ = Json::arrayValue;
+    }
+
+    bool IsFull() const
+    {
+      return (limit_ != 0 &&
+              answer_.size() >= limit_);
+    }
+
+    // Returns NULL if the row is skipped because of the offset
+    Json::Value* Add()
+    {
+      if (toSkip_ > 0)
+      {
+        toSkip_--;
+        return NULL;
+      }
+      else
+      {
+        return &answer_.append(Json::objectValue);
+      }
+    }
+  };
+}
+
+
+const StoreMirror::Attribute& StoreMirror::GetAttribute(Level level,
+                                                        size_t column)
+{
+  if (column >= GetColumnsCount(level))
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+
+  switch (level)
+  {
+    case Level_Study:
+      return STUDY_ATTRIBUTES[column];
+
+    case Level_Series:
+      return SERIES_ATTRIBUTES[column];
+
+    case Level_Instance:
+      return INSTANCE_ATTRIBUTES[column];
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+static std::string GetJsonString(const Json::Value& source,
+                                 const StoreMirror::Attribute& attribute)
+{
+  const std::string tag = FormatTag(attribute);
+
+  if (source.type() != Json::objectValue ||
+      !source.isMember(tag) ||
+      source[tag].type() != Json::objectValue ||
+      !source[tag].isMember("Value") ||
+      source[tag]["Value"].type() != Json::arrayValue ||
+      source[tag]["Value"].size() == 0)
+  {
+    return "";
+  }
+
+  const Json::Value& value = source[tag]["Value"][0];
+
+  switch (value.type())
+  {
+    case Json::stringValue:
+      return value.asString();
+
+    case Json::intValue:
+    case Json::uintValue:
+      return boost::lexical_cast<std::string>(value.asInt64());
+
+    case Json::realValue:
+      return boost::lexical_cast<std::string>(value.asDouble());
+
+    case Json::objectValue:
+      // Person names
+      return (value.isMember("Alphabetic") && value["Alphabetic"].type() == Json::stringValue ?
+              value["Alphabetic"].asString() : "");
+
+    default:
+      return "";
+  }
+}
+
+
+void StoreMirror::ParseStudy(StudyRecord& target,
+                             const Json::Value& source)
+{
+  for (size_t i = 0; i < STUDY_COLUMNS; i++)
+  {
+    target.study_[i] = GetJsonString(source, STUDY_ATTRIBUTES[i]);
+  }
+}
+
+
+void StoreMirror::ParseInstance(InstanceRecord& target,
+                                const Json::Value& source)
+{
+  for (size_t i = 0; i < SERIES_COLUMNS; i++)
+  {
+    target.series_[i] = GetJsonString(source, SERIES_ATTRIBUTES[i]);
+  }
+
+  for (size_t i = 0; i < INSTANCE_COLUMNS; i++)
+  {
+    target.instance_[i] = GetJsonString(source, INSTANCE_ATTRIBUTES[i]);
+  }
+}
+
+
+std::string StoreMirror::GetIncludeFields(Level level)
+{
+  std::string s;
+
+  if (level == Level_Study)
+  {
+    for (size_t i = 0; i < STUDY_COLUMNS; i++)
+    {
+      s += (s.empty() ? "" : ",") + FormatTag(STUDY_ATTRIBUTES[i]);
+    }
+
+    s += "," + FormatTag(STUDY_INSTANCES_COUNT);
+  }
+  else
+  {
+    for (size_t i = 0; i < SERIES_COLUMNS; i++)
+    {
+      s += (s.empty() ? "" : ",") + FormatTag(SERIES_ATTRIBUTES[i]);
+    }
+
+    for (size_t i = 0; i < INSTANCE_COLUMNS; i++)
+    {
+      s += "," + FormatTag(INSTANCE_ATTRIBUTES[i]);
+    }
+  }
+
+  return s;
+}
+
+
+std::string StoreMirror::GetString(uint32_t offset) const
+{
+  const char* data = NULL;
+  size_t size = 0;
+  arena_->Get(data, size, offset);
+  return std::string(data, size);
+}
+
+
+std::string StoreMirror::DecodeUid(uint32_t offset,
+                                   const std::string& parentUid) const
+{
+  const char* data = NULL;
+  size_t size = 0;
+  arena_->Get(data, size, offset);
+
+  if (size == 0)
+  {
+    return "";
+  }
+  else
+  {
+    // Front-coded against the UID of the parent
+    const size_t prefix = std::min(static_cast<size_t>(static_cast<uint8_t>(data[0])), parentUid.size());
+    return parentUid.substr(0, prefix) + std::string(data + 1, size - 1);
+  }
+}
+
+
+std::string StoreMirror::GetUid(Level level,
+                                uint32_t row) const
+{
+  switch (level)
+  {
+    case Level_Study:
+      return GetString(studyColumns_[StudyColumn_StudyInstanceUid][row]);
+
+    case Level_Series:
+      return DecodeUid(seriesColumns_[SeriesColumn_SeriesInstanceUid][row],
+                       GetUid(Level_Study, seriesStudy_[row]));
+
+    case Level_Instance:
+      return DecodeUid(instanceColumns_[InstanceColumn_SopInstanceUid][row],
+                       GetUid(Level_Series, instanceSeries_[row]));
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+std::string StoreMirror::GetColumn(Level level,
+                                   size_t column,
+                                   uint32_t row) const
+{
+  switch (level)
+  {
+    case Level_Study:
+      return GetString(studyColumns_[column][row]);
+
+    case Level_Series:
+      if (column == SeriesColumn_SeriesInstanceUid)
+      {
+        return GetUid(Level_Series, row);
+      }
+      else if (column == SeriesColumn_Modality)
+      {
+        return dictionary_->Get(seriesColumns_[column][row]);
+      }
+      else
+      {
+        return GetString(seriesColumns_[column][row]);
+      }
+
+    case Level_Instance:
+      if (column == InstanceColumn_SopInstanceUid)
+      {
+        return GetUid(Level_Instance, row);
+      }
+      else if (column == InstanceColumn_SopClassUid)
+      {
+        return dictionary_->Get(instanceColumns_[column][row]);
+      }
+      else
+      {
+        return GetString(instanceColumns_[column][row]);
+      }
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+uint32_t StoreMirror::EncodeUid(const std::string& uid,
+                                const std::string& parentUid)
+{
+  size_t prefix = 0;
+  while (prefix < uid.size() &&
+         prefix < parentUid.size() &&
+         prefix < 255 &&
+         uid[prefix] == parentUid[prefix])
+  {
+    prefix++;
+  }
+
+  return arena_->Append(std::string(1, static_cast<char>(prefix)) + uid.substr(prefix));
+}
+
+
+uint32_t StoreMirror::EncodeColumn(Level level,
+                                   size_t column,
+                                   const std::string& value,
+                                   const std::string& parentUid)
+{
+  if ((level == Level_Series && column == SeriesColumn_SeriesInstanceUid) ||
+      (level == Level_Instance && column == InstanceColumn_SopInstanceUid))
+  {
+    return EncodeUid(value, parentUid);
+  }
+  else if ((level == Level_Series && column == SeriesColumn_Modality) ||
+           (level == Level_Instance && column == InstanceColumn_SopClassUid))
+  {
+    return dictionary_->Intern(value);
+  }
+  else
+  {
+    return arena_->Append(value);
+  }
+}
+
+
+uint32_t StoreMirror::LookupStudy(const std::string& uid) const
+{
+  return studyIndex_->Find(uid);
+}
+
+
+uint32_t StoreMirror::LookupSeries(const std::string& uid) const
+{
+  return seriesIndex_->Find(uid);
+}
+
+
+uint32_t StoreMirror::LookupInstance(const std::string& uid) const
+{
+  return instanceIndex_->Find(uid);
+}
+
+
+uint32_t StoreMirror::GetOrCreateStudy(const StudyRecord& study)
+{
+  const std::string& uid = study.study_[StudyColumn_StudyInstanceUid];
+  if (uid.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Study without StudyInstanceUID");
+  }
+
+  uint32_t row = LookupStudy(uid);
+
+  if (row == NONE)
+  {
+    row = static_cast<uint32_t>(studyFirstSeries_.size());
+
+    for (size_t i = 0; i < STUDY_COLUMNS; i++)
+    {
+      studyColumns_[i].push_back(arena_->Append(study.study_[i]));
+    }
+
+    studyFirstSeries_.push_back(NONE);
+    studySeriesCount_.push_back(0);
+    studyInstancesCount_.push_back(0);
+    studyIndex_->Insert(uid, row);
+  }
+  else
+  {
+    // Only the modified attributes are appended to the arena
+    for (size_t i = 1; i < STUDY_COLUMNS; i++)
+    {
+      if (GetColumn(Level_Study, i, row) != study.study_[i])
+      {
+        studyColumns_[i][row] = arena_->Append(study.study_[i]);
+      }
+    }
+  }
+
+  dirty_ = true;
+  return row;
+}
+
+
+void StoreMirror::UnlinkInstance(uint32_t instance)
+{
+  assert(!instanceDeleted_[instance]);
+
+  const uint32_t series = instanceSeries_[instance];
+  const uint32_t study = seriesStudy_[series];
+
+  if (seriesFirstInstance_[series] == instance)
+  {
+    seriesFirstInstance_[series] = instanceNext_[instance];
+  }
+  else
+  {
+    for (uint32_t i = seriesFirstInstance_[series]; i != NONE; i = instanceNext_[i])
+    {
+      if (instanceNext_[i] == instance)
+      {
+        instanceNext_[i] = instanceNext_[instance];
+        break;
+      }
+    }
+  }
+
+  instanceNext_[instance] = NONE;
+  instanceDeleted_[instance] = 1;
+
+  seriesInstancesCount_[series]--;
+  studyInstancesCount_[study]--;
+  liveInstances_--;
+
+  if (seriesInstancesCount_[series] == 0)
+  {
+    studySeriesCount_[study]--;
+  }
+}
+
+
+void StoreMirror::AddInstanceInternal(uint32_t study,
+                                      const InstanceRecord& instance)
+{
+  const std::string& seriesUid = instance.series_[SeriesColumn_SeriesInstanceUid];
+  const std::string& sopUid = instance.instance_[InstanceColumn_SopInstanceUid];
+
+  if (seriesUid.empty() ||
+      sopUid.empty())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Instance without SeriesInstanceUID or SOPInstanceUID");
+  }
+
+  const std::string studyUid = GetUid(Level_Study, study);
+
+  uint32_t series = LookupSeries(seriesUid);
+
+  if (series == NONE)
+  {
+    series = static_cast<uint32_t>(seriesStudy_.size());
+
+    seriesStudy_.push_back(study);   // Before encoding, as the UID is front-coded against the study
+
+    for (size_t i = 0; i < SERIES_COLUMNS; i++)
+    {
+      seriesColumns_[i].push_back(EncodeColumn(Level_Series, i, instance.series_[i], studyUid));
+    }
+
+    seriesNext_.push_back(studyFirstSeries_[study]);
+    seriesFirstInstance_.push_back(NONE);
+    seriesInstancesCount_.push_back(0);
+    studyFirstSeries_[study] = series;
+    seriesIndex_->Insert(seriesUid, series);
+  }
+  else if (seriesStudy_[series] != study)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "Series " + seriesUid + " has moved to another study");
+  }
+  else
+  {
+    for (size_t i = 1; i < SERIES_COLUMNS; i++)
+    {
+      if (GetColumn(Level_Series, i, series) != instance.series_[i])
+      {
+        seriesColumns_[i][series] = EncodeColumn(Level_Series, i, instance.series_[i], studyUid);
+      }
+    }
+  }
+
+  uint32_t row = LookupInstance(sopUid);
+
+  if (row == NONE)
+  {
+    row = static_cast<uint32_t>(instanceSeries_.size());
+
+    instanceSeries_.push_back(series);
+
+    for (size_t i = 0; i < INSTANCE_COLUMNS; i++)
+    {
+      instanceColumns_[i].push_back(EncodeColumn(Level_Instance, i, instance.instance_[i], seriesUid));
+    }
+
+    instanceNext_.push_back(NONE);
+    instanceDeleted_.push_back(1);
+    instanceIndex_->Insert(sopUid, row);
+  }
+  else
+  {
+    if (!instanceDeleted_[row])
+    {
+      UnlinkInstance(row);
+    }
+
+    if (instanceSeries_[row] != series)
+    {
+      // Re-encode the UID against its new parent
+      instanceSeries_[row] = series;
+      instanceColumns_[InstanceColumn_SopInstanceUid][row] = EncodeUid(sopUid, seriesUid);
+    }
+
+    for (size_t i = 1; i < INSTANCE_COLUMNS; i++)
+    {
+      if (GetColumn(Level_Instance, i, row) != instance.instance_[i])
+      {
+        instanceColumns_[i][row] = EncodeColumn(Level_Instance, i, instance.instance_[i], seriesUid);
+      }
+    }
+  }
+
+  // Link the instance at the head of its series
+  instanceDeleted_[row] = 0;
+  instanceNext_[row] = seriesFirstInstance_[series];
+  seriesFirstInstance_[series] = row;
+
+  if (seriesInstancesCount_[series] == 0)
+  {
+    studySeriesCount_[study]++;
+  }
+
+  seriesInstancesCount_[series]++;
+  studyInstancesCount_[study]++;
+  liveInstances_++;
+}
+
+
+void StoreMirror::DetachInstances(uint32_t study)
+{
+  for (uint32_t series = studyFirstSeries_[study]; series != NONE; series = seriesNext_[series])
+  {
+    for (uint32_t instance = seriesFirstInstance_[series]; instance != NONE; )
+    {
+      const uint32_t next = instanceNext_[instance];
+      instanceDeleted_[instance] = 1;
+      instanceNext_[instance] = NONE;
+      instance = next;
+    }
+
+    liveInstances_ -= seriesInstancesCount_[series];
+    seriesFirstInstance_[series] = NONE;
+    seriesInstancesCount_[series] = 0;
+  }
+
+  studySeriesCount_[study] = 0;
+  studyInstancesCount_[study] = 0;
+}
+
+
+void StoreMirror::RebuildSecondaryIndexes()
+{
+  const size_t count = studyFirstSeries_.size();
+
+  patientIds_.clear();
+  accessionNumbers_.clear();
+  studyDates_.clear();
+
+  patientIds_.reserve(count);
+  accessionNumbers_.reserve(count);
+  studyDates_.reserve(count);
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    if (studyInstancesCount_[i] > 0)
+    {
+      patientIds_.push_back(std::make_pair(HashString(GetColumn(Level_Study, StudyColumn_PatientId, i)), i));
+      accessionNumbers_.push_back(std::make_pair(HashString(GetColumn(Level_Study, StudyColumn_AccessionNumber, i)), i));
+
+      const uint32_t date = ParseDate(GetColumn(Level_Study, StudyColumn_StudyDate, i));
+      if (date != 0)
+      {
+        studyDates_.push_back(std::make_pair(date, i));
+      }
+    }
+  }
+
+  std::sort(patientIds_.begin(), patientIds_.end());
+  std::sort(accessionNumbers_.begin(), accessionNumbers_.end());
+  std::sort(studyDates_.begin(), studyDates_.end());
+}
+
+
+StoreMirror::StoreMirror() :
+  arena_(new StringArena),
+  dictionary_(new Dictionary),
+  dirty_(false),
+  liveInstances_(0)
+{
+  studyIndex_.reset(new UidIndex(*this, Level_Study));
+  seriesIndex_.reset(new UidIndex(*this, Level_Series));
+  instanceIndex_.reset(new UidIndex(*this, Level_Instance));
+}
+
+
+StoreMirror::~StoreMirror()
+{
+}
+
+
+void StoreMirror::ReplaceStudy(const StudyRecord& study)
+{
+  boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+  const uint32_t row = GetOrCreateStudy(study);
+  DetachInstances(row);
+
+  for (size_t i = 0; i < study.instances_.size(); i++)
+  {
+    AddInstanceInternal(row, study.instances_[i]);
+  }
+}
+
+
+void StoreMirror::RemoveStudy(const std::string& studyInstanceUid)
+{
+  boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+  const uint32_t row = LookupStudy(studyInstanceUid);
+  if (row != NONE)
+  {
+    DetachInstances(row);
+    dirty_ = true;
+  }
+}
+
+
+void StoreMirror::AddInstance(const StudyRecord& study,
+                              const InstanceRecord& instance)
+{
+  boost::unique_lock<boost::shared_mutex> lock(mutex_);
+  AddInstanceInternal(GetOrCreateStudy(study), instance);
+}
+
+
+void StoreMirror::RemoveInstance(const std::string& sopInstanceUid)
+{
+  boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+  const uint32_t row = LookupInstance(sopInstanceUid);
+  if (row != NONE &&
+      !instanceDeleted_[row])
+  {
+    UnlinkInstance(row);
+    dirty_ = true;
+  }
+}
+
+
+void StoreMirror::Commit()
+{
+  boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+  if (dirty_)
+  {
+    RebuildSecondaryIndexes();
+    dirty_ = false;
+  }
+}
+
+
+static void FormatAttribute(Json::Value& target,
+                            const StoreMirror::Attribute& attribute,
+                            const std::string& value)
+{
+  Json::Value item = Json::objectValue;
+  item["vr"] = attribute.vr_;
+
+  if (!value.empty())
+  {
+    const std::string vr = attribute.vr_;
+    Json::Value values = Json::arrayValue;
+
+    if (vr == "PN")
+    {
+      Json::Value name = Json::objectValue;
+      name["Alphabetic"] = value;
+      values.append(name);
+    }
+    else if (vr == "IS")
+    {
+      try
+      {
+        values.append(boost::lexical_cast<int>(Orthanc::Toolbox::StripSpaces(value)));
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        values.append(value);
+      }
+    }
+    else
+    {
+      values.append(value);
+    }
+
+    item["Value"] = values;
+  }
+
+  target[FormatTag(attribute)] = item;
+}
+
+
+static void FormatCount(Json::Value& target,
+                        const StoreMirror::Attribute& attribute,
+                        uint32_t count)
+{
+  Json::Value item = Json::objectValue;
+  item["vr"] = attribute.vr_;
+  item["Value"] = Json::arrayValue;
+  item["Value"].append(count);
+  target[FormatTag(attribute)] = item;
+}
+
+
+void StoreMirror::FormatSeriesParent(Json::Value& target,
+                                     uint32_t series) const
+{
+  FormatAttribute(target, STUDY_ATTRIBUTES[StudyColumn_StudyInstanceUid], GetUid(Level_Study, seriesStudy_[series]));
+
+  for (size_t i = 0; i < SERIES_COLUMNS; i++)
+  {
+    FormatAttribute(target, SERIES_ATTRIBUTES[i], GetColumn(Level_Series, i, series));
+  }
+}
+
+
+void StoreMirror::FormatInstance(Json::Value& target,
+                                 const Json::Value& parent,
+                                 const std::string& seriesUid,
+                                 uint32_t instance) const
+{
+  target = parent;
+
+  FormatAttribute(target, INSTANCE_ATTRIBUTES[InstanceColumn_SopInstanceUid],
+                  DecodeUid(instanceColumns_[InstanceColumn_SopInstanceUid][instance], seriesUid));
+
+  for (size_t i = 1; i < INSTANCE_COLUMNS; i++)
+  {
+    FormatAttribute(target, INSTANCE_ATTRIBUTES[i], GetColumn(Level_Instance, i, instance));
+  }
+}
+
+
+void StoreMirror::FormatRow(Json::Value& target,
+                            Level level,
+                            uint32_t row) const
+{
+  switch (level)
+  {
+    case Level_Study:
+    {
+      for (size_t i = 0; i < STUDY_COLUMNS; i++)
+      {
+        FormatAttribute(target, STUDY_ATTRIBUTES[i], GetColumn(Level_Study, i, row));
+      }
+
+      std::set<std::string> modalities;
+      for (uint32_t i = studyFirstSeries_[row]; i != NONE; i = seriesNext_[i])
+      {
+        if (seriesInstancesCount_[i] > 0)
+        {
+          modalities.insert(GetColumn(Level_Series, SeriesColumn_Modality, i));
+        }
+      }
+
+      Json::Value item = Json::objectValue;
+      item["vr"] = MODALITIES_IN_STUDY.vr_;
+      item["Value"] = Json::arrayValue;
+      for (std::set<std::string>::const_iterator it = modalities.begin(); it != modalities.end(); ++it)
+      {
+        item["Value"].append(*it);
+      }
+
+      target[FormatTag(MODALITIES_IN_STUDY)] = item;
+
+      FormatCount(target, STUDY_SERIES_COUNT, studySeriesCount_[row]);
+      FormatCount(target, STUDY_INSTANCES_COUNT, studyInstancesCount_[row]);
+      break;
+    }
+
+    case Level_Series:
+      FormatSeriesParent(target, row);
+      FormatCount(target, SERIES_INSTANCES_COUNT, seriesInstancesCount_[row]);
+      break;
+
+    case Level_Instance:
+    {
+      Json::Value parent = Json::objectValue;
+      FormatSeriesParent(parent, instanceSeries_[row]);
+      FormatInstance(target, parent, GetUid(Level_Series, instanceSeries_[row]), row);
+      break;
+    }
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+void StoreMirror::CollectStudies(std::vector<uint32_t>& target,
+                                 const Matcher& matcher) const
+{
+  target.clear();
+
+  const Matcher::Constraint* uids = matcher.LookupConstraint(Level_Study, StudyColumn_StudyInstanceUid);
+  const Matcher::Constraint* patientId = matcher.LookupConstraint(Level_Study, StudyColumn_PatientId);
+  const Matcher::Constraint* accessionNumber = matcher.LookupConstraint(Level_Study, StudyColumn_AccessionNumber);
+  const Matcher::Constraint* studyDate = matcher.LookupConstraint(Level_Study, StudyColumn_StudyDate);
+
+  if (uids != NULL)
+  {
+    for (size_t i = 0; i < uids->values_.size(); i++)
+    {
+      const uint32_t study = LookupStudy(uids->values_[i]);
+      if (study != NONE)
+      {
+        target.push_back(study);
+      }
+    }
+  }
+  else if (!dirty_ &&
+           ((patientId != NULL && patientId->type_ == Matcher::Type_Exact) ||
+            (accessionNumber != NULL && accessionNumber->type_ == Matcher::Type_Exact)))
+  {
+    // The matches are verified by the caller, as hashes can collide
+    const bool isPatient = (patientId != NULL && patientId->type_ == Matcher::Type_Exact);
+    const std::vector<std::pair<uint64_t, uint32_t> >& index = (isPatient ? patientIds_ : accessionNumbers_);
+    const uint64_t hash = HashString(isPatient ? patientId->values_[0] : accessionNumber->values_[0]);
+
+    std::vector<std::pair<uint64_t, uint32_t> >::const_iterator it =
+      std::lower_bound(index.begin(), index.end(), std::make_pair(hash, static_cast<uint32_t>(0)));
+
+    for (; it != index.end() && it->first == hash; ++it)
+    {
+      target.push_back(it->second);
+    }
+
+    std::sort(target.begin(), target.end());
+  }
+  else if (!dirty_ &&
+           studyDate != NULL &&
+           (studyDate->type_ == Matcher::Type_Exact ||
+            studyDate->type_ == Matcher::Type_Range))
+  {
+    uint32_t lower, upper;
+
+    if (studyDate->type_ == Matcher::Type_Exact)
+    {
+      lower = upper = ParseDate(studyDate->values_[0]);
+    }
+    else
+    {
+      lower = (studyDate->values_[0].empty() ? 0 : ParseDate(studyDate->values_[0]));
+      upper = (studyDate->values_[1].empty() ? 0xffffffffu : ParseDate(studyDate->values_[1]));
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t> >::const_iterator it =
+      std::lower_bound(studyDates_.begin(), studyDates_.end(), std::make_pair(lower, static_cast<uint32_t>(0)));
+
+    for (; it != studyDates_.end() && it->first <= upper; ++it)
+    {
+      target.push_back(it->second);
+    }
+
+    // Most recent studies first, as expected by worklists
+    std::reverse(target.begin(), target.end());
+  }
+  else
+  {
+    target.reserve(studyFirstSeries_.size());
+    for (uint32_t i = 0; i < studyFirstSeries_.size(); i++)
+    {
+      target.push_back(i);
+    }
+  }
+}
+
+
+bool StoreMirror::Execute(Json::Value& answer,
+                          const Query& query) const
+{
+  Matcher matcher;
+  if (!matcher.Parse(query))
+  {
+    return false;
+  }
+
+  boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+  ResultCollector collector(answer, query.offset_, query.limit_);
+
+  uint32_t pathStudy = NONE;
+  uint32_t pathSeries = NONE;
+
+  if (!query.study_.empty())
+  {
+    pathStudy = LookupStudy(query.study_);
+    if (pathStudy == NONE ||
+        studyInstancesCount_[pathStudy] == 0)
+    {
+      return true;  // Empty answer
+    }
+  }
+
+  if (!query.series_.empty())
+  {
+    pathSeries = LookupSeries(query.series_);
+    if (pathSeries == NONE ||
+        seriesInstancesCount_[pathSeries] == 0 ||
+        (pathStudy != NONE && seriesStudy_[pathSeries] != pathStudy))
+    {
+      return true;
+    }
+  }
+
+  // Candidate studies, if the query constrains the study level
+  const bool hasStudies = (pathStudy != NONE ||
+                           pathSeries != NONE ||
+                           query.level_ == Level_Study ||
+                           matcher.HasConstraints(Level_Study));
+
+  std::vector<uint32_t> studies;
+  if (pathStudy != NONE)
+  {
+    studies.push_back(pathStudy);
+  }
+  else if (pathSeries != NONE)
+  {
+    studies.push_back(seriesStudy_[pathSeries]);
+  }
+  else if (hasStudies)
+  {
+    CollectStudies(studies, matcher);
+  }
+
+  if (query.level_ == Level_Study)
+  {
+    for (size_t i = 0; i < studies.size() && !collector.IsFull(); i++)
+    {
+      if (studyInstancesCount_[studies[i]] > 0 &&
+          matcher.Match(*this, Level_Study, studies[i]))
+      {
+        Json::Value* target = collector.Add();
+        if (target != NULL)
+        {
+          FormatRow(*target, Level_Study, studies[i]);
+        }
+      }
+    }
+
+    return true;
+  }
+
+  // Candidate series
+  std::vector<uint32_t> allSeries;
+  const Matcher::Constraint* seriesUids = matcher.LookupConstraint(Level_Series, SeriesColumn_SeriesInstanceUid);
+
+  if (hasStudies)
+  {
+    for (size_t i = 0; i < studies.size(); i++)
+    {
+      if (studyInstancesCount_[studies[i]] > 0 &&
+          matcher.Match(*this, Level_Study, studies[i]))
+      {
+        if (pathSeries != NONE)
+        {
+          allSeries.push_back(pathSeries);
+        }
+        else
+        {
+          for (uint32_t series = studyFirstSeries_[studies[i]]; series != NONE; series = seriesNext_[series])
+          {
+            allSeries.push_back(series);
+          }
+        }
+      }
+    }
+  }
+  else if (seriesUids != NULL)
+  {
+    for (size_t i = 0; i < seriesUids->values_.size(); i++)
+    {
+      const uint32_t series = LookupSeries(seriesUids->values_[i]);
+      if (series != NONE)
+      {
+        allSeries.push_back(series);
+      }
+    }
+  }
+  else if (query.level_ == Level_Instance &&
+           matcher.LookupConstraint(Level_Instance, InstanceColumn_SopInstanceUid) != NULL)
+  {
+    // Direct lookup of the instances, below
+  }
+  else
+  {
+    allSeries.reserve(seriesStudy_.size());
+    for (uint32_t i = 0; i < seriesStudy_.size(); i++)
+    {
+      allSeries.push_back(i);
+    }
+  }
+
+  if (query.level_ == Level_Series)
+  {
+    for (size_t i = 0; i < allSeries.size() && !collector.IsFull(); i++)
+    {
+      const uint32_t series = allSeries[i];
+      if (seriesInstancesCount_[series] > 0 &&
+          matcher.Match(*this, Level_Series, series))
+      {
+        Json::Value* target = collector.Add();
+        if (target != NULL)
+        {
+          FormatRow(*target, Level_Series, series);
+        }
+      }
+    }
+
+    return true;
+  }
+
+  // Instance level
+  const Matcher::Constraint* sopUids = matcher.LookupConstraint(Level_Instance, InstanceColumn_SopInstanceUid);
+
+  if (sopUids != NULL &&
+      !hasStudies &&
+      seriesUids == NULL)
+  {
+    for (size_t i = 0; i < sopUids->values_.size() && !collector.IsFull(); i++)
+    {
+      const uint32_t instance = LookupInstance(sopUids->values_[i]);
+      if (instance != NONE &&
+          !instanceDeleted_[instance] &&
+          matcher.Match(*this, Level_Study, seriesStudy_[instanceSeries_[instance]]) &&
+          matcher.Match(*this, Level_Series, instanceSeries_[instance]) &&
+          matcher.Match(*this, Level_Instance, instance))
+      {
+        Json::Value* target = collector.Add();
+        if (target != NULL)
+        {
+          FormatRow(*target, Level_Instance, instance);
+        }
+      }
+    }
+
+    return true;
+  }
+
+  for (size_t i = 0; i < allSeries.size() && !collector.IsFull(); i++)
+  {
+    const uint32_t series = allSeries[i];
+    if (seriesInstancesCount_[series] == 0 ||
+        !matcher.Match(*this, Level_Series, series))
+    {
+      continue;
+    }
+
+    // The attributes of the series are only formatted once
+    Json::Value parent;
+    std::string seriesUid;
+
+    for (uint32_t instance = seriesFirstInstance_[series];
+         instance != NONE && !collector.IsFull(); instance = instanceNext_[instance])
+    {
+      if (matcher.Match(*this, Level_Instance, instance))
+      {
+        Json::Value* target = collector.Add();
+        if (target != NULL)
+        {
+          if (seriesUid.empty())
+          {
+            parent = Json::objectValue;
+            FormatSeriesParent(parent, series);
+            seriesUid = GetUid(Level_Series, series);
+          }
+
+          FormatInstance(*target, parent, seriesUid, instance);
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+
+void StoreMirror::ListStudies(std::map<std::string, uint32_t>& target) const
+{
+  boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+  target.clear();
+
+  for (uint32_t i = 0; i < studyFirstSeries_.size(); i++)
+  {
+    if (studyInstancesCount_[i] > 0)
+    {
+      target[GetUid(Level_Study, i)] = studyInstancesCount_[i];
+    }
+  }
+}
+
+
+size_t StoreMirror::GetStudiesCount() const
+{
+  boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+  size_t count = 0;
+  for (size_t i = 0; i < studyInstancesCount_.size(); i++)
+  {
+    if (studyInstancesCount_[i] > 0)
+    {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+
+size_t StoreMirror::GetInstancesCount() const
+{
+  boost::shared_lock<boost::shared_mutex> lock(mutex_);
+  return liveInstances_;
+}
+
+
+uint64_t StoreMirror::GetMemoryUsage() const
+{
+  boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+  uint64_t size = arena_->GetMemoryUsage() + dictionary_->GetMemoryUsage();
+
+  for (size_t i = 0; i < STUDY_COLUMNS; i++)
+  {
+    size += GetVectorMemory(studyColumns_[i]);
+  }
+
+  for (size_t i = 0; i < SERIES_COLUMNS; i++)
+  {
+    size += GetVectorMemory(seriesColumns_[i]);
+  }
+
+  for (size_t i = 0; i < INSTANCE_COLUMNS; i++)
+  {
+    size += GetVectorMemory(instanceColumns_[i]);
+  }
+
+  size += (GetVectorMemory(studyFirstSeries_) +
+           GetVectorMemory(studySeriesCount_) +
+           GetVectorMemory(studyInstancesCount_) +
+           GetVectorMemory(seriesStudy_) +
+           GetVectorMemory(seriesNext_) +
+           GetVectorMemory(seriesFirstInstance_) +
+           GetVectorMemory(seriesInstancesCount_) +
+           GetVectorMemory(instanceSeries_) +
+           GetVectorMemory(instanceNext_) +
+           GetVectorMemory(instanceDeleted_) +
+           GetVectorMemory(patientIds_) +
+           GetVectorMemory(accessionNumbers_) +
+           GetVectorMemory(studyDates_) +
+           studyIndex_->GetMemoryUsage() +
+           seriesIndex_->GetMemoryUsage() +
+           instanceIndex_->GetMemoryUsage());
+
+  return size;
+}
+
+
+void StoreMirror::SaveSnapshot(const std::string& path) const
+{
+  const std::string tmp = path + ".tmp";
+
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    std::ofstream stream(tmp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!stream.good())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot write the mirror snapshot: " + tmp);
+    }
+
+    // Native byte order: The snapshot is only meant to be read back on the same host
+    stream.write(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+    arena_->Save(stream);
+    dictionary_->Save(stream);
+
+    for (size_t i = 0; i < STUDY_COLUMNS; i++)
+    {
+      WriteVector(stream, studyColumns_[i]);
+    }
+
+    WriteVector(stream, studyFirstSeries_);
+    WriteVector(stream, studySeriesCount_);
+    WriteVector(stream, studyInstancesCount_);
+
+    for (size_t i = 0; i < SERIES_COLUMNS; i++)
+    {
+      WriteVector(stream, seriesColumns_[i]);
+    }
+
+    WriteVector(stream, seriesStudy_);
+    WriteVector(stream, seriesNext_);
+    WriteVector(stream, seriesFirstInstance_);
+    WriteVector(stream, seriesInstancesCount_);
+
+    for (size_t i = 0; i < INSTANCE_COLUMNS; i++)
+    {
+      WriteVector(stream, instanceColumns_[i]);
+    }
+
+    WriteVector(stream, instanceSeries_);
+    WriteVector(stream, instanceNext_);
+    WriteVector(stream, instanceDeleted_);
+
+    stream.flush();
+    if (!stream.good())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot write the mirror snapshot: " + tmp);
+    }
+  }
+
+  if (rename(tmp.c_str(), path.c_str()) != 0)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot write the mirror snapshot: " + path);
+  }
+}
+
+
+bool StoreMirror::LoadSnapshot(const std::string& path)
+{
+  std::ifstream stream(path.c_str(), std::ios::in | std::ios::binary);
+  if (!stream.good())
+  {
+    return false;
+  }
+
+  char magic[SNAPSHOT_MAGIC_SIZE];
+  if (!stream.read(magic, SNAPSHOT_MAGIC_SIZE) ||
+      memcmp(magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE) != 0)
+  {
+    LOG(WARNING) << "Ignoring invalid mirror snapshot: " << path;
+    return false;
+  }
+
+  boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+  try
+  {
+    arena_->Load(stream);
+    dictionary_->Load(stream);
+
+    for (size_t i = 0; i < STUDY_COLUMNS; i++)
+    {
+      ReadVector(stream, studyColumns_[i]);
+    }
+
+    ReadVector(stream, studyFirstSeries_);
+    ReadVector(stream, studySeriesCount_);
+    ReadVector(stream, studyInstancesCount_);
+
+    for (size_t i = 0; i < SERIES_COLUMNS; i++)
+    {
+      ReadVector(stream, seriesColumns_[i]);
+    }
+
+    ReadVector(stream, seriesStudy_);
+    ReadVector(stream, seriesNext_);
+    ReadVector(stream, seriesFirstInstance_);
+    ReadVector(stream, seriesInstancesCount_);
+
+    for (size_t i = 0; i < INSTANCE_COLUMNS; i++)
+    {
+      ReadVector(stream, instanceColumns_[i]);
+    }
+
+    ReadVector(stream, instanceSeries_);
+    ReadVector(stream, instanceNext_);
+    ReadVector(stream, instanceDeleted_);
+
+    // Consistency of the sizes of the columns
+    for (size_t i = 0; i < STUDY_COLUMNS; i++)
+    {
+      if (studyColumns_[i].size() != studyFirstSeries_.size())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+      }
+    }
+
+    for (size_t i = 0; i < SERIES_COLUMNS; i++)
+    {
+      if (seriesColumns_[i].size() != seriesStudy_.size())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+      }
+    }
+
+    for (size_t i = 0; i < INSTANCE_COLUMNS; i++)
+    {
+      if (instanceColumns_[i].size() != instanceSeries_.size())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+      }
+    }
+
+    if (studySeriesCount_.size() != studyFirstSeries_.size() ||
+        studyInstancesCount_.size() != studyFirstSeries_.size() ||
+        seriesNext_.size() != seriesStudy_.size() ||
+        seriesFirstInstance_.size() != seriesStudy_.size() ||
+        seriesInstancesCount_.size() != seriesStudy_.size() ||
+        instanceNext_.size() != instanceSeries_.size() ||
+        instanceDeleted_.size() != instanceSeries_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile);
+    }
+  }
+  catch (Orthanc::OrthancException&)
+  {
+    LOG(WARNING) << "Ignoring corrupted mirror snapshot: " << path;
+
+    arena_->Reset();
+    dictionary_->Reset();
+
+    for (size_t i = 0; i < STUDY_COLUMNS; i++)
+    {
+      studyColumns_[i].clear();
+    }
+
+    for (size_t i = 0; i < SERIES_COLUMNS; i++)
+    {
+      seriesColumns_[i].clear();
+    }
+
+    for (size_t i = 0; i < INSTANCE_COLUMNS; i++)
+    {
+      instanceColumns_[i].clear();
+    }
+
+    studyFirstSeries_.clear();
+    studySeriesCount_.clear();
+    studyInstancesCount_.clear();
+    seriesStudy_.clear();
+    seriesNext_.clear();
+    seriesFirstInstance_.clear();
+    seriesInstancesCount_.clear();
+    instanceSeries_.clear();
+    instanceNext_.clear();
+    instanceDeleted_.clear();
+    studyIndex_->Reset();
+    seriesIndex_->Reset();
+    instanceIndex_->Reset();
+    liveInstances_ = 0;
+    return false;
+  }
+
+  // The hash tables and the secondary indexes are not saved, as they
+  // are quickly rebuilt from the columns
+  studyIndex_->Reset();
+  seriesIndex_->Reset();
+  instanceIndex_->Reset();
+
+  studyIndex_->Reserve(studyFirstSeries_.size());
+  seriesIndex_->Reserve(seriesStudy_.size());
+  instanceIndex_->Reserve(instanceSeries_.size());
+
+  for (uint32_t i = 0; i < studyFirstSeries_.size(); i++)
+  {
+    studyIndex_->Insert(GetUid(Level_Study, i), i);
+  }
+
+  std::vector<std::string> seriesUids(seriesStudy_.size());
+  for (uint32_t i = 0; i < seriesStudy_.size(); i++)
+  {
+    seriesUids[i] = GetUid(Level_Series, i);
+    seriesIndex_->Insert(seriesUids[i], i);
+  }
+
+  liveInstances_ = 0;
+  for (uint32_t i = 0; i < instanceSeries_.size(); i++)
+  {
+    instanceIndex_->Insert(DecodeUid(instanceColumns_[InstanceColumn_SopInstanceUid][i],
+                                     seriesUids[instanceSeries_[i]]), i);
+
+    if (!instanceDeleted_[i])
+    {
+      liveInstances_++;
+    }
+  }
+
+  RebuildSecondaryIndexes();
+  dirty_ = false;
+
+  return true;
+}
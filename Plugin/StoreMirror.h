@@ -0,0 +1,297 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <json/value.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+/**
+ * In-memory index of the study/series/instance metadata of one DICOM
+ * store, answering the QIDO-RS queries locally. The three levels are
+ * stored as columns of 32-bit integers: The strings are appended to
+ * an arena and referenced by their offset, the strings with a low
+ * cardinality (modality, SOP class) are interned, and the series and
+ * instance UIDs are front-coded against the UID of their parent (they
+ * usually share a long prefix). The children of a study or series are
+ * chained through "next sibling" columns, and the UIDs are indexed by
+ * open-addressing hash tables of row numbers. Exact matches on the
+ * patient ID and the accession number, and ranges of study dates, use
+ * secondary indexes that are rebuilt once per batch of updates.
+ *
+ * The index is updated by study: Each update replaces the full set of
+ * instances of one study. Replaced strings are not reclaimed until the
+ * next snapshot is loaded.
+ **/
+class StoreMirror : public boost::noncopyable
+{
+public:
+  enum Level
+  {
+    Level_Study,
+    Level_Series,
+    Level_Instance
+  };
+
+  enum StudyColumn
+  {
+    StudyColumn_StudyInstanceUid,
+    StudyColumn_PatientName,
+    StudyColumn_PatientId,
+    StudyColumn_PatientBirthDate,
+    StudyColumn_PatientSex,
+    StudyColumn_StudyDate,
+    StudyColumn_StudyTime,
+    StudyColumn_AccessionNumber,
+    StudyColumn_ReferringPhysicianName,
+    StudyColumn_StudyId,
+    StudyColumn_StudyDescription
+  };
+
+  enum SeriesColumn
+  {
+    SeriesColumn_SeriesInstanceUid,
+    SeriesColumn_Modality,
+    SeriesColumn_SeriesNumber,
+    SeriesColumn_SeriesDescription
+  };
+
+  enum InstanceColumn
+  {
+    InstanceColumn_SopInstanceUid,
+    InstanceColumn_SopClassUid,
+    InstanceColumn_InstanceNumber
+  };
+
+  static const size_t STUDY_COLUMNS = 11;
+  static const size_t SERIES_COLUMNS = 4;
+  static const size_t INSTANCE_COLUMNS = 3;
+
+  struct InstanceRecord
+  {
+    std::string  series_[SERIES_COLUMNS];
+    std::string  instance_[INSTANCE_COLUMNS];
+  };
+
+  struct StudyRecord
+  {
+    std::string                  study_[STUDY_COLUMNS];
+    std::vector<InstanceRecord>  instances_;
+  };
+
+  // Tag, VR and keyword of the columns
+  struct Attribute
+  {
+    uint16_t     group_;
+    uint16_t     element_;
+    const char*  vr_;
+    const char*  keyword_;
+  };
+
+  static const Attribute& GetAttribute(Level level,
+                                       size_t column);
+
+  // Fills a record from one entry of a QIDO-RS answer (DICOM JSON),
+  // at the study level or at the instance level
+  static void ParseStudy(StudyRecord& target,
+                         const Json::Value& source);
+
+  static void ParseInstance(InstanceRecord& target,
+                            const Json::Value& source);
+
+  // Tags to be requested through "includefield" to fill the records
+  static std::string GetIncludeFields(Level level);
+
+  struct Query
+  {
+    Level                               level_;
+    std::string                         study_;    // From the path, may be empty
+    std::string                         series_;   // From the path, may be empty
+    std::map<std::string, std::string>  filters_;  // Keyword or tag => DICOM matching value
+    size_t                              offset_;
+    size_t                              limit_;    // 0 means no limit
+
+    Query() :
+      level_(Level_Study),
+      offset_(0),
+      limit_(0)
+    {
+    }
+  };
+
+private:
+  class StringArena;
+  class Dictionary;
+  class UidIndex;
+  class Matcher;
+
+  static const uint32_t NONE = 0xffffffffu;
+
+  std::unique_ptr<StringArena>  arena_;
+  std::unique_ptr<Dictionary>   dictionary_;
+
+  // Study level
+  std::vector<uint32_t>  studyColumns_[STUDY_COLUMNS];
+  std::vector<uint32_t>  studyFirstSeries_;
+  std::vector<uint32_t>  studySeriesCount_;
+  std::vector<uint32_t>  studyInstancesCount_;
+
+  // Series level
+  std::vector<uint32_t>  seriesColumns_[SERIES_COLUMNS];
+  std::vector<uint32_t>  seriesStudy_;
+  std::vector<uint32_t>  seriesNext_;
+  std::vector<uint32_t>  seriesFirstInstance_;
+  std::vector<uint32_t>  seriesInstancesCount_;
+
+  // Instance level. The deleted instances are kept, so that their row
+  // is reused if they come back.
+  std::vector<uint32_t>  instanceColumns_[INSTANCE_COLUMNS];
+  std::vector<uint32_t>  instanceSeries_;
+  std::vector<uint32_t>  instanceNext_;
+  std::vector<uint8_t>   instanceDeleted_;
+
+  std::unique_ptr<UidIndex>  studyIndex_;
+  std::unique_ptr<UidIndex>  seriesIndex_;
+  std::unique_ptr<UidIndex>  instanceIndex_;
+
+  // Secondary indexes, rebuilt by "Commit()"
+  std::vector<std::pair<uint64_t, uint32_t> >  patientIds_;        // Sorted (hash, study)
+  std::vector<std::pair<uint64_t, uint32_t> >  accessionNumbers_;  // Sorted (hash, study)
+  std::vector<std::pair<uint32_t, uint32_t> >  studyDates_;        // Sorted (YYYYMMDD, study)
+  bool                                         dirty_;
+
+  size_t  liveInstances_;
+
+  mutable boost::shared_mutex  mutex_;
+
+  std::string GetString(uint32_t offset) const;
+
+  std::string GetColumn(Level level,
+                        size_t column,
+                        uint32_t row) const;
+
+  std::string DecodeUid(uint32_t offset,
+                        const std::string& parentUid) const;
+
+  std::string GetUid(Level level,
+                     uint32_t row) const;
+
+  uint32_t EncodeUid(const std::string& uid,
+                     const std::string& parentUid);
+
+  uint32_t EncodeColumn(Level level,
+                        size_t column,
+                        const std::string& value,
+                        const std::string& parentUid);
+
+  uint32_t LookupStudy(const std::string& uid) const;
+
+  uint32_t LookupSeries(const std::string& uid) const;
+
+  uint32_t LookupInstance(const std::string& uid) const;
+
+  uint32_t GetOrCreateStudy(const StudyRecord& study);
+
+  void UnlinkInstance(uint32_t instance);
+
+  void AddInstanceInternal(uint32_t study,
+                           const InstanceRecord& instance);
+
+  void DetachInstances(uint32_t study);
+
+  void RebuildSecondaryIndexes();
+
+  // StudyInstanceUID and the attributes of the series
+  void FormatSeriesParent(Json::Value& target,
+                          uint32_t series) const;
+
+  void FormatInstance(Json::Value& target,
+                      const Json::Value& parent,
+                      const std::string& seriesUid,
+                      uint32_t instance) const;
+
+  void FormatRow(Json::Value& target,
+                 Level level,
+                 uint32_t row) const;
+
+  void CollectStudies(std::vector<uint32_t>& target,
+                      const Matcher& matcher) const;
+
+public:
+  StoreMirror();
+
+  ~StoreMirror();
+
+  // Replaces the metadata of one study by the given state. A study
+  // without instances is removed.
+  void ReplaceStudy(const StudyRecord& study);
+
+  void RemoveStudy(const std::string& studyInstanceUid);
+
+  // Adds (or updates) one instance, without affecting its siblings
+  void AddInstance(const StudyRecord& study,
+                   const InstanceRecord& instance);
+
+  void RemoveInstance(const std::string& sopInstanceUid);
+
+  // Must be called after a batch of updates, before the next queries
+  void Commit();
+
+  // Returns "false" if the query uses a feature that is not supported
+  // by the mirror (unknown attribute, fuzzy matching...)
+  bool Execute(Json::Value& answer,
+               const Query& query) const;
+
+  // Study UIDs and their number of instances, to detect the changes
+  void ListStudies(std::map<std::string, uint32_t>& target) const;
+
+  size_t GetStudiesCount() const;
+
+  size_t GetInstancesCount() const;
+
+  uint64_t GetMemoryUsage() const;
+
+  void SaveSnapshot(const std::string& path) const;
+
+  // Returns "false" if the file does not exist or is not a snapshot
+  bool LoadSnapshot(const std::string& path);
+};
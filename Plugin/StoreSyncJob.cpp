@@ -0,0 +1,841 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StoreSyncJob.h"
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+
+#include "GoogleConfiguration.h"
+#include "GoogleUpdater.h"
+#include "HealthcareClient.h"
+#include "PluginToolbox.h"
+#include "PresenceFilters.h"
+#include "TransferStreams.h"
+
+#include <Logging.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/lexical_cast.hpp>
+
+
+const char* const StoreSyncJob::JOB_TYPE = "GcpStoreSync";
+
+static const unsigned int OPERATION_WAIT = 1000;      // Maximum duration of one step while the operation runs, in ms
+static const unsigned int ORTHANC_PAGE_SIZE = 1000;
+static const unsigned int GOOGLE_PAGE_SIZE = 5000;    // Maximum "limit" accepted by Google for instances
+static const size_t RUN_SIZE = 100000;                // Number of UIDs in one sorted run (a few MB in memory)
+
+static const char* const ORTHANC_RUNS = "orthanc";
+static const char* const GOOGLE_RUNS = "google";
+static const char* const MISSING_IN_GOOGLE = "missing-in-google.txt";    // Orthanc identifiers
+static const char* const MISSING_IN_ORTHANC = "missing-in-orthanc.txt";  // "{study}/{series}/{sop}"
+
+
+static std::string GetFirstValue(const Json::Value& item,
+                                 const char* tag)
+{
+  if (item.isMember(tag) &&
+      item[tag].isMember("Value") &&
+      item[tag]["Value"].type() == Json::arrayValue &&
+      item[tag]["Value"].size() >= 1 &&
+      item[tag]["Value"][0].type() == Json::stringValue)
+  {
+    return item[tag]["Value"][0].asString();
+  }
+  else
+  {
+    return "";
+  }
+}
+
+
+namespace
+{
+  // Writes the lists of the instances to be transferred, one per line
+  class DifferenceWriter : public SortedUidRuns::IDifferenceVisitor
+  {
+  private:
+    boost::filesystem::ofstream  missingInGoogle_;
+    boost::filesystem::ofstream  missingInOrthanc_;
+    bool                         toGoogle_;
+    bool                         toOrthanc_;
+    uint64_t                     missingInGoogleCount_;
+    uint64_t                     missingInOrthancCount_;
+
+  public:
+    DifferenceWriter(const boost::filesystem::path& directory,
+                     StoreSyncJob::Direction direction) :
+      missingInGoogle_(directory / MISSING_IN_GOOGLE, std::ios::out | std::ios::trunc),
+      missingInOrthanc_(directory / MISSING_IN_ORTHANC, std::ios::out | std::ios::trunc),
+      toGoogle_(direction != StoreSyncJob::Direction_ToOrthanc),
+      toOrthanc_(direction != StoreSyncJob::Direction_ToGoogle),
+      missingInGoogleCount_(0),
+      missingInOrthancCount_(0)
+    {
+      if (!missingInGoogle_.is_open() ||
+          !missingInOrthanc_.is_open())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                        "Cannot write the differences into: " + directory.string());
+      }
+    }
+
+    void VisitLeftOnly(const std::string& uid,
+                       const std::string& payload) override
+    {
+      if (toGoogle_)
+      {
+        missingInGoogle_ << payload << "\n";
+        missingInGoogleCount_++;
+      }
+    }
+
+    void VisitRightOnly(const std::string& uid,
+                        const std::string& payload) override
+    {
+      if (toOrthanc_)
+      {
+        missingInOrthanc_ << payload << "/" << uid << "\n";
+        missingInOrthancCount_++;
+      }
+    }
+
+    void Close()
+    {
+      missingInGoogle_.close();
+      missingInOrthanc_.close();
+
+      if (missingInGoogle_.fail() ||
+          missingInOrthanc_.fail())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                        "Cannot write the differences");
+      }
+    }
+
+    uint64_t GetMissingInGoogleCount() const
+    {
+      return missingInGoogleCount_;
+    }
+
+    uint64_t GetMissingInOrthancCount() const
+    {
+      return missingInOrthancCount_;
+    }
+  };
+
+
+  // Retrieves the instances that are missing in Orthanc with WADO-RS
+  class RetrieveStreams : public TransferStreams
+  {
+  private:
+    StorageStaging::IInstanceTarget&  target_;
+    const std::string&                accountName_;
+    const std::string&                dicomWebUrl_;
+    boost::mutex                      mutex_;
+    std::string                       header_;   // Shared by the streams, updated if Google rejects the token
+    std::atomic<size_t>               deleted_;
+
+  protected:
+    uint64_t Transfer(const std::string& item) override
+    {
+      std::vector<std::string> tokens;
+      Orthanc::Toolbox::TokenizeString(tokens, item, '/');
+
+      if (tokens.size() != 3)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "Bad line in the list of the instances to download: " + item);
+      }
+
+      const std::string url = (dicomWebUrl_ + "studies/" + tokens[0] + "/series/" +
+                               tokens[1] + "/instances/" + tokens[2]);
+
+      std::string header;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        header = header_;
+      }
+
+      std::string dicom;
+
+      try
+      {
+        try
+        {
+          HealthcareClient::RetrieveInstance(dicom, url, header);
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          // Retry once if the token has expired in the meantime
+          if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+              GoogleUpdater::GetInstance().HandleRejectedToken(accountName_, header) &&
+              GoogleUpdater::GetInstance().GetAuthorizationHeader(header, accountName_))
+          {
+            {
+              boost::mutex::scoped_lock lock(mutex_);
+              header_ = header;
+            }
+
+            HealthcareClient::RetrieveInstance(dicom, url, header);
+          }
+          else
+          {
+            throw;
+          }
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        if (e.GetErrorCode() == Orthanc::ErrorCode_InexistentItem)
+        {
+          // Deleted from Google since the listing
+          deleted_++;
+          return 0;
+        }
+        else
+        {
+          throw;
+        }
+      }
+
+      target_.StoreInstance(dicom, item);
+      return dicom.size();
+    }
+
+  public:
+    RetrieveStreams(const std::vector<std::string>& items,
+                    StorageStaging::IInstanceTarget& target,
+                    const std::string& accountName,
+                    const std::string& dicomWebUrl,
+                    const std::string& header) :
+      TransferStreams(items),
+      target_(target),
+      accountName_(accountName),
+      dicomWebUrl_(dicomWebUrl),
+      header_(header),
+      deleted_(0)
+    {
+    }
+
+    size_t GetDeletedCount() const
+    {
+      return deleted_;
+    }
+  };
+}
+
+
+bool StoreSyncJob::HasStaging(const Json::Value& source)
+{
+  // No file is staged in Google Cloud Storage if only downloading
+  return StringToDirection(GetStringField(source, "Direction", "Both")) != Direction_ToOrthanc;
+}
+
+
+StoreSyncJob::StoreSyncJob(const Json::Value& source) :
+  BulkTransferJob(JOB_TYPE, source, "orthanc-sync/", HasStaging(source)),
+  direction_(StringToDirection(GetStringField(source, "Direction", "Both"))),
+  listPosition_(0),
+  listedCount_(0)
+{
+  const GoogleConfiguration& configuration = GoogleConfiguration::GetInstance();
+
+  workDirectory_ = GetStringField(source, "WorkDirectory", "");
+  if (workDirectory_.empty())
+  {
+    // Each job has its own work directory, removed once it is done
+    workDirectory_ = (boost::filesystem::path(PluginToolbox::ResolveConfigurationPath(configuration.GetStorageDirectory())) /
+                      ("gcp-sync-" + Orthanc::Toolbox::GenerateUuid())).string();
+  }
+
+  const Json::Value checkpoint = GetCheckpoint(source);
+  phase_ = StringToPhase(GetStringField(checkpoint, "Phase", EnumerationToString(Phase_ListOrthanc)));
+  position_ = GetIntegerField(checkpoint, "Position", 0);
+  orthancRuns_ = static_cast<unsigned int>(GetIntegerField(checkpoint, "OrthancRuns", 0));
+  googleRuns_ = static_cast<unsigned int>(GetIntegerField(checkpoint, "GoogleRuns", 0));
+  orthancCount_ = GetIntegerField(checkpoint, "OrthancCount", 0);
+  googleCount_ = GetIntegerField(checkpoint, "GoogleCount", 0);
+  commonCount_ = GetIntegerField(checkpoint, "CommonCount", 0);
+  missingInGoogle_ = GetIntegerField(checkpoint, "MissingInGoogle", 0);
+  missingInOrthanc_ = GetIntegerField(checkpoint, "MissingInOrthanc", 0);
+  downloaded_ = GetIntegerField(checkpoint, "Downloaded", 0);
+  uploaded_ = GetIntegerField(checkpoint, "Uploaded", 0);
+  transferredBytes_ = GetIntegerField(checkpoint, "TransferredBytes", 0);
+
+  Checkpoint();
+}
+
+
+const char* StoreSyncJob::EnumerationToString(Direction direction)
+{
+  switch (direction)
+  {
+    case Direction_Both:
+      return "Both";
+
+    case Direction_ToGoogle:
+      return "ToGoogle";
+
+    case Direction_ToOrthanc:
+      return "ToOrthanc";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+StoreSyncJob::Direction StoreSyncJob::StringToDirection(const std::string& direction)
+{
+  if (direction == "Both")
+  {
+    return Direction_Both;
+  }
+  else if (direction == "ToGoogle")
+  {
+    return Direction_ToGoogle;
+  }
+  else if (direction == "ToOrthanc")
+  {
+    return Direction_ToOrthanc;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Unknown direction of a store synchronization (must be "
+                                    "\"Both\", \"ToGoogle\" or \"ToOrthanc\"): " + direction);
+  }
+}
+
+
+const char* StoreSyncJob::EnumerationToString(Phase phase)
+{
+  switch (phase)
+  {
+    case Phase_ListOrthanc:
+      return "ListOrthanc";
+
+    case Phase_ListGoogle:
+      return "ListGoogle";
+
+    case Phase_Compare:
+      return "Compare";
+
+    case Phase_Download:
+      return "Download";
+
+    case Phase_Upload:
+      return "Upload";
+
+    case Phase_Import:
+      return "Import";
+
+    case Phase_Done:
+      return "Done";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+StoreSyncJob::Phase StoreSyncJob::StringToPhase(const std::string& phase)
+{
+  if (phase == "ListOrthanc")
+  {
+    return Phase_ListOrthanc;
+  }
+  else if (phase == "ListGoogle")
+  {
+    return Phase_ListGoogle;
+  }
+  else if (phase == "Compare")
+  {
+    return Phase_Compare;
+  }
+  else if (phase == "Download")
+  {
+    return Phase_Download;
+  }
+  else if (phase == "Upload")
+  {
+    return Phase_Upload;
+  }
+  else if (phase == "Import")
+  {
+    return Phase_Import;
+  }
+  else if (phase == "Done")
+  {
+    return Phase_Done;
+  }
+  else
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                    "Unknown phase of a store synchronization: " + phase);
+  }
+}
+
+
+void StoreSyncJob::SerializeParameters(Json::Value& target) const
+{
+  BulkTransferJob::SerializeParameters(target);
+  target["Direction"] = EnumerationToString(direction_);
+  target["WorkDirectory"] = workDirectory_;
+}
+
+
+void StoreSyncJob::Checkpoint()
+{
+  Json::Value checkpoint = Json::objectValue;
+  checkpoint["Phase"] = EnumerationToString(phase_);
+  checkpoint["Position"] = static_cast<Json::UInt64>(position_);
+  checkpoint["OrthancRuns"] = orthancRuns_;
+  checkpoint["GoogleRuns"] = googleRuns_;
+  checkpoint["OrthancCount"] = static_cast<Json::UInt64>(orthancCount_);
+  checkpoint["GoogleCount"] = static_cast<Json::UInt64>(googleCount_);
+  checkpoint["CommonCount"] = static_cast<Json::UInt64>(commonCount_);
+  checkpoint["MissingInGoogle"] = static_cast<Json::UInt64>(missingInGoogle_);
+  checkpoint["MissingInOrthanc"] = static_cast<Json::UInt64>(missingInOrthanc_);
+  checkpoint["Downloaded"] = static_cast<Json::UInt64>(downloaded_);
+  checkpoint["Uploaded"] = static_cast<Json::UInt64>(uploaded_);
+  checkpoint["TransferredBytes"] = static_cast<Json::UInt64>(transferredBytes_);
+
+  Json::Value details = Json::objectValue;
+  details["Direction"] = EnumerationToString(direction_);
+  details["WorkDirectory"] = workDirectory_;
+
+  if (!bucket_.empty())
+  {
+    details["GcsSource"] = "gs://" + bucket_ + "/" + prefix_;
+  }
+
+  // The listings and the comparison account for 45% of the progress,
+  // the downloads for 25%, the uploads for 20%, and the import for the rest
+  switch (phase_)
+  {
+    case Phase_ListOrthanc:
+      SaveCheckpoint(checkpoint, details, 0.0f);
+      break;
+
+    case Phase_ListGoogle:
+      SaveCheckpoint(checkpoint, details, 0.2f);
+      break;
+
+    case Phase_Compare:
+      SaveCheckpoint(checkpoint, details, 0.4f);
+      break;
+
+    case Phase_Download:
+      SaveCheckpoint(checkpoint, details, missingInOrthanc_ == 0 ? 0.45f :
+                     0.45f + 0.25f * static_cast<float>(downloaded_) / static_cast<float>(missingInOrthanc_));
+      break;
+
+    case Phase_Upload:
+      SaveCheckpoint(checkpoint, details, missingInGoogle_ == 0 ? 0.7f :
+                     0.7f + 0.2f * static_cast<float>(uploaded_) / static_cast<float>(missingInGoogle_));
+      break;
+
+    case Phase_Import:
+      SaveCheckpoint(checkpoint, details, 0.9f + 0.1f * operationProgress_);
+      break;
+
+    case Phase_Done:
+      SaveCheckpoint(checkpoint, details, 1.0f);
+      break;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+std::string StoreSyncJob::GetPath(const std::string& name) const
+{
+  return (boost::filesystem::path(workDirectory_) / name).string();
+}
+
+
+std::string StoreSyncJob::GetDicomWebUrl() const
+{
+  return account_.GetDicomWebUrl(GoogleConfiguration::GetInstance().GetBaseGoogleUrl(), dataset_, dicomStore_);
+}
+
+
+bool StoreSyncJob::ReadLines(std::vector<std::string>& lines,
+                             uint64_t& offset,
+                             const std::string& path,
+                             size_t maxCount)
+{
+  lines.clear();
+
+  boost::filesystem::ifstream f(path, std::ios::in | std::ios::binary);
+  if (!f.is_open())
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile,
+                                    "Cannot read the list of instances to be transferred: " + path);
+  }
+
+  f.seekg(static_cast<std::streamoff>(offset));
+
+  std::string line;
+  while (lines.size() < maxCount &&
+         std::getline(f, line))
+  {
+    // All the lines end with a newline, as written by "DifferenceWriter"
+    offset += line.size() + 1;
+
+    if (!line.empty())
+    {
+      lines.push_back(line);
+    }
+  }
+
+  return !lines.empty();
+}
+
+
+bool StoreSyncJob::ListOrthancPage()
+{
+  Json::Value page;
+  if (!OrthancPlugins::RestApiGet(page, "/instances?expand&since=" + boost::lexical_cast<std::string>(listPosition_) +
+                                  "&limit=" + boost::lexical_cast<std::string>(ORTHANC_PAGE_SIZE), false) ||
+      page.type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                    "Cannot list the instances stored by Orthanc");
+  }
+
+  for (Json::Value::ArrayIndex i = 0; i < page.size(); i++)
+  {
+    const Json::Value& instance = page[i];
+    if (instance.isMember("ID") &&
+        instance.isMember("MainDicomTags") &&
+        instance["MainDicomTags"].isMember("SOPInstanceUID"))
+    {
+      writer_->Add(instance["MainDicomTags"]["SOPInstanceUID"].asString(), instance["ID"].asString());
+      listedCount_++;
+    }
+  }
+
+  listPosition_ += page.size();
+  return page.size() < ORTHANC_PAGE_SIZE;
+}
+
+
+bool StoreSyncJob::ListGooglePage()
+{
+  static const char* const STUDY_INSTANCE_UID = "0020000D";
+  static const char* const SERIES_INSTANCE_UID = "0020000E";
+  static const char* const SOP_INSTANCE_UID = "00080018";
+
+  // The study, series and SOP instance UIDs are part of the default
+  // attributes of QIDO-RS at the instance level
+  const std::string url = (GetDicomWebUrl() + "instances?limit=" + boost::lexical_cast<std::string>(GOOGLE_PAGE_SIZE) +
+                           "&offset=" + boost::lexical_cast<std::string>(listPosition_));
+
+  std::string header = GetAuthorizationHeader();
+
+  Json::Value page;
+
+  try
+  {
+    HealthcareClient::Search(page, url, header);
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    // Retry once if the token has expired in the meantime
+    if (e.GetErrorCode() == Orthanc::ErrorCode_Unauthorized &&
+        GoogleUpdater::GetInstance().HandleRejectedToken(account_.GetName(), header))
+    {
+      HealthcareClient::Search(page, url, GetAuthorizationHeader());
+    }
+    else
+    {
+      throw;
+    }
+  }
+
+  PresenceFilters& filters = PresenceFilters::GetInstance();
+
+  for (Json::Value::ArrayIndex i = 0; i < page.size(); i++)
+  {
+    const std::string study = GetFirstValue(page[i], STUDY_INSTANCE_UID);
+    const std::string series = GetFirstValue(page[i], SERIES_INSTANCE_UID);
+    const std::string sop = GetFirstValue(page[i], SOP_INSTANCE_UID);
+
+    if (!study.empty() &&
+        !series.empty() &&
+        !sop.empty())
+    {
+      writer_->Add(sop, study + "/" + series);
+      listedCount_++;
+
+      // The listing also refreshes the presence filter of the store, if any
+      filters.Add(account_.GetName(), dataset_, dicomStore_, sop);
+    }
+  }
+
+  listPosition_ += page.size();
+  return page.size() < GOOGLE_PAGE_SIZE;
+}
+
+
+OrthancPluginJobStepStatus StoreSyncJob::StepList(Phase next)
+{
+  const bool isOrthanc = (phase_ == Phase_ListOrthanc);
+  unsigned int& runs = (isOrthanc ? orthancRuns_ : googleRuns_);
+  uint64_t& count = (isOrthanc ? orthancCount_ : googleCount_);
+
+  if (writer_.get() == NULL)
+  {
+    // New phase, or resuming from the last checkpoint, that is
+    // located at the boundary of a run
+    boost::filesystem::create_directories(workDirectory_);
+    writer_.reset(new SortedUidRuns::Writer(workDirectory_, isOrthanc ? ORTHANC_RUNS : GOOGLE_RUNS, RUN_SIZE, runs));
+    listPosition_ = position_;
+    listedCount_ = 0;
+  }
+
+  const bool done = (isOrthanc ? ListOrthancPage() : ListGooglePage());
+
+  if (done ||
+      writer_->IsFull())
+  {
+    writer_->Flush();
+
+    runs = writer_->GetRunsCount();
+    count += listedCount_;
+    listedCount_ = 0;
+    position_ = listPosition_;
+
+    if (done)
+    {
+      LOG(INFO) << "Store synchronization with \"" << dataset_ << "/" << dicomStore_ << "\": "
+                << count << " instance(s) listed in " << (isOrthanc ? "Orthanc" : "Google")
+                << " (" << runs << " sorted run(s))";
+
+      writer_.reset();
+      phase_ = next;
+      position_ = 0;
+    }
+
+    Checkpoint();
+  }
+
+  return OrthancPluginJobStepStatus_Continue;
+}
+
+
+OrthancPluginJobStepStatus StoreSyncJob::StepCompare()
+{
+  {
+    SortedUidRuns::Reader orthanc(workDirectory_, ORTHANC_RUNS, orthancRuns_);
+    SortedUidRuns::Reader google(workDirectory_, GOOGLE_RUNS, googleRuns_);
+
+    DifferenceWriter writer(workDirectory_, direction_);
+    commonCount_ = SortedUidRuns::ComputeDifferences(writer, orthanc, google);
+    writer.Close();
+
+    missingInGoogle_ = writer.GetMissingInGoogleCount();
+    missingInOrthanc_ = writer.GetMissingInOrthancCount();
+  }
+
+  SortedUidRuns::RemoveRuns(workDirectory_, ORTHANC_RUNS, orthancRuns_);
+  SortedUidRuns::RemoveRuns(workDirectory_, GOOGLE_RUNS, googleRuns_);
+
+  LOG(WARNING) << "Store synchronization with \"" << dataset_ << "/" << dicomStore_ << "\": "
+               << commonCount_ << " common instance(s), " << missingInGoogle_ << " to upload, "
+               << missingInOrthanc_ << " to download";
+
+  phase_ = Phase_Download;
+  position_ = 0;
+  Checkpoint();
+
+  return OrthancPluginJobStepStatus_Continue;
+}
+
+
+OrthancPluginJobStepStatus StoreSyncJob::StepDownload()
+{
+  std::vector<std::string> batch;
+  uint64_t offset = position_;
+
+  if (!ReadLines(batch, offset, GetPath(MISSING_IN_ORTHANC), GetBatchSize()))
+  {
+    phase_ = Phase_Upload;
+    position_ = 0;
+  }
+  else
+  {
+    OrthancInstanceTarget target;
+    RetrieveStreams streams(batch, target, account_.GetName(), GetDicomWebUrl(), GetAuthorizationHeader());
+
+    const uint64_t bytes = streams.Run(threads_);
+
+    if (streams.GetDeletedCount() > 0)
+    {
+      LOG(WARNING) << "Store synchronization with \"" << dataset_ << "/" << dicomStore_ << "\": "
+                   << streams.GetDeletedCount() << " instance(s) deleted from Google since the listing";
+    }
+
+    position_ = offset;
+    downloaded_ += batch.size();
+    transferredBytes_ += bytes;
+    AddTransferredBytes(bytes);
+  }
+
+  Checkpoint();
+  return OrthancPluginJobStepStatus_Continue;
+}
+
+
+OrthancPluginJobStepStatus StoreSyncJob::StepUpload()
+{
+  std::vector<std::string> batch;
+  uint64_t offset = position_;
+
+  if (!ReadLines(batch, offset, GetPath(MISSING_IN_GOOGLE), GetBatchSize()))
+  {
+    if (uploaded_ == 0)
+    {
+      return Finish();
+    }
+    else
+    {
+      StorageStaging& staging = GetStaging();
+
+      Json::Value body = Json::objectValue;
+      body["gcsSource"] = Json::objectValue;
+      body["gcsSource"]["uri"] = staging.GetSourceUri(prefix_);
+
+      StartOperation("import", body);
+      phase_ = Phase_Import;
+
+      LOG(WARNING) << "Store synchronization: Import of " << uploaded_ << " instance(s) from "
+                   << staging.GetSourceUri(prefix_) << " into DICOM store \"" << dataset_
+                   << "/" << dicomStore_ << "\": " << operation_;
+    }
+  }
+  else
+  {
+    OrthancInstanceSource source;
+    const uint64_t bytes = GetStaging().UploadInstances(source, batch, prefix_, threads_);
+
+    position_ = offset;
+    uploaded_ += batch.size();
+    transferredBytes_ += bytes;
+    AddTransferredBytes(bytes);
+  }
+
+  Checkpoint();
+  return OrthancPluginJobStepStatus_Continue;
+}
+
+
+OrthancPluginJobStepStatus StoreSyncJob::StepImport()
+{
+  if (WaitOperation(OPERATION_WAIT))
+  {
+    return Finish();
+  }
+  else
+  {
+    Checkpoint();
+    return OrthancPluginJobStepStatus_Continue;
+  }
+}
+
+
+OrthancPluginJobStepStatus StoreSyncJob::Finish()
+{
+  boost::system::error_code error;
+  boost::filesystem::remove_all(workDirectory_, error);
+
+  if (error)
+  {
+    LOG(WARNING) << "Cannot remove the work directory of a store synchronization: " << workDirectory_;
+  }
+
+  phase_ = Phase_Done;
+  Checkpoint();
+
+  LOG(WARNING) << "Store synchronization with DICOM store \"" << dataset_ << "/" << dicomStore_ << "\" is done: "
+               << downloaded_ << " instance(s) downloaded, " << uploaded_ << " uploaded";
+  return OrthancPluginJobStepStatus_Success;
+}
+
+
+OrthancPluginJobStepStatus StoreSyncJob::StepPhase()
+{
+  switch (phase_)
+  {
+    case Phase_ListOrthanc:
+      return StepList(Phase_ListGoogle);
+
+    case Phase_ListGoogle:
+      return StepList(Phase_Compare);
+
+    case Phase_Compare:
+      return StepCompare();
+
+    case Phase_Download:
+      return StepDownload();
+
+    case Phase_Upload:
+      return StepUpload();
+
+    case Phase_Import:
+      return StepImport();
+
+    case Phase_Done:
+      return OrthancPluginJobStepStatus_Success;
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+  }
+}
+
+
+void StoreSyncJob::Reset()
+{
+  // The entries that were listed since the last checkpoint are listed again
+  writer_.reset();
+  BulkTransferJob::Reset();
+}
+
+#endif
@@ -0,0 +1,160 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "BulkTransferJob.h"
+
+#if HAS_ORTHANC_PLUGIN_JOB == 1
+
+#include "SortedUidRuns.h"
+
+
+/**
+ * Orthanc job that reconciles the instances of Orthanc with those of
+ * one DICOM store of Google Healthcare. The SOPInstanceUIDs of both
+ * sides are listed by pages and sorted on disk by runs of bounded
+ * size (in "WorkDirectory"), then the two sorted streams are compared
+ * by a merge join, which writes the lists of differences. The
+ * instances that are missing in Orthanc are retrieved with WADO-RS by
+ * concurrent streams, and those that are missing in Google are
+ * staged in Google Cloud Storage then loaded by one "import"
+ * operation, as in "BulkImportJob". "Direction" restricts the
+ * synchronization to one way ("ToGoogle" or "ToOrthanc").
+ *
+ * The job is checkpointed after each sorted run and each batch of
+ * transfers. The memory usage is bounded by the size of one run,
+ * whatever the size of the stores. As the listings are paginated,
+ * the instances that are added or removed during the listing might
+ * be missed, and are handled by the next synchronization.
+ **/
+class StoreSyncJob : public BulkTransferJob
+{
+public:
+  static const char* const JOB_TYPE;
+
+  enum Direction
+  {
+    Direction_Both,
+    Direction_ToGoogle,
+    Direction_ToOrthanc
+  };
+
+private:
+  enum Phase
+  {
+    Phase_ListOrthanc,
+    Phase_ListGoogle,
+    Phase_Compare,
+    Phase_Download,
+    Phase_Upload,
+    Phase_Import,
+    Phase_Done
+  };
+
+  Direction     direction_;
+  std::string   workDirectory_;
+
+  // Checkpoint
+  Phase         phase_;
+  uint64_t      position_;          // Listing position of the last run, or offset in the list of differences
+  unsigned int  orthancRuns_;
+  unsigned int  googleRuns_;
+  uint64_t      orthancCount_;      // Number of instances in the written runs
+  uint64_t      googleCount_;
+  uint64_t      commonCount_;
+  uint64_t      missingInGoogle_;
+  uint64_t      missingInOrthanc_;
+  uint64_t      downloaded_;
+  uint64_t      uploaded_;
+  uint64_t      transferredBytes_;
+
+  // Not serialized: The runs being built since the last checkpoint
+  std::unique_ptr<SortedUidRuns::Writer>  writer_;
+  uint64_t                                listPosition_;
+  uint64_t                                listedCount_;
+
+  static bool HasStaging(const Json::Value& source);
+
+  std::string GetPath(const std::string& name) const;
+
+  std::string GetDicomWebUrl() const;
+
+  // Returns "true" once the listing is complete
+  bool ListOrthancPage();
+
+  bool ListGooglePage();
+
+  OrthancPluginJobStepStatus StepList(Phase next);
+
+  OrthancPluginJobStepStatus StepCompare();
+
+  OrthancPluginJobStepStatus StepDownload();
+
+  OrthancPluginJobStepStatus StepUpload();
+
+  OrthancPluginJobStepStatus StepImport();
+
+  OrthancPluginJobStepStatus Finish();
+
+  static const char* EnumerationToString(Phase phase);
+
+  static Phase StringToPhase(const std::string& phase);
+
+protected:
+  void SerializeParameters(Json::Value& target) const override;
+
+  OrthancPluginJobStepStatus StepPhase() override;
+
+  void Checkpoint() override;
+
+public:
+  // "source" is either the body of the REST request, or the
+  // serialized job (which is the request plus the checkpoint)
+  explicit StoreSyncJob(const Json::Value& source);
+
+  void Reset() override;
+
+  static const char* EnumerationToString(Direction direction);
+
+  static Direction StringToDirection(const std::string& direction);
+
+  // Reads the next lines of a text file from the given byte offset,
+  // which is updated. Returns "false" at the end of the file.
+  static bool ReadLines(std::vector<std::string>& lines,
+                        uint64_t& offset,
+                        const std::string& path,
+                        size_t maxCount);
+};
+
+#endif
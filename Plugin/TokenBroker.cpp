@@ -0,0 +1,181 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "TokenBroker.h"
+
+#include <Toolbox.h>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/split.hpp>
+
+#include <algorithm>
+
+
+namespace TokenBroker
+{
+  bool IsBrokerUri(const char* uri)
+  {
+    // Matches the "/gcp/accounts/([^/]*)/token" route. Orthanc decodes
+    // the URI and drops its empty components before matching the
+    // routes, so "/gcp//accounts/x/token/" reaches the same callback:
+    // The URI must be normalized the same way.
+    std::string path(uri);
+
+    const size_t query = path.find('?');
+    if (query != std::string::npos)
+    {
+      path.resize(query);
+    }
+
+    Orthanc::Toolbox::UrlDecode(path);
+
+    std::vector<std::string> tokens;
+    Orthanc::Toolbox::TokenizeString(tokens, path, '/');
+
+    std::vector<std::string> components;
+    components.reserve(tokens.size());
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      if (!tokens[i].empty())
+      {
+        components.push_back(tokens[i]);
+      }
+    }
+
+    return (components.size() == 4 &&
+            components[0] == "gcp" &&
+            components[1] == "accounts" &&
+            components[3] == "token");
+  }
+
+
+  bool IsLocalAddress(const std::string& ip)
+  {
+    return (ip == "::1" ||
+            boost::starts_with(ip, "127.") ||
+            boost::starts_with(ip, "::ffff:127."));
+  }
+
+
+  bool IsAuthorized(const OrthancPluginHttpRequest* request,
+                    const std::string& secret)
+  {
+    if (secret.empty())
+    {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < request->headersCount; i++)
+    {
+      if (boost::iequals(request->headersKeys[i], SECRET_HEADER))
+      {
+        const std::string provided(request->headersValues[i]);
+
+        // Don't leak the position of the first difference through timing
+        unsigned char difference = (provided.size() == secret.size() ? 0 : 1);
+        for (size_t j = 0; j < provided.size(); j++)
+        {
+          difference |= static_cast<unsigned char>(provided[j] ^ secret[j % secret.size()]);
+        }
+
+        return (difference == 0);
+      }
+    }
+
+    return false;
+  }
+
+
+  bool FormatToken(Json::Value& target,
+                   const std::string& authorizationHeader,
+                   const boost::posix_time::ptime& expiration)
+  {
+    std::string key, value;
+    GoogleAccount::ParseAuthorizationHeader(key, value, authorizationHeader);
+
+    static const std::string BEARER = "Bearer ";
+    if (!boost::starts_with(value, BEARER))
+    {
+      return false;
+    }
+
+    target = Json::objectValue;
+    target["access_token"] = value.substr(BEARER.size());
+    target["token_type"] = "Bearer";
+
+    if (!expiration.is_not_a_date_time())
+    {
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+      const long long remaining = (expiration - now).total_seconds();
+      target["expires_in"] = static_cast<Json::Int64>(std::max(0ll, remaining));
+    }
+
+    return true;
+  }
+
+
+  bool FormatToken(Json::Value& target,
+                   AccountRefresher& refresher,
+                   unsigned int timeoutSeconds)
+  {
+    std::string header;
+    if (refresher.GetToken(header, timeoutSeconds))
+    {
+      return FormatToken(target, header, refresher.GetStatus()->tokenExpiration_);
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void ParseScopes(std::set<std::string>& target,
+                   const std::string& scopes)
+  {
+    target.clear();
+
+    std::vector<std::string> tokens;
+    boost::algorithm::split(tokens, scopes, boost::is_any_of(", "));
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      if (!tokens[i].empty())
+      {
+        target.insert(tokens[i]);
+      }
+    }
+  }
+}
@@ -0,0 +1,79 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "AccountRefresher.h"
+
+#include <set>
+
+
+/**
+ * The token broker gives the co-located components (other plugins,
+ * scripts, sidecars) access to the tokens that are maintained by the
+ * plugin, instead of running their own OAuth 2.0 flows. The tokens
+ * are served from memory, only to clients connecting from the
+ * loopback interface and knowing the shared secret.
+ **/
+namespace TokenBroker
+{
+  // Name of the HTTP header that must contain the shared secret
+  static const char* const SECRET_HEADER = "x-token-broker-secret";
+
+  // Whether the URI reaches the token route, after the normalization
+  // done by Orthanc: "/gcp/accounts/x/token/", "/gcp//accounts/x/token"
+  // or "/%67cp/accounts/x/token" are also recognized
+  bool IsBrokerUri(const char* uri);
+
+  bool IsLocalAddress(const std::string& ip);
+
+  // Constant-time comparison of the secret provided by the client
+  bool IsAuthorized(const OrthancPluginHttpRequest* request,
+                    const std::string& secret);
+
+  // Same format as the metadata server of Google Compute Engine, so
+  // that the Google client libraries can consume it
+  bool FormatToken(Json::Value& target,
+                   const std::string& authorizationHeader,
+                   const boost::posix_time::ptime& expiration);
+
+  // Token with the default scope, which wakes up a dormant account
+  // (lazy mode). Returns "false" if no token is available yet.
+  bool FormatToken(Json::Value& target,
+                   AccountRefresher& refresher,
+                   unsigned int timeoutSeconds);
+
+  // Parses a comma- or space-separated list of OAuth 2.0 scopes
+  void ParseScopes(std::set<std::string>& target,
+                   const std::string& scopes);
+}
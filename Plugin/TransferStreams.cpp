@@ -0,0 +1,123 @@
+/**
+ * Google Cloud Platform credentials for DICOMweb and Orthanc
+ * Copyright (C) 2019-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2026 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "TransferStreams.h"
+
+#include <OrthancException.h>
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+
+
+TransferStreams::TransferStreams(const std::vector<std::string>& items) :
+  items_(items),
+  next_(0),
+  bytes_(0),
+  failed_(false)
+{
+}
+
+
+void TransferStreams::SetFailure(const std::string& error)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (!failed_)
+  {
+    failed_ = true;
+    error_ = error;
+  }
+}
+
+
+bool TransferStreams::IsFailed()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return failed_;
+}
+
+
+void TransferStreams::Worker(TransferStreams* that)
+{
+  for (;;)
+  {
+    const size_t index = that->next_++;
+
+    if (index >= that->items_.size() ||
+        that->IsFailed())
+    {
+      return;
+    }
+
+    try
+    {
+      that->bytes_ += that->Transfer(that->items_[index]);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      that->SetFailure(e.What());
+    }
+  }
+}
+
+
+uint64_t TransferStreams::Run(unsigned int streamsCount)
+{
+  std::vector<boost::thread*> workers(std::min(static_cast<size_t>(std::max(1u, streamsCount)),
+                                               std::max(static_cast<size_t>(1), items_.size())));
+
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    workers[i] = new boost::thread(Worker, this);
+  }
+
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    if (workers[i]->joinable())
+    {
+      workers[i]->join();
+    }
+
+    delete workers[i];
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  if (failed_)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, error_);
+  }
+  else
+  {
+    return bytes_;
+  }
+}